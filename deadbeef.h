@@ -636,6 +636,21 @@ typedef struct ddb_fileadd_data_s {
 } ddb_fileadd_data_t;
 #endif
 
+// since 1.11
+#if (DDB_API_LEVEL >= 11)
+// the max number of bands which can be requested by vis_spectrum_listen2
+#define DDB_FREQ_MAX_BANDS 8192
+
+// window functions applied to the audio data before calculating the spectrum
+enum {
+    DDB_FFT_WINDOW_DEFAULT, // raised cosine window, used by vis_spectrum_listen
+    DDB_FFT_WINDOW_HANN,
+    DDB_FFT_WINDOW_BLACKMAN_HARRIS,
+    DDB_FFT_WINDOW_RECTANGULAR,
+    DDB_FFT_WINDOW_COUNT,
+};
+#endif
+
 // since 1.8
 #if (DDB_API_LEVEL >= 8)
 enum {
@@ -840,6 +855,7 @@ typedef struct {
 
     // Increments modification index.
     // This would mark playlist as "dirty" -- meaning it needs to be saved when `pl_save_all` is called.
+    // Dirty playlists are also saved in background, shortly after the last modification.
     // The flag is reset as soon as playlist is saved.
     // This is called automatically when playlists are created / cleared / removed, and when items are added/removed to them.
     // However, other changes -- like changing track metadata -- would not call this function.
@@ -1006,6 +1022,7 @@ typedef struct {
     int (*pl_is_selected) (DB_playItem_t *it);
 
     // save current playlist
+    // the playlist is written before the call returns; returns -1 on failure
     int (*pl_save_current) (void);
 
     // save all playlists
@@ -1530,6 +1547,14 @@ typedef struct {
     void (*streamer_set_repeat) (ddb_repeat_t repeat);
 
     ddb_repeat_t (*streamer_get_repeat) (void);
+
+    // register for getting spectrum data with the specified resolution and window function,
+    // unregister using vis_spectrum_unlisten
+    // nbands must be a power of 2 between 64 and DDB_FREQ_MAX_BANDS,
+    // and the data contains nbands frames per channel
+    // window is one of DDB_FFT_WINDOW_*
+    // higher resolution means longer analysis window, and lower time resolution
+    void (*vis_spectrum_listen2) (void *ctx, int nbands, int window, void (*callback)(void *ctx, ddb_audio_data_t *data));
 #endif
 } DB_functions_t;
 
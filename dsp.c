@@ -143,11 +143,13 @@ dsp_clone (ddb_dsp_context_t *from) {
 void
 streamer_set_dsp_chain_real (ddb_dsp_context_t *chain) {
     streamer_lock ();
+    streamer_lock_dsp ();
     dsp_chain_free (dsp_chain);
     dsp_chain = chain;
     eq = NULL;
 
     streamer_dsp_postinit ();
+    streamer_unlock_dsp ();
     streamer_dsp_chain_save();
 
     streamer_unlock ();
@@ -25,23 +25,48 @@
 #endif
 #include "deadbeef.h"
 #include <math.h>
-#include <complex.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+#include "fft.h"
+
+// The input is real, so an N point transform is done as an N/2 point complex transform
+// of the even/odd samples packed into real/imaginary parts, followed by a split step
+// which separates the spectra of the two halves.
+// The complex transform is an iterative radix-2 decimation in time,
+// with separate real/imaginary arrays and contiguous per-stage twiddles,
+// so that the butterflies of each group can run 4 at a time.
+//
+// A plan with the tables is created once per size, on first use.
+// The plans are not protected by locks, the spectrum is only calculated on one thread.
+
+#define FFT_MIN_LOGN 7 // 64 bands
+#define FFT_MAX_LOGN 14 // 8192 bands
 
-#define N (DDB_FREQ_BANDS * 2)
+typedef struct {
+    int n;              /* number of real input samples */
+    int m;              /* n/2, size of the complex transform */
+    int *reversed;      /* bit-reversal table for m */
+    float *tw_re;       /* twiddles for the stage with h butterflies per group start at h-1 */
+    float *tw_im;
+    float *split_re;    /* exp(-2*pi*i*k/n), k <= m */
+    float *split_im;
+    float *windows[DDB_FFT_WINDOW_COUNT];
+    float *re;          /* work buffers */
+    float *im;
+} fft_plan_t;
 
-static float hamming[N];              /* hamming window, scaled to sum to 1 */
-static int reversed[N];               /* bit-reversal table */
-static float complex roots[N / 2];    /* N-th roots of unity */
-static int generated = 0;
-static int LOGN; /* log N (base 2) */
+static fft_plan_t *plans[FFT_MAX_LOGN + 1];
 
-/* Reverse the order of the lowest LOGN bits in an integer. */
+/* Reverse the order of the lowest logn bits in an integer. */
 
-static int bit_reverse (int x)
+static int bit_reverse (int x, int logn)
 {
     int y = 0;
 
-    for (int n = LOGN; n --; )
+    for (int n = logn; n --; )
     {
         y = (y << 1) | (x & 1);
         x >>= 1;
@@ -50,67 +75,198 @@ static int bit_reverse (int x)
     return y;
 }
 
-#ifndef HAVE_LOG2
-static inline float log2(float x) {return (float)log(x)/M_LN2;}
-#endif
+static int log2_int (int n)
+{
+    int logn = 0;
+    while ((1 << logn) < n)
+        logn ++;
+    return logn;
+}
 
 /* Generate lookup tables. */
 
-static void generate_tables (void)
+static fft_plan_t *get_plan (int logn)
 {
-    if (generated)
-        return;
-
-    LOGN = (int)log2(N);
-    for (int n = 0; n < N; n ++)
-        hamming[n] = 1 - 0.85f * cosf (2 * (float)M_PI * n / N);
-    for (int n = 0; n < N; n ++)
-        reversed[n] = bit_reverse (n);
-    for (int n = 0; n < N / 2; n ++)
-        roots[n] = cexpf (2 * (float)M_PI * I * n / N);
-
-    generated = 1;
+    if (plans[logn])
+        return plans[logn];
+
+    fft_plan_t *plan = calloc (1, sizeof (fft_plan_t));
+    int n = 1 << logn;
+    int m = n / 2;
+    plan->n = n;
+    plan->m = m;
+
+    plan->reversed = malloc (m * sizeof (int));
+    for (int k = 0; k < m; k ++)
+        plan->reversed[k] = bit_reverse (k, logn - 1);
+
+    plan->tw_re = malloc (m * sizeof (float));
+    plan->tw_im = malloc (m * sizeof (float));
+    for (int h = 1; h < m; h <<= 1)
+    {
+        for (int b = 0; b < h; b ++)
+        {
+            double a = -M_PI * b / h;
+            plan->tw_re[h - 1 + b] = cos (a);
+            plan->tw_im[h - 1 + b] = sin (a);
+        }
+    }
+
+    plan->split_re = malloc ((m + 1) * sizeof (float));
+    plan->split_im = malloc ((m + 1) * sizeof (float));
+    for (int k = 0; k <= m; k ++)
+    {
+        double a = -2 * M_PI * k / n;
+        plan->split_re[k] = cos (a);
+        plan->split_im[k] = sin (a);
+    }
+
+    plan->re = malloc (m * sizeof (float));
+    plan->im = malloc (m * sizeof (float));
+
+    plans[logn] = plan;
+    return plan;
 }
 
-static void do_fft (float complex a[N])
+static const float *get_window (fft_plan_t *plan, int type)
 {
-    int half = 1;       /* (2^s)/2 */
-    int inv = N / 2;    /* N/(2^s) */
+    if (type < 0 || type >= DDB_FFT_WINDOW_COUNT)
+        type = DDB_FFT_WINDOW_DEFAULT;
 
-    /* loop through steps */
-    while (inv)
+    if (plan->windows[type])
+        return plan->windows[type];
+
+    int n = plan->n;
+    float *w = malloc (n * sizeof (float));
+    for (int i = 0; i < n; i ++)
     {
-        /* loop through groups */
-        for (int g = 0; g < N; g += half << 1)
+        double x = 2 * M_PI * i / n;
+        switch (type)
         {
-            /* loop through butterflies */
-            for (int b = 0, r = 0; b < half; b ++, r += inv)
-            {
-                float complex even = a[g + b];
-                float complex odd = roots[r] * a[g + half + b];
-                a[g + b] = even + odd;
-                a[g + half + b] = even - odd;
-            }
+        case DDB_FFT_WINDOW_HANN:
+            w[i] = 0.5 - 0.5 * cos (x);
+            break;
+        case DDB_FFT_WINDOW_BLACKMAN_HARRIS:
+            w[i] = 0.35875 - 0.48829 * cos (x) + 0.14128 * cos (2 * x) - 0.01168 * cos (3 * x);
+            break;
+        case DDB_FFT_WINDOW_RECTANGULAR:
+            w[i] = 1;
+            break;
+        default:
+            w[i] = 1 - 0.85f * cosf (2 * (float)M_PI * i / n);
+            break;
         }
+    }
+
+    plan->windows[type] = w;
+    return w;
+}
 
-        half <<= 1;
-        inv >>= 1;
+/* One group of butterflies: (a, b) = (a + w*b, a - w*b) */
+
+static void butterflies (float * restrict ar, float * restrict ai, float * restrict br, float * restrict bi,
+ const float * restrict wr, const float * restrict wi, int h)
+{
+    int b = 0;
+#ifdef __SSE__
+    for (; b + 4 <= h; b += 4)
+    {
+        __m128 xr = _mm_loadu_ps (br + b), xi = _mm_loadu_ps (bi + b);
+        __m128 cr = _mm_loadu_ps (wr + b), ci = _mm_loadu_ps (wi + b);
+        __m128 tr = _mm_sub_ps (_mm_mul_ps (xr, cr), _mm_mul_ps (xi, ci));
+        __m128 ti = _mm_add_ps (_mm_mul_ps (xr, ci), _mm_mul_ps (xi, cr));
+        __m128 yr = _mm_loadu_ps (ar + b), yi = _mm_loadu_ps (ai + b);
+        _mm_storeu_ps (br + b, _mm_sub_ps (yr, tr));
+        _mm_storeu_ps (bi + b, _mm_sub_ps (yi, ti));
+        _mm_storeu_ps (ar + b, _mm_add_ps (yr, tr));
+        _mm_storeu_ps (ai + b, _mm_add_ps (yi, ti));
+    }
+#endif
+    for (; b < h; b ++)
+    {
+        float tr = br[b] * wr[b] - bi[b] * wi[b];
+        float ti = br[b] * wi[b] + bi[b] * wr[b];
+        br[b] = ar[b] - tr;
+        bi[b] = ai[b] - ti;
+        ar[b] += tr;
+        ai[b] += ti;
+    }
+}
+
+static void do_fft (fft_plan_t *plan)
+{
+    int m = plan->m;
+    float *re = plan->re;
+    float *im = plan->im;
+
+    /* loop through steps */
+    for (int h = 1; h < m; h <<= 1)
+    {
+        /* loop through groups */
+        for (int g = 0; g < m; g += h << 1)
+            butterflies (re + g, im + g, re + g + h, im + g + h, plan->tw_re + h - 1, plan->tw_im + h - 1, h);
     }
 }
 
 void
-calc_freq (float *data, float *freq) {
-    generate_tables ();
-
-    // fft code shamelessly stolen from audacious
-    // thanks, John
-    float complex a[N];
-    for (int n = 0; n < N; n ++) {
-        a[reversed[n]] = data[n] * hamming[n];
+calc_freq_ex (const float *data, float *freq, int nbands, int window) {
+    int logn = log2_int (nbands) + 1;
+    if (logn < FFT_MIN_LOGN)
+        logn = FFT_MIN_LOGN;
+    if (logn > FFT_MAX_LOGN)
+        logn = FFT_MAX_LOGN;
+
+    fft_plan_t *plan = get_plan (logn);
+    const float *w = get_window (plan, window);
+    int n = plan->n;
+    int m = plan->m;
+
+    // pack the windowed even/odd samples as complex numbers, in bit-reversed order
+    for (int k = 0; k < m; k ++) {
+        int r = plan->reversed[k];
+        plan->re[r] = data[2 * k] * w[2 * k];
+        plan->im[r] = data[2 * k + 1] * w[2 * k + 1];
+    }
+    do_fft (plan);
+
+    // split: X[k] = (Z[k] + conj(Z[m-k]))/2 - i*exp(-2*pi*i*k/n)*(Z[k] - conj(Z[m-k]))/2
+    for (int k = 1; k <= m; k ++) {
+        int k1 = k == m ? 0 : k;
+        int k2 = m - k;
+        float zr = plan->re[k1], zi = plan->im[k1];
+        float cr = plan->re[k2], ci = -plan->im[k2];
+        float er = (zr + cr) / 2, ei = (zi + ci) / 2;
+        float dr = (zr - cr) / 2, di = (zi - ci) / 2;
+        // o = -i * d
+        float or_ = di, oi = -dr;
+        float xr = er + plan->split_re[k] * or_ - plan->split_im[k] * oi;
+        float xi = ei + plan->split_re[k] * oi + plan->split_im[k] * or_;
+        float mag = sqrtf (xr * xr + xi * xi);
+        freq[k - 1] = k == m ? mag / n : 2 * mag / n;
     }
-    do_fft(a);
+}
+
+void
+calc_freq (const float *data, float *freq) {
+    calc_freq_ex (data, freq, DDB_FREQ_BANDS, DDB_FFT_WINDOW_DEFAULT);
+}
 
-    for (int n = 0; n < N / 2 - 1; n ++)
-        freq[n] = 2 * cabsf (a[1 + n]) / N;
-    freq[N / 2 - 1] = cabsf(a[N / 2]) / N;
+void
+fft_free (void) {
+    for (int i = 0; i <= FFT_MAX_LOGN; i ++) {
+        fft_plan_t *plan = plans[i];
+        if (!plan)
+            continue;
+        free (plan->reversed);
+        free (plan->tw_re);
+        free (plan->tw_im);
+        free (plan->split_re);
+        free (plan->split_im);
+        for (int w = 0; w < DDB_FFT_WINDOW_COUNT; w ++)
+            free (plan->windows[w]);
+        free (plan->re);
+        free (plan->im);
+        free (plan);
+        plans[i] = NULL;
+    }
 }
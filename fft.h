@@ -20,6 +20,14 @@
 #ifndef AUDACIOUS_FFT_H
 #define AUDACIOUS_FFT_H
 
-void calc_freq (const float data[512], float freq[256]);
+void calc_freq (const float *data, float *freq);
+
+// nbands must be a power of 2 between 64 and DDB_FREQ_MAX_BANDS,
+// data contains nbands * 2 samples, and freq receives nbands magnitudes
+// window is one of DDB_FFT_WINDOW_*
+void calc_freq_ex (const float *data, float *freq, int nbands, int window);
+
+// free the cached plans
+void fft_free (void);
 
 #endif
@@ -47,6 +47,7 @@ typedef struct handler_s {
     message_t *mqtail;
     uintptr_t mutex;
     uintptr_t cond;
+    int wakeup;
     message_t pool[1];
 } handler_t;
 
@@ -55,6 +56,7 @@ handler_reset (handler_t *h) {
     h->mqueue = NULL;
     h->mfree = NULL;
     h->mqtail = NULL;
+    h->wakeup = 0;
     memset (h->pool, 0, sizeof (message_t) * h->queue_size);
     for (int i = 0; i < h->queue_size; i++) {
         h->pool[i].next = h->mfree;
@@ -119,6 +121,29 @@ handler_wait (handler_t *h) {
     mutex_unlock (h->mutex);
 }
 
+void
+handler_wakeup (handler_t *h) {
+    if (!h) {
+        return;
+    }
+    mutex_lock (h->mutex);
+    h->wakeup = 1;
+    mutex_unlock (h->mutex);
+    cond_signal (h->cond);
+}
+
+int
+handler_wait_timeout (handler_t *h, int timeout_ms) {
+    int res = 0;
+    mutex_lock (h->mutex);
+    if (!h->mqueue && !h->wakeup) {
+        res = cond_wait_timeout (h->cond, h->mutex, timeout_ms);
+    }
+    h->wakeup = 0;
+    mutex_unlock (h->mutex);
+    return res;
+}
+
 int
 handler_pop (handler_t *h, uint32_t *id, uintptr_t *ctx, uint32_t *p1, uint32_t *p2) {
     mutex_lock (h->mutex);
@@ -47,6 +47,16 @@ handler_pop (struct handler_s *h, uint32_t *id, uintptr_t *ctx, uint32_t *p1, ui
 void
 handler_wait (struct handler_s *h);
 
+// Wakes up a thread blocked in handler_wait_timeout, without posting a message.
+// A wakeup sent while nobody is waiting is kept until the next wait.
+void
+handler_wakeup (struct handler_s *h);
+
+// Blocks until a message is pushed, handler_wakeup is called, or timeout_ms expires.
+// Returns immediately if there are pending messages or a pending wakeup.
+int
+handler_wait_timeout (struct handler_s *h, int timeout_ms);
+
 int
 handler_hasmessages (struct handler_s *h);
 
@@ -29,6 +29,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "metacache.h"
+#include "threading.h"
 
 typedef struct metacache_str_s {
     struct metacache_str_s *next;
@@ -43,9 +44,11 @@ typedef struct {
     metacache_str_t *chain;
 } metacache_hash_t;
 
-#define HASH_SIZE 4096
+#define HASH_INITIAL_SIZE 4096
 
-static metacache_hash_t hash[HASH_SIZE];
+// grows 4x whenever the average chain length exceeds 2
+static metacache_hash_t *hash;
+static uint32_t hash_size;
 
 static uint32_t
 metacache_get_hash_sdbm (const char *str, size_t len) {
@@ -62,8 +65,29 @@ metacache_get_hash_sdbm (const char *str, size_t len) {
     return h;
 }
 
+static void
+metacache_resize (uint32_t newsize) {
+    metacache_hash_t *newhash = calloc (newsize, sizeof (metacache_hash_t));
+    for (uint32_t i = 0; i < hash_size; i++) {
+        metacache_str_t *chain = hash[i].chain;
+        while (chain) {
+            metacache_str_t *next = chain->next;
+            uint32_t h = metacache_get_hash_sdbm (chain->str, chain->value_length) & (newsize-1);
+            chain->next = newhash[h].chain;
+            newhash[h].chain = chain;
+            chain = next;
+        }
+    }
+    free (hash);
+    hash = newhash;
+    hash_size = newsize;
+}
+
 static metacache_str_t *
 metacache_find_in_bucket (uint32_t h, const char *value, size_t len) {
+    if (!hash) {
+        return NULL;
+    }
     metacache_hash_t *bucket = &hash[h];
     metacache_str_t *chain = bucket->chain;
     while (chain) {
@@ -79,17 +103,45 @@ static int n_strings = 0;
 static int n_inserts = 0;
 static int n_buckets = 0;
 
+// metacache is shared by all playlists, and can be accessed concurrently
+// by threads holding different playlist locks (see plt_lock)
+static uintptr_t mutex;
+
+#define LOCK {if (mutex) mutex_lock (mutex);}
+#define UNLOCK {if (mutex) mutex_unlock (mutex);}
+
+void
+metacache_init (void) {
+    mutex = mutex_create_nonrecursive ();
+}
+
+void
+metacache_free (void) {
+    if (mutex) {
+        mutex_free (mutex);
+        mutex = 0;
+    }
+}
+
 const char *
 metacache_add_value (const char *value, size_t len) {
     //    printf ("n_strings=%d, n_inserts=%d, n_buckets=%d\n", n_strings, n_inserts, n_buckets);
     uint32_t h = metacache_get_hash_sdbm (value, len);
-    metacache_str_t *data = metacache_find_in_bucket (h & (HASH_SIZE-1), value, len);
+    LOCK;
+    metacache_str_t *data = metacache_find_in_bucket (h & (hash_size-1), value, len);
     n_inserts++;
     if (data) {
         data->refcount++;
+        UNLOCK;
         return data->str;
     }
-    metacache_hash_t *bucket = &hash[h & (HASH_SIZE-1)];
+    if (!hash) {
+        metacache_resize (HASH_INITIAL_SIZE);
+    }
+    else if (n_strings > hash_size * 2) {
+        metacache_resize (hash_size * 4);
+    }
+    metacache_hash_t *bucket = &hash[h & (hash_size-1)];
     if (!bucket->chain) {
         n_buckets++;
     }
@@ -101,6 +153,7 @@ metacache_add_value (const char *value, size_t len) {
     data->next = bucket->chain;
     bucket->chain = data;
     n_strings++;
+    UNLOCK;
     return data->str;
 }
 
@@ -112,7 +165,12 @@ metacache_add_string (const char *str) {
 void
 metacache_remove_value (const char *value, size_t valuesize) {
     uint32_t h = metacache_get_hash_sdbm (value, valuesize);
-    metacache_hash_t *bucket = &hash[h & (HASH_SIZE-1)];
+    LOCK;
+    if (!hash) {
+        UNLOCK;
+        return;
+    }
+    metacache_hash_t *bucket = &hash[h & (hash_size-1)];
     metacache_str_t *chain = bucket->chain;
     metacache_str_t *prev = NULL;
     while (chain) {
@@ -126,12 +184,14 @@ metacache_remove_value (const char *value, size_t valuesize) {
                     bucket->chain = chain->next;
                 }
                 free (chain);
+                n_strings--;
             }
             break;
         }
         prev = chain;
         chain = chain->next;
     }
+    UNLOCK;
 }
 
 void
@@ -142,13 +202,17 @@ metacache_remove_string (const char *str) {
 void
 metacache_ref (const char *str) {
     uint32_t *refc = (uint32_t *)(str-5);
+    LOCK;
     (*refc)++;
+    UNLOCK;
 }
 
 void
 metacache_unref (const char *str) {
     uint32_t *refc = (uint32_t *)(str-5);
+    LOCK;
     (*refc)--;
+    UNLOCK;
 }
 
 const char *
@@ -159,12 +223,121 @@ metacache_get_string (const char *str) {
 const char *
 metacache_get_value (const char *value, size_t len) {
     uint32_t h = metacache_get_hash_sdbm (value, len);
-    metacache_str_t *data = metacache_find_in_bucket (h & (HASH_SIZE-1), value, len);
+    LOCK;
+    metacache_str_t *data = metacache_find_in_bucket (h & (hash_size-1), value, len);
     n_inserts++;
     if (data) {
         data->refcount++;
+        UNLOCK;
         return data->str;
     }
+    UNLOCK;
 
     return NULL;
 }
+
+// key atoms
+
+typedef struct {
+    uint32_t hash;
+    uint32_t atom;
+    char *key; // lowercase, including the prefix
+} metacache_atom_t;
+
+static metacache_atom_t *atoms;
+static uint32_t atoms_size; // power of 2
+static uint32_t n_atoms;
+
+static inline char
+_ascii_lower (char c) {
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+static uint32_t
+metacache_get_key_hash (char prefix, const char *key) {
+    uint32_t h = 0;
+    if (prefix) {
+        h = (uint8_t)_ascii_lower (prefix);
+    }
+    for (const char *p = key; *p; p++) {
+        h = (uint8_t)_ascii_lower (*p) + (h << 6) + (h << 16) - h;
+    }
+    return h;
+}
+
+static int
+metacache_key_equals (const char *lowercase_key, char prefix, const char *key) {
+    const char *p = lowercase_key;
+    if (prefix) {
+        if (*p++ != _ascii_lower (prefix)) {
+            return 0;
+        }
+    }
+    for (; *key; p++, key++) {
+        if (*p != _ascii_lower (*key)) {
+            return 0;
+        }
+    }
+    return *p == 0;
+}
+
+static void
+metacache_atoms_grow (void) {
+    uint32_t newsize = atoms_size ? atoms_size * 2 : 256;
+    metacache_atom_t *newatoms = calloc (newsize, sizeof (metacache_atom_t));
+    for (uint32_t i = 0; i < atoms_size; i++) {
+        if (!atoms[i].atom) {
+            continue;
+        }
+        uint32_t idx = atoms[i].hash & (newsize-1);
+        while (newatoms[idx].atom) {
+            idx = (idx + 1) & (newsize-1);
+        }
+        newatoms[idx] = atoms[i];
+    }
+    free (atoms);
+    atoms = newatoms;
+    atoms_size = newsize;
+}
+
+uint32_t
+metacache_key_atom (char prefix, const char *key) {
+    uint32_t h = metacache_get_key_hash (prefix, key);
+    LOCK;
+    if (atoms_size) {
+        uint32_t idx = h & (atoms_size-1);
+        while (atoms[idx].atom) {
+            if (atoms[idx].hash == h && metacache_key_equals (atoms[idx].key, prefix, key)) {
+                uint32_t atom = atoms[idx].atom;
+                UNLOCK;
+                return atom;
+            }
+            idx = (idx + 1) & (atoms_size-1);
+        }
+    }
+
+    // keep load factor under 1/2
+    if ((n_atoms + 1) * 2 > atoms_size) {
+        metacache_atoms_grow ();
+    }
+
+    size_t len = strlen (key);
+    char *lc = malloc (len + 2);
+    char *out = lc;
+    if (prefix) {
+        *out++ = _ascii_lower (prefix);
+    }
+    for (size_t i = 0; i <= len; i++) {
+        *out++ = _ascii_lower (key[i]);
+    }
+
+    uint32_t idx = h & (atoms_size-1);
+    while (atoms[idx].atom) {
+        idx = (idx + 1) & (atoms_size-1);
+    }
+    atoms[idx].hash = h;
+    atoms[idx].atom = ++n_atoms;
+    atoms[idx].key = lc;
+    UNLOCK;
+    return n_atoms;
+}
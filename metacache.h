@@ -27,6 +27,16 @@
 #ifndef __METACACHE_H
 #define __METACACHE_H
 
+#include <stddef.h>
+#include <stdint.h>
+
+// Creates the lock which makes metacache functions thread-safe, called from pl_init
+void
+metacache_init (void);
+
+void
+metacache_free (void);
+
 // Adds a new NULL-terminated string, or finds an existing one
 const char *
 metacache_add_string (const char *str);
@@ -59,4 +69,11 @@ metacache_ref (const char *str);
 void
 metacache_unref (const char *str);
 
+// Returns a small positive integer uniquely identifying the key, compared
+// case-insensitively (ASCII), and optionally prefixed with a single character
+// (pass 0 for no prefix). The atom is created on the first call, and stays valid
+// for the lifetime of the process.
+uint32_t
+metacache_key_atom (char prefix, const char *key);
+
 #endif
@@ -0,0 +1,162 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2018 Alexey Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+#import <XCTest/XCTest.h>
+#include <sys/stat.h>
+#include "deadbeef.h"
+#include "plugins.h"
+#include "../../plugins/converter/converter.h"
+
+extern DB_functions_t *deadbeef;
+
+#define FAKEIN_NUMSAMPLES (44100 * 5)
+#define WAV_HEADER_SIZE 44
+
+// the encoder leaves a marker file next to the output when its input is a named pipe
+#define FIFO_DETECTING_ENCODER "[ -p %i ] && touch %o.fifo; cat %i > %o"
+
+extern DB_plugin_t *converter_load (DB_functions_t *api);
+
+@interface ConverterTests : XCTestCase {
+    DB_plugin_t *_fakein;
+    ddb_converter_t *_converter;
+    ddb_encoder_preset_t *_encoder_preset;
+    ddb_playlist_t *_plt;
+    DB_playItem_t *_it;
+    char _out[PATH_MAX];
+    char _marker[PATH_MAX];
+}
+@end
+
+@implementation ConverterTests
+
+- (void)setUp {
+    [super setUp];
+
+    extern DB_plugin_t * fakein_load (DB_functions_t *api);
+    plug_init_plugin (fakein_load, NULL);
+    _fakein = fakein_load (deadbeef);
+    plug_register_in (_fakein);
+
+    _converter = (ddb_converter_t *)converter_load (deadbeef);
+
+    _encoder_preset = _converter->encoder_preset_alloc ();
+    _encoder_preset->title = strdup ("test");
+    _encoder_preset->ext = strdup ("wav");
+    _encoder_preset->encoder = strdup (FIFO_DETECTING_ENCODER);
+    _encoder_preset->method = DDB_ENCODER_METHOD_FILE;
+
+    _plt = deadbeef->plt_alloc ("converter_test");
+    _it = deadbeef->plt_insert_file2 (0, _plt, NULL, "/sine.fake", NULL, NULL, NULL);
+    deadbeef->pl_item_ref (_it);
+
+    snprintf (_out, sizeof (_out), "%s/converter_test.wav", [NSTemporaryDirectory() UTF8String]);
+    snprintf (_marker, sizeof (_marker), "%s.fifo", _out);
+    unlink (_out);
+    unlink (_marker);
+}
+
+- (void)tearDown {
+    deadbeef->pl_item_unref (_it);
+    deadbeef->plt_unref (_plt);
+    _converter->encoder_preset_free (_encoder_preset);
+    unlink (_out);
+    unlink (_marker);
+
+    [super tearDown];
+}
+
+- (int)convert {
+    ddb_converter_settings_t settings = {
+        .output_bps = 16,
+        .encoder_preset = _encoder_preset,
+    };
+    return _converter->convert2 (&settings, _it, _out, NULL);
+}
+
+// Returns the data size from the wave header, and the actual data size
+- (void)readDataSize:(uint32_t *)header_size actualSize:(int64_t *)actual_size {
+    *header_size = 0;
+    *actual_size = -1;
+    FILE *fp = fopen (_out, "rb");
+    if (!fp) {
+        return;
+    }
+    uint8_t hdr[WAV_HEADER_SIZE];
+    if (fread (hdr, 1, sizeof (hdr), fp) == sizeof (hdr)) {
+        *header_size = hdr[40] | (hdr[41] << 8) | (hdr[42] << 16) | ((uint32_t)hdr[43] << 24);
+    }
+    fseek (fp, 0, SEEK_END);
+    *actual_size = ftell (fp) - WAV_HEADER_SIZE;
+    fclose (fp);
+}
+
+- (void)test_ConvertFileMethod_ExactLength_StreamedThroughFifo {
+    deadbeef->pl_item_set_startsample (_it, 0);
+    deadbeef->pl_item_set_endsample (_it, FAKEIN_NUMSAMPLES - 1);
+
+    XCTAssertEqual ([self convert], 0);
+
+    struct stat st;
+    XCTAssertEqual (stat (_marker, &st), 0);
+
+    uint32_t header_size;
+    int64_t actual_size;
+    [self readDataSize:&header_size actualSize:&actual_size];
+    XCTAssertEqual (actual_size, FAKEIN_NUMSAMPLES * 2 * 2);
+    XCTAssertEqual (header_size, actual_size);
+}
+
+- (void)test_ConvertFileMethod_WrongLength_RedoneThroughTempFile {
+    // the decoder returns more data than the header sent through the fifo says
+    deadbeef->pl_item_set_startsample (_it, 0);
+    deadbeef->pl_item_set_endsample (_it, 44100 - 1);
+
+    XCTAssertEqual ([self convert], 0);
+
+    // the first attempt has been streamed
+    struct stat st;
+    XCTAssertEqual (stat (_marker, &st), 0);
+
+    uint32_t header_size;
+    int64_t actual_size;
+    [self readDataSize:&header_size actualSize:&actual_size];
+    XCTAssertEqual (actual_size, FAKEIN_NUMSAMPLES * 2 * 2);
+    XCTAssertEqual (header_size, actual_size);
+}
+
+- (void)test_ConvertFileMethod_UnknownLength_NotStreamed {
+    XCTAssertEqual ([self convert], 0);
+
+    struct stat st;
+    XCTAssertNotEqual (stat (_marker, &st), 0);
+
+    uint32_t header_size;
+    int64_t actual_size;
+    [self readDataSize:&header_size actualSize:&actual_size];
+    XCTAssertEqual (actual_size, FAKEIN_NUMSAMPLES * 2 * 2);
+    XCTAssertEqual (header_size, actual_size);
+}
+
+@end
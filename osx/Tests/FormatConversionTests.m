@@ -22,9 +22,12 @@
 */
 
 #import <XCTest/XCTest.h>
+#include <math.h>
 #include "deadbeef.h"
 #include "premix.h"
 
+#define SIMD_TEST_FRAMES 1001 // not a multiple of the vector size, to exercise the scalar tails
+
 @interface FormatConversion : XCTestCase
 
 @end
@@ -93,4 +96,108 @@
     XCTAssert(outsamples[3] == 0x4000, @"sample3 is %d", outsamples[3]);
 }
 
+// Converts the same input with and without the vectorized converters, and checks that the output is identical
+- (void)assertSimdConversionFrom:(int)inbps isFloat:(int)infloat to:(int)outbps isFloat:(int)outfloat input:(const char *)input {
+    for (int channels = 1; channels <= 8; channels++) {
+        ddb_waveformat_t inputfmt = {
+            .bps = inbps,
+            .is_float = infloat,
+            .channels = channels,
+            .samplerate = 44100,
+            .channelmask = (1 << channels) - 1
+        };
+        ddb_waveformat_t outputfmt = inputfmt;
+        outputfmt.bps = outbps;
+        outputfmt.is_float = outfloat;
+
+        int inputsize = SIMD_TEST_FRAMES * channels * inbps / 8;
+        int outputsize = SIMD_TEST_FRAMES * channels * outbps / 8;
+        char *scalar = malloc (outputsize);
+        char *simd = malloc (outputsize);
+        memset (scalar, 0x55, outputsize);
+        memset (simd, 0xaa, outputsize);
+
+        pcm_convert_set_simd_enabled (0);
+        int res = pcm_convert (&inputfmt, input, &outputfmt, scalar, inputsize);
+        pcm_convert_set_simd_enabled (1);
+        XCTAssertEqual (pcm_convert (&inputfmt, input, &outputfmt, simd, inputsize), res);
+        XCTAssert (!memcmp (scalar, simd, outputsize), @"%d to %d bit conversion mismatch with %d channels", inbps, outbps, channels);
+
+        free (scalar);
+        free (simd);
+    }
+}
+
+- (void)testConvert16ToFloat_SimdMatchesScalar {
+    int16_t *samples = malloc (SIMD_TEST_FRAMES * 8 * sizeof (int16_t));
+    for (int i = 0; i < SIMD_TEST_FRAMES * 8; i++) {
+        samples[i] = (int16_t)(i * 7919);
+    }
+    samples[0] = -0x8000;
+    samples[1] = 0x7fff;
+    [self assertSimdConversionFrom:16 isFloat:0 to:32 isFloat:1 input:(const char *)samples];
+    free (samples);
+}
+
+- (void)testConvertFloatTo16_SimdMatchesScalarIncludingClipping {
+    float *samples = malloc (SIMD_TEST_FRAMES * 8 * sizeof (float));
+    for (int i = 0; i < SIMD_TEST_FRAMES * 8; i++) {
+        switch (i % 5) {
+        case 0:
+            samples[i] = (i % 4000) / 1000.f - 2.f; // clipping
+            break;
+        case 1:
+            samples[i] = ((i % 65536) - 32768 + 0.5f) / 0x8000; // rounding ties
+            break;
+        case 2:
+            samples[i] = i & 1 ? 1.f : -1.f;
+            break;
+        case 3:
+            samples[i] = i & 1 ? 1e10f : -1e10f; // out of int32 range
+            break;
+        default:
+            samples[i] = sinf (i);
+            break;
+        }
+    }
+    [self assertSimdConversionFrom:32 isFloat:1 to:16 isFloat:0 input:(const char *)samples];
+    free (samples);
+}
+
+- (void)testConvert24To32_SimdMatchesScalar {
+    uint8_t *samples = malloc (SIMD_TEST_FRAMES * 8 * 3);
+    for (int i = 0; i < SIMD_TEST_FRAMES * 8 * 3; i++) {
+        samples[i] = (uint8_t)(i * 131 + (i >> 8));
+    }
+    [self assertSimdConversionFrom:24 isFloat:0 to:32 isFloat:0 input:(const char *)samples];
+    free (samples);
+}
+
+- (void)testConvertFloatTo16Stereo_Performance {
+    int nframes = 44100 * 10;
+    float *samples = malloc (nframes * 2 * sizeof (float));
+    int16_t *outsamples = malloc (nframes * 2 * sizeof (int16_t));
+    for (int i = 0; i < nframes * 2; i++) {
+        samples[i] = sinf (i * 0.01f);
+    }
+
+    ddb_waveformat_t inputfmt = {
+        .bps = 32,
+        .is_float = 1,
+        .channels = 2,
+        .samplerate = 44100,
+        .channelmask = DDB_SPEAKER_FRONT_LEFT|DDB_SPEAKER_FRONT_RIGHT
+    };
+    ddb_waveformat_t outputfmt = inputfmt;
+    outputfmt.bps = 16;
+    outputfmt.is_float = 0;
+
+    [self measureBlock:^{
+        pcm_convert (&inputfmt, (const char *)samples, &outputfmt, (char *)outsamples, nframes * 2 * sizeof (float));
+    }];
+
+    free (samples);
+    free (outsamples);
+}
+
 @end
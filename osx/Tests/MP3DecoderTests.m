@@ -7,6 +7,7 @@
 //
 
 #import <XCTest/XCTest.h>
+#include <sys/stat.h>
 #include "deadbeef.h"
 #include "../../common.h"
 #include "playlist.h"
@@ -129,5 +130,59 @@ extern DB_functions_t *deadbeef;
     XCTAssertEqual(res/4, size/4);
 }
 
+- (void)test_SeekIndexCache_Reopen_SameDurationAndSamples {
+    char path[PATH_MAX];
+    snprintf (path, sizeof (path), "%s/TestData/mp3parser/vbr_rhytm_30sec.mp3", dbplugindir);
+
+    // FNV-1a of the path, same as the index file name
+    uint64_t hash = 14695981039346656037ULL;
+    for (const char *c = path; *c; c++) {
+        hash ^= (uint8_t)*c;
+        hash *= 1099511628211ULL;
+    }
+    char cachepath[PATH_MAX];
+    snprintf (cachepath, sizeof (cachepath), "%s/mp3seekindex/%016llx", deadbeef->get_system_dir (DDB_SYS_DIR_CACHE), (unsigned long long)hash);
+    unlink (cachepath);
+
+    deadbeef->conf_set_int ("mp3.backend", 0);
+    deadbeef->conf_set_int ("mp3.seek_index_cache", 1);
+
+    playlist_t *plt = plt_alloc ("testplt");
+    DB_playItem_t *it = deadbeef->plt_insert_file2 (0, (ddb_playlist_t *)plt, NULL, path, NULL, NULL, NULL);
+    DB_decoder_t *dec = (DB_decoder_t *)deadbeef->plug_get_for_id ("stdmpg");
+
+    int size = 100000;
+    char *buffer = malloc (size);
+    char *buffer2 = malloc (size);
+
+    DB_fileinfo_t *fi = dec->open (0);
+    dec->init (fi, it);
+    float duration = deadbeef->pl_get_item_duration (it);
+    dec->seek_sample (fi, 500000);
+    int res = dec->read (fi, buffer, size);
+    XCTAssertEqual(res, size);
+    dec->free (fi);
+
+    struct stat st;
+    XCTAssertEqual(stat (cachepath, &st), 0);
+
+    // the duration comes from the cached parse results
+    deadbeef->plt_set_item_duration ((ddb_playlist_t *)plt, it, 0);
+    fi = dec->open (0);
+    dec->init (fi, it);
+    XCTAssertEqual(deadbeef->pl_get_item_duration (it), duration);
+    dec->seek_sample (fi, 500000);
+    res = dec->read (fi, buffer2, size);
+    XCTAssertEqual(res, size);
+    dec->free (fi);
+
+    XCTAssertTrue(memcmp (buffer, buffer2, size) == 0);
+
+    free (buffer);
+    free (buffer2);
+    deadbeef->plt_unref ((ddb_playlist_t *)plt);
+    deadbeef->conf_set_int ("mp3.seek_index_cache", 0);
+    unlink (cachepath);
+}
 
 @end
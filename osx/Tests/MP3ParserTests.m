@@ -201,4 +201,41 @@
     XCTAssertLessThan(info.valid_packets, info.npackets);
 }
 
+
+- (void)test_VBRSeekWithIndex_GivesSamePacketAsFullScan {
+    mp3info_t info, indexed;
+    mp3_seekindex_t index = {0};
+    char path[PATH_MAX];
+    snprintf (path, sizeof (path), "%s/TestData/mp3parser/vbr_rhytm_30sec.mp3", dbplugindir);
+    DB_FILE *fp = vfs_fopen (path);
+    int64_t fsize = vfs_fgetlength(fp);
+    for (int64_t sample = 0; sample < 1000000; sample += 37000) {
+        int res = mp3_parse_file (&info, 0, fp, fsize, 0, 0, sample);
+        XCTAssert (!res);
+        res = mp3_parse_file_indexed (&indexed, 0, fp, fsize, 0, 0, sample, &index);
+        XCTAssert (!res);
+        XCTAssertEqual(indexed.packet_offs, info.packet_offs);
+        XCTAssertEqual(indexed.pcmsample, info.pcmsample);
+    }
+    XCTAssertGreaterThan(index.count, 0);
+    mp3_seekindex_free (&index);
+    vfs_fclose (fp);
+}
+
+- (void)test_VBRSeekWithIndex_Performance {
+    mp3_seekindex_t index = {0};
+    char path[PATH_MAX];
+    snprintf (path, sizeof (path), "%s/TestData/mp3parser/vbr_rhytm_30sec.mp3", dbplugindir);
+    DB_FILE *fp = vfs_fopen (path);
+    int64_t fsize = vfs_fgetlength(fp);
+    [self measureBlock:^{
+        mp3info_t info;
+        for (int64_t sample = 0; sample < 1000000; sample += 1000) {
+            mp3_parse_file_indexed (&info, 0, fp, fsize, 0, 0, sample, &index);
+        }
+    }];
+    mp3_seekindex_free (&index);
+    vfs_fclose (fp);
+}
+
 @end
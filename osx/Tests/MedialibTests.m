@@ -0,0 +1,180 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2018 Alexey Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#import <XCTest/XCTest.h>
+#include <sys/stat.h>
+#include <utime.h>
+#include "deadbeef.h"
+#include "plugins.h"
+#include "medialib.h"
+
+extern DB_functions_t *deadbeef;
+
+static void
+_write_file (const char *path, const char *data) {
+    FILE *fp = fopen (path, "wb");
+    fputs (data, fp);
+    fclose (fp);
+}
+
+static DB_playItem_t *
+_find_track (ddb_playlist_t *plt, const char *fname) {
+    DB_playItem_t *it = deadbeef->plt_get_first (plt, PL_MAIN);
+    while (it) {
+        const char *uri = deadbeef->pl_find_meta (it, ":URI");
+        const char *slash = strrchr (uri, '/');
+        if (slash && !strcmp (slash + 1, fname)) {
+            return it;
+        }
+        DB_playItem_t *next = deadbeef->pl_get_next (it, PL_MAIN);
+        deadbeef->pl_item_unref (it);
+        it = next;
+    }
+    return NULL;
+}
+
+@interface MedialibTests : XCTestCase {
+    DB_plugin_t *_fakein;
+    DB_plugin_t *_medialib;
+    char _musicdir[PATH_MAX];
+    char _folder[PATH_MAX];
+}
+@end
+
+@implementation MedialibTests
+
+- (void)removeDatabase {
+    char path[PATH_MAX];
+    snprintf (path, sizeof (path), "%s/medialib.dbpl", deadbeef->get_system_dir (DDB_SYS_DIR_CONFIG));
+    unlink (path);
+    snprintf (path, sizeof (path), "%s/medialib.stat", deadbeef->get_system_dir (DDB_SYS_DIR_CONFIG));
+    unlink (path);
+}
+
+- (void)setUp {
+    [super setUp];
+
+    extern DB_plugin_t * fakein_load (DB_functions_t *api);
+    plug_init_plugin (fakein_load, NULL);
+    _fakein = fakein_load (deadbeef);
+    plug_register_in (_fakein);
+
+    [self removeDatabase];
+
+    snprintf (_musicdir, sizeof (_musicdir), "%s/medialib_test", [NSTemporaryDirectory() UTF8String]);
+    snprintf (_folder, sizeof (_folder), "%s/album", _musicdir);
+    mkdir (_musicdir, 0755);
+    mkdir (_folder, 0755);
+
+    char path[PATH_MAX];
+    for (int i = 1; i <= 3; i++) {
+        snprintf (path, sizeof (path), "%s/%d.fake", _folder, i);
+        _write_file (path, "fake");
+    }
+    // the folders modified in the same second as the scan are always rechecked
+    struct utimbuf times = { .actime = time (NULL) - 100, .modtime = time (NULL) - 100 };
+    utime (_folder, &times);
+    deadbeef->conf_set_str ("medialib.path", _musicdir);
+
+    _medialib = medialib_load (deadbeef);
+    _medialib->start ();
+}
+
+- (void)tearDown {
+    _medialib->stop ();
+    deadbeef->conf_set_str ("medialib.path", "");
+    [self removeDatabase];
+
+    char path[PATH_MAX];
+    for (int i = 1; i <= 4; i++) {
+        snprintf (path, sizeof (path), "%s/%d.fake", _folder, i);
+        unlink (path);
+    }
+    rmdir (_folder);
+    rmdir (_musicdir);
+
+    [super tearDown];
+}
+
+- (void)test_RescanAfterRestart_FolderUnchanged_FolderSkipped {
+    ddb_playlist_t *plt = ml_scan ();
+    XCTAssertEqual (deadbeef->plt_get_item_count (plt, PL_MAIN), 3);
+
+    struct stat st;
+    stat (_folder, &st);
+
+    // add a file, but keep the folder mtime, so that the folder looks unchanged
+    char path[PATH_MAX];
+    snprintf (path, sizeof (path), "%s/4.fake", _folder);
+    _write_file (path, "fake");
+    struct utimbuf times = { .actime = st.st_atime, .modtime = st.st_mtime };
+    utime (_folder, &times);
+
+    // the index is loaded back from medialib.dbpl and medialib.stat
+    _medialib->stop ();
+    _medialib->start ();
+    plt = ml_scan ();
+    XCTAssertEqual (deadbeef->plt_get_item_count (plt, PL_MAIN), 3);
+
+    // now the folder has changed
+    times.modtime = st.st_mtime - 10;
+    utime (_folder, &times);
+    plt = ml_scan ();
+    XCTAssertEqual (deadbeef->plt_get_item_count (plt, PL_MAIN), 4);
+}
+
+- (void)test_Rescan_FileModified_OnlyModifiedFileReread {
+    ddb_playlist_t *plt = ml_scan ();
+    XCTAssertEqual (deadbeef->plt_get_item_count (plt, PL_MAIN), 3);
+
+    // mark the tracks, the re-read track won't have the mark
+    DB_playItem_t *it = deadbeef->plt_get_first (plt, PL_MAIN);
+    while (it) {
+        deadbeef->pl_add_meta (it, "test_mark", "1");
+        DB_playItem_t *next = deadbeef->pl_get_next (it, PL_MAIN);
+        deadbeef->pl_item_unref (it);
+        it = next;
+    }
+
+    // modifying the file in place doesn't change the folder
+    char path[PATH_MAX];
+    snprintf (path, sizeof (path), "%s/2.fake", _folder);
+    _write_file (path, "modified fake");
+
+    plt = ml_scan ();
+    XCTAssertEqual (deadbeef->plt_get_item_count (plt, PL_MAIN), 3);
+
+    const char *names[] = { "1.fake", "2.fake", "3.fake" };
+    for (int i = 0; i < 3; i++) {
+        it = _find_track (plt, names[i]);
+        XCTAssert (it);
+        if (!it) {
+            continue;
+        }
+        int marked = deadbeef->pl_find_meta (it, "test_mark") != NULL;
+        XCTAssertEqual (marked, i != 1, @"%s", names[i]);
+        deadbeef->pl_item_unref (it);
+    }
+}
+
+@end
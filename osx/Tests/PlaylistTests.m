@@ -9,8 +9,13 @@
 #import <XCTest/XCTest.h>
 #include "deadbeef.h"
 #include "../../common.h"
+#include "conf.h"
 #include "playlist.h"
 #include "plugins.h"
+#include "pltmeta.h"
+#include "sort.h"
+#include <dirent.h>
+#include <sys/stat.h>
 
 @interface PlaylistTests : XCTestCase
 
@@ -155,4 +160,746 @@
 }
 
 
+#pragma mark - Metadata lookup
+
+static playItem_t *
+_make_item_with_many_tags (void) {
+    playItem_t *it = pl_item_alloc();
+    char key[20];
+    for (int i = 0; i < 36; i++) {
+        snprintf (key, sizeof (key), "tag%d", i);
+        pl_add_meta (it, key, "value");
+    }
+    pl_add_meta (it, "title", "title");
+    pl_add_meta (it, "!title", "override");
+    pl_add_meta (it, ":URI", "/path/file.mp3");
+    pl_add_meta (it, ":DURATION", "1:00");
+    pl_add_meta (it, "!DURATION", "2:00");
+    return it;
+}
+
+static const char *
+_find_meta_linear (playItem_t *it, const char *key) {
+    for (DB_metaInfo_t *m = it->meta; m; m = m->next) {
+        if (!strcasecmp (key, m->key)) {
+            return m->value;
+        }
+    }
+    return NULL;
+}
+
+static const char *lookup_keys[] = { "artist", "title", "album", "tag30", "tracknumber", ":URI", "year", "genre" };
+
+- (void)test_FindMetaInManyTags_CaseInsensitive_FindsValue {
+    playItem_t *it = _make_item_with_many_tags ();
+    pl_lock ();
+    XCTAssertTrue(!strcmp (pl_find_meta (it, "TAG5"), "value"));
+    XCTAssertTrue(!strcmp (pl_find_meta (it, ":uri"), "/path/file.mp3"));
+    XCTAssertTrue(pl_find_meta (it, "nonexistent") == NULL);
+    pl_unlock ();
+    pl_item_unref (it);
+}
+
+- (void)test_FindMetaInManyTags_OverridenProperty_FindsOverride {
+    playItem_t *it = _make_item_with_many_tags ();
+    pl_lock ();
+    XCTAssertTrue(!strcmp (pl_find_meta (it, ":DURATION"), "2:00"));
+    XCTAssertTrue(!strcmp (pl_find_meta_raw (it, ":DURATION"), "1:00"));
+    XCTAssertTrue(!strcmp (pl_meta_for_key_with_override (it, "Title")->value, "override"));
+    pl_unlock ();
+    pl_item_unref (it);
+}
+
+- (void)test_AddDuplicateMetaInManyTags_KeepsOriginal {
+    playItem_t *it = _make_item_with_many_tags ();
+    pl_add_meta (it, "TAG5", "dupe");
+    pl_lock ();
+    XCTAssertTrue(!strcmp (pl_find_meta (it, "tag5"), "value"));
+    pl_unlock ();
+    pl_item_unref (it);
+}
+
+- (void)test_DeleteMetaInManyTags_NotFound {
+    playItem_t *it = _make_item_with_many_tags ();
+    pl_lock ();
+    XCTAssertTrue(pl_find_meta (it, "tag5") != NULL);
+    pl_delete_meta (it, "tag5");
+    XCTAssertTrue(pl_find_meta (it, "tag5") == NULL);
+    XCTAssertTrue(pl_find_meta (it, "tag6") != NULL);
+    pl_unlock ();
+    pl_item_unref (it);
+}
+
+- (void)test_FindMeta_Performance {
+    playItem_t *it = _make_item_with_many_tags ();
+    pl_lock ();
+    [self measureBlock:^{
+        for (int i = 0; i < 1000000; i++) {
+            pl_find_meta (it, lookup_keys[i&7]);
+        }
+    }];
+    pl_unlock ();
+    pl_item_unref (it);
+}
+
+- (void)test_FindMetaLinearScan_Performance {
+    playItem_t *it = _make_item_with_many_tags ();
+    pl_lock ();
+    [self measureBlock:^{
+        for (int i = 0; i < 1000000; i++) {
+            _find_meta_linear (it, lookup_keys[i&7]);
+        }
+    }];
+    pl_unlock ();
+    pl_item_unref (it);
+}
+
+#pragma mark - Binary playlist format
+
+- (void)test_SaveBinaryPlaylist_LoadsIdenticalTracks {
+    char saved_confdir[PATH_MAX];
+    strcpy (saved_confdir, dbconfdir);
+    strcpy (dbconfdir, [NSTemporaryDirectory() UTF8String]);
+
+    int idx = plt_add (plt_get_count (), "test");
+    playlist_t *plt = plt_get_for_idx (idx);
+    for (int i = 0; i < 3; i++) {
+        playItem_t *it = _make_item_with_many_tags ();
+        const char values[] = "value1\0value2\0";
+        pl_add_meta_full (it, "genre", values, sizeof (values));
+        pl_item_set_startsample (it, 5000000000LL + i);
+        pl_item_set_endsample (it, 6000000000LL + i);
+        plt_insert_item (plt, plt->tail[PL_MAIN], it);
+        pl_item_unref (it);
+    }
+    plt_add_meta (plt, "plt_key", "plt_value");
+
+    XCTAssertEqual(plt_save_n (idx), 0);
+
+    char path[PATH_MAX];
+    snprintf (path, sizeof (path), "%s/playlists/%d.dbpl", dbconfdir, idx);
+    playlist_t *loaded = plt_alloc ("loaded");
+    plt_load (loaded, NULL, path, NULL, NULL, NULL);
+    unlink (path);
+
+    XCTAssertEqual(loaded->count[PL_MAIN], 3);
+    pl_lock ();
+    for (playItem_t *a = plt->head[PL_MAIN], *b = loaded->head[PL_MAIN]; a && b; a = a->next[PL_MAIN], b = b->next[PL_MAIN]) {
+        XCTAssertEqual(pl_item_get_startsample (a), pl_item_get_startsample (b));
+        XCTAssertEqual(pl_item_get_endsample (a), pl_item_get_endsample (b));
+        XCTAssertEqual(a->_flags, b->_flags);
+        XCTAssertEqual(a->_duration, b->_duration);
+        for (DB_metaInfo_t *m = a->meta; m; m = m->next) {
+            if (m->key[0] == '_' || m->key[0] == '!') {
+                continue;
+            }
+            DB_metaInfo_t *lm = pl_meta_for_key (b, m->key);
+            XCTAssertTrue(lm != NULL);
+            XCTAssertEqual(lm->valuesize, m->valuesize);
+            XCTAssertTrue(lm->value == m->value); // interned in metacache
+        }
+        XCTAssertTrue(pl_meta_for_key (b, "!title") == NULL);
+    }
+    XCTAssertTrue(!strcmp (plt_find_meta (loaded, "plt_key"), "plt_value"));
+    pl_unlock ();
+
+    plt_unref (loaded);
+    plt_unref (plt);
+    plt_remove (idx);
+    strcpy (dbconfdir, saved_confdir);
+}
+
+static int
+_abort_after_two_cb (playItem_t *it, void *user_data) {
+    int *count = user_data;
+    return ++(*count) == 2 ? -1 : 0;
+}
+
+- (void)test_LoadBinaryPlaylist_AfterItemWithCallback_InsertsInPlaceUntilAborted {
+    char saved_confdir[PATH_MAX];
+    strcpy (saved_confdir, dbconfdir);
+    strcpy (dbconfdir, [NSTemporaryDirectory() UTF8String]);
+
+    int idx = plt_add (plt_get_count (), "test");
+    playlist_t *plt = plt_get_for_idx (idx);
+    for (int i = 0; i < 3; i++) {
+        playItem_t *it = pl_item_alloc ();
+        pl_add_meta (it, "title", "saved");
+        plt_insert_item (plt, plt->tail[PL_MAIN], it);
+        pl_item_unref (it);
+    }
+    XCTAssertEqual(plt_save_n (idx), 0);
+
+    char path[PATH_MAX];
+    snprintf (path, sizeof (path), "%s/playlists/%d.dbpl", dbconfdir, idx);
+    playlist_t *loaded = plt_alloc ("loaded");
+    playItem_t *first = pl_item_alloc ();
+    playItem_t *last = pl_item_alloc ();
+    plt_insert_item (loaded, NULL, first);
+    plt_insert_item (loaded, first, last);
+
+    int count = 0;
+    int abort = 0;
+    plt_load (loaded, first, path, &abort, _abort_after_two_cb, &count);
+    unlink (path);
+
+    XCTAssertEqual(count, 2);
+    XCTAssertEqual(abort, 1);
+    XCTAssertEqual(loaded->count[PL_MAIN], 4);
+    pl_lock ();
+    XCTAssertTrue(loaded->head[PL_MAIN] == first);
+    XCTAssertTrue(!strcmp (pl_find_meta (first->next[PL_MAIN], "title"), "saved"));
+    XCTAssertTrue(!strcmp (pl_find_meta (first->next[PL_MAIN]->next[PL_MAIN], "title"), "saved"));
+    XCTAssertTrue(loaded->tail[PL_MAIN] == last);
+    pl_unlock ();
+
+    pl_item_unref (first);
+    pl_item_unref (last);
+    plt_unref (loaded);
+    plt_unref (plt);
+    plt_remove (idx);
+    strcpy (dbconfdir, saved_confdir);
+}
+
+- (void)test_SaveBinaryPlaylist_TrackWithOver65535Fields_KeepsAllFields {
+    char saved_confdir[PATH_MAX];
+    strcpy (saved_confdir, dbconfdir);
+    strcpy (dbconfdir, [NSTemporaryDirectory() UTF8String]);
+
+    int idx = plt_add (plt_get_count (), "test");
+    playlist_t *plt = plt_get_for_idx (idx);
+    playItem_t *it = pl_item_alloc ();
+    char key[20];
+    for (int i = 0; i < 70000; i++) {
+        snprintf (key, sizeof (key), "tag%d", i);
+        pl_add_meta (it, key, "value");
+    }
+    plt_insert_item (plt, NULL, it);
+    pl_item_unref (it);
+    XCTAssertEqual(plt_save_n (idx), 0);
+
+    char path[PATH_MAX];
+    snprintf (path, sizeof (path), "%s/playlists/%d.dbpl", dbconfdir, idx);
+    playlist_t *loaded = plt_alloc ("loaded");
+    plt_load (loaded, NULL, path, NULL, NULL, NULL);
+    unlink (path);
+
+    XCTAssertEqual(loaded->count[PL_MAIN], 1);
+    pl_lock ();
+    int fields = 0;
+    for (DB_metaInfo_t *m = loaded->head[PL_MAIN]->meta; m; m = m->next) {
+        fields++;
+    }
+    XCTAssertEqual(fields, 70000);
+    XCTAssertTrue(pl_find_meta (loaded->head[PL_MAIN], "tag69999") != NULL);
+    pl_unlock ();
+
+    plt_unref (loaded);
+    plt_unref (plt);
+    plt_remove (idx);
+    strcpy (dbconfdir, saved_confdir);
+}
+
+#pragma mark - Saving
+
+static int
+_count_temp_files (const char *dir) {
+    int count = 0;
+    DIR *d = opendir (dir);
+    if (d) {
+        struct dirent *e;
+        while ((e = readdir (d))) {
+            if (!strncmp (e->d_name, ".save", 5)) {
+                count++;
+            }
+        }
+        closedir (d);
+    }
+    return count;
+}
+
+- (void)test_ModifyPlaylistRepeatedly_SavesOnceInBackgroundAfterChangesStop {
+    char saved_confdir[PATH_MAX];
+    strcpy (saved_confdir, dbconfdir);
+    strcpy (dbconfdir, [NSTemporaryDirectory() UTF8String]);
+
+    int idx = plt_add (plt_get_count (), "test");
+    playlist_t *plt = plt_get_for_idx (idx);
+    char path[PATH_MAX];
+    snprintf (path, sizeof (path), "%s/playlists/%d.dbpl", dbconfdir, idx);
+    unlink (path);
+
+    // changes 100ms apart are coalesced, nothing is written while they keep coming
+    struct stat st;
+    for (int i = 0; i < 10; i++) {
+        playItem_t *it = pl_item_alloc ();
+        plt_insert_item (plt, plt->tail[PL_MAIN], it);
+        pl_item_unref (it);
+        plt_modified (plt);
+        usleep (100000);
+        XCTAssertNotEqual(stat (path, &st), 0);
+    }
+
+    int saved = 0;
+    for (int i = 0; i < 50 && !saved; i++) {
+        usleep (100000);
+        saved = !stat (path, &st);
+    }
+    XCTAssertTrue(saved);
+    ino_t ino = st.st_ino;
+
+    // written once, via a temp file which is renamed into place
+    usleep (1500000);
+    XCTAssertEqual(stat (path, &st), 0);
+    XCTAssertEqual(st.st_ino, ino);
+    char dir[PATH_MAX];
+    snprintf (dir, sizeof (dir), "%s/playlists", dbconfdir);
+    XCTAssertEqual(_count_temp_files (dir), 0);
+
+    playlist_t *loaded = plt_alloc ("loaded");
+    plt_load (loaded, NULL, path, NULL, NULL, NULL);
+    XCTAssertEqual(loaded->count[PL_MAIN], 10);
+    plt_unref (loaded);
+
+    unlink (path);
+    plt_unref (plt);
+    plt_remove (idx);
+    strcpy (dbconfdir, saved_confdir);
+}
+
+- (void)test_SaveCurrent_WritesFileBeforeReturning {
+    char saved_confdir[PATH_MAX];
+    strcpy (saved_confdir, dbconfdir);
+    strcpy (dbconfdir, [NSTemporaryDirectory() UTF8String]);
+
+    int saved_curr = plt_get_curr_idx ();
+    int idx = plt_add (plt_get_count (), "test");
+    plt_set_curr_idx (idx);
+    playlist_t *plt = plt_get_for_idx (idx);
+    for (int i = 0; i < 3; i++) {
+        playItem_t *it = pl_item_alloc ();
+        plt_insert_item (plt, plt->tail[PL_MAIN], it);
+        pl_item_unref (it);
+    }
+    char path[PATH_MAX];
+    snprintf (path, sizeof (path), "%s/playlists/%d.dbpl", dbconfdir, idx);
+    unlink (path);
+
+    XCTAssertEqual(pl_save_current (), 0);
+
+    playlist_t *loaded = plt_alloc ("loaded");
+    plt_load (loaded, NULL, path, NULL, NULL, NULL);
+    XCTAssertEqual(loaded->count[PL_MAIN], 3);
+    plt_unref (loaded);
+
+    unlink (path);
+    plt_unref (plt);
+    plt_set_curr_idx (saved_curr);
+    plt_remove (idx);
+    strcpy (dbconfdir, saved_confdir);
+}
+
+#pragma mark - Position index
+
+static playlist_t *
+_make_playlist_with_items (int count) {
+    playlist_t *plt = plt_alloc ("test");
+    for (int i = 0; i < count; i++) {
+        playItem_t *it = pl_item_alloc ();
+        plt_insert_item (plt, plt->tail[PL_MAIN], it);
+        pl_item_unref (it);
+    }
+    return plt;
+}
+
+- (void)test_GetItemForIdxAfterInsertAndRemove_MatchesListOrder {
+    playlist_t *plt = _make_playlist_with_items (1000);
+    pl_lock ();
+    // populate the index, then modify the list in the middle and at the ends
+    playItem_t *it = plt_get_item_for_idx (plt, 500, PL_MAIN);
+    plt_remove_item (plt, it);
+    pl_item_unref (it);
+    it = plt_get_item_for_idx (plt, 0, PL_MAIN);
+    plt_remove_item (plt, it);
+    pl_item_unref (it);
+    playItem_t *after = plt_get_item_for_idx (plt, 300, PL_MAIN);
+    for (int i = 0; i < 600; i++) {
+        it = pl_item_alloc ();
+        plt_insert_item (plt, after, it);
+        pl_item_unref (it);
+    }
+    pl_item_unref (after);
+
+    XCTAssertEqual(plt->count[PL_MAIN], 1598);
+    int idx = 0;
+    for (playItem_t *c = plt->head[PL_MAIN]; c; c = c->next[PL_MAIN], idx++) {
+        XCTAssertEqual(plt_get_item_idx (plt, c, PL_MAIN), idx);
+        playItem_t *found = plt_get_item_for_idx (plt, idx, PL_MAIN);
+        XCTAssertTrue(found == c);
+        pl_item_unref (found);
+    }
+    XCTAssertTrue(plt_get_item_for_idx (plt, idx, PL_MAIN) == NULL);
+    pl_unlock ();
+    plt_unref (plt);
+}
+
+- (void)test_GetItemIdxAfterSort_MatchesListOrder {
+    playlist_t *plt = _make_playlist_with_items (1000);
+    pl_lock ();
+    playItem_t *it = plt_get_item_for_idx (plt, 10, PL_MAIN);
+    pl_item_unref (it);
+    plt_sort_random (plt, PL_MAIN);
+    int idx = 0;
+    for (playItem_t *c = plt->head[PL_MAIN]; c; c = c->next[PL_MAIN], idx++) {
+        XCTAssertEqual(plt_get_item_idx (plt, c, PL_MAIN), idx);
+    }
+    pl_unlock ();
+    plt_unref (plt);
+}
+
+- (void)test_GetItemForIdx_Performance {
+    playlist_t *plt = _make_playlist_with_items (1000000);
+    pl_lock ();
+    [self measureBlock:^{
+        for (int i = 0; i < 100000; i++) {
+            playItem_t *it = plt_get_item_for_idx (plt, (i * 7919) % 1000000, PL_MAIN);
+            plt_get_item_idx (plt, it, PL_MAIN);
+            pl_item_unref (it);
+        }
+    }];
+    pl_unlock ();
+    plt_unref (plt);
+}
+
+- (void)test_RandomInsertRemove_Performance {
+    playlist_t *plt = _make_playlist_with_items (1000000);
+    pl_lock ();
+    [self measureBlock:^{
+        for (int i = 0; i < 10000; i++) {
+            playItem_t *it = plt_get_item_for_idx (plt, (i * 7919) % plt->count[PL_MAIN], PL_MAIN);
+            plt_remove_item (plt, it);
+            plt_insert_item (plt, plt->head[PL_MAIN], it);
+            pl_item_unref (it);
+        }
+    }];
+    pl_unlock ();
+    plt_unref (plt);
+}
+
+#pragma mark - Locking
+
+- (void)test_PltLock_DifferentPlaylists_DontBlockEachOther {
+    playlist_t *plt1 = _make_playlist_with_items (10);
+    playlist_t *plt2 = _make_playlist_with_items (10);
+
+    dispatch_semaphore_t locked = dispatch_semaphore_create (0);
+    dispatch_semaphore_t release = dispatch_semaphore_create (0);
+    dispatch_async (dispatch_get_global_queue (DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        plt_lock (plt1);
+        dispatch_semaphore_signal (locked);
+        dispatch_semaphore_wait (release, DISPATCH_TIME_FOREVER);
+        plt_unlock (plt1);
+        dispatch_semaphore_signal (locked);
+    });
+    dispatch_semaphore_wait (locked, DISPATCH_TIME_FOREVER);
+
+    // plt1 is locked by another thread, plt2 must be accessible
+    plt_lock (plt2);
+    XCTAssertTrue(pl_lock_is_shared ());
+    playItem_t *it = plt_get_item_for_idx (plt2, 5, PL_MAIN);
+    XCTAssertTrue(it != NULL);
+    char title[100];
+    pl_replace_meta (it, "title", "value");
+    XCTAssertEqual(pl_get_meta (it, "title", title, sizeof (title)), 1);
+    XCTAssertTrue(!strcmp (title, "value"));
+    pl_item_unref (it);
+    plt_unlock (plt2);
+
+    dispatch_semaphore_signal (release);
+    dispatch_semaphore_wait (locked, DISPATCH_TIME_FOREVER);
+
+    pl_lock ();
+    XCTAssertFalse(pl_lock_is_shared ());
+    // nested plt_lock doesn't downgrade the exclusive lock
+    plt_lock (plt1);
+    XCTAssertFalse(pl_lock_is_shared ());
+    plt_unlock (plt1);
+    pl_unlock ();
+
+    plt_unref (plt1);
+    plt_unref (plt2);
+}
+
+- (void)test_PlLock_WaitsForPltLock {
+    playlist_t *plt = _make_playlist_with_items (10);
+
+    __block int unlocked = 0;
+    dispatch_semaphore_t locked = dispatch_semaphore_create (0);
+    dispatch_semaphore_t done = dispatch_semaphore_create (0);
+    dispatch_async (dispatch_get_global_queue (DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        plt_lock (plt);
+        dispatch_semaphore_signal (locked);
+        usleep (100000);
+        unlocked = 1;
+        plt_unlock (plt);
+        dispatch_semaphore_signal (done);
+    });
+    dispatch_semaphore_wait (locked, DISPATCH_TIME_FOREVER);
+
+    pl_lock ();
+    XCTAssertEqual(unlocked, 1);
+    pl_unlock ();
+
+    dispatch_semaphore_wait (done, DISPATCH_TIME_FOREVER);
+    plt_unref (plt);
+}
+
+- (void)test_PltLock_WhilePlLockIsWaiting_WaitsForPlLock {
+    playlist_t *plt1 = _make_playlist_with_items (10);
+    playlist_t *plt2 = _make_playlist_with_items (10);
+
+    __block int seq = 0;
+    __block int exclusive_seq = 0;
+    dispatch_semaphore_t locked = dispatch_semaphore_create (0);
+    dispatch_semaphore_t done = dispatch_semaphore_create (0);
+    dispatch_async (dispatch_get_global_queue (DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        plt_lock (plt1);
+        dispatch_semaphore_signal (locked);
+        usleep (200000);
+        plt_unlock (plt1);
+        dispatch_semaphore_signal (done);
+    });
+    dispatch_semaphore_wait (locked, DISPATCH_TIME_FOREVER);
+
+    dispatch_async (dispatch_get_global_queue (DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        pl_lock ();
+        exclusive_seq = __sync_add_and_fetch (&seq, 1);
+        pl_unlock ();
+        dispatch_semaphore_signal (done);
+    });
+    // let pl_lock start waiting for plt1
+    usleep (50000);
+
+    plt_lock (plt2);
+    int shared_seq = __sync_add_and_fetch (&seq, 1);
+    plt_unlock (plt2);
+
+    dispatch_semaphore_wait (done, DISPATCH_TIME_FOREVER);
+    dispatch_semaphore_wait (done, DISPATCH_TIME_FOREVER);
+    XCTAssertEqual(exclusive_seq, 1);
+    XCTAssertEqual(shared_seq, 2);
+
+    plt_unref (plt1);
+    plt_unref (plt2);
+}
+
+#pragma mark - Search index
+
+static playlist_t *
+_make_playlist_with_titles (int count) {
+    playlist_t *plt = plt_alloc ("test");
+    char title[100];
+    for (int i = 0; i < count; i++) {
+        playItem_t *it = pl_item_alloc ();
+        snprintf (title, sizeof (title), "Title %d", i);
+        pl_add_meta (it, "title", title);
+        pl_add_meta (it, "artist", i % 2 ? "Odd Artist" : "Even Artist");
+        plt_insert_item (plt, plt->tail[PL_MAIN], it);
+        pl_item_unref (it);
+    }
+    return plt;
+}
+
+- (void)test_SearchWithIndex_FindsSameItemsAsLinearScan {
+    playlist_t *plt = _make_playlist_with_titles (2000);
+
+    plt_search_process (plt, "title 123");
+    // 123, 1230..1239
+    XCTAssertEqual(plt->count[PL_SEARCH], 11);
+
+    plt_search_process (plt, "odd art");
+    XCTAssertEqual(plt->count[PL_SEARCH], 1000);
+
+    plt_search_process (plt, "nonexistent");
+    XCTAssertEqual(plt->count[PL_SEARCH], 0);
+
+    plt_unref (plt);
+}
+
+- (void)test_SearchWithIndex_TagEditAndRemove_UpdatesResults {
+    playlist_t *plt = _make_playlist_with_titles (2000);
+
+    plt_search_process (plt, "title 1999");
+    XCTAssertEqual(plt->count[PL_SEARCH], 1);
+
+    pl_lock ();
+    playItem_t *it = plt_get_item_for_idx (plt, 5, PL_MAIN);
+    pl_replace_meta (it, "title", "Replaced");
+    pl_unlock ();
+
+    plt_search_process (plt, "replaced");
+    XCTAssertEqual(plt->count[PL_SEARCH], 1);
+    XCTAssertTrue(plt->head[PL_SEARCH] == it);
+
+    plt_search_process (plt, "title 5");
+    // 5x, 5xx; the original "Title 5" is gone
+    XCTAssertEqual(plt->count[PL_SEARCH], 110);
+
+    pl_lock ();
+    plt_remove_item (plt, it);
+    pl_unlock ();
+    pl_item_unref (it);
+
+    plt_search_process (plt, "replaced");
+    XCTAssertEqual(plt->count[PL_SEARCH], 0);
+
+    plt_unref (plt);
+}
+
+- (void)test_SearchWithIndex_TagDelete_UpdatesResults {
+    playlist_t *plt = _make_playlist_with_titles (2000);
+
+    plt_search_process (plt, "title 1999");
+    XCTAssertEqual(plt->count[PL_SEARCH], 1);
+
+    pl_lock ();
+    playItem_t *it = plt_get_item_for_idx (plt, 1999, PL_MAIN);
+    pl_delete_meta (it, "title");
+    pl_unlock ();
+
+    plt_search_process (plt, "title 1999");
+    XCTAssertEqual(plt->count[PL_SEARCH], 0);
+
+    pl_lock ();
+    pl_delete_all_meta (it);
+    pl_unlock ();
+    pl_item_unref (it);
+
+    plt_search_process (plt, "odd art");
+    XCTAssertEqual(plt->count[PL_SEARCH], 999);
+
+    plt_unref (plt);
+}
+
+- (void)test_SearchWithIndex_Performance {
+    playlist_t *plt = _make_playlist_with_titles (300000);
+    [self measureBlock:^{
+        plt_search_process (plt, "title 4242");
+        plt_search_process (plt, "even");
+        plt_search_process (plt, "zzz");
+    }];
+    plt_unref (plt);
+}
+
+#pragma mark - Folder scanning
+
+static playlist_t *
+_scan_test_data (int nthreads, int *pabort, int (*cb)(playItem_t *it, void *user_data), void *user_data) {
+    char path[PATH_MAX];
+    snprintf (path, sizeof (path), "%s/TestData", dbplugindir);
+
+    conf_set_int ("add_folders_threads", nthreads);
+    playlist_t *plt = plt_alloc ("test");
+    plt_insert_dir2 (0, plt, NULL, path, pabort, cb, user_data);
+    conf_set_int ("add_folders_threads", 4);
+    return plt;
+}
+
+- (void)assertSameTracks:(playlist_t *)a :(playlist_t *)b {
+    XCTAssertEqual(plt_get_item_count (a, PL_MAIN), plt_get_item_count (b, PL_MAIN));
+    playItem_t *ia = a->head[PL_MAIN];
+    playItem_t *ib = b->head[PL_MAIN];
+    for (; ia && ib; ia = ia->next[PL_MAIN], ib = ib->next[PL_MAIN]) {
+        XCTAssertEqual(strcmp (pl_find_meta (ia, ":URI"), pl_find_meta (ib, ":URI")), 0);
+        XCTAssertEqual(pl_find_meta_int (ia, ":TRACKNUM", 0), pl_find_meta_int (ib, ":TRACKNUM", 0));
+    }
+    XCTAssertTrue(ia == NULL && ib == NULL);
+}
+
+static int
+_abort_after_3_cb (playItem_t *it, void *user_data) {
+    int *count = user_data;
+    return ++(*count) >= 3 ? -1 : 0;
+}
+
+- (void)test_InsertDirParallel_SameTracksAndOrderAsSerial {
+    playlist_t *serial = _scan_test_data (1, NULL, NULL, NULL);
+    playlist_t *parallel = _scan_test_data (4, NULL, NULL, NULL);
+
+    XCTAssertTrue(plt_get_item_count (serial, PL_MAIN) > 0);
+    [self assertSameTracks:serial :parallel];
+
+    plt_free (serial);
+    plt_free (parallel);
+}
+
+- (void)test_InsertDirParallel_CallbackAbort_StopsAtSameTrack {
+    int serial_count = 0;
+    int serial_abort = 0;
+    playlist_t *serial = _scan_test_data (1, &serial_abort, _abort_after_3_cb, &serial_count);
+    int parallel_count = 0;
+    int parallel_abort = 0;
+    playlist_t *parallel = _scan_test_data (4, &parallel_abort, _abort_after_3_cb, &parallel_count);
+
+    XCTAssertEqual(serial_abort, 1);
+    XCTAssertEqual(parallel_abort, 1);
+    XCTAssertEqual(serial_count, parallel_count);
+    [self assertSameTracks:serial :parallel];
+
+    plt_free (serial);
+    plt_free (parallel);
+}
+
+#pragma mark - Sorting
+
+- (void)test_SortByTitle_NumbersAndCase_SortsLikeStrcasecmpNumeric {
+    playlist_t *plt = plt_alloc ("test");
+    const char *titles[] = { "b", "10 x", "A", "9 x", "Éa", "éb", "a" };
+    for (int i = 0; i < 7; i++) {
+        playItem_t *it = pl_item_alloc ();
+        pl_add_meta (it, "title", titles[i]);
+        plt_insert_item (plt, plt->tail[PL_MAIN], it);
+        pl_item_unref (it);
+    }
+
+    plt_sort_v2 (plt, PL_MAIN, -1, "%title%", DDB_SORT_ASCENDING);
+
+    // stable: "A" stays before "a"
+    const char *expected[] = { "9 x", "10 x", "A", "a", "b", "Éa", "éb" };
+    int idx = 0;
+    for (playItem_t *it = plt->head[PL_MAIN]; it; it = it->next[PL_MAIN], idx++) {
+        XCTAssertTrue(!strcmp (pl_find_meta (it, "title"), expected[idx]));
+    }
+    XCTAssertEqual(idx, 7);
+
+    plt_unref (plt);
+}
+
+- (void)test_SortLargePlaylistDescending_MatchesListOrder {
+    playlist_t *plt = _make_playlist_with_titles (20000);
+
+    plt_sort_v2 (plt, PL_MAIN, -1, "%title%", DDB_SORT_DESCENDING);
+
+    XCTAssertTrue(!strcmp (pl_find_meta (plt->head[PL_MAIN], "title"), "Title 9999"));
+    XCTAssertTrue(!strcmp (pl_find_meta (plt->tail[PL_MAIN], "title"), "Title 0"));
+    int idx = 0;
+    playItem_t *prev = NULL;
+    for (playItem_t *it = plt->head[PL_MAIN]; it; it = it->next[PL_MAIN], idx++) {
+        XCTAssertTrue(it->prev[PL_MAIN] == prev);
+        prev = it;
+    }
+    XCTAssertEqual(idx, 20000);
+
+    plt_unref (plt);
+}
+
+- (void)test_SortByTitle_Performance {
+    playlist_t *plt = _make_playlist_with_titles (500000);
+    [self measureBlock:^{
+        plt_sort_v2 (plt, PL_MAIN, -1, "%artist% - %title%", DDB_SORT_ASCENDING);
+        plt_sort_v2 (plt, PL_MAIN, -1, "%title%", DDB_SORT_DESCENDING);
+    }];
+    plt_unref (plt);
+}
+
 @end
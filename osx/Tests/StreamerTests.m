@@ -22,12 +22,17 @@
 */
 
 #import <XCTest/XCTest.h>
+#include <sched.h>
+#include <sys/time.h>
+#include <math.h>
 #include "deadbeef.h"
 #include "playlist.h"
 #include "plugins.h"
 #include "conf.h"
 #include "../../common.h"
 #include "streamer.h"
+#include "streamreader.h"
+#include "fft.h"
 #include "threading.h"
 #include "messagepump.h"
 #include "fakein.h"
@@ -35,6 +40,7 @@
 #include "playmodes.h"
 
 static int count_played;
+static int count_seeked;
 
 static void (*_trackinfochanged_handler)(ddb_event_track_t *ev);
 
@@ -99,6 +105,9 @@ mainloop (void *ctx) {
                     case DB_EV_SONGSTARTED:
                         count_played++;
                         break;
+                    case DB_EV_SEEKED:
+                        count_seeked++;
+                        break;
                     case DB_EV_TRACKINFOCHANGED:
                         if (_trackinfochanged_handler) {
                             _trackinfochanged_handler ((ddb_event_track_t *)ctx);
@@ -170,6 +179,7 @@ wait_until_stopped (void) {
 
     streamer_set_repeat(DDB_REPEAT_OFF);
     count_played = 0;
+    count_seeked = 0;
 
     _mainloop_tid = thread_start (mainloop, NULL);
 }
@@ -273,4 +283,369 @@ static void switchtest_trackinfochanged_handler (ddb_event_track_t *ev) {
     XCTAssert (count_played = 2);
 }
 
+// plays the output in small steps, without running ahead of the streamer
+static void
+_consume_until_playpos (float pos) {
+    while (streamer_get_playpos () < pos) {
+        if (streamer_ok_to_read (-1)) {
+            fakeout_consume (4096);
+        }
+        else {
+            usleep (1000);
+        }
+    }
+}
+
+// The next track is requeued when shuffle changes, while its first chunks may already be processed for the output.
+// Those must be dropped, otherwise the old next track starts playing, and then the new one starts again.
+- (void)test_ToggleShuffleWithNextTrackPrebuffered_NextTrackStartsOnce {
+    // the next track is looked up in the registered playlists
+    int idx = plt_add (plt_get_count (), "testplt");
+    playlist_t *plt = plt_get_for_idx (idx);
+    DB_playItem_t *a = deadbeef->plt_insert_file2 (0, (ddb_playlist_t *)plt, NULL, "/a.fake", NULL, NULL, NULL);
+    DB_playItem_t *b = deadbeef->plt_insert_file2 (0, (ddb_playlist_t *)plt, a, "/b.fake", NULL, NULL, NULL);
+    DB_playItem_t *c = deadbeef->plt_insert_file2 (0, (ddb_playlist_t *)plt, b, "/c.fake", NULL, NULL, NULL);
+
+    plt_set_curr (plt);
+
+    // the whole playlist gets prebuffered, so that all tracks are already marked as played when shuffle gets enabled,
+    // and without repeat there would be no next track to requeue
+    streamer_set_repeat (DDB_REPEAT_ALL);
+    fakeout_set_manual (1);
+
+    streamer_set_nextsong (0, 0);
+    streamer_yield ();
+
+    // play up to the last 100ms of the first track, and let the beginning of the next one get processed
+    _consume_until_playpos (4.9f);
+    usleep (300000);
+    playItem_t *playing = streamer_get_playing_track ();
+    XCTAssert (playing == (playItem_t *)a);
+    if (playing) {
+        pl_item_unref (playing);
+    }
+
+    // the streamer picks up the new shuffle mode on its next iteration, which can take up to STREAMER_IDLE_TIMEOUT_MS
+    int played = count_played;
+    streamer_set_shuffle (DDB_SHUFFLE_TRACKS);
+    usleep (1500000);
+
+    // play into the next track
+    fakeout_consume (44100 * 4 * 2);
+    usleep (300000);
+
+    // the dropped chunks would start the old next track, and then the requeued one
+    XCTAssertEqual (count_played - played, 1);
+
+    streamer_set_shuffle (DDB_SHUFFLE_OFF);
+    streamer_set_repeat (DDB_REPEAT_OFF);
+    fakeout_set_manual (0);
+
+    plt_set_curr (NULL);
+    plt_unref (plt);
+    plt_remove (idx);
+    (void)c;
+}
+
+// Measures the time from a seek request to the first block of audio at the new position,
+// while the streamer is idle with all of its blocks full.
+- (void)test_SeekWithFullBuffers_FirstAudioLatency {
+    playlist_t *plt = plt_alloc ("testplt");
+    deadbeef->plt_insert_file2 (0, (ddb_playlist_t *)plt, NULL, "/sine.fake", NULL, NULL, NULL);
+
+    plt_set_curr (plt);
+
+    fakeout_set_manual (1);
+
+    streamer_set_nextsong (0, 0);
+    streamer_yield ();
+
+    __block int iteration = 0;
+    [self measureMetrics:[[self class] defaultPerformanceMetrics] automaticallyStartMeasuring:NO forBlock:^{
+        // let the streamer fill all blocks and go to sleep
+        while (!streamer_ok_to_read (-1)) {
+            usleep (1000);
+        }
+        usleep (100000);
+
+        int seeked = count_seeked;
+        [self startMeasuring];
+        streamer_set_seek (iteration++ % 2 ? 1.f : 2.f);
+        while (count_seeked == seeked || !streamer_ok_to_read (-1)) {
+            usleep (100);
+        }
+        [self stopMeasuring];
+    }];
+
+    fakeout_set_manual (0);
+
+    plt_set_curr (NULL);
+    deadbeef->plt_unref ((ddb_playlist_t *)plt);
+
+    XCTAssert (count_seeked >= iteration);
+}
+
+- (void)test_StreamerReadWithFullBuffers_OutputCallbackCost {
+    playlist_t *plt = plt_alloc ("testplt");
+    deadbeef->plt_insert_file2 (0, (ddb_playlist_t *)plt, NULL, "/sine.fake", NULL, NULL, NULL);
+
+    plt_set_curr (plt);
+
+    fakeout_set_manual (1);
+
+    streamer_set_nextsong (0, 0);
+    streamer_yield ();
+
+    __block int starved = 0;
+    [self measureMetrics:[[self class] defaultPerformanceMetrics] automaticallyStartMeasuring:NO forBlock:^{
+        // let the DSP thread fill the processed chunk queue
+        while (!streamer_ok_to_read (-1)) {
+            usleep (1000);
+        }
+        usleep (100000);
+
+        char buffer[4096];
+        float pos = streamer_get_playpos ();
+        [self startMeasuring];
+        for (int i = 0; i < 16; i++) {
+            streamer_read (buffer, sizeof (buffer));
+        }
+        [self stopMeasuring];
+        if (streamer_get_playpos () <= pos) {
+            starved++;
+        }
+    }];
+
+    fakeout_set_manual (0);
+
+    plt_set_curr (NULL);
+    deadbeef->plt_unref ((ddb_playlist_t *)plt);
+
+    XCTAssert (starved == 0);
+}
+
+static int _slow_waveform_calls;
+
+static void
+_slow_waveform_listener (void *ctx, ddb_audio_data_t *data) {
+    _slow_waveform_calls++;
+    usleep (50000);
+}
+
+- (void)test_SlowWaveformListener_DoesNotStallStreamerRead {
+    playlist_t *plt = plt_alloc ("testplt");
+    deadbeef->plt_insert_file2 (0, (ddb_playlist_t *)plt, NULL, "/sine.fake", NULL, NULL, NULL);
+
+    plt_set_curr (plt);
+
+    fakeout_set_manual (1);
+
+    _slow_waveform_calls = 0;
+    int64_t dropped = vis_get_frames_dropped ();
+    vis_waveform_listen (self, _slow_waveform_listener);
+
+    streamer_set_nextsong (0, 0);
+    streamer_yield ();
+
+    // the listener can only take 20 calls per second, while the output keeps reading
+    char buffer[16384];
+    for (int i = 0; i < 200; i++) {
+        while (!streamer_ok_to_read (-1)) {
+            usleep (1000);
+        }
+        struct timeval tm1, tm2;
+        gettimeofday (&tm1, NULL);
+        streamer_read (buffer, sizeof (buffer));
+        gettimeofday (&tm2, NULL);
+        int ms = (int)((tm2.tv_sec-tm1.tv_sec)*1000 + (tm2.tv_usec-tm1.tv_usec)/1000);
+        XCTAssertLessThan (ms, 50);
+        usleep (2000);
+    }
+
+    vis_waveform_unlisten (self);
+
+    fakeout_set_manual (0);
+
+    plt_set_curr (NULL);
+    deadbeef->plt_unref ((ddb_playlist_t *)plt);
+
+    XCTAssertGreaterThan (_slow_waveform_calls, 0);
+    XCTAssertGreaterThan (vis_get_frames_dropped (), dropped);
+}
+
+- (void)test_CalcFreqEx_SinePeaksAtItsBand_AllSizesAndWindows {
+    float *data = malloc (DDB_FREQ_MAX_BANDS * 2 * sizeof (float));
+    float *freq = malloc (DDB_FREQ_MAX_BANDS * sizeof (float));
+    for (int nbands = 64; nbands <= DDB_FREQ_MAX_BANDS; nbands *= 2) {
+        // freq[n] corresponds to the frequency of (n+1) periods per window
+        int band = nbands / 4;
+        for (int i = 0; i < nbands * 2; i++) {
+            data[i] = sinf (2 * (float)M_PI * (band + 1) * i / (nbands * 2));
+        }
+        for (int window = 0; window < DDB_FFT_WINDOW_COUNT; window++) {
+            calc_freq_ex (data, freq, nbands, window);
+            int peak = 0;
+            for (int n = 1; n < nbands; n++) {
+                if (freq[n] > freq[peak]) {
+                    peak = n;
+                }
+            }
+            XCTAssertEqual (peak, band, @"nbands=%d window=%d", nbands, window);
+        }
+    }
+    free (data);
+    free (freq);
+}
+
+- (void)test_CalcFreq_MatchesDFT {
+    float data[DDB_FREQ_BANDS * 2];
+    float freq[DDB_FREQ_BANDS];
+    int n = DDB_FREQ_BANDS * 2;
+    for (int i = 0; i < n; i++) {
+        data[i] = sinf (i * 0.3f) * 0.7f + cosf (i * 1.7f) * 0.2f;
+    }
+    calc_freq (data, freq);
+    for (int k = 1; k <= DDB_FREQ_BANDS; k++) {
+        double re = 0, im = 0;
+        for (int i = 0; i < n; i++) {
+            double w = 1 - 0.85 * cos (2 * M_PI * i / n);
+            re += data[i] * w * cos (2 * M_PI * k * i / n);
+            im -= data[i] * w * sin (2 * M_PI * k * i / n);
+        }
+        double mag = sqrt (re * re + im * im) / n;
+        if (k < DDB_FREQ_BANDS) {
+            mag *= 2;
+        }
+        XCTAssertEqualWithAccuracy (freq[k-1], mag, 1e-4);
+    }
+}
+
+#define STRESS_BLOCK_COUNT 1000000
+
+static playItem_t *_stress_track;
+static int _stress_failed;
+
+static void
+_stress_producer (void *ctx) {
+    for (uint32_t i = 0; i < STRESS_BLOCK_COUNT; i++) {
+        streamblock_t *block;
+        while (!(block = streamreader_get_next_block ())) {
+            sched_yield ();
+        }
+        memcpy (block->buf, &i, sizeof (i));
+        block->size = sizeof (i);
+        block->pos = 0;
+        block->track = _stress_track;
+        streamreader_enqueue_block (block);
+    }
+}
+
+static void
+_stress_consumer (void *ctx) {
+    for (uint32_t i = 0; i < STRESS_BLOCK_COUNT; i++) {
+        streamblock_t *block;
+        while (!(block = streamreader_get_curr_block ())) {
+            sched_yield ();
+        }
+        uint32_t value;
+        memcpy (&value, block->buf, sizeof (value));
+        int ready = streamreader_num_blocks_ready ();
+        if (value != i || block->size != sizeof (i) || block->track != _stress_track || ready < 1) {
+            _stress_failed = 1;
+        }
+        streamreader_next_block ();
+    }
+}
+
+// The streamer is stopped during this test, so its thread doesn't touch the block queue
+- (void)test_StreamReaderQueue_ConcurrentProducerConsumer_KeepsOrder {
+    _stress_track = pl_item_alloc ();
+    _stress_failed = 0;
+    streamreader_reset ();
+
+    intptr_t producer = thread_start (_stress_producer, NULL);
+    intptr_t consumer = thread_start (_stress_consumer, NULL);
+    thread_join (producer);
+    thread_join (consumer);
+
+    XCTAssertEqual (_stress_failed, 0);
+    XCTAssertEqual (streamreader_num_blocks_ready (), 0);
+    XCTAssertTrue (streamreader_get_curr_block () == NULL);
+
+    pl_item_unref (_stress_track);
+    _stress_track = NULL;
+}
+
+static int
+_readahead_fake_read (DB_fileinfo_t *info, char *buf, int size) {
+    memset (buf, 0, size);
+    return size;
+}
+
+static DB_decoder_t _readahead_fake_decoder = {
+    .read = _readahead_fake_read,
+};
+
+// decodes, queues and plays one block, returns the resulting read-ahead
+static int
+_readahead_play_block (DB_fileinfo_t *fileinfo, playItem_t *track) {
+    streamblock_t *block = streamreader_get_next_block ();
+    streamreader_read_block (block, track, fileinfo);
+    streamreader_enqueue_block (block);
+    streamreader_get_curr_block ();
+    streamreader_next_block ();
+    return streamreader_get_readahead_blocks ();
+}
+
+- (void)test_StreamReaderReadahead_SizedInTimeForTheFormat {
+    playItem_t *track = pl_item_alloc ();
+    DB_fileinfo_t fileinfo = {
+        .plugin = &_readahead_fake_decoder,
+        .fmt = { .samplerate = 44100, .channels = 2, .bps = 16 },
+    };
+    streamreader_reset ();
+    streamreader_set_readahead (5000);
+
+    int cd_blocks = _readahead_play_block (&fileinfo, track);
+
+    fileinfo.fmt = (ddb_waveformat_t){ .samplerate = 192000, .channels = 8, .bps = 32, .is_float = 1 };
+    int hires_blocks = _readahead_play_block (&fileinfo, track);
+
+    streamreader_set_readahead (1000);
+    int short_blocks = _readahead_play_block (&fileinfo, track);
+
+    // 5 sec of 44100/16/2 in 16K blocks
+    XCTAssertEqual (cd_blocks, 54);
+    XCTAssertEqual (hires_blocks, 1875);
+    XCTAssertEqual (short_blocks, 375);
+
+    pl_item_unref (track);
+}
+
+- (void)test_StreamReaderReadahead_UnderrunDuringPlayback_DoublesReadahead {
+    playItem_t *track = pl_item_alloc ();
+    DB_fileinfo_t fileinfo = {
+        .plugin = &_readahead_fake_decoder,
+        .fmt = { .samplerate = 44100, .channels = 2, .bps = 16 },
+    };
+    streamreader_reset ();
+    streamreader_set_readahead (5000);
+
+    int before = _readahead_play_block (&fileinfo, track);
+
+    // the queue is empty after a block was played
+    streamreader_underrun ();
+    int after = _readahead_play_block (&fileinfo, track);
+
+    // the queue is empty after a reset, which is not an underrun
+    streamreader_reset ();
+    streamreader_underrun ();
+    int after_reset = _readahead_play_block (&fileinfo, track);
+
+    XCTAssertEqual (after, before * 2);
+    XCTAssertEqual (after_reset, after);
+
+    pl_item_unref (track);
+}
+
 @end
@@ -29,6 +29,7 @@
 #include "playqueue.h"
 #include "streamer.h"
 #include "plugins.h"
+#include <pthread.h>
 
 static int fake_out_state_value = DDB_PLAYBACK_STATE_STOPPED;
 
@@ -2402,4 +2403,140 @@ static DB_output_t fake_out = {
     free (output);
 }
 
+- (void)test_EvalTwiceWithTitleChangedInBetween_ReturnsNewTitle {
+    pl_add_meta (it, "title", "Title");
+    char *bc = tf_compile("%title%");
+    tf_eval (&ctx, bc, buffer, sizeof (buffer));
+    XCTAssertTrue(!strcmp (buffer, "Title"), @"The actual output is: %s", buffer);
+    pl_replace_meta (it, "title", "New Title");
+    tf_eval (&ctx, bc, buffer, sizeof (buffer));
+    XCTAssertTrue(!strcmp (buffer, "New Title"), @"The actual output is: %s", buffer);
+    pl_delete_meta (it, "title");
+    tf_eval (&ctx, bc, buffer, sizeof (buffer));
+    XCTAssertTrue(!strcmp (buffer, "testfile"), @"The actual output is: %s", buffer);
+    tf_free (bc);
+}
+
+- (void)test_EvalTwiceWithSmallerBuffer_ReturnsTruncatedValue {
+    pl_add_meta (it, "title", "Title");
+    char *bc = tf_compile("%title%");
+    tf_eval (&ctx, bc, buffer, sizeof (buffer));
+    XCTAssertTrue(!strcmp (buffer, "Title"), @"The actual output is: %s", buffer);
+    tf_eval (&ctx, bc, buffer, 3);
+    XCTAssertTrue(!strcmp (buffer, "Ti"), @"The actual output is: %s", buffer);
+    tf_free (bc);
+}
+
+typedef struct {
+    char *bc;
+    playItem_t **items;
+    int count;
+    int errors;
+} tf_shared_eval_t;
+
+static void *
+_tf_shared_eval_thread (void *ctx) {
+    tf_shared_eval_t *e = ctx;
+    pl_lock_shared ();
+    for (int n = 0; n < 20; n++) {
+        for (int i = 0; i < e->count; i++) {
+            ddb_tf_context_t c = {
+                ._size = sizeof (ddb_tf_context_t),
+                .it = (DB_playItem_t *)e->items[i],
+            };
+            char out[100], expected[100];
+            tf_eval (&c, e->bc, out, sizeof (out));
+            snprintf (expected, sizeof (expected), "Title %d", i);
+            if (strcmp (out, expected)) {
+                e->errors++;
+            }
+        }
+    }
+    pl_unlock ();
+    return NULL;
+}
+
+- (void)test_EvalConcurrentlyUnderSharedLock_ReturnsCorrectValues {
+    const int count = 1000;
+    playItem_t *items[count];
+    for (int i = 0; i < count; i++) {
+        items[i] = pl_item_alloc_init ("testfile.flac", "stdflac");
+        char value[100];
+        snprintf (value, sizeof (value), "Title %d", i);
+        pl_add_meta (items[i], "title", value);
+    }
+    char *bc = tf_compile ("%title%");
+
+    tf_shared_eval_t e[4];
+    pthread_t tids[4];
+    for (int t = 0; t < 4; t++) {
+        e[t] = (tf_shared_eval_t){ .bc = bc, .items = items, .count = count };
+        pthread_create (&tids[t], NULL, _tf_shared_eval_thread, &e[t]);
+    }
+    for (int t = 0; t < 4; t++) {
+        pthread_join (tids[t], NULL);
+        XCTAssertEqual(e[t].errors, 0);
+    }
+
+    tf_free (bc);
+    for (int i = 0; i < count; i++) {
+        pl_item_unref (items[i]);
+    }
+}
+
+- (void)test_EvalColumnScripts_Performance {
+    static const char *scripts[] = {
+        "%artist% - %title%",
+        "$if(%album artist%,%album artist%,%artist%) - %album%",
+        "[%tracknumber%. ]%title%",
+        "%length%",
+        "%year%",
+    };
+    const int count = 5000;
+    playItem_t **items = calloc (count, sizeof (playItem_t *));
+    for (int i = 0; i < count; i++) {
+        char value[100];
+        items[i] = pl_item_alloc_init ("testfile.flac", "stdflac");
+        snprintf (value, sizeof (value), "Artist %d", i % 100);
+        pl_add_meta (items[i], "artist", value);
+        snprintf (value, sizeof (value), "Title %d", i);
+        pl_add_meta (items[i], "title", value);
+        snprintf (value, sizeof (value), "Album %d", i % 500);
+        pl_add_meta (items[i], "album", value);
+        snprintf (value, sizeof (value), "%d", i % 20 + 1);
+        pl_add_meta (items[i], "track", value);
+        pl_add_meta (items[i], "year", "2018");
+        plt_set_item_duration (NULL, items[i], 180 + i % 120);
+    }
+
+    char *bc[5];
+    for (int s = 0; s < 5; s++) {
+        bc[s] = tf_compile (scripts[s]);
+    }
+
+    // redraw a screenful of rows repeatedly, while scrolling through the list
+    [self measureBlock:^{
+        for (int n = 0; n < 1000; n++) {
+            for (int i = n / 100 * 50; i < n / 100 * 50 + 50; i++) {
+                ddb_tf_context_t c = {
+                    ._size = sizeof (ddb_tf_context_t),
+                    .it = (DB_playItem_t *)items[i],
+                };
+                char out[200];
+                for (int s = 0; s < 5; s++) {
+                    tf_eval (&c, bc[s], out, sizeof (out));
+                }
+            }
+        }
+    }];
+
+    for (int s = 0; s < 5; s++) {
+        tf_free (bc[s]);
+    }
+    for (int i = 0; i < count; i++) {
+        pl_item_unref (items[i]);
+    }
+    free (items);
+}
+
 @end
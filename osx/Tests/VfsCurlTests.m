@@ -7,13 +7,213 @@
 //
 
 #import <XCTest/XCTest.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
 #include "vfs_curl.h"
 #include "playlist.h"
 
 extern DB_functions_t *deadbeef;
 
+#define TEST_BLOCK_SIZE (256*1024) // the disk cache block size
+#define TEST_LENGTH (4*TEST_BLOCK_SIZE+1000)
+#define MAX_REQUESTS 100
+
+// A local http server, serving TEST_LENGTH bytes of test data on any path.
+// Each version of the data has its own ETag.
+static struct {
+    int fd;
+    int port;
+    pthread_t tid;
+    volatile int stop;
+    volatile int version;
+    volatile int ranges; // 0 if the server ignores the Range header, and responds with the whole content
+    volatile int accept_ranges_none;
+    pthread_mutex_t mutex;
+    int64_t requests[MAX_REQUESTS]; // the range start of each request
+    int nrequests;
+    int connections;
+} _server;
+
+static uint8_t
+_test_data (int64_t offs, int version) {
+    return (uint8_t)(offs + (offs >> 8) * 3 + (offs >> 16) * 7 + version * 101);
+}
+
+static void *
+_server_connection (void *ctx) {
+    int fd = (int)(intptr_t)ctx;
+    char req[4096];
+    size_t len = 0;
+    while (len < sizeof (req) - 1) {
+        ssize_t rb = recv (fd, req + len, sizeof (req) - 1 - len, 0);
+        if (rb <= 0) {
+            break;
+        }
+        len += rb;
+        req[len] = 0;
+        if (strstr (req, "\r\n\r\n")) {
+            break;
+        }
+    }
+    req[len] = 0;
+
+    int64_t start = 0;
+    const char *range = strstr (req, "Range: bytes=");
+    if (range) {
+        start = atoll (range + 13);
+    }
+    int version = _server.version;
+    pthread_mutex_lock (&_server.mutex);
+    if (_server.nrequests < MAX_REQUESTS) {
+        _server.requests[_server.nrequests++] = start;
+    }
+    pthread_mutex_unlock (&_server.mutex);
+
+    char hdr[500];
+    if (range && _server.ranges) {
+        snprintf (hdr, sizeof (hdr), "HTTP/1.1 206 Partial Content\r\nContent-Length: %lld\r\nContent-Range: bytes %lld-%lld/%lld\r\nETag: \"v%d\"\r\nConnection: close\r\n\r\n", (long long)(TEST_LENGTH - start), (long long)start, (long long)TEST_LENGTH - 1, (long long)TEST_LENGTH, version);
+    }
+    else {
+        start = 0;
+        snprintf (hdr, sizeof (hdr), "HTTP/1.1 200 OK\r\nContent-Length: %lld\r\nETag: \"v%d\"\r\n%sConnection: close\r\n\r\n", (long long)TEST_LENGTH, version, _server.accept_ranges_none ? "Accept-Ranges: none\r\n" : "");
+    }
+    if (send (fd, hdr, strlen (hdr), 0) == strlen (hdr)) {
+        uint8_t buf[16384];
+        for (int64_t offs = start; offs < TEST_LENGTH && !_server.stop; ) {
+            size_t size = (size_t)MIN ((int64_t)sizeof (buf), TEST_LENGTH - offs);
+            for (size_t i = 0; i < size; i++) {
+                buf[i] = _test_data (offs + i, version);
+            }
+            if (send (fd, buf, size, 0) != size) {
+                break; // the client has closed the connection
+            }
+            offs += size;
+        }
+    }
+    close (fd);
+    pthread_mutex_lock (&_server.mutex);
+    _server.connections--;
+    pthread_mutex_unlock (&_server.mutex);
+    return NULL;
+}
+
+static void *
+_server_thread (void *ctx) {
+    while (!_server.stop) {
+        struct pollfd pfd = { .fd = _server.fd, .events = POLLIN };
+        if (poll (&pfd, 1, 20) <= 0) {
+            continue;
+        }
+        int fd = accept (_server.fd, NULL, NULL);
+        if (fd < 0) {
+            continue;
+        }
+        pthread_mutex_lock (&_server.mutex);
+        _server.connections++;
+        pthread_mutex_unlock (&_server.mutex);
+        pthread_t tid;
+        pthread_create (&tid, NULL, _server_connection, (void *)(intptr_t)fd);
+        pthread_detach (tid);
+    }
+    return NULL;
+}
+
+static void
+_server_start (void) {
+    memset (&_server, 0, sizeof (_server));
+    pthread_mutex_init (&_server.mutex, NULL);
+    _server.version = 1;
+    _server.ranges = 1;
+    _server.fd = socket (AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl (INADDR_LOOPBACK) };
+    socklen_t addrlen = sizeof (addr);
+    bind (_server.fd, (struct sockaddr *)&addr, addrlen);
+    listen (_server.fd, 16);
+    getsockname (_server.fd, (struct sockaddr *)&addr, &addrlen);
+    _server.port = ntohs (addr.sin_port);
+    pthread_create (&_server.tid, NULL, _server_thread, NULL);
+}
+
+static void
+_server_stop (void) {
+    _server.stop = 1;
+    pthread_join (_server.tid, NULL);
+    close (_server.fd);
+    for (;;) {
+        pthread_mutex_lock (&_server.mutex);
+        int connections = _server.connections;
+        pthread_mutex_unlock (&_server.mutex);
+        if (!connections) {
+            break;
+        }
+        usleep (1000);
+    }
+    pthread_mutex_destroy (&_server.mutex);
+}
+
+static void
+_server_clear_requests (void) {
+    pthread_mutex_lock (&_server.mutex);
+    _server.nrequests = 0;
+    pthread_mutex_unlock (&_server.mutex);
+}
+
+// returns the number of requests which didn't start at one of the expected offsets
+static int
+_server_unexpected_requests (const int64_t *expected, int count) {
+    int unexpected = 0;
+    pthread_mutex_lock (&_server.mutex);
+    for (int i = 0; i < _server.nrequests; i++) {
+        int found = 0;
+        for (int j = 0; j < count; j++) {
+            found |= _server.requests[i] == expected[j];
+        }
+        unexpected += !found;
+    }
+    pthread_mutex_unlock (&_server.mutex);
+    return unexpected;
+}
+
+static int
+_server_has_request (int64_t start) {
+    int found = 0;
+    pthread_mutex_lock (&_server.mutex);
+    for (int i = 0; i < _server.nrequests; i++) {
+        found |= _server.requests[i] == start;
+    }
+    pthread_mutex_unlock (&_server.mutex);
+    return found;
+}
+
+// reads size bytes at the current position, returns 0 if they match the given version of the test data
+static int
+_read_and_verify (DB_vfs_t *vfs, DB_FILE *f, int64_t size, int version) {
+    int64_t offs = vfs->tell (f);
+    uint8_t buf[32768];
+    while (size > 0) {
+        size_t rb = vfs->read (buf, 1, (size_t)MIN ((int64_t)sizeof (buf), size), f);
+        if (!rb) {
+            return -1;
+        }
+        for (size_t i = 0; i < rb; i++) {
+            if (buf[i] != _test_data (offs + i, version)) {
+                return -1;
+            }
+        }
+        offs += rb;
+        size -= rb;
+    }
+    return 0;
+}
+
 @interface VfsCurlTests : XCTestCase {
     HTTP_FILE *_file;
+    DB_vfs_t *_vfs;
+    char _url[100];
 }
 
 @end
@@ -22,14 +222,39 @@ extern DB_functions_t *deadbeef;
 
 - (void)setUp {
     extern DB_plugin_t *vfs_curl_load (DB_functions_t *api);
-    vfs_curl_load (deadbeef);
+    _vfs = (DB_vfs_t *)vfs_curl_load (deadbeef);
+    _vfs->plugin.start ();
 
     _file = calloc (sizeof (HTTP_FILE), 1);
     _file->track = (DB_playItem_t *)pl_item_alloc ();
+
+    signal (SIGPIPE, SIG_IGN);
+    _server_start ();
+    snprintf (_url, sizeof (_url), "http://127.0.0.1:%d/test.mp3", _server.port);
+    deadbeef->conf_set_int ("vfs_curl.disk_cache", 1);
+    [self removeCacheEntry];
 }
 
 - (void)tearDown {
     vfs_curl_free_file(_file);
+    _vfs->plugin.stop ();
+    _server_stop ();
+    [self removeCacheEntry];
+    deadbeef->conf_set_int ("vfs_curl.disk_cache", 0);
+}
+
+- (void)removeCacheEntry {
+    // FNV-1a of the url, same as the cache entry name
+    uint64_t hash = 14695981039346656037ULL;
+    for (const char *c = _url; *c; c++) {
+        hash ^= (uint8_t)*c;
+        hash *= 1099511628211ULL;
+    }
+    char path[PATH_MAX];
+    snprintf (path, sizeof (path), "%s/vfs_curl/%016llx.idx", deadbeef->get_system_dir (DDB_SYS_DIR_CACHE), (unsigned long long)hash);
+    unlink (path);
+    snprintf (path, sizeof (path), "%s/vfs_curl/%016llx.data", deadbeef->get_system_dir (DDB_SYS_DIR_CACHE), (unsigned long long)hash);
+    unlink (path);
 }
 
 #pragma mark - In-stream headers
@@ -92,4 +317,134 @@ extern DB_functions_t *deadbeef;
     XCTAssertEqual (strcmp (title, "Title"), 0);
 }
 
+#pragma mark - Range requests
+
+- (void)test_HandleIcyHeaders_ContentLengthOfRangeRequest_LengthIncludesRangeStart {
+    char *data = "ICY 200 OK\r\nContent-Length: 500\r\nETag: \"abc\"\r\n\r\n";
+    _file->request_start = 1000;
+    vfs_curl_handle_icy_headers (strlen(data), _file, data);
+    XCTAssertEqual (_file->length, 1500);
+    XCTAssertEqual (strcmp (_file->etag, "\"abc\""), 0);
+}
+
+- (void)test_HandleIcyHeaders_AcceptRangesNone_RangesNotSupported {
+    char *data = "ICY 200 OK\r\nAccept-Ranges: none\r\n\r\n";
+    vfs_curl_handle_icy_headers (strlen(data), _file, data);
+    XCTAssertEqual (_file->no_ranges, 1);
+}
+
+#pragma mark - Disk cache
+
+- (void)test_Seek_CachedData_ServedFromDiskCache {
+    DB_FILE *f = _vfs->open (_url);
+    XCTAssertEqual (_read_and_verify (_vfs, f, TEST_LENGTH, 1), 0);
+    _vfs->close (f);
+
+    _server_clear_requests ();
+    f = _vfs->open (_url);
+    XCTAssertEqual (_read_and_verify (_vfs, f, 1000, 1), 0);
+    _vfs->seek (f, 2*TEST_BLOCK_SIZE+5, SEEK_SET);
+    XCTAssertEqual (_read_and_verify (_vfs, f, 100000, 1), 0);
+    _vfs->seek (f, 100, SEEK_SET);
+    XCTAssertEqual (_read_and_verify (_vfs, f, TEST_BLOCK_SIZE, 1), 0);
+    _vfs->close (f);
+
+    // only the initial request, the rest is read from the cache
+    int64_t expected[] = { 0 };
+    XCTAssertEqual (_server_unexpected_requests (expected, 1), 0);
+}
+
+- (void)test_Seek_PartiallyCached_ResumesAtFirstMissingBlock {
+    // the first 2 blocks get complete
+    DB_FILE *f = _vfs->open (_url);
+    XCTAssertEqual (_read_and_verify (_vfs, f, 2*TEST_BLOCK_SIZE+10000, 1), 0);
+    _vfs->close (f);
+
+    _server_clear_requests ();
+    f = _vfs->open (_url);
+    XCTAssertEqual (_read_and_verify (_vfs, f, 1000, 1), 0);
+    _vfs->seek (f, TEST_BLOCK_SIZE+100, SEEK_SET);
+    XCTAssertEqual (_read_and_verify (_vfs, f, TEST_BLOCK_SIZE+50000, 1), 0);
+    _vfs->close (f);
+
+    int64_t expected[] = { 0, 2*TEST_BLOCK_SIZE };
+    XCTAssertEqual (_server_unexpected_requests (expected, 2), 0);
+    XCTAssertTrue (_server_has_request (2*TEST_BLOCK_SIZE));
+}
+
+- (void)test_Seek_ServerIgnoresRange_ReadsFromStart {
+    deadbeef->conf_set_int ("vfs_curl.disk_cache", 0);
+    _server.ranges = 0;
+    DB_FILE *f = _vfs->open (_url);
+    XCTAssertEqual (_read_and_verify (_vfs, f, 1000, 1), 0);
+    _vfs->seek (f, 3*TEST_BLOCK_SIZE, SEEK_SET);
+    XCTAssertEqual (_read_and_verify (_vfs, f, 1000, 1), 0);
+    _vfs->close (f);
+
+    // the range request fails, and is retried from the start
+    XCTAssertTrue (_server_has_request (3*TEST_BLOCK_SIZE));
+    pthread_mutex_lock (&_server.mutex);
+    XCTAssertEqual (_server.nrequests, 3);
+    XCTAssertEqual (_server.requests[_server.nrequests-1], 0);
+    pthread_mutex_unlock (&_server.mutex);
+}
+
+- (void)test_Seek_AcceptRangesNone_ReadsFromStart {
+    deadbeef->conf_set_int ("vfs_curl.disk_cache", 0);
+    _server.ranges = 0;
+    _server.accept_ranges_none = 1;
+    DB_FILE *f = _vfs->open (_url);
+    XCTAssertEqual (_read_and_verify (_vfs, f, 1000, 1), 0);
+    _vfs->seek (f, 3*TEST_BLOCK_SIZE, SEEK_SET);
+    XCTAssertEqual (_read_and_verify (_vfs, f, 1000, 1), 0);
+    _vfs->close (f);
+
+    int64_t expected[] = { 0 };
+    XCTAssertEqual (_server_unexpected_requests (expected, 1), 0);
+}
+
+- (void)test_Seek_ResourceChanged_CacheEntryDropped {
+    DB_FILE *f = _vfs->open (_url);
+    XCTAssertEqual (_read_and_verify (_vfs, f, 2*TEST_BLOCK_SIZE+10000, 1), 0);
+    _vfs->close (f);
+
+    // the new version comes with the response to the request past the cached blocks
+    f = _vfs->open (_url);
+    XCTAssertEqual (_read_and_verify (_vfs, f, 1000, 1), 0);
+    _server.version = 2;
+    _vfs->seek (f, 3*TEST_BLOCK_SIZE, SEEK_SET);
+    XCTAssertEqual (_read_and_verify (_vfs, f, 1000, 2), 0);
+    _vfs->seek (f, TEST_BLOCK_SIZE, SEEK_SET);
+    XCTAssertEqual (_read_and_verify (_vfs, f, 1000, 2), 0);
+    _vfs->close (f);
+
+    // the stale entry is not used by the new streams
+    f = _vfs->open (_url);
+    XCTAssertEqual (_read_and_verify (_vfs, f, TEST_LENGTH, 2), 0);
+    _vfs->close (f);
+}
+
+- (void)test_Open_OtherVersionOpenInAnotherStream_EntryNotReset {
+    DB_FILE *f1 = _vfs->open (_url);
+    XCTAssertEqual (_read_and_verify (_vfs, f1, 2*TEST_BLOCK_SIZE+10000, 1), 0);
+
+    _server.version = 2;
+    DB_FILE *f2 = _vfs->open (_url);
+    XCTAssertEqual (_read_and_verify (_vfs, f2, TEST_LENGTH, 2), 0);
+    _vfs->close (f2);
+    _vfs->close (f1);
+
+    // the cached blocks of the first stream are still valid
+    _server.version = 1;
+    _server_clear_requests ();
+    f1 = _vfs->open (_url);
+    XCTAssertEqual (_read_and_verify (_vfs, f1, 1000, 1), 0);
+    _vfs->seek (f1, TEST_BLOCK_SIZE, SEEK_SET);
+    XCTAssertEqual (_read_and_verify (_vfs, f1, TEST_BLOCK_SIZE+1000, 1), 0);
+    _vfs->close (f1);
+
+    int64_t expected[] = { 0, 2*TEST_BLOCK_SIZE };
+    XCTAssertEqual (_server_unexpected_requests (expected, 2), 0);
+}
+
 @end
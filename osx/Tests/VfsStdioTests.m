@@ -0,0 +1,165 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2018 Alexey Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+#import <XCTest/XCTest.h>
+#include "deadbeef.h"
+#include "vfs.h"
+
+#define SYNTH_FILE_SIZE (16*1024*1024+123) // not a multiple of any buffer size
+
+extern DB_functions_t *deadbeef;
+
+@interface VfsStdioTests : XCTestCase {
+    DB_vfs_t *_vfs;
+    uint8_t *_data;
+    char _path[PATH_MAX];
+}
+
+@end
+
+@implementation VfsStdioTests
+
+- (void)setUp {
+    [super setUp];
+    extern DB_plugin_t *stdio_load (DB_functions_t *api);
+    _vfs = (DB_vfs_t *)stdio_load (deadbeef);
+
+    _data = malloc (SYNTH_FILE_SIZE);
+    uint32_t x = 1;
+    for (int i = 0; i < SYNTH_FILE_SIZE; i++) {
+        x = x * 1664525 + 1013904223;
+        _data[i] = x >> 24;
+    }
+    snprintf (_path, sizeof (_path), "%s/vfs_stdio_synth.bin", [NSTemporaryDirectory() UTF8String]);
+    FILE *fp = fopen (_path, "wb");
+    fwrite (_data, 1, SYNTH_FILE_SIZE, fp);
+    fclose (fp);
+}
+
+- (void)tearDown {
+    unlink (_path);
+    free (_data);
+    vfs_set_thread_usage (VFS_USAGE_DEFAULT);
+    deadbeef->conf_set_int ("vfs_stdio.buffer_size", 64);
+    [super tearDown];
+}
+
+- (int)verifyRandomAccess {
+    DB_FILE *f = _vfs->open (_path);
+    XCTAssert (f);
+    XCTAssertEqual (_vfs->getlength (f), SYNTH_FILE_SIZE);
+
+    static uint8_t buf[2*1024*1024];
+    int mismatches = 0;
+    srand (1);
+    for (int i = 0; i < 2000; i++) {
+        int64_t pos = _vfs->tell (f);
+        switch (rand () % 4) {
+        case 0:
+            pos = rand () % SYNTH_FILE_SIZE;
+            _vfs->seek (f, pos, SEEK_SET);
+            break;
+        case 1:
+            pos = MAX (0, pos - rand () % 10000);
+            _vfs->seek (f, pos - _vfs->tell (f), SEEK_CUR);
+            break;
+        case 2:
+            pos = SYNTH_FILE_SIZE - rand () % 100000;
+            _vfs->seek (f, pos - SYNTH_FILE_SIZE, SEEK_END);
+            break;
+        }
+        XCTAssertEqual (_vfs->tell (f), pos);
+
+        // mostly small reads like tag readers do, and some larger than the buffer
+        size_t size = rand () % 8 ? rand () % 4096 : rand () % sizeof (buf);
+        size_t expected = MIN (size, SYNTH_FILE_SIZE - pos);
+        size_t rb = _vfs->read (buf, 1, size, f);
+        if (rb != expected || memcmp (buf, _data + pos, rb)) {
+            mismatches++;
+        }
+    }
+    _vfs->close (f);
+    return mismatches;
+}
+
+- (void)readSequentiallyWithChunkSize:(size_t)chunk {
+    [self measureBlock:^{
+        DB_FILE *f = self->_vfs->open (self->_path);
+        uint8_t buf[chunk];
+        size_t total = 0;
+        size_t rb;
+        while ((rb = self->_vfs->read (buf, 1, chunk, f)) > 0) {
+            total += rb;
+        }
+        self->_vfs->close (f);
+        XCTAssertEqual (total, SYNTH_FILE_SIZE);
+    }];
+}
+
+- (void)test_RandomAccess_DefaultUsage_ReadsFileContents {
+    XCTAssertEqual ([self verifyRandomAccess], 0);
+}
+
+- (void)test_RandomAccess_ScanWithLargeBuffer_ReadsFileContents {
+    vfs_set_thread_usage (VFS_USAGE_SCAN);
+    deadbeef->conf_set_int ("vfs_stdio.buffer_size", 1024);
+    XCTAssertEqual ([self verifyRandomAccess], 0);
+}
+
+- (void)test_Read_ScanFileGrown_ReadsAppendedData {
+    vfs_set_thread_usage (VFS_USAGE_SCAN);
+    DB_FILE *f = _vfs->open (_path);
+    uint8_t buf[1000];
+    _vfs->seek (f, SYNTH_FILE_SIZE - 500, SEEK_SET);
+    XCTAssertEqual (_vfs->read (buf, 1, 500, f), 500);
+
+    FILE *fp = fopen (_path, "ab");
+    fwrite (_data, 1, 1000, fp);
+    fclose (fp);
+
+    XCTAssertEqual (_vfs->read (buf, 1, 1000, f), 1000);
+    XCTAssertEqual (memcmp (buf, _data, 1000), 0);
+    XCTAssertEqual (_vfs->getlength (f), SYNTH_FILE_SIZE + 1000);
+    _vfs->seek (f, 100, SEEK_SET);
+    XCTAssertEqual (_vfs->read (buf, 1, 1000, f), 1000);
+    XCTAssertEqual (memcmp (buf, _data + 100, 1000), 0);
+    _vfs->close (f);
+}
+
+- (void)test_SequentialRead_TagReadingSizedChunks_Performance {
+    [self readSequentiallyWithChunkSize:16];
+}
+
+- (void)test_SequentialRead_ScanBuffer1MB_Performance {
+    vfs_set_thread_usage (VFS_USAGE_SCAN);
+    deadbeef->conf_set_int ("vfs_stdio.buffer_size", 1024);
+    [self readSequentiallyWithChunkSize:4096];
+}
+
+- (void)test_SequentialRead_PlaybackBuffered_Performance {
+    vfs_set_thread_usage (VFS_USAGE_PLAYBACK);
+    deadbeef->conf_set_int ("vfs_stdio.buffer_size", 256);
+    [self readSequentiallyWithChunkSize:4096];
+}
+
+@end
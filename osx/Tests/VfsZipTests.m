@@ -0,0 +1,218 @@
+/*
+    DeaDBeeF -- the music player
+    Copyright (C) 2009-2018 Alexey Yakovenko and other contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty.  In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+     claim that you wrote the original software. If you use this software
+     in a product, an acknowledgment in the product documentation would be
+     appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+     misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source distribution.
+*/
+
+
+#import <XCTest/XCTest.h>
+#include <zlib.h>
+#include "deadbeef.h"
+
+#define MEMBER_SIZE (3*1024*1024+12345) // spans several inflate checkpoints
+#define CHECKPOINT_SPAN (1024*1024)
+
+extern DB_functions_t *deadbeef;
+
+static void
+_put16 (FILE *fp, uint32_t v) {
+    fputc (v & 0xff, fp);
+    fputc ((v >> 8) & 0xff, fp);
+}
+
+static void
+_put32 (FILE *fp, uint32_t v) {
+    _put16 (fp, v & 0xffff);
+    _put16 (fp, v >> 16);
+}
+
+// writes a zip with a single deflated member
+static int
+_write_zip (const char *path, const char *name, const uint8_t *data, size_t size) {
+    uLong bound = compressBound (size) + 1024;
+    uint8_t *comp = malloc (bound);
+    z_stream strm;
+    memset (&strm, 0, sizeof (strm));
+    if (deflateInit2 (&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        free (comp);
+        return -1;
+    }
+    strm.next_in = (Bytef *)data;
+    strm.avail_in = (uInt)size;
+    strm.next_out = comp;
+    strm.avail_out = (uInt)bound;
+    int res = deflate (&strm, Z_FINISH);
+    uint32_t compsize = (uint32_t)strm.total_out;
+    deflateEnd (&strm);
+    if (res != Z_STREAM_END) {
+        free (comp);
+        return -1;
+    }
+    uint32_t crc = (uint32_t)crc32 (crc32 (0, NULL, 0), data, (uInt)size);
+    uint32_t namelen = (uint32_t)strlen (name);
+
+    FILE *fp = fopen (path, "wb");
+    // local file header
+    _put32 (fp, 0x04034b50);
+    _put16 (fp, 20); // version needed
+    _put16 (fp, 0); // flags
+    _put16 (fp, 8); // deflate
+    _put16 (fp, 0); // time
+    _put16 (fp, 0x21); // date
+    _put32 (fp, crc);
+    _put32 (fp, compsize);
+    _put32 (fp, (uint32_t)size);
+    _put16 (fp, namelen);
+    _put16 (fp, 0); // extra field length
+    fwrite (name, namelen, 1, fp);
+    fwrite (comp, compsize, 1, fp);
+
+    // central directory
+    long cdoffs = ftell (fp);
+    _put32 (fp, 0x02014b50);
+    _put16 (fp, 20); // version made by
+    _put16 (fp, 20); // version needed
+    _put16 (fp, 0);
+    _put16 (fp, 8);
+    _put16 (fp, 0);
+    _put16 (fp, 0x21);
+    _put32 (fp, crc);
+    _put32 (fp, compsize);
+    _put32 (fp, (uint32_t)size);
+    _put16 (fp, namelen);
+    _put16 (fp, 0); // extra field length
+    _put16 (fp, 0); // comment length
+    _put16 (fp, 0); // disk number
+    _put16 (fp, 0); // internal attributes
+    _put32 (fp, 0); // external attributes
+    _put32 (fp, 0); // local header offset
+    fwrite (name, namelen, 1, fp);
+    long cdsize = ftell (fp) - cdoffs;
+
+    // end of central directory
+    _put32 (fp, 0x06054b50);
+    _put16 (fp, 0);
+    _put16 (fp, 0);
+    _put16 (fp, 1);
+    _put16 (fp, 1);
+    _put32 (fp, (uint32_t)cdsize);
+    _put32 (fp, (uint32_t)cdoffs);
+    _put16 (fp, 0);
+    res = fclose (fp);
+    free (comp);
+    return res;
+}
+
+@interface VfsZipTests : XCTestCase {
+    uint8_t *_data;
+    char _path[PATH_MAX];
+    char _url[PATH_MAX+100];
+}
+
+@end
+
+@implementation VfsZipTests
+
+- (void)setUp {
+    [super setUp];
+
+    // compressible, but not too well
+    _data = malloc (MEMBER_SIZE);
+    uint32_t x = 1;
+    for (int i = 0; i < MEMBER_SIZE; i++) {
+        x = x * 1664525 + 1013904223;
+        _data[i] = (x >> 28) + 'a';
+    }
+    snprintf (_path, sizeof (_path), "%s/vfs_zip_test.zip", [NSTemporaryDirectory() UTF8String]);
+    XCTAssertEqual (_write_zip (_path, "member.bin", _data, MEMBER_SIZE), 0);
+    snprintf (_url, sizeof (_url), "zip://%s:member.bin", _path);
+}
+
+- (void)tearDown {
+    unlink (_path);
+    free (_data);
+    [super tearDown];
+}
+
+- (void)test_SeekFromCheckpoint_LargeDeflatedMember_SameAsSequentialRead {
+    DB_FILE *f = deadbeef->fopen (_url);
+    XCTAssert (f);
+    if (!f) {
+        return;
+    }
+    XCTAssertEqual (deadbeef->fgetlength (f), MEMBER_SIZE);
+
+    // the sequential read saves the checkpoints
+    uint8_t *seq = malloc (MEMBER_SIZE);
+    size_t total = 0;
+    size_t rb;
+    while (total < MEMBER_SIZE && (rb = deadbeef->fread (seq + total, 1, MIN (65536, MEMBER_SIZE - total), f)) > 0) {
+        total += rb;
+    }
+    XCTAssertEqual (total, MEMBER_SIZE);
+    XCTAssertEqual (memcmp (seq, _data, MEMBER_SIZE), 0);
+
+    // backward and forward seeks around the checkpoints
+    int64_t offsets[] = { 2*CHECKPOINT_SPAN+77, CHECKPOINT_SPAN-1, CHECKPOINT_SPAN, 10, 3*CHECKPOINT_SPAN+1000, CHECKPOINT_SPAN+5, MEMBER_SIZE-5000 };
+    size_t size = 100000;
+    uint8_t *buf = malloc (size);
+    for (int i = 0; i < sizeof (offsets) / sizeof (offsets[0]); i++) {
+        int64_t offs = offsets[i];
+        XCTAssertEqual (deadbeef->fseek (f, offs, SEEK_SET), 0);
+        XCTAssertEqual (deadbeef->ftell (f), offs);
+        size_t expected = (size_t)MIN ((int64_t)size, MEMBER_SIZE - offs);
+        rb = deadbeef->fread (buf, 1, size, f);
+        XCTAssertEqual (rb, expected, @"%lld", (long long)offs);
+        XCTAssertEqual (memcmp (buf, seq + offs, expected), 0, @"%lld", (long long)offs);
+    }
+    deadbeef->fclose (f);
+
+    // a new file of the same member starts with the saved checkpoints
+    f = deadbeef->fopen (_url);
+    XCTAssertEqual (deadbeef->fseek (f, 2*CHECKPOINT_SPAN+500, SEEK_SET), 0);
+    rb = deadbeef->fread (buf, 1, size, f);
+    XCTAssertEqual (rb, size);
+    XCTAssertEqual (memcmp (buf, seq + 2*CHECKPOINT_SPAN+500, size), 0);
+    deadbeef->fclose (f);
+
+    free (buf);
+    free (seq);
+}
+
+- (void)test_Stop_FileStillOpen_ClosedAfterRestart {
+    DB_plugin_t *zip = deadbeef->plug_get_for_id ("vfs_zip");
+    DB_FILE *f = deadbeef->fopen (_url);
+    XCTAssert (f);
+    if (!f) {
+        return;
+    }
+    zip->stop ();
+    uint8_t buf[1000];
+    XCTAssertEqual (deadbeef->fread (buf, 1, sizeof (buf), f), sizeof (buf));
+    XCTAssertEqual (memcmp (buf, _data, sizeof (buf)), 0);
+    deadbeef->fclose (f);
+    zip->start ();
+
+    f = deadbeef->fopen (_url);
+    XCTAssert (f);
+    deadbeef->fclose (f);
+}
+
+@end
@@ -39,6 +39,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <assert.h>
 #include <time.h>
 #include <sys/time.h>
@@ -48,6 +49,9 @@
 #include <limits.h>
 #include <errno.h>
 #include <math.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
 #include "gettext.h"
 #include "playlist.h"
 #include "streamer.h"
@@ -92,9 +96,17 @@
 //    removed legacy data used for compat with 0.4.4
 //    note: ddb-0.5.0 should keep using 1.2 playlist format
 //    1.3 support is designed for transition to ddb-0.6.0
+// 2.0:
+//    binary format with fixed-size track records and a deduplicated string table,
+//    loaded via mmap. used for the internal playlists in $CONFIG/playlists,
+//    1.x files are migrated when they are saved next time.
+//    1.2 is still written by plt_save, e.g. when exporting .dbpl files.
 #define PLAYLIST_MAJOR_VER 1
 #define PLAYLIST_MINOR_VER 2
 
+#define PLAYLIST_BIN_MAJOR_VER 2
+#define PLAYLIST_BIN_MINOR_VER 0
+
 #if (PLAYLIST_MINOR_VER<2)
 #error writing playlists in format <1.2 is not supported
 #endif
@@ -106,8 +118,36 @@ static playlist_t *playlists_head = NULL;
 static playlist_t *playlist = NULL; // current playlist
 static int plt_loading = 0; // disable sending event about playlist switch, config regen, etc
 
+static void
+pl_autosave_init (void);
+
+static void
+pl_autosave_free (void);
+
+static void
+pl_autosave_request (void);
+
+static void
+pl_search_index_add_item (playlist_t *plt, playItem_t *it);
+
+static void
+pl_search_index_remove_item (playlist_t *plt, playItem_t *it);
+
+static void
+pl_search_index_free (playlist_t *plt);
+
 #if !DISABLE_LOCKING
-static uintptr_t mutex;
+// pl_lock state, see the comment above pl_lock
+static uintptr_t mutex; // held during pl_lock, and briefly to update lock_shared_count
+static uintptr_t lock_cond; // signalled when lock_shared_count drops to 0, and when pl_unlock lets the shared waiters in
+static int lock_shared_count; // number of threads holding the lock in shared mode
+static int lock_exclusive_waiting; // number of threads in pl_lock waiting for lock_shared_count to drop to 0
+static int lock_shared_waiting; // number of threads waiting for lock_exclusive_waiting to drop to 0
+static __thread int lock_depth; // pl_lock / plt_lock recursion depth in the current thread
+static __thread int lock_is_shared; // the current thread holds plt_lock, and not pl_lock
+
+#define PL_ITEM_LOCK_STRIPES 64
+static uintptr_t item_locks[PL_ITEM_LOCK_STRIPES];
 #endif
 
 #define LOCK {pl_lock();}
@@ -166,12 +206,19 @@ pl_init (void) {
     playlist = &dummy_playlist;
 #if !DISABLE_LOCKING
     mutex = mutex_create ();
+    lock_cond = cond_create ();
+    for (int i = 0; i < PL_ITEM_LOCK_STRIPES; i++) {
+        item_locks[i] = rwlock_create ();
+    }
 #endif
+    metacache_init ();
+    pl_autosave_init ();
     return 0;
 }
 
 void
 pl_free (void) {
+    pl_autosave_free ();
     LOCK;
     playqueue_clear ();
     plt_loading = 1;
@@ -194,7 +241,16 @@ pl_free (void) {
         mutex_free (mutex);
         mutex = 0;
     }
+    if (lock_cond) {
+        cond_free (lock_cond);
+        lock_cond = 0;
+    }
+    for (int i = 0; i < PL_ITEM_LOCK_STRIPES; i++) {
+        rwlock_free (item_locks[i]);
+        item_locks[i] = 0;
+    }
 #endif
+    metacache_free ();
     playlist = NULL;
 }
 
@@ -206,10 +262,51 @@ static pthread_t tids[1000];
 static int ntids = 0;
 pthread_t pl_lock_tid = 0;
 #endif
-void
-pl_lock (void) {
+
+// Locking.
+// pl_lock is the global lock, which protects all playlists, tracks, and the play queue.
+// It is recursive, and exclusive: only one thread can hold it at a time.
+// pl_lock_shared takes the global lock in shared mode, which only allows reading
+// the global state, e.g. the list of playlists.
+// plt_lock locks a single playlist: it takes the global lock in shared mode, plus
+// the playlist's own mutex. Threads holding plt_lock on different playlists run
+// concurrently, while pl_lock waits until all of them are done, and vice versa.
+// pl_lock is preferred: while it's waiting, new shared holders wait too, so that
+// a stream of short plt_lock calls (e.g. from the streamer) can't starve it.
+// Rules for the code running under plt_lock:
+// * only access the locked playlist and its tracks, don't nest plt_lock on different playlists.
+// * pl_lock called by such code doesn't upgrade the lock to exclusive, it only
+//   increments the recursion depth, which keeps the existing helpers usable.
+// * track metadata and refcounts, which may be shared with other threads (e.g. the
+//   playing track, or the play queue), are protected by the per-track reader/writer
+//   locks, see pl_item_rdlock.
+static void
+_pl_lock_acquire (int shared) {
 #if !DISABLE_LOCKING
-    mutex_lock (mutex);
+    if (!lock_depth) {
+        mutex_lock (mutex);
+        if (shared) {
+            while (lock_exclusive_waiting) {
+                lock_shared_waiting++;
+                cond_wait_timeout (lock_cond, mutex, -1);
+                lock_shared_waiting--;
+            }
+            lock_shared_count++;
+            mutex_unlock (mutex);
+        }
+        else {
+            // keep the mutex locked until pl_unlock
+            if (lock_shared_count) {
+                lock_exclusive_waiting++;
+                while (lock_shared_count) {
+                    cond_wait_timeout (lock_cond, mutex, -1);
+                }
+                lock_exclusive_waiting--;
+            }
+        }
+        lock_is_shared = shared;
+    }
+    lock_depth++;
 #if DETECT_PL_LOCK_RC
     pl_lock_tid = pthread_self ();
     tids[ntids++] = pl_lock_tid;
@@ -222,6 +319,11 @@ pl_lock (void) {
 #endif
 }
 
+void
+pl_lock (void) {
+    _pl_lock_acquire (0);
+}
+
 void
 pl_unlock (void) {
 #if !DISABLE_LOCKING
@@ -236,7 +338,20 @@ pl_unlock (void) {
         pl_lock_tid = 0;
     }
 #endif
-    mutex_unlock (mutex);
+    if (!--lock_depth) {
+        if (lock_is_shared) {
+            mutex_lock (mutex);
+            lock_shared_count--;
+            if (!lock_shared_count) {
+                cond_broadcast (lock_cond);
+            }
+            lock_is_shared = 0;
+        }
+        else if (lock_shared_waiting) {
+            cond_broadcast (lock_cond);
+        }
+        mutex_unlock (mutex);
+    }
 #if DEBUG_LOCKING
     pl_lock_cnt--;
     printf ("pcnt: %d\n", pl_lock_cnt);
@@ -244,6 +359,76 @@ pl_unlock (void) {
 #endif
 }
 
+void
+pl_lock_shared (void) {
+    _pl_lock_acquire (1);
+}
+
+void
+plt_lock (playlist_t *plt) {
+    _pl_lock_acquire (1);
+#if !DISABLE_LOCKING
+    if (lock_is_shared && plt->mutex) {
+        mutex_lock (plt->mutex);
+    }
+#endif
+}
+
+void
+plt_unlock (playlist_t *plt) {
+#if !DISABLE_LOCKING
+    if (lock_is_shared && plt->mutex) {
+        mutex_unlock (plt->mutex);
+    }
+#endif
+    pl_unlock ();
+}
+
+int
+pl_lock_is_shared (void) {
+#if !DISABLE_LOCKING
+    return lock_is_shared;
+#else
+    return 0;
+#endif
+}
+
+#if !DISABLE_LOCKING
+static inline uintptr_t
+_pl_item_lock_for (playItem_t *it) {
+    uintptr_t h = (uintptr_t)it;
+    h ^= h >> 12;
+    return item_locks[(h >> 5) & (PL_ITEM_LOCK_STRIPES-1)];
+}
+#endif
+
+void
+pl_item_rdlock (playItem_t *it) {
+#if !DISABLE_LOCKING
+    if (lock_is_shared) {
+        rwlock_rdlock (_pl_item_lock_for (it));
+    }
+#endif
+}
+
+void
+pl_item_wrlock (playItem_t *it) {
+#if !DISABLE_LOCKING
+    if (lock_is_shared) {
+        rwlock_wrlock (_pl_item_lock_for (it));
+    }
+#endif
+}
+
+void
+pl_item_unlock (playItem_t *it) {
+#if !DISABLE_LOCKING
+    if (lock_is_shared) {
+        rwlock_unlock (_pl_item_lock_for (it));
+    }
+#endif
+}
+
 static void
 pl_item_free (playItem_t *it);
 
@@ -362,6 +547,9 @@ plt_alloc (const char *title) {
     memset (plt, 0, sizeof (playlist_t));
     plt->refc = 1;
     plt->title = strdup (title);
+#if !DISABLE_LOCKING
+    plt->mutex = mutex_create ();
+#endif
     return plt;
 }
 
@@ -439,7 +627,7 @@ plt_remove (int plt) {
     assert (plt >= 0 && plt < playlists_count);
     LOCK;
 
-    // find playlist and notify streamer
+    // find playlist
     playlist_t *p = playlists_head;
     playlist_t *prev = NULL;
     for (i = 0; p && i < plt; i++) {
@@ -452,7 +640,6 @@ plt_remove (int plt) {
         return;
     }
 
-    streamer_notify_playlist_deleted (p);
     if (!plt_loading) {
         // move files (will decrease number of files by 1)
         for (int i = plt+1; i < playlists_count; i++) {
@@ -509,6 +696,8 @@ plt_remove (int plt) {
         }
     }
 
+    // the streamer switches to the new current playlist
+    streamer_notify_playlist_deleted (p);
     plt_unref (p);
     playlists_count--;
     UNLOCK;
@@ -632,6 +821,9 @@ plt_modified (playlist_t *plt) {
     pl_lock ();
     plt->modification_idx++;
     pl_unlock ();
+    if (!plt_loading) {
+        pl_autosave_request ();
+    }
 }
 
 int
@@ -660,6 +852,11 @@ plt_free (playlist_t *plt) {
         free (m);
     }
 
+#if !DISABLE_LOCKING
+    if (plt->mutex) {
+        mutex_free (plt->mutex);
+    }
+#endif
     free (plt);
     UNLOCK;
 }
@@ -802,6 +999,9 @@ plt_move (int from, int to) {
 void
 plt_clear (playlist_t *plt) {
     pl_lock ();
+    plt_index_invalidate (plt, PL_MAIN);
+    plt_index_invalidate (plt, PL_SEARCH);
+    pl_search_index_free (plt);
     while (plt->head[PL_MAIN]) {
         plt_remove_item (plt, plt->head[PL_MAIN]);
     }
@@ -839,8 +1039,70 @@ plt_insert_cue (playlist_t *plt, playItem_t *after, playItem_t *origin, int nums
     return NULL;
 }
 
+// Parallel folder scanning, see _plt_insert_dir_root.
+// The calling thread walks the folders in the usual order, and passes the decoder insert
+// calls and the reading of the subfolders to a pool of worker threads.
+// Each file is inserted by the decoder into a private playlist, and the resulting items are
+// moved to the target playlist in the walk order, so the order of the tracks, and the calls
+// to the callback and the file add listeners, are the same as with the serial scan.
+// Cuesheets, archives and streams are inserted by the calling thread, after all preceding files.
+
+#define PL_SCAN_DEFAULT_THREADS 4
+#define PL_SCAN_MAX_THREADS 16
+#define PL_SCAN_MAX_PENDING 256 // max number of files read ahead of the insertion point
+#define PL_SCAN_DIRS_HASH_SIZE 1024 // must be a power of 2
+
+enum {
+    PL_SCAN_JOB_FILE,
+    PL_SCAN_JOB_DIR,
+};
+
+enum {
+    PL_SCAN_JOB_QUEUED,
+    PL_SCAN_JOB_RUNNING,
+    PL_SCAN_JOB_DONE,
+};
+
+typedef struct pl_scan_job_s {
+    int type;
+    int state;
+    char *path;
+    playlist_t *plt; // file: private playlist for the decoder to insert into
+    playItem_t *inserted; // file: the item returned by the decoder
+    struct dirent **namelist; // dir: the result of scandir
+    int n;
+    struct pl_scan_job_s *queue_prev; // in the worker queue
+    struct pl_scan_job_s *queue_next;
+    struct pl_scan_job_s *next; // in pl_scan_t.files, or in a pl_scan_t.dirs bucket
+} pl_scan_job_t;
+
+typedef struct {
+    int visibility;
+    playlist_t *playlist;
+    playItem_t *after; // last item inserted into the target playlist
+    int *pabort;
+    int (*cb)(playItem_t *it, void *data);
+    void *user_data;
+
+    uintptr_t mutex;
+    uintptr_t queue_cond; // signaled when a job is queued
+    uintptr_t done_cond; // signaled when a job is done
+    int terminate;
+    pl_scan_job_t *queue_head; // jobs waiting for a worker
+    pl_scan_job_t *queue_tail;
+
+    // the following are only accessed by the walking thread
+    pl_scan_job_t *files_head; // files in the walk order, which are not in the target playlist yet
+    pl_scan_job_t *files_tail;
+    int nfiles;
+    pl_scan_job_t **dirs; // subfolders being read ahead, hashed by path
+
+    intptr_t threads[PL_SCAN_MAX_THREADS];
+    int nthreads;
+} pl_scan_t;
+
 static playItem_t *
-plt_insert_dir_int (int visibility, playlist_t *playlist, DB_vfs_t *vfs, playItem_t *after, const char *dirname, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data);
+plt_insert_dir_int (int visibility, playlist_t *playlist, DB_vfs_t *vfs, pl_scan_t *scan, playItem_t *after, const char *dirname, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data);
 
 static playItem_t *
 plt_load_int (int visibility, playlist_t *plt, playItem_t *after, const char *fname, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data);
@@ -856,8 +1118,325 @@ fileadd_filter_test (ddb_file_found_data_t *data) {
     return 0;
 }
 
+static int
+_plt_decoder_supports_file (DB_decoder_t *decoder, const char *fn, const char *ext) {
+    if (!decoder->insert) {
+        return 0;
+    }
+    if (decoder->exts) {
+        for (int e = 0; decoder->exts[e]; e++) {
+            if (!strcasecmp (decoder->exts[e], ext) || !strcmp (decoder->exts[e], "*")) {
+                return 1;
+            }
+        }
+    }
+    if (decoder->prefixes) {
+        for (int e = 0; decoder->prefixes[e]; e++) {
+            size_t l = strlen (decoder->prefixes[e]);
+            if (!strncasecmp (decoder->prefixes[e], fn, l) && fn[l] == '.') {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Tries the decoders supporting the file, until one of them inserts it.
+// fn is the file name without the path, ext is the extension without the dot.
+static playItem_t *
+_plt_insert_file_with_decoders (playlist_t *playlist, playItem_t *after, const char *fname, const char *fn, const char *ext) {
+    DB_decoder_t **decoders = plug_get_decoder_list ();
+    playItem_t *inserted = NULL;
+    int usage = vfs_set_thread_usage (VFS_USAGE_SCAN);
+    for (int i = 0; decoders[i]; i++) {
+        if (_plt_decoder_supports_file (decoders[i], fn, ext)) {
+            inserted = (playItem_t *)decoders[i]->insert ((ddb_playlist_t *)playlist, DB_PLAYITEM (after), fname);
+            if (inserted) {
+                break;
+            }
+        }
+    }
+    vfs_set_thread_usage (usage);
+    return inserted;
+}
+
+// Calls the insert callback and the file add listeners for a newly inserted file
+static void
+_plt_file_inserted (int visibility, playlist_t *playlist, playItem_t *inserted, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data) {
+    if (cb && cb (inserted, user_data) < 0 && pabort) {
+        *pabort = 1;
+    }
+    if (file_add_listeners) {
+        ddb_fileadd_data_t d;
+        memset (&d, 0, sizeof (d));
+        d.visibility = visibility;
+        d.plt = (ddb_playlist_t *)playlist;
+        d.track = (ddb_playItem_t *)inserted;
+        for (ddb_fileadd_listener_t *l = file_add_listeners; l; l = l->next) {
+            if (l->callback (&d, l->user_data) < 0) {
+                if (pabort) {
+                    *pabort = 1;
+                }
+                break;
+            }
+        }
+    }
+}
+
+static int dirent_alphasort (const struct dirent **a, const struct dirent **b) {
+    return strcmp ((*a)->d_name, (*b)->d_name);
+}
+
+static void
+_plt_scan_run_job (pl_scan_t *scan, pl_scan_job_t *job) {
+    if (scan->pabort && *scan->pabort) {
+        return;
+    }
+    if (job->type == PL_SCAN_JOB_FILE) {
+        const char *fn = strrchr (job->path, '/');
+        fn = fn ? fn + 1 : job->path;
+        const char *ext = strrchr (job->path, '.') + 1;
+        job->inserted = _plt_insert_file_with_decoders (job->plt, NULL, job->path, fn, ext);
+        if (!job->inserted) {
+            trace_err ("ERROR: could not load: %s\n", job->path);
+        }
+    }
+    else {
+        job->n = scandir (job->path, &job->namelist, NULL, dirent_alphasort);
+    }
+}
+
+// must be called with scan->mutex locked
+static void
+_plt_scan_dequeue (pl_scan_t *scan, pl_scan_job_t *job) {
+    if (job->queue_prev) {
+        job->queue_prev->queue_next = job->queue_next;
+    }
+    else {
+        scan->queue_head = job->queue_next;
+    }
+    if (job->queue_next) {
+        job->queue_next->queue_prev = job->queue_prev;
+    }
+    else {
+        scan->queue_tail = job->queue_prev;
+    }
+    job->queue_prev = job->queue_next = NULL;
+    job->state = PL_SCAN_JOB_RUNNING;
+}
+
+// Queues the job for the workers: folders go to the front, since they produce more work
+static void
+_plt_scan_enqueue (pl_scan_t *scan, pl_scan_job_t *job, int front) {
+    mutex_lock (scan->mutex);
+    job->state = PL_SCAN_JOB_QUEUED;
+    if (front) {
+        job->queue_next = scan->queue_head;
+        if (scan->queue_head) {
+            scan->queue_head->queue_prev = job;
+        }
+        else {
+            scan->queue_tail = job;
+        }
+        scan->queue_head = job;
+    }
+    else {
+        job->queue_prev = scan->queue_tail;
+        if (scan->queue_tail) {
+            scan->queue_tail->queue_next = job;
+        }
+        else {
+            scan->queue_head = job;
+        }
+        scan->queue_tail = job;
+    }
+    cond_signal (scan->queue_cond);
+    mutex_unlock (scan->mutex);
+}
+
+static void
+_plt_scan_worker (void *ctx) {
+    pl_scan_t *scan = ctx;
+    mutex_lock (scan->mutex);
+    for (;;) {
+        while (!scan->queue_head && !scan->terminate) {
+            cond_wait_timeout (scan->queue_cond, scan->mutex, -1);
+        }
+        if (scan->terminate) {
+            break;
+        }
+        pl_scan_job_t *job = scan->queue_head;
+        _plt_scan_dequeue (scan, job);
+        mutex_unlock (scan->mutex);
+        _plt_scan_run_job (scan, job);
+        mutex_lock (scan->mutex);
+        job->state = PL_SCAN_JOB_DONE;
+        cond_broadcast (scan->done_cond);
+    }
+    mutex_unlock (scan->mutex);
+}
+
+// Waits until the job is done, or runs it on the calling thread if no worker has taken it yet
+static void
+_plt_scan_wait (pl_scan_t *scan, pl_scan_job_t *job) {
+    mutex_lock (scan->mutex);
+    if (job->state == PL_SCAN_JOB_QUEUED) {
+        _plt_scan_dequeue (scan, job);
+        mutex_unlock (scan->mutex);
+        _plt_scan_run_job (scan, job);
+        mutex_lock (scan->mutex);
+        job->state = PL_SCAN_JOB_DONE;
+    }
+    while (job->state != PL_SCAN_JOB_DONE) {
+        cond_wait_timeout (scan->done_cond, scan->mutex, -1);
+    }
+    mutex_unlock (scan->mutex);
+}
+
+static void
+_plt_scan_job_free (pl_scan_job_t *job) {
+    if (job->plt) {
+        plt_free (job->plt);
+    }
+    if (job->namelist) {
+        for (int i = 0; i < job->n; i++) {
+            free (job->namelist[i]);
+        }
+        free (job->namelist);
+    }
+    free (job->path);
+    free (job);
+}
+
+// Moves the items of the finished files to the target playlist, in the walk order.
+// Waits for the files until no more than max_pending remain.
+static void
+_plt_scan_merge (pl_scan_t *scan, int max_pending) {
+    while (scan->files_head) {
+        pl_scan_job_t *job = scan->files_head;
+        if (scan->nfiles > max_pending) {
+            _plt_scan_wait (scan, job);
+        }
+        else {
+            mutex_lock (scan->mutex);
+            int done = job->state == PL_SCAN_JOB_DONE;
+            mutex_unlock (scan->mutex);
+            if (!done) {
+                break;
+            }
+        }
+
+        scan->files_head = job->next;
+        if (!scan->files_head) {
+            scan->files_tail = NULL;
+        }
+        scan->nfiles--;
+
+        if (!scan->pabort || !*scan->pabort) {
+            playItem_t *it;
+            while ((it = job->plt->head[PL_MAIN])) {
+                pl_item_ref (it);
+                plt_remove_item (job->plt, it);
+                scan->after = plt_insert_item (scan->playlist, scan->after, it);
+                pl_item_unref (it);
+            }
+            if (job->inserted) {
+                _plt_file_inserted (scan->visibility, scan->playlist, job->inserted, scan->pabort, scan->cb, scan->user_data);
+            }
+        }
+        _plt_scan_job_free (job);
+    }
+}
+
+// Inserts all pending files, and returns the item to insert after
+static playItem_t *
+_plt_scan_flush (pl_scan_t *scan) {
+    _plt_scan_merge (scan, 0);
+    return scan->after;
+}
+
+static void
+_plt_scan_add_file (pl_scan_t *scan, const char *fname) {
+    pl_scan_job_t *job = calloc (1, sizeof (pl_scan_job_t));
+    job->type = PL_SCAN_JOB_FILE;
+    job->path = strdup (fname);
+    job->plt = plt_alloc ("scan");
+    if (scan->files_tail) {
+        scan->files_tail->next = job;
+    }
+    else {
+        scan->files_head = job;
+    }
+    scan->files_tail = job;
+    scan->nfiles++;
+    _plt_scan_enqueue (scan, job, 0);
+    _plt_scan_merge (scan, PL_SCAN_MAX_PENDING);
+}
+
+static void
+_get_fullname_and_dir (char *fullname, int sz, char *dir, int dirsz, DB_vfs_t *vfs, const char *dirname, const char *d_name);
+
+static uint32_t
+_plt_scan_dir_hash (const char *path) {
+    uint32_t h = 5381;
+    for (const uint8_t *p = (const uint8_t *)path; *p; p++) {
+        h = h * 33 + *p;
+    }
+    return h & (PL_SCAN_DIRS_HASH_SIZE-1);
+}
+
+// Starts reading the subfolders of the folder, before the walk gets to them
+static void
+_plt_scan_prefetch_dirs (pl_scan_t *scan, const char *dirname, struct dirent **namelist, int n) {
+#if !defined(__MINGW32__) && !defined(__SVR4)
+    char fullname[PATH_MAX];
+    if (!scan->dirs) {
+        scan->dirs = calloc (PL_SCAN_DIRS_HASH_SIZE, sizeof (pl_scan_job_t *));
+    }
+    // queued to the front in reverse, so that they're read in the walk order
+    for (int i = n-1; i >= 0; i--) {
+        if (namelist[i]->d_type != DT_DIR || namelist[i]->d_name[0] == '.') {
+            continue;
+        }
+        _get_fullname_and_dir (fullname, sizeof (fullname), NULL, 0, NULL, dirname, namelist[i]->d_name);
+        pl_scan_job_t *job = calloc (1, sizeof (pl_scan_job_t));
+        job->type = PL_SCAN_JOB_DIR;
+        job->path = strdup (fullname);
+        job->n = -1;
+        uint32_t h = _plt_scan_dir_hash (job->path);
+        job->next = scan->dirs[h];
+        scan->dirs[h] = job;
+        _plt_scan_enqueue (scan, job, 1);
+    }
+#endif
+}
+
+// Same as scandir, using the prefetched result if available
+static int
+_plt_scan_scandir (pl_scan_t *scan, const char *dirname, struct dirent ***namelist) {
+    pl_scan_job_t *prev = NULL;
+    uint32_t h = _plt_scan_dir_hash (dirname);
+    for (pl_scan_job_t *job = scan->dirs ? scan->dirs[h] : NULL; job; prev = job, job = job->next) {
+        if (!strcmp (job->path, dirname)) {
+            if (prev) {
+                prev->next = job->next;
+            }
+            else {
+                scan->dirs[h] = job->next;
+            }
+            _plt_scan_wait (scan, job);
+            int n = job->n;
+            *namelist = job->namelist;
+            job->namelist = NULL;
+            _plt_scan_job_free (job);
+            return n;
+        }
+    }
+    return scandir (dirname, namelist, NULL, dirent_alphasort);
+}
+
 static playItem_t *
-plt_insert_file_int (int visibility, playlist_t *playlist, playItem_t *after, const char *fname, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data) {
+plt_insert_file_int (int visibility, playlist_t *playlist, pl_scan_t *scan, playItem_t *after, const char *fname, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data) {
     if (!fname || !(*fname)) {
         return NULL;
     }
@@ -868,8 +1447,14 @@ plt_insert_file_int (int visibility, playlist_t *playlist, playItem_t *after, co
         for (int i = 0; vfsplugs[i]; i++) {
             if (vfsplugs[i]->is_container) {
                 if (vfsplugs[i]->is_container (fname)) {
-                    playItem_t *it = plt_insert_dir_int (visibility, playlist, vfsplugs[i], after, fname, pabort, cb, user_data);
+                    if (scan) {
+                        after = _plt_scan_flush (scan);
+                    }
+                    playItem_t *it = plt_insert_dir_int (visibility, playlist, vfsplugs[i], NULL, after, fname, pabort, cb, user_data);
                     if (it) {
+                        if (scan) {
+                            scan->after = it;
+                        }
                         return it;
                     }
                 }
@@ -937,10 +1522,16 @@ plt_insert_file_int (int visibility, playlist_t *playlist, playItem_t *after, co
                 }
             }
 
+            if (scan) {
+                after = _plt_scan_flush (scan);
+            }
             playItem_t *it = pl_item_alloc_init (fname, NULL);
             pl_replace_meta (it, ":FILETYPE", "content");
             after = plt_insert_item (addfiles_playlist ? addfiles_playlist : playlist, after, it);
             pl_item_unref (it);
+            if (scan) {
+                scan->after = after;
+            }
             return after;
         }
     }
@@ -986,109 +1577,53 @@ plt_insert_file_int (int visibility, playlist_t *playlist, playItem_t *after, co
 
     // handle cue files
     if (!strcasecmp (eol, "cue")) {
+        if (scan) {
+            after = _plt_scan_flush (scan);
+        }
         playItem_t *inserted = plt_load_cue_file(playlist, after, fname, NULL, NULL, 0);
+        if (scan && inserted) {
+            scan->after = inserted;
+        }
         return inserted;
     }
 
-    int filter_done = 0;
     int file_recognized = 0;
-
     DB_decoder_t **decoders = plug_get_decoder_list ();
-    // match by decoder
     for (int i = 0; decoders[i]; i++) {
-        if (decoders[i]->exts && decoders[i]->insert) {
-            const char **exts = decoders[i]->exts;
-            for (int e = 0; exts[e]; e++) {
-                if (!strcasecmp (exts[e], eol) || !strcmp (exts[e], "*")) {
-                    if (!filter_done) {
-                        ddb_file_found_data_t dt;
-                        dt.filename = fname;
-                        dt.plt = (ddb_playlist_t *)playlist;
-                        dt.is_dir = 0;
-                        if (fileadd_filter_test (&dt) < 0) {
-                            return NULL;
-                        }
-                        filter_done = 1;
-                    }
-
-                    file_recognized = 1;
-
-                    playItem_t *inserted = (playItem_t *)decoders[i]->insert ((ddb_playlist_t *)playlist, DB_PLAYITEM (after), fname);
-                    if (inserted != NULL) {
-                        if (cb && cb (inserted, user_data) < 0) {
-                            *pabort = 1;
-                        }
-                        if (file_add_listeners) {
-                            ddb_fileadd_data_t d;
-                            memset (&d, 0, sizeof (d));
-                            d.visibility = visibility;
-                            d.plt = (ddb_playlist_t *)playlist;
-                            d.track = (ddb_playItem_t *)inserted;
-                            for (ddb_fileadd_listener_t *l = file_add_listeners; l; l = l->next) {
-                                if (pabort && l->callback (&d, l->user_data) < 0) {
-                                    *pabort = 1;
-                                    break;
-                                }
-                            }
-                        }
-                        return inserted;
-                    }
-                }
-            }
+        if (_plt_decoder_supports_file (decoders[i], fn, eol)) {
+            file_recognized = 1;
+            break;
         }
-        if (decoders[i]->prefixes && decoders[i]->insert) {
-            const char **prefixes = decoders[i]->prefixes;
-            for (int e = 0; prefixes[e]; e++) {
-                if (!strncasecmp (prefixes[e], fn, strlen(prefixes[e])) && *(fn + strlen (prefixes[e])) == '.') {
-                    if (!filter_done) {
-                        ddb_file_found_data_t dt;
-                        dt.filename = fname;
-                        dt.plt = (ddb_playlist_t *)playlist;
-                        dt.is_dir = 0;
-                        if (fileadd_filter_test (&dt) < 0) {
-                            return NULL;
-                        }
-                        filter_done = 1;
-                    }
+    }
+    if (!file_recognized) {
+        return NULL;
+    }
 
-                    file_recognized = 1;
-                    playItem_t *inserted = (playItem_t *)decoders[i]->insert ((ddb_playlist_t *)playlist, DB_PLAYITEM (after), fname);
-                    if (inserted != NULL) {
-                        if (cb && cb (inserted, user_data) < 0) {
-                            *pabort = 1;
-                        }
-                        if (file_add_listeners) {
-                            ddb_fileadd_data_t d;
-                            memset (&d, 0, sizeof (d));
-                            d.visibility = visibility;
-                            d.plt = (ddb_playlist_t *)playlist;
-                            d.track = (ddb_playItem_t *)inserted;
-                            for (ddb_fileadd_listener_t *l = file_add_listeners; l; l = l->next) {
-                                if (l->callback (&d, l->user_data) < 0) {
-                                    *pabort = 1;
-                                    break;
-                                }
-                            }
-                        }
-                        return inserted;
-                    }
-                }
-            }
-        }
+    ddb_file_found_data_t dt;
+    dt.filename = fname;
+    dt.plt = (ddb_playlist_t *)playlist;
+    dt.is_dir = 0;
+    if (fileadd_filter_test (&dt) < 0) {
+        return NULL;
+    }
+
+    if (scan) {
+        _plt_scan_add_file (scan, fname);
+        return scan->after;
     }
-    if (file_recognized) {
+
+    playItem_t *inserted = _plt_insert_file_with_decoders (playlist, after, fname, fn, eol);
+    if (!inserted) {
         trace_err ("ERROR: could not load: %s\n", fname);
+        return NULL;
     }
-    return NULL;
+    _plt_file_inserted (visibility, playlist, inserted, pabort, cb, user_data);
+    return inserted;
 }
 
 playItem_t *
 plt_insert_file (playlist_t *playlist, playItem_t *after, const char *fname, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data) {
-    return plt_insert_file_int (0, playlist, after, fname, pabort, cb, user_data);
-}
-
-static int dirent_alphasort (const struct dirent **a, const struct dirent **b) {
-    return strcmp ((*a)->d_name, (*b)->d_name);
+    return plt_insert_file_int (0, playlist, NULL, after, fname, pabort, cb, user_data);
 }
 
 static void
@@ -1151,7 +1686,7 @@ _get_fullname_and_dir (char *fullname, int sz, char *dir, int dirsz, DB_vfs_t *v
 }
 
 static playItem_t *
-plt_insert_dir_int (int visibility, playlist_t *playlist, DB_vfs_t *vfs, playItem_t *after, const char *dirname, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data) {
+plt_insert_dir_int (int visibility, playlist_t *playlist, DB_vfs_t *vfs, pl_scan_t *scan, playItem_t *after, const char *dirname, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data) {
     if (!strncmp (dirname, "file://", 7)) {
         dirname += 7;
     }
@@ -1208,6 +1743,9 @@ plt_insert_dir_int (int visibility, playlist_t *playlist, DB_vfs_t *vfs, playIte
         }
         #endif
     }
+    else if (scan) {
+        n = _plt_scan_scandir (scan, dirname, &namelist);
+    }
     else {
         n = scandir (dirname, &namelist, NULL, dirent_alphasort);
     }
@@ -1218,6 +1756,10 @@ plt_insert_dir_int (int visibility, playlist_t *playlist, DB_vfs_t *vfs, playIte
         return NULL;	// not a dir or no read access
     }
 
+    if (scan) {
+        _plt_scan_prefetch_dirs (scan, dirname, namelist, n);
+    }
+
     // find all cue files in the folder
     int cuefiles[n];
     int ncuefiles = 0;
@@ -1247,11 +1789,17 @@ plt_insert_dir_int (int visibility, playlist_t *playlist, DB_vfs_t *vfs, playIte
         int i = cuefiles[c];
         _get_fullname_and_dir (fullname, sizeof (fullname), fulldir, sizeof(fulldir), vfs, dirname, namelist[i]->d_name);
 
+        if (scan) {
+            after = _plt_scan_flush (scan);
+        }
         playItem_t *inserted = plt_load_cue_file (playlist, after, fullname, fulldir, namelist, n);
         namelist[i]->d_name[0] = 0;
 
         if (inserted) {
             after = inserted;
+            if (scan) {
+                scan->after = inserted;
+            }
         }
         if (pabort && *pabort) {
             break;
@@ -1269,10 +1817,10 @@ plt_insert_dir_int (int visibility, playlist_t *playlist, DB_vfs_t *vfs, playIte
             _get_fullname_and_dir (fullname, sizeof (fullname), NULL, 0, vfs, dirname, namelist[i]->d_name);
             playItem_t *inserted = NULL;
             if (!vfs) {
-                inserted = plt_insert_dir_int (visibility, playlist, vfs, after, fullname, pabort, cb, user_data);
+                inserted = plt_insert_dir_int (visibility, playlist, vfs, scan, after, fullname, pabort, cb, user_data);
             }
             if (!inserted) {
-                inserted = plt_insert_file_int (visibility, playlist, after, fullname, pabort, cb, user_data);
+                inserted = plt_insert_file_int (visibility, playlist, scan, after, fullname, pabort, cb, user_data);
             }
 
             if (inserted) {
@@ -1291,7 +1839,71 @@ plt_insert_dir_int (int visibility, playlist_t *playlist, DB_vfs_t *vfs, playIte
     }
     free (namelist);
 
-    return after;
+    return scan ? scan->after : after;
+}
+
+// Inserts the folder contents, reading the files in add_folders_threads threads
+static playItem_t *
+_plt_insert_dir_root (int visibility, playlist_t *playlist, playItem_t *after, const char *dirname, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data) {
+    int nthreads = conf_get_int ("add_folders_threads", PL_SCAN_DEFAULT_THREADS);
+    if (nthreads > PL_SCAN_MAX_THREADS) {
+        nthreads = PL_SCAN_MAX_THREADS;
+    }
+#if DISABLE_LOCKING
+    nthreads = 1;
+#else
+    // the workers need pl_lock to insert, so the parallel scan would deadlock if the caller holds it
+    if (lock_depth) {
+        nthreads = 1;
+    }
+#endif
+    if (nthreads <= 1) {
+        return plt_insert_dir_int (visibility, playlist, NULL, NULL, after, dirname, pabort, cb, user_data);
+    }
+
+    pl_scan_t scan;
+    memset (&scan, 0, sizeof (scan));
+    scan.visibility = visibility;
+    scan.playlist = playlist;
+    scan.after = after;
+    scan.pabort = pabort;
+    scan.cb = cb;
+    scan.user_data = user_data;
+    scan.mutex = mutex_create_nonrecursive ();
+    scan.queue_cond = cond_create ();
+    scan.done_cond = cond_create ();
+    for (scan.nthreads = 0; scan.nthreads < nthreads; scan.nthreads++) {
+        scan.threads[scan.nthreads] = thread_start (_plt_scan_worker, &scan);
+    }
+
+    plt_insert_dir_int (visibility, playlist, NULL, &scan, after, dirname, pabort, cb, user_data);
+    _plt_scan_flush (&scan);
+
+    mutex_lock (scan.mutex);
+    scan.terminate = 1;
+    cond_broadcast (scan.queue_cond);
+    mutex_unlock (scan.mutex);
+    for (int i = 0; i < scan.nthreads; i++) {
+        thread_join (scan.threads[i]);
+    }
+
+    // subfolders which were read ahead, but not walked, e.g. after abort
+    if (scan.dirs) {
+        for (int i = 0; i < PL_SCAN_DIRS_HASH_SIZE; i++) {
+            while (scan.dirs[i]) {
+                pl_scan_job_t *next = scan.dirs[i]->next;
+                _plt_scan_job_free (scan.dirs[i]);
+                scan.dirs[i] = next;
+            }
+        }
+        free (scan.dirs);
+    }
+
+    cond_free (scan.queue_cond);
+    cond_free (scan.done_cond);
+    mutex_free (scan.mutex);
+
+    return scan.after;
 }
 
 playItem_t *
@@ -1302,7 +1914,7 @@ plt_insert_dir (playlist_t *playlist, playItem_t *after, const char *dirname, in
     int prev = playlist->ignore_archives;
     playlist->ignore_archives = conf_get_int ("ignore_archives", 1);
 
-    playItem_t *ret = plt_insert_dir_int (0, playlist, NULL, after, dirname, pabort, cb, user_data);
+    playItem_t *ret = _plt_insert_dir_root (0, playlist, after, dirname, pabort, cb, user_data);
 
     playlist->follow_symlinks = prev_sl;
     playlist->ignore_archives = prev;
@@ -1313,7 +1925,7 @@ plt_insert_dir (playlist_t *playlist, playItem_t *after, const char *dirname, in
 static int
 plt_add_file_int (int visibility, playlist_t *plt, const char *fname, int (*cb)(playItem_t *it, void *data), void *user_data) {
     int abort = 0;
-    playItem_t *it = plt_insert_file_int (visibility, plt, plt->tail[PL_MAIN], fname, &abort, cb, user_data);
+    playItem_t *it = plt_insert_file_int (visibility, plt, NULL, plt->tail[PL_MAIN], fname, &abort, cb, user_data);
     if (it) {
         // pl_insert_file doesn't hold reference, don't unref here
         return 0;
@@ -1347,6 +1959,236 @@ pl_add_files_end (void) {
     return plt_add_files_end (addfiles_playlist, 0);
 }
 
+// Position index, maps items to their positions in playlist and back.
+// Items are stored in a list of chunks, with a cached start position for each chunk,
+// which makes lookups O(log n), and insertion / removal O(chunk size) in the typical case.
+// The index is built on first lookup, maintained by plt_insert_item / plt_remove_item,
+// and dropped by operations which relink the whole list, e.g. sorting.
+
+#define PL_INDEX_CHUNK_SIZE 256
+
+typedef struct pl_index_chunk_s {
+    struct pl_index_s *index;
+    int start; // position of the first item in the playlist
+    int pos; // position of the chunk in index->chunks
+    int count;
+    playItem_t *items[PL_INDEX_CHUNK_SIZE];
+} pl_index_chunk_t;
+
+typedef struct pl_index_s {
+    pl_index_chunk_t **chunks;
+    int count;
+    int reserved;
+    int dirty_from; // start and pos need to be recalculated for chunks starting from this one
+} pl_index_t;
+
+void
+plt_index_invalidate (playlist_t *plt, int iter) {
+    pl_index_t *index = plt->index[iter];
+    if (!index) {
+        return;
+    }
+    for (int i = 0; i < index->count; i++) {
+        pl_index_chunk_t *chunk = index->chunks[i];
+        for (int k = 0; k < chunk->count; k++) {
+            chunk->items[k]->index_chunk[iter] = NULL;
+        }
+        free (chunk);
+    }
+    free (index->chunks);
+    free (index);
+    plt->index[iter] = NULL;
+}
+
+static pl_index_chunk_t *
+pl_index_insert_chunk (pl_index_t *index, int pos) {
+    if (index->count == index->reserved) {
+        index->reserved = index->reserved ? index->reserved * 2 : 16;
+        index->chunks = realloc (index->chunks, index->reserved * sizeof (pl_index_chunk_t *));
+    }
+    pl_index_chunk_t *chunk = malloc (sizeof (pl_index_chunk_t));
+    chunk->index = index;
+    chunk->count = 0;
+    chunk->pos = pos;
+    chunk->start = 0;
+    memmove (&index->chunks[pos+1], &index->chunks[pos], (index->count - pos) * sizeof (pl_index_chunk_t *));
+    index->chunks[pos] = chunk;
+    index->count++;
+    if (pos < index->dirty_from) {
+        index->dirty_from = pos;
+    }
+    return chunk;
+}
+
+static void
+pl_index_refresh (pl_index_t *index) {
+    int start = 0;
+    if (index->dirty_from > 0) {
+        pl_index_chunk_t *prev = index->chunks[index->dirty_from-1];
+        start = prev->start + prev->count;
+    }
+    for (int i = index->dirty_from; i < index->count; i++) {
+        index->chunks[i]->pos = i;
+        index->chunks[i]->start = start;
+        start += index->chunks[i]->count;
+    }
+    index->dirty_from = index->count;
+}
+
+static pl_index_t *
+pl_index_get (playlist_t *plt, int iter) {
+    pl_index_t *index = plt->index[iter];
+    if (!index) {
+        index = plt->index[iter] = calloc (1, sizeof (pl_index_t));
+        pl_index_chunk_t *chunk = NULL;
+        for (playItem_t *it = plt->head[iter]; it; it = it->next[iter]) {
+            if (!chunk || chunk->count == PL_INDEX_CHUNK_SIZE) {
+                chunk = pl_index_insert_chunk (index, index->count);
+            }
+            it->index_chunk[iter] = chunk;
+            it->index_pos[iter] = chunk->count;
+            chunk->items[chunk->count++] = it;
+        }
+    }
+    if (index->dirty_from < index->count) {
+        pl_index_refresh (index);
+    }
+    return index;
+}
+
+static void
+pl_index_insert (playlist_t *plt, int iter, playItem_t *after, playItem_t *it) {
+    pl_index_t *index = plt->index[iter];
+    if (!index) {
+        return;
+    }
+    if (index->dirty_from < index->count) {
+        pl_index_refresh (index);
+    }
+
+    pl_index_chunk_t *chunk;
+    int pos;
+    if (!after) {
+        if (!index->count) {
+            pl_index_insert_chunk (index, 0);
+        }
+        chunk = index->chunks[0];
+        pos = 0;
+    }
+    else {
+        chunk = after->index_chunk[iter];
+        if (!chunk || chunk->index != index) {
+            // shouldn't happen, but don't crash
+            plt_index_invalidate (plt, iter);
+            return;
+        }
+        pos = after->index_pos[iter] + 1;
+    }
+
+    if (chunk->count == PL_INDEX_CHUNK_SIZE) {
+        pl_index_chunk_t *newchunk = pl_index_insert_chunk (index, chunk->pos + 1);
+        if (pos == PL_INDEX_CHUNK_SIZE) {
+            // appending after a full chunk, start a new one
+            chunk = newchunk;
+            pos = 0;
+        }
+        else {
+            // split in half
+            int half = PL_INDEX_CHUNK_SIZE / 2;
+            newchunk->count = PL_INDEX_CHUNK_SIZE - half;
+            memcpy (newchunk->items, &chunk->items[half], newchunk->count * sizeof (playItem_t *));
+            for (int i = 0; i < newchunk->count; i++) {
+                newchunk->items[i]->index_chunk[iter] = newchunk;
+                newchunk->items[i]->index_pos[iter] = i;
+            }
+            chunk->count = half;
+            if (pos > half) {
+                chunk = newchunk;
+                pos -= half;
+            }
+        }
+    }
+
+    memmove (&chunk->items[pos+1], &chunk->items[pos], (chunk->count - pos) * sizeof (playItem_t *));
+    chunk->items[pos] = it;
+    chunk->count++;
+    for (int i = pos; i < chunk->count; i++) {
+        chunk->items[i]->index_chunk[iter] = chunk;
+        chunk->items[i]->index_pos[iter] = i;
+    }
+    if (chunk->pos + 1 < index->dirty_from) {
+        index->dirty_from = chunk->pos + 1;
+    }
+}
+
+static void
+pl_index_remove (playlist_t *plt, int iter, playItem_t *it) {
+    pl_index_t *index = plt->index[iter];
+    pl_index_chunk_t *chunk = it->index_chunk[iter];
+    if (!index || !chunk || chunk->index != index) {
+        return;
+    }
+    if (index->dirty_from < index->count) {
+        pl_index_refresh (index);
+    }
+
+    int pos = it->index_pos[iter];
+    it->index_chunk[iter] = NULL;
+    chunk->count--;
+    memmove (&chunk->items[pos], &chunk->items[pos+1], (chunk->count - pos) * sizeof (playItem_t *));
+    for (int i = pos; i < chunk->count; i++) {
+        chunk->items[i]->index_pos[iter] = i;
+    }
+
+    int chunkpos = chunk->pos;
+    if (!chunk->count) {
+        memmove (&index->chunks[chunkpos], &index->chunks[chunkpos+1], (index->count - chunkpos - 1) * sizeof (pl_index_chunk_t *));
+        index->count--;
+        free (chunk);
+        if (chunkpos < index->dirty_from) {
+            index->dirty_from = chunkpos;
+        }
+    }
+    else if (chunkpos + 1 < index->dirty_from) {
+        index->dirty_from = chunkpos + 1;
+    }
+}
+
+static playItem_t *
+pl_index_get_item (playlist_t *plt, int idx, int iter) {
+    if (idx < 0 || idx >= plt->count[iter]) {
+        return NULL;
+    }
+    pl_index_t *index = pl_index_get (plt, iter);
+    int lo = 0;
+    int hi = index->count - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (index->chunks[mid]->start <= idx) {
+            lo = mid;
+        }
+        else {
+            hi = mid - 1;
+        }
+    }
+    pl_index_chunk_t *chunk = index->chunks[lo];
+    idx -= chunk->start;
+    if (idx >= chunk->count) {
+        return NULL;
+    }
+    return chunk->items[idx];
+}
+
+static int
+pl_index_get_idx (playlist_t *plt, playItem_t *it, int iter) {
+    pl_index_t *index = pl_index_get (plt, iter);
+    pl_index_chunk_t *chunk = it->index_chunk[iter];
+    if (!chunk || chunk->index != index) {
+        return -1;
+    }
+    return chunk->start + it->index_pos[iter];
+}
+
 int
 plt_remove_item (playlist_t *playlist, playItem_t *it) {
     if (!it)
@@ -1359,9 +2201,11 @@ plt_remove_item (playlist_t *playlist, playItem_t *it) {
 
     // remove from both lists
     LOCK;
+    pl_search_index_remove_item (playlist, it);
     for (int iter = PL_MAIN; iter <= PL_SEARCH; iter++) {
         if (it->prev[iter] || it->next[iter] || playlist->head[iter] == it || playlist->tail[iter] == it) {
             playlist->count[iter]--;
+            pl_index_remove (playlist, iter, it);
         }
 
         playItem_t *next = it->next[iter];
@@ -1448,14 +2292,7 @@ pl_getselcount (void) {
 playItem_t *
 plt_get_item_for_idx (playlist_t *playlist, int idx, int iter) {
     LOCK;
-    playItem_t *it = playlist->head[iter];
-    while (idx--) {
-        if (!it) {
-            UNLOCK;
-            return NULL;
-        }
-        it = it->next[iter];
-    }
+    playItem_t *it = pl_index_get_item (playlist, idx, iter);
     if (it) {
         pl_item_ref (it);
     }
@@ -1479,16 +2316,7 @@ pl_get_for_idx (int idx) {
 int
 plt_get_item_idx (playlist_t *playlist, playItem_t *it, int iter) {
     LOCK;
-    playItem_t *c = playlist->head[iter];
-    int idx = 0;
-    while (c && c != it) {
-        c = c->next[iter];
-        idx++;
-    }
-    if (!c) {
-        UNLOCK;
-        return -1;
-    }
+    int idx = pl_index_get_idx (playlist, it, iter);
     UNLOCK;
     return idx;
 }
@@ -1533,6 +2361,8 @@ plt_insert_item (playlist_t *playlist, playItem_t *after, playItem_t *it) {
         }
     }
     it->in_playlist = 1;
+    pl_index_insert (playlist, PL_MAIN, after, it);
+    pl_search_index_add_item (playlist, it);
 
     playlist->count[PL_MAIN]++;
 
@@ -1607,6 +2437,8 @@ pl_item_alloc (void) {
     memset (it, 0, sizeof (playItem_t));
     it->_duration = -1;
     it->_refc = 1;
+    // a new stamp, so that the data cached for a freed item at the same address isn't reused
+    pl_item_set_modified (it);
     return it;
 }
 
@@ -1621,7 +2453,9 @@ pl_item_alloc_init (const char *fname, const char *decoder_id) {
 void
 pl_item_ref (playItem_t *it) {
     LOCK;
+    pl_item_wrlock (it);
     it->_refc++;
+    pl_item_unlock (it);
     //fprintf (stderr, "\033[0;34m+it %p: refc=%d: %s\033[37;0m\n", it, it->_refc, pl_find_meta_raw (it, ":URI"));
     UNLOCK;
 }
@@ -1636,6 +2470,7 @@ pl_item_free (playItem_t *it) {
             it->meta = m->next;
             free (m);
         }
+        pl_meta_index_free (it);
 
         free (it);
     }
@@ -1645,13 +2480,15 @@ pl_item_free (playItem_t *it) {
 void
 pl_item_unref (playItem_t *it) {
     LOCK;
-    it->_refc--;
+    pl_item_wrlock (it);
+    int refc = --it->_refc;
+    pl_item_unlock (it);
     //trace ("\033[0;31m-it %p: refc=%d: %s\033[37;0m\n", it, it->_refc, pl_find_meta_raw (it, ":URI"));
-    if (it->_refc < 0) {
+    if (refc < 0) {
         trace ("\033[0;31mplaylist: bad refcount on item %p\033[37;0m\n", it);
         assert(0);
     }
-    if (it->_refc <= 0) {
+    if (refc <= 0) {
         //printf ("\033[0;31mdeleted %s\033[37;0m\n", pl_find_meta_raw (it, ":URI"));
         pl_item_free (it);
     }
@@ -1913,16 +2750,487 @@ plt_save (playlist_t *plt, playItem_t *first, playItem_t *last, const char *fnam
         fprintf (stderr, "playlist rename %s -> %s failed: %s\n", tempfile, fname, strerror (errno));
         return -1;
     }
-    return 0;
-save_fail:
-    UNLOCK;
-    fclose (fp);
-    unlink (tempfile);
-    return -1;
+    return 0;
+save_fail:
+    UNLOCK;
+    fclose (fp);
+    unlink (tempfile);
+    return -1;
+}
+
+// binary playlist format (2.0)
+// all numbers are in host byte order, all sections are 8-byte aligned
+//
+// header:
+//   "DBPL", u8 major, u8 minor, u16 reserved
+//   u32 track_count, u32 field_count, u32 string_count
+//   u32 plt_field_first, u32 plt_field_count, u32 reserved
+//   u64 tracks_offset, u64 fields_offset, u64 strings_offset
+// tracks: track_count * dbpl_bin_track_t
+// fields: field_count * dbpl_bin_field_t (track metadata, then playlist metadata)
+// strings: u32 offsets[string_count+1], followed by string data;
+//   string i spans offsets[i]..offsets[i+1] relative to the end of the offset table,
+//   and includes the terminating 0 (multi-value strings have embedded 0s)
+
+typedef struct {
+    char magic[4];
+    uint8_t majorver;
+    uint8_t minorver;
+    uint16_t reserved0;
+    uint32_t track_count;
+    uint32_t field_count;
+    uint32_t string_count;
+    uint32_t plt_field_first;
+    uint32_t plt_field_count;
+    uint32_t reserved1;
+    uint64_t tracks_offset;
+    uint64_t fields_offset;
+    uint64_t strings_offset;
+} dbpl_bin_header_t;
+
+#define DBPL_BIN_HAS_STARTSAMPLE64 1
+#define DBPL_BIN_HAS_ENDSAMPLE64 2
+
+typedef struct {
+    int64_t startsample;
+    int64_t endsample;
+    float duration;
+    uint32_t flags;
+    uint32_t field_first;
+    uint32_t field_count;
+    uint32_t sampleflags;
+    uint32_t reserved;
+} dbpl_bin_track_t;
+
+typedef struct {
+    uint32_t key;
+    uint32_t value;
+} dbpl_bin_field_t;
+
+// string table builder, deduplicates by metacache pointer
+typedef struct {
+    const char *str;
+    uint32_t size;
+    uint32_t idx;
+} dbpl_bin_str_t;
+
+typedef struct {
+    dbpl_bin_str_t *hash; // open addressing, keyed by pointer
+    uint32_t hash_size;
+    const dbpl_bin_str_t **list; // in index order
+    uint32_t count;
+    uint64_t datasize;
+} dbpl_bin_strtab_t;
+
+static void
+dbpl_bin_strtab_insert (dbpl_bin_strtab_t *tab, dbpl_bin_str_t *s) {
+    uint32_t idx = (uint32_t)(((uintptr_t)s->str >> 3) * 2654435761u) & (tab->hash_size - 1);
+    while (tab->hash[idx].str) {
+        idx = (idx + 1) & (tab->hash_size - 1);
+    }
+    tab->hash[idx] = *s;
+}
+
+static int
+dbpl_bin_strtab_add (dbpl_bin_strtab_t *tab, const char *str, uint32_t size, uint32_t *out_idx) {
+    if (tab->hash_size) {
+        uint32_t idx = (uint32_t)(((uintptr_t)str >> 3) * 2654435761u) & (tab->hash_size - 1);
+        while (tab->hash[idx].str) {
+            if (tab->hash[idx].str == str && tab->hash[idx].size == size) {
+                *out_idx = tab->hash[idx].idx;
+                return 0;
+            }
+            idx = (idx + 1) & (tab->hash_size - 1);
+        }
+    }
+
+    if ((tab->count + 1) * 2 > tab->hash_size) {
+        dbpl_bin_str_t *old = tab->hash;
+        uint32_t oldsize = tab->hash_size;
+        tab->hash_size = oldsize ? oldsize * 2 : 1024;
+        tab->hash = calloc (tab->hash_size, sizeof (dbpl_bin_str_t));
+        if (!tab->hash) {
+            return -1;
+        }
+        for (uint32_t i = 0; i < oldsize; i++) {
+            if (old[i].str) {
+                dbpl_bin_strtab_insert (tab, &old[i]);
+            }
+        }
+        free (old);
+    }
+
+    dbpl_bin_str_t s = { .str = str, .size = size, .idx = tab->count };
+    dbpl_bin_strtab_insert (tab, &s);
+    tab->count++;
+    tab->datasize += size;
+    *out_idx = s.idx;
+    return 0;
+}
+
+static void
+dbpl_bin_strtab_free (dbpl_bin_strtab_t *tab) {
+    free (tab->hash);
+    free (tab->list);
+}
+
+static int
+dbpl_bin_add_field (dbpl_bin_strtab_t *tab, dbpl_bin_field_t **fields, uint32_t *count, uint32_t *reserved, const char *key, const char *value, uint32_t valuesize) {
+    if (*count == *reserved) {
+        *reserved = *reserved ? *reserved * 2 : 1024;
+        dbpl_bin_field_t *newfields = realloc (*fields, *reserved * sizeof (dbpl_bin_field_t));
+        if (!newfields) {
+            return -1;
+        }
+        *fields = newfields;
+    }
+    dbpl_bin_field_t *f = &(*fields)[*count];
+    if (dbpl_bin_strtab_add (tab, key, (uint32_t)strlen (key) + 1, &f->key) < 0) {
+        return -1;
+    }
+    if (dbpl_bin_strtab_add (tab, value, valuesize, &f->value) < 0) {
+        return -1;
+    }
+    (*count)++;
+    return 0;
+}
+
+static int
+dbpl_bin_write (FILE *fp, const void *data, size_t size, uint64_t *offs) {
+    if (size && fwrite (data, 1, size, fp) != size) {
+        return -1;
+    }
+    *offs += size;
+    return 0;
+}
+
+static int
+dbpl_bin_pad (FILE *fp, uint64_t *offs) {
+    static const char zeros[8];
+    size_t pad = (8 - (*offs & 7)) & 7;
+    return dbpl_bin_write (fp, zeros, pad, offs);
+}
+
+// In-memory copy of a playlist, which can be written to disk without holding pl_lock.
+// All strings are referenced in the metacache until the snapshot is freed.
+typedef struct {
+    playlist_t *plt;
+    int modification_idx;
+    int snapshot_idx;
+    int temp_idx; // unique suffix of the temporary file name
+    dbpl_bin_track_t *tracks;
+    uint32_t track_count;
+    dbpl_bin_field_t *fields;
+    uint32_t field_count;
+    uint32_t plt_field_first;
+    dbpl_bin_strtab_t strtab;
+} dbpl_bin_snapshot_t;
+
+static int save_temp_idx;
+
+static void
+plt_bin_snapshot_free (dbpl_bin_snapshot_t *snapshot);
+
+// must be called under pl_lock
+static dbpl_bin_snapshot_t *
+plt_bin_snapshot (playlist_t *plt) {
+    dbpl_bin_snapshot_t *snapshot = calloc (1, sizeof (dbpl_bin_snapshot_t));
+    if (!snapshot) {
+        return NULL;
+    }
+    snapshot->plt = plt;
+    plt_ref (plt);
+    snapshot->modification_idx = plt->modification_idx;
+    snapshot->snapshot_idx = ++plt->save_snapshot_idx;
+    snapshot->temp_idx = ++save_temp_idx;
+
+    uint32_t fields_reserved = 0;
+    dbpl_bin_strtab_t *strtab = &snapshot->strtab;
+
+    snapshot->tracks = calloc (plt->count[PL_MAIN] ? plt->count[PL_MAIN] : 1, sizeof (dbpl_bin_track_t));
+    if (!snapshot->tracks) {
+        goto error;
+    }
+
+    for (playItem_t *it = plt->head[PL_MAIN]; it; it = it->next[PL_MAIN], snapshot->track_count++) {
+        dbpl_bin_track_t *t = &snapshot->tracks[snapshot->track_count];
+        t->startsample = it->has_startsample64 ? it->startsample64 : it->startsample;
+        t->endsample = it->has_endsample64 ? it->endsample64 : it->endsample;
+        t->sampleflags = (it->has_startsample64 ? DBPL_BIN_HAS_STARTSAMPLE64 : 0) | (it->has_endsample64 ? DBPL_BIN_HAS_ENDSAMPLE64 : 0);
+        t->duration = it->_duration;
+        t->flags = it->_flags;
+        t->field_first = snapshot->field_count;
+        for (DB_metaInfo_t *m = it->meta; m; m = m->next) {
+            if (m->key[0] == '_' || m->key[0] == '!') {
+                continue; // skip reserved names
+            }
+            if (dbpl_bin_add_field (strtab, &snapshot->fields, &snapshot->field_count, &fields_reserved, m->key, m->value, m->valuesize) < 0) {
+                goto error;
+            }
+            t->field_count++;
+        }
+    }
+
+    snapshot->plt_field_first = snapshot->field_count;
+    for (DB_metaInfo_t *m = plt->meta; m; m = m->next) {
+        if (dbpl_bin_add_field (strtab, &snapshot->fields, &snapshot->field_count, &fields_reserved, m->key, m->value, (uint32_t)strlen (m->value) + 1) < 0) {
+            goto error;
+        }
+    }
+
+    strtab->list = malloc ((strtab->count ? strtab->count : 1) * sizeof (dbpl_bin_str_t *));
+    if (!strtab->list) {
+        goto error;
+    }
+    for (uint32_t i = 0; i < strtab->hash_size; i++) {
+        if (strtab->hash[i].str) {
+            strtab->list[strtab->hash[i].idx] = &strtab->hash[i];
+            metacache_ref (strtab->hash[i].str);
+        }
+    }
+
+    return snapshot;
+error:
+    plt_bin_snapshot_free (snapshot);
+    return NULL;
+}
+
+// must be called under pl_lock
+static void
+plt_bin_snapshot_free (dbpl_bin_snapshot_t *snapshot) {
+    if (snapshot->strtab.list) {
+        for (uint32_t i = 0; i < snapshot->strtab.count; i++) {
+            metacache_remove_value (snapshot->strtab.list[i]->str, snapshot->strtab.list[i]->size);
+        }
+    }
+    dbpl_bin_strtab_free (&snapshot->strtab);
+    free (snapshot->tracks);
+    free (snapshot->fields);
+    plt_unref (snapshot->plt);
+    free (snapshot);
+}
+
+// writes the snapshot to a file, doesn't require pl_lock
+static int
+plt_bin_snapshot_write (dbpl_bin_snapshot_t *snapshot, const char *fname) {
+    dbpl_bin_strtab_t *strtab = &snapshot->strtab;
+
+    if (strtab->datasize > UINT32_MAX) {
+        return -1;
+    }
+
+    dbpl_bin_header_t hdr;
+    memset (&hdr, 0, sizeof (hdr));
+    memcpy (hdr.magic, "DBPL", 4);
+    hdr.majorver = PLAYLIST_BIN_MAJOR_VER;
+    hdr.minorver = PLAYLIST_BIN_MINOR_VER;
+    hdr.track_count = snapshot->track_count;
+    hdr.field_count = snapshot->field_count;
+    hdr.string_count = strtab->count;
+    hdr.plt_field_first = snapshot->plt_field_first;
+    hdr.plt_field_count = snapshot->field_count - snapshot->plt_field_first;
+    hdr.tracks_offset = sizeof (hdr);
+    hdr.fields_offset = hdr.tracks_offset + (uint64_t)snapshot->track_count * sizeof (dbpl_bin_track_t);
+    hdr.strings_offset = hdr.fields_offset + (uint64_t)snapshot->field_count * sizeof (dbpl_bin_field_t);
+
+    FILE *fp = fopen (fname, "w+b");
+    if (!fp) {
+        return -1;
+    }
+
+    uint64_t offs = 0;
+    if (dbpl_bin_write (fp, &hdr, sizeof (hdr), &offs) < 0
+        || dbpl_bin_write (fp, snapshot->tracks, snapshot->track_count * sizeof (dbpl_bin_track_t), &offs) < 0
+        || dbpl_bin_write (fp, snapshot->fields, snapshot->field_count * sizeof (dbpl_bin_field_t), &offs) < 0) {
+        goto save_fail;
+    }
+
+    uint32_t stroffs = 0;
+    for (uint32_t i = 0; i <= strtab->count; i++) {
+        if (dbpl_bin_write (fp, &stroffs, 4, &offs) < 0) {
+            goto save_fail;
+        }
+        if (i < strtab->count) {
+            stroffs += strtab->list[i]->size;
+        }
+    }
+    for (uint32_t i = 0; i < strtab->count; i++) {
+        if (dbpl_bin_write (fp, strtab->list[i]->str, strtab->list[i]->size, &offs) < 0) {
+            goto save_fail;
+        }
+    }
+    if (dbpl_bin_pad (fp, &offs) < 0) {
+        goto save_fail;
+    }
+
+    if (fclose (fp) != 0) {
+        unlink (fname);
+        return -1;
+    }
+    return 0;
+save_fail:
+    fclose (fp);
+    unlink (fname);
+    return -1;
+}
+
+// loads a playlist in binary format
+// the file is mapped into memory, each distinct string is added to the metacache
+// once, and the track metadata lists are built directly from the field records
+static playItem_t *
+plt_load_bin (int visibility, playlist_t *plt, playItem_t *after, const char *fname, int *pabort, int (*cb)(playItem_t *it, void *data), void *user_data) {
+    int fd = open (fname, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat (fd, &st) != 0 || st.st_size < sizeof (dbpl_bin_header_t)) {
+        close (fd);
+        return NULL;
+    }
+    size_t size = st.st_size;
+#ifndef _WIN32
+    const uint8_t *data = mmap (NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+#ifdef MADV_SEQUENTIAL
+    madvise ((void *)data, size, MADV_SEQUENTIAL);
+#endif
+#else
+    uint8_t *data = malloc (size);
+    if (!data || read (fd, data, size) != size) {
+        free (data);
+        close (fd);
+        return NULL;
+    }
+    close (fd);
+#endif
+
+    playItem_t *last_added = NULL;
+    const char **strings = NULL;
+    const uint32_t *stroffs = NULL;
+    const char *strdata = NULL;
+
+    dbpl_bin_header_t hdr;
+    memcpy (&hdr, data, sizeof (hdr));
+    if (memcmp (hdr.magic, "DBPL", 4) || hdr.majorver != PLAYLIST_BIN_MAJOR_VER) {
+        goto load_fail;
+    }
+
+    // validate layout
+    if (hdr.tracks_offset > size
+        || (size - hdr.tracks_offset) / sizeof (dbpl_bin_track_t) < hdr.track_count
+        || hdr.fields_offset > size
+        || (size - hdr.fields_offset) / sizeof (dbpl_bin_field_t) < hdr.field_count
+        || hdr.strings_offset > size
+        || (size - hdr.strings_offset) / 4 <= hdr.string_count
+        || hdr.plt_field_first > hdr.field_count
+        || hdr.field_count - hdr.plt_field_first < hdr.plt_field_count
+        || (hdr.tracks_offset | hdr.fields_offset | hdr.strings_offset) & 7) {
+        goto load_fail;
+    }
+
+    const dbpl_bin_track_t *tracks = (const dbpl_bin_track_t *)(data + hdr.tracks_offset);
+    const dbpl_bin_field_t *fields = (const dbpl_bin_field_t *)(data + hdr.fields_offset);
+    stroffs = (const uint32_t *)(data + hdr.strings_offset);
+    strdata = (const char *)(stroffs + hdr.string_count + 1);
+    size_t strdata_size = size - hdr.strings_offset - (hdr.string_count + 1) * 4;
+    if (stroffs[hdr.string_count] > strdata_size) {
+        goto load_fail;
+    }
+    for (uint32_t i = 0; i < hdr.string_count; i++) {
+        if (stroffs[i] >= stroffs[i+1] || strdata[stroffs[i+1]-1] != 0) {
+            goto load_fail;
+        }
+    }
+    for (uint32_t i = 0; i < hdr.field_count; i++) {
+        if (fields[i].key >= hdr.string_count || fields[i].value >= hdr.string_count) {
+            goto load_fail;
+        }
+    }
+
+    // metacache pointers, resolved on first use
+    strings = calloc (hdr.string_count ? hdr.string_count : 1, sizeof (const char *));
+    if (!strings) {
+        goto load_fail;
+    }
+
+#define STR_SIZE(idx) (stroffs[(idx)+1] - stroffs[idx])
+#define RESOLVE_STR(idx) (strings[idx] ? (metacache_ref (strings[idx]), strings[idx]) : (strings[idx] = metacache_add_value (strdata + stroffs[idx], STR_SIZE(idx))))
+
+    for (uint32_t i = 0; i < hdr.track_count; i++) {
+        if (pabort && *pabort) {
+            break;
+        }
+
+        const dbpl_bin_track_t *t = &tracks[i];
+        if (t->field_first > hdr.plt_field_first || hdr.plt_field_first - t->field_first < t->field_count) {
+            goto load_fail;
+        }
+
+        playItem_t *it = pl_item_alloc ();
+        it->startsample64 = t->startsample;
+        it->endsample64 = t->endsample;
+        it->startsample = t->startsample >= 0x7fffffff ? 0x7fffffff : (int32_t)t->startsample;
+        it->endsample = t->endsample >= 0x7fffffff ? 0x7fffffff : (int32_t)t->endsample;
+        it->has_startsample64 = (t->sampleflags & DBPL_BIN_HAS_STARTSAMPLE64) ? 1 : 0;
+        it->has_endsample64 = (t->sampleflags & DBPL_BIN_HAS_ENDSAMPLE64) ? 1 : 0;
+        it->_duration = t->duration;
+        it->_flags = t->flags;
+
+        DB_metaInfo_t *tail = NULL;
+        for (uint32_t f = t->field_first; f < t->field_first + t->field_count; f++) {
+            DB_metaInfo_t *m = calloc (1, sizeof (DB_metaInfo_t));
+            m->key = RESOLVE_STR(fields[f].key);
+            m->value = RESOLVE_STR(fields[f].value);
+            m->valuesize = STR_SIZE(fields[f].value);
+            if (tail) {
+                tail->next = m;
+            }
+            else {
+                it->meta = m;
+            }
+            tail = m;
+        }
+
+        plt_insert_item (plt, after, it);
+        if (last_added) {
+            pl_item_unref (last_added);
+        }
+        last_added = it;
+        after = it;
+        _plt_file_inserted (visibility, plt, it, pabort, cb, user_data);
+    }
+
+    for (uint32_t f = hdr.plt_field_first; f < hdr.plt_field_first + hdr.plt_field_count; f++) {
+        plt_add_meta (plt, strdata + stroffs[fields[f].key], strdata + stroffs[fields[f].value]);
+    }
+
+#undef RESOLVE_STR
+#undef STR_SIZE
+
+load_fail:
+    free (strings);
+#ifndef _WIN32
+    munmap ((void *)data, size);
+#else
+    free (data);
+#endif
+    if (last_added) {
+        pl_item_unref (last_added);
+    }
+    return last_added;
 }
 
-int
-plt_save_n (int n) {
+// Saves the playlist at index idx, or all playlists if idx is -1.
+// The playlists are copied under pl_lock, and written to temporary files without holding it.
+// The files are then renamed under pl_lock, using the current playlist indexes,
+// so that playlists moved or removed in the meantime end up in the right place.
+// If gen_conf is set, the playlist list in the config is updated under the same lock as the copies.
+static int
+pl_save_int (int idx, int modified_only, int gen_conf) {
     char path[PATH_MAX];
     if (snprintf (path, sizeof (path), "%s/playlists", dbconfdir) > sizeof (path)) {
         fprintf (stderr, "error: failed to make path string for playlists folder\n");
@@ -1932,64 +3240,192 @@ plt_save_n (int n) {
     mkdir (path, 0755);
 
     LOCK;
-    int err = 0;
-
-    plt_loading = 1;
-    if (snprintf (path, sizeof (path), "%s/playlists/%d.dbpl", dbconfdir, n) > sizeof (path)) {
-        fprintf (stderr, "error: failed to make path string for playlist file\n");
+    if (gen_conf) {
+        plt_gen_conf ();
+    }
+    int cnt = playlists_count;
+    if (idx >= cnt) {
         UNLOCK;
         return -1;
     }
+    if (cnt == 0) {
+        UNLOCK;
+        return 0;
+    }
+    dbpl_bin_snapshot_t **snapshots = calloc (cnt, sizeof (dbpl_bin_snapshot_t *));
+    int *results = calloc (cnt, sizeof (int));
+    int err = 0;
+    playlist_t *p = playlists_head;
+    for (int i = 0; i < cnt && p; i++, p = p->next) {
+        if (idx >= 0 && i != idx) {
+            continue;
+        }
+        if (modified_only && p->last_save_modification_idx == p->modification_idx) {
+            continue;
+        }
+        snapshots[i] = plt_bin_snapshot (p);
+        if (!snapshots[i]) {
+            err = -1;
+        }
+    }
+    UNLOCK;
 
-    int i;
-    playlist_t *plt;
-    for (i = 0, plt = playlists_head; plt && i < n; i++, plt = plt->next);
-    err = plt_save (plt, NULL, NULL, path, NULL, NULL, NULL);
-    plt_loading = 0;
+    for (int i = 0; i < cnt; i++) {
+        if (!snapshots[i]) {
+            continue;
+        }
+        snprintf (path, sizeof (path), "%s/playlists/.save%d.tmp", dbconfdir, snapshots[i]->temp_idx);
+        results[i] = plt_bin_snapshot_write (snapshots[i], path);
+        if (results[i] < 0) {
+            err = -1;
+        }
+    }
+
+    LOCK;
+    for (int i = 0; i < cnt; i++) {
+        dbpl_bin_snapshot_t *snapshot = snapshots[i];
+        if (!snapshot) {
+            continue;
+        }
+        if (!results[i]) {
+            char temp[PATH_MAX];
+            snprintf (temp, sizeof (temp), "%s/playlists/.save%d.tmp", dbconfdir, snapshot->temp_idx);
+            playlist_t *plt = snapshot->plt;
+            int n = plt_get_idx (plt);
+            if (n < 0 || snapshot->snapshot_idx <= plt->save_written_idx) {
+                // the playlist was deleted, or a newer copy was already written
+                unlink (temp);
+            }
+            else if (snprintf (path, sizeof (path), "%s/playlists/%d.dbpl", dbconfdir, n) > sizeof (path)) {
+                fprintf (stderr, "error: failed to make path string for playlist file\n");
+                unlink (temp);
+                err = -1;
+            }
+            else if (rename (temp, path) != 0) {
+                fprintf (stderr, "playlist rename %s -> %s failed: %s\n", temp, path, strerror (errno));
+                unlink (temp);
+                err = -1;
+            }
+            else {
+                plt->save_written_idx = snapshot->snapshot_idx;
+                plt->last_save_modification_idx = snapshot->modification_idx;
+            }
+        }
+        plt_bin_snapshot_free (snapshot);
+    }
     UNLOCK;
+
+    free (snapshots);
+    free (results);
     return err;
 }
 
 int
-pl_save_current (void) {
-    return plt_save_n (plt_get_curr_idx ());
+plt_save_n (int n) {
+    return pl_save_int (n, 0, 0);
 }
 
+// Synchronous, the file is written when this returns.
+// Modified playlists are also saved in background, see autosave_thread.
 int
-pl_save_all (void) {
-    char path[PATH_MAX];
-    if (snprintf (path, sizeof (path), "%s/playlists", dbconfdir) > sizeof (path)) {
-        fprintf (stderr, "error: failed to make path string for playlists folder\n");
+pl_save_current (void) {
+    int idx = plt_get_curr_idx ();
+    if (idx < 0) {
         return -1;
     }
-    // make folder
-    mkdir (path, 0755);
+    return pl_save_int (idx, 0, 0);
+}
 
-    LOCK;
-    playlist_t *p = playlists_head;
-    int i;
-    int cnt = plt_get_count ();
-    int err = 0;
+int
+pl_save_all (void) {
+    return pl_save_int (-1, 1, 1);
+}
 
-    plt_gen_conf ();
-    plt_loading = 1;
-    for (i = 0; i < cnt; i++, p = p->next) {
-        if (snprintf (path, sizeof (path), "%s/playlists/%d.dbpl", dbconfdir, i) > sizeof (path)) {
-            fprintf (stderr, "error: failed to make path string for playlist file\n");
-            err = -1;
-            break;
-        }
-        if (p->last_save_modification_idx == p->modification_idx) {
-            continue;
+// background saving
+
+#define AUTOSAVE_DELAY_MS 1000 // wait for this long after the last change
+#define AUTOSAVE_MAX_DELAY_MS 10000 // but not longer than this after the first one
+
+static intptr_t autosave_tid;
+static uintptr_t autosave_mutex;
+static uintptr_t autosave_cond;
+static int autosave_pending;
+static int autosave_terminate;
+
+static void
+autosave_thread (void *ctx) {
+    mutex_lock (autosave_mutex);
+    for (;;) {
+        while (!autosave_pending && !autosave_terminate) {
+            cond_wait_timeout (autosave_cond, autosave_mutex, -1);
+        }
+
+        // coalesce bursts of changes
+        struct timeval start;
+        gettimeofday (&start, NULL);
+        while (!autosave_terminate) {
+            autosave_pending = 0;
+            struct timeval now;
+            gettimeofday (&now, NULL);
+            int elapsed = (int)((now.tv_sec - start.tv_sec) * 1000 + (now.tv_usec - start.tv_usec) / 1000);
+            if (elapsed >= AUTOSAVE_MAX_DELAY_MS) {
+                break;
+            }
+            int res = cond_wait_timeout (autosave_cond, autosave_mutex, min (AUTOSAVE_DELAY_MS, AUTOSAVE_MAX_DELAY_MS - elapsed));
+            if (res == ETIMEDOUT && !autosave_pending) {
+                break;
+            }
         }
-        err = plt_save (p, NULL, NULL, path, NULL, NULL, NULL);
-        if (err < 0) {
-            break;
+
+        if (autosave_terminate) {
+            break; // the remaining changes are saved by pl_save_all on exit
         }
+
+        autosave_pending = 0;
+        mutex_unlock (autosave_mutex);
+        pl_save_int (-1, 1, 0);
+        mutex_lock (autosave_mutex);
     }
-    plt_loading = 0;
-    UNLOCK;
-    return err;
+    mutex_unlock (autosave_mutex);
+}
+
+static void
+pl_autosave_request (void) {
+    if (!autosave_mutex) {
+        return;
+    }
+    mutex_lock (autosave_mutex);
+    autosave_pending = 1;
+    cond_signal (autosave_cond);
+    mutex_unlock (autosave_mutex);
+}
+
+static void
+pl_autosave_init (void) {
+    autosave_mutex = mutex_create_nonrecursive ();
+    autosave_cond = cond_create ();
+    autosave_pending = 0;
+    autosave_terminate = 0;
+    autosave_tid = thread_start_low_priority (autosave_thread, NULL);
+}
+
+static void
+pl_autosave_free (void) {
+    if (!autosave_mutex) {
+        return;
+    }
+    mutex_lock (autosave_mutex);
+    autosave_terminate = 1;
+    cond_signal (autosave_cond);
+    mutex_unlock (autosave_mutex);
+    if (autosave_tid) {
+        thread_join (autosave_tid);
+        autosave_tid = 0;
+    }
+    cond_free (autosave_cond);
+    autosave_cond = 0;
+    mutex_free (autosave_mutex);
+    autosave_mutex = 0;
 }
 
 static playItem_t *
@@ -2044,6 +3480,10 @@ plt_load_int (int visibility, playlist_t *plt, playItem_t *after, const char *fn
     if (fread (&majorver, 1, 1, fp) != 1) {
         goto load_fail;
     }
+    if (majorver == PLAYLIST_BIN_MAJOR_VER) {
+        fclose (fp);
+        return plt_load_bin (visibility, plt, after, fname, pabort, cb, user_data);
+    }
     if (majorver != PLAYLIST_MAJOR_VER) {
 //        trace ("bad majorver=%d\n", majorver);
         goto load_fail;
@@ -3293,10 +4733,7 @@ plt_copy_items (playlist_t *to, int iter, playlist_t *from, playItem_t *before,
 
     playItem_t **items = malloc (cnt * sizeof(playItem_t *));
     for (int i = 0; i < cnt; i++) {
-        playItem_t *it = from->head[iter];
-        for (int idx = 0; it && idx < indices[i]; idx++) {
-            it = it->next[iter];
-        }
+        playItem_t *it = pl_index_get_item (from, indices[i], iter);
         items[i] = it;
         if (!it) {
             trace ("plt_copy_items: warning: item %d not found in source plt_to\n", indices[i]);
@@ -3320,6 +4757,7 @@ plt_copy_items (playlist_t *to, int iter, playlist_t *from, playItem_t *before,
 static void
 plt_search_reset_int (playlist_t *playlist, int clear_selection) {
     LOCK;
+    plt_index_invalidate (playlist, PL_SEARCH);
     while (playlist->head[PL_SEARCH]) {
         playItem_t *next = playlist->head[PL_SEARCH]->next[PL_SEARCH];
         if (clear_selection) {
@@ -3341,6 +4779,7 @@ plt_search_reset (playlist_t *playlist) {
 
 static void
 _plsearch_append (playlist_t *plt, playItem_t *it, int select_results) {
+    pl_index_insert (plt, PL_SEARCH, plt->tail[PL_SEARCH], it);
     it->next[PL_SEARCH] = NULL;
     it->prev[PL_SEARCH] = plt->tail[PL_SEARCH];
     if (plt->tail[PL_SEARCH]) {
@@ -3356,9 +4795,415 @@ _plsearch_append (playlist_t *plt, playItem_t *it, int select_results) {
     plt->count[PL_SEARCH]++;
 }
 
+// Search index.
+// Maps trigrams of the searchable metadata values to the values which contain them,
+// so that plt_search_process2 only needs to verify the values which can match the query,
+// instead of every value in the playlist.
+// Values are normalized the same way utfcasestr_fast compares them: each character
+// is replaced with the first character of its lowercase form. Since UTF-8 is self-synchronizing,
+// the query matches a value exactly when the normalized value contains the query bytes.
+// The index is built on the first search in a large playlist, tracks are added on insertion,
+// and re-added at the next search after their metadata changes (playItem_t.search_dirty).
+// Removed tracks leave stale entries behind, which only produce extra candidates, and the
+// index is rebuilt when there are too many of them.
+// Memory use is roughly 100 bytes per distinct value.
+
+#define PL_SEARCH_INDEX_MIN_ITEMS 1000
+
+typedef struct {
+    const char *value; // metacache value, referenced by the index
+    int valuesize;
+    int is_uri; // only the file name part is searchable
+} pl_search_value_t;
+
+typedef struct {
+    uint32_t trigram; // 0 for empty slots
+    uint32_t count;
+    uint32_t reserved;
+    uint32_t *values; // ascending value ids
+} pl_search_trigram_t;
+
+typedef struct {
+    playItem_t *it; // NULL if removed
+    uint32_t first; // range in item_values
+    uint32_t count;
+} pl_search_item_t;
+
+typedef struct pl_search_index_s {
+    pl_search_value_t *values;
+    uint32_t values_count;
+    uint32_t values_reserved;
+
+    uint32_t *value_hash; // value -> value id + 1, open addressing
+    uint32_t value_hash_size; // power of 2
+
+    pl_search_trigram_t *trigrams; // open addressing
+    uint32_t trigrams_count;
+    uint32_t trigrams_size; // power of 2
+
+    pl_search_item_t *items; // indexed by playItem_t.search_slot - 1
+    uint32_t items_count;
+    uint32_t items_reserved;
+    uint32_t items_removed;
+
+    uint32_t *item_values;
+    uint32_t item_values_count;
+    uint32_t item_values_reserved;
+} pl_search_index_t;
+
+// Returns 1 if the field is searchable, 0 if it should be skipped,
+// or -1 if the rest of the fields should be skipped.
+static int
+_plsearch_field_type (DB_metaInfo_t *m, int *is_uri) {
+    *is_uri = !strcmp (m->key, ":URI");
+    if ((m->key[0] == ':' && !*is_uri) || m->key[0] == '_' || m->key[0] == '!') {
+        return -1;
+    }
+    if (!strcasecmp(m->key, "cuesheet") || !strcasecmp (m->key, "log")) {
+        return 0;
+    }
+    return 1;
+}
+
+static const char *
+_plsearch_value_start (const char *value, int is_uri) {
+    if (is_uri) {
+        const char *slash = strrchr (value, '/');
+        if (slash) {
+            return slash + 1;
+        }
+    }
+    return value;
+}
+
+static void *
+_plsearch_grow (void *array, uint32_t *reserved, uint32_t count, size_t elemsize) {
+    if (count < *reserved) {
+        return array;
+    }
+    *reserved = *reserved ? *reserved * 2 : 16;
+    return realloc (array, *reserved * elemsize);
+}
+
+static pl_search_trigram_t *
+_plsearch_trigram_find (pl_search_index_t *index, uint32_t trigram) {
+    if (!index->trigrams_size) {
+        return NULL;
+    }
+    uint32_t idx = (trigram * 2654435761u) & (index->trigrams_size-1);
+    while (index->trigrams[idx].trigram) {
+        if (index->trigrams[idx].trigram == trigram) {
+            return &index->trigrams[idx];
+        }
+        idx = (idx + 1) & (index->trigrams_size-1);
+    }
+    return NULL;
+}
+
+static pl_search_trigram_t *
+_plsearch_trigram_get (pl_search_index_t *index, uint32_t trigram) {
+    pl_search_trigram_t *t = _plsearch_trigram_find (index, trigram);
+    if (t) {
+        return t;
+    }
+    // keep load factor under 1/2
+    if ((index->trigrams_count + 1) * 2 > index->trigrams_size) {
+        uint32_t oldsize = index->trigrams_size;
+        pl_search_trigram_t *old = index->trigrams;
+        index->trigrams_size = oldsize ? oldsize * 2 : 4096;
+        index->trigrams = calloc (index->trigrams_size, sizeof (pl_search_trigram_t));
+        for (uint32_t i = 0; i < oldsize; i++) {
+            if (old[i].trigram) {
+                uint32_t idx = (old[i].trigram * 2654435761u) & (index->trigrams_size-1);
+                while (index->trigrams[idx].trigram) {
+                    idx = (idx + 1) & (index->trigrams_size-1);
+                }
+                index->trigrams[idx] = old[i];
+            }
+        }
+        free (old);
+    }
+    uint32_t idx = (trigram * 2654435761u) & (index->trigrams_size-1);
+    while (index->trigrams[idx].trigram) {
+        idx = (idx + 1) & (index->trigrams_size-1);
+    }
+    index->trigrams[idx].trigram = trigram;
+    index->trigrams_count++;
+    return &index->trigrams[idx];
+}
+
+// Adds trigrams of a single (not multi-value) string
+static void
+_plsearch_index_string (pl_search_index_t *index, uint32_t value_id, const char *str, int len) {
+    if (!u8_valid (str, len, NULL)) {
+        return; // can't match, see plt_search_process2
+    }
+
+    // normalize
+    char stackbuf[1024];
+    char *norm = len < sizeof (stackbuf) / 4 ? stackbuf : malloc (len * 4 + 1);
+    int normlen = 0;
+    const char *p = str;
+    while (*p) {
+        int32_t i = 0;
+        char lw[10];
+        u8_nextchar (p, &i);
+        u8_tolower ((const int8_t *)p, i, lw);
+        int32_t l = 0;
+        u8_nextchar (lw, &l);
+        memcpy (norm + normlen, lw, l);
+        normlen += l;
+        p += i;
+    }
+
+    for (int i = 0; i + 2 < normlen; i++) {
+        uint32_t trigram = (uint8_t)norm[i] | ((uint8_t)norm[i+1] << 8) | ((uint32_t)(uint8_t)norm[i+2] << 16);
+        pl_search_trigram_t *t = _plsearch_trigram_get (index, trigram);
+        if (t->count && t->values[t->count-1] == value_id) {
+            continue; // the value has this trigram already
+        }
+        t->values = _plsearch_grow (t->values, &t->reserved, t->count, sizeof (uint32_t));
+        t->values[t->count++] = value_id;
+    }
+
+    if (norm != stackbuf) {
+        free (norm);
+    }
+}
+
+static uint32_t
+_plsearch_index_value (pl_search_index_t *index, const char *value, int valuesize, int is_uri) {
+    uintptr_t key = (uintptr_t)value + is_uri;
+    if (index->value_hash_size) {
+        uint32_t idx = (uint32_t)((key >> 3) * 2654435761u) & (index->value_hash_size-1);
+        while (index->value_hash[idx]) {
+            pl_search_value_t *v = &index->values[index->value_hash[idx]-1];
+            if ((uintptr_t)v->value + v->is_uri == key) {
+                return index->value_hash[idx]-1;
+            }
+            idx = (idx + 1) & (index->value_hash_size-1);
+        }
+    }
+
+    uint32_t value_id = index->values_count;
+    index->values = _plsearch_grow (index->values, &index->values_reserved, index->values_count, sizeof (pl_search_value_t));
+    pl_search_value_t *v = &index->values[index->values_count++];
+    v->value = value;
+    v->valuesize = valuesize;
+    v->is_uri = is_uri;
+    metacache_ref (value);
+
+    // keep load factor under 1/2
+    if (index->values_count * 2 > index->value_hash_size) {
+        free (index->value_hash);
+        index->value_hash_size = index->value_hash_size ? index->value_hash_size * 2 : 4096;
+        index->value_hash = calloc (index->value_hash_size, sizeof (uint32_t));
+        for (uint32_t i = 0; i < index->values_count; i++) {
+            uintptr_t k = (uintptr_t)index->values[i].value + index->values[i].is_uri;
+            uint32_t idx = (uint32_t)((k >> 3) * 2654435761u) & (index->value_hash_size-1);
+            while (index->value_hash[idx]) {
+                idx = (idx + 1) & (index->value_hash_size-1);
+            }
+            index->value_hash[idx] = i + 1;
+        }
+    }
+    else {
+        uint32_t idx = (uint32_t)((key >> 3) * 2654435761u) & (index->value_hash_size-1);
+        while (index->value_hash[idx]) {
+            idx = (idx + 1) & (index->value_hash_size-1);
+        }
+        index->value_hash[idx] = value_id + 1;
+    }
+
+    const char *end = value + valuesize;
+    const char *s = _plsearch_value_start (value, is_uri);
+    while (s < end) {
+        int len = (int)strlen (s);
+        _plsearch_index_string (index, value_id, s, len);
+        s += len + 1;
+    }
+
+    return value_id;
+}
+
+static void
+pl_search_index_remove_item (playlist_t *plt, playItem_t *it) {
+    pl_search_index_t *index = plt->search_index;
+    if (!index || !it->search_slot) {
+        return;
+    }
+    index->items[it->search_slot-1].it = NULL;
+    index->items_removed++;
+    it->search_slot = 0;
+}
+
+static void
+pl_search_index_add_item (playlist_t *plt, playItem_t *it) {
+    pl_search_index_t *index = plt->search_index;
+    if (!index) {
+        return;
+    }
+    pl_search_index_remove_item (plt, it);
+
+    index->items = _plsearch_grow (index->items, &index->items_reserved, index->items_count, sizeof (pl_search_item_t));
+    pl_search_item_t *item = &index->items[index->items_count++];
+    item->it = it;
+    item->first = index->item_values_count;
+    for (DB_metaInfo_t *m = it->meta; m; m = m->next) {
+        int is_uri;
+        int type = _plsearch_field_type (m, &is_uri);
+        if (type < 0) {
+            break;
+        }
+        if (type == 0 || !m->value) {
+            continue;
+        }
+        uint32_t value_id = _plsearch_index_value (index, m->value, m->valuesize, is_uri);
+        index->item_values = _plsearch_grow (index->item_values, &index->item_values_reserved, index->item_values_count, sizeof (uint32_t));
+        index->item_values[index->item_values_count++] = value_id;
+    }
+    item->count = index->item_values_count - item->first;
+    it->search_slot = index->items_count;
+    it->search_dirty = 0;
+}
+
+static void
+pl_search_index_free (playlist_t *plt) {
+    pl_search_index_t *index = plt->search_index;
+    if (!index) {
+        return;
+    }
+    for (uint32_t i = 0; i < index->items_count; i++) {
+        if (index->items[i].it) {
+            index->items[i].it->search_slot = 0;
+        }
+    }
+    for (uint32_t i = 0; i < index->values_count; i++) {
+        metacache_remove_value (index->values[i].value, index->values[i].valuesize);
+    }
+    for (uint32_t i = 0; i < index->trigrams_size; i++) {
+        free (index->trigrams[i].values);
+    }
+    free (index->values);
+    free (index->value_hash);
+    free (index->trigrams);
+    free (index->items);
+    free (index->item_values);
+    free (index);
+    plt->search_index = NULL;
+}
+
+static void
+pl_search_index_update (playlist_t *plt) {
+    pl_search_index_t *index = plt->search_index;
+    if (index && index->items_removed > index->items_count / 2) {
+        pl_search_index_free (plt);
+        index = NULL;
+    }
+    if (!index) {
+        plt->search_index = calloc (1, sizeof (pl_search_index_t));
+    }
+    for (playItem_t *it = plt->head[PL_MAIN]; it; it = it->next[PL_MAIN]) {
+        if (!it->search_slot || it->search_dirty) {
+            pl_search_index_add_item (plt, it);
+        }
+    }
+}
+
+static int
+_plsearch_cmp_trigram_count (const void *a, const void *b) {
+    const pl_search_trigram_t *ta = *(const pl_search_trigram_t **)a;
+    const pl_search_trigram_t *tb = *(const pl_search_trigram_t **)b;
+    return ta->count < tb->count ? -1 : ta->count > tb->count;
+}
+
+// Returns a newly allocated array of the value ids containing all trigrams of the query
+static uint32_t *
+_plsearch_candidates (pl_search_index_t *index, const char *lc, int *count) {
+    int len = (int)strlen (lc);
+    int ntrigrams = 0;
+    pl_search_trigram_t **trigrams = malloc ((len - 2) * sizeof (pl_search_trigram_t *));
+    for (int i = 0; i + 2 < len; i++) {
+        uint32_t trigram = (uint8_t)lc[i] | ((uint8_t)lc[i+1] << 8) | ((uint32_t)(uint8_t)lc[i+2] << 16);
+        pl_search_trigram_t *t = _plsearch_trigram_find (index, trigram);
+        if (!t) {
+            free (trigrams);
+            *count = 0;
+            return NULL;
+        }
+        trigrams[ntrigrams++] = t;
+    }
+
+    // intersect, starting from the rarest trigram
+    qsort (trigrams, ntrigrams, sizeof (pl_search_trigram_t *), _plsearch_cmp_trigram_count);
+    uint32_t *candidates = malloc (trigrams[0]->count * sizeof (uint32_t));
+    memcpy (candidates, trigrams[0]->values, trigrams[0]->count * sizeof (uint32_t));
+    int n = trigrams[0]->count;
+    for (int t = 1; t < ntrigrams && n > 0; t++) {
+        const uint32_t *values = trigrams[t]->values;
+        uint32_t nvalues = trigrams[t]->count;
+        uint32_t k = 0;
+        int out = 0;
+        for (int i = 0; i < n; i++) {
+            while (k < nvalues && values[k] < candidates[i]) {
+                k++;
+            }
+            if (k == nvalues) {
+                break;
+            }
+            if (values[k] == candidates[i]) {
+                candidates[out++] = candidates[i];
+            }
+        }
+        n = out;
+    }
+    free (trigrams);
+    *count = n;
+    return candidates;
+}
+
+static int
+_plsearch_value_matches (const char *value, int valuesize, int is_uri, const char *lc) {
+    const char *end = value + valuesize;
+    const char *s = _plsearch_value_start (value, is_uri);
+    do {
+        int len = (int)strlen (s);
+        if (u8_valid (s, len, NULL) && utfcasestr_fast (s, lc)) {
+            return 1;
+        }
+        s += len + 1;
+    } while (s < end);
+    return 0;
+}
+
+// Search results are cached in the metacache strings, which are shared by all playlists,
+// so each search gets its own index, including concurrent searches in different playlists.
+// Searches only hold the shared pl_lock, so the cmpidx byte in front of the string
+// can be overwritten by a concurrent search at any time: it's accessed atomically,
+// and a lost write only means the string gets compared again.
+// Two concurrent searches could only get the same index if 127 other searches started
+// in between.
+static int search_cmpidx;
+
+static int
+plt_search_next_cmpidx (void) {
+#if !DISABLE_LOCKING
+    mutex_lock (mutex);
+#endif
+    search_cmpidx++;
+    if (search_cmpidx > 127) {
+        search_cmpidx = 1;
+    }
+    int cmpidx = search_cmpidx;
+#if !DISABLE_LOCKING
+    mutex_unlock (mutex);
+#endif
+    return cmpidx;
+}
+
 void
 plt_search_process2 (playlist_t *playlist, const char *text, int select_results) {
-    LOCK;
+    plt_lock (playlist);
     plt_search_reset_int (playlist, select_results);
 
     // convert text to lowercase, to save some cycles
@@ -3383,9 +5228,37 @@ plt_search_process2 (playlist_t *playlist, const char *text, int select_results)
 
     int lc_is_valid_u8 = u8_valid (lc, (int)strlen (lc), NULL);
 
-    playlist->search_cmpidx++;
-    if (playlist->search_cmpidx > 127) {
-        playlist->search_cmpidx = 1;
+    playlist->search_cmpidx = plt_search_next_cmpidx ();
+
+    if (*text && lc_is_valid_u8 && strlen (lc) >= 3 && playlist->count[PL_MAIN] >= PL_SEARCH_INDEX_MIN_ITEMS) {
+        pl_search_index_update (playlist);
+        pl_search_index_t *index = playlist->search_index;
+
+        // verify the candidates
+        int ncandidates;
+        uint32_t *candidates = _plsearch_candidates (index, lc, &ncandidates);
+        uint8_t *matches = calloc (index->values_count + 1, 1);
+        for (int i = 0; i < ncandidates; i++) {
+            pl_search_value_t *v = &index->values[candidates[i]];
+            matches[candidates[i]] = _plsearch_value_matches (v->value, v->valuesize, v->is_uri, lc);
+        }
+        free (candidates);
+
+        for (playItem_t *it = playlist->head[PL_MAIN]; it; it = it->next[PL_MAIN]) {
+            if (select_results) {
+                pl_set_selected_in_playlist(playlist, it, 0);
+            }
+            pl_search_item_t *item = &index->items[it->search_slot-1];
+            for (uint32_t i = 0; i < item->count; i++) {
+                if (matches[index->item_values[item->first + i]]) {
+                    _plsearch_append (playlist, it, select_results);
+                    break;
+                }
+            }
+        }
+        free (matches);
+        plt_unlock (playlist);
+        return;
     }
 
     for (playItem_t *it = playlist->head[PL_MAIN]; it; it = it->next[PL_MAIN]) {
@@ -3395,28 +5268,17 @@ plt_search_process2 (playlist_t *playlist, const char *text, int select_results)
         if (*text) {
             DB_metaInfo_t *m = NULL;
             for (m = it->meta; m; m = m->next) {
-                int is_uri = !strcmp (m->key, ":URI");
-                if ((m->key[0] == ':' && !is_uri) || m->key[0] == '_' || m->key[0] == '!') {
+                int is_uri;
+                int type = _plsearch_field_type (m, &is_uri);
+                if (type < 0) {
                     break;
                 }
-                if (!strcasecmp(m->key, "cuesheet") || !strcasecmp (m->key, "log")) {
+                if (type == 0) {
                     continue;
                 }
 
-                const char *value = m->value;
-                const char *end = value + m->valuesize;
-
-                if (is_uri) {
-                    value = strrchr (value, '/');
-                    if (value) {
-                        value++;
-                    }
-                    else {
-                        value = m->value;
-                    }
-                }
-
-                char cmp = *(m->value-1);
+                char *pcmp = (char *)m->value-1;
+                char cmp = __atomic_load_n (pcmp, __ATOMIC_RELAXED);
 
                 if (abs (cmp) == playlist->search_cmpidx) { // string was already compared in this search
                     if (cmp > 0) { // it's a match -- append to search results
@@ -3426,16 +5288,11 @@ plt_search_process2 (playlist_t *playlist, const char *text, int select_results)
                 }
                 else {
                     int match = -playlist->search_cmpidx; // assume no match
-                    do {
-                        int len = (int)strlen(value);
-                        if (lc_is_valid_u8 && u8_valid(value, len, NULL) && utfcasestr_fast (value, lc)) {
-                            _plsearch_append (playlist, it, select_results);
-                            match = playlist->search_cmpidx; // it's a match
-                            break;
-                        }
-                        value += len+1;
-                    } while (value < end);
-                    *((char *)m->value-1) = match;
+                    if (lc_is_valid_u8 && _plsearch_value_matches (m->value, m->valuesize, is_uri, lc)) {
+                        _plsearch_append (playlist, it, select_results);
+                        match = playlist->search_cmpidx; // it's a match
+                    }
+                    __atomic_store_n (pcmp, (char)match, __ATOMIC_RELAXED);
                     if (match > 0) {
                         break;
                     }
@@ -3443,7 +5300,7 @@ plt_search_process2 (playlist_t *playlist, const char *text, int select_results)
             }
         }
     }
-    UNLOCK;
+    plt_unlock (playlist);
 }
 
 void
@@ -3717,7 +5574,7 @@ playItem_t *
 pl_item_init (const char *fname) {
     playlist_t plt;
     memset (&plt, 0, sizeof (plt));
-    return plt_insert_file_int (-1, &plt, NULL, fname, NULL, NULL, NULL);
+    return plt_insert_file_int (-1, &plt, NULL, NULL, fname, NULL, NULL, NULL);
 }
 
 int
@@ -3729,7 +5586,7 @@ plt_add_dir2 (int visibility, playlist_t *plt, const char *dirname, int (*callba
     plt->ignore_archives = conf_get_int ("ignore_archives", 1);
 
     int abort = 0;
-    playItem_t *it = plt_insert_dir_int (visibility, plt, NULL, plt->tail[PL_MAIN], dirname, &abort, callback, user_data);
+    playItem_t *it = _plt_insert_dir_root (visibility, plt, plt->tail[PL_MAIN], dirname, &abort, callback, user_data);
 
     plt->ignore_archives = prev;
     plt->follow_symlinks = prev_sl;
@@ -3742,7 +5599,7 @@ plt_add_dir2 (int visibility, playlist_t *plt, const char *dirname, int (*callba
 
 playItem_t *
 plt_insert_file2 (int visibility, playlist_t *playlist, playItem_t *after, const char *fname, int *pabort, int (*callback)(playItem_t *it, void *user_data), void *user_data) {
-    return plt_insert_file_int (visibility, playlist, after, fname, pabort, callback, user_data);
+    return plt_insert_file_int (visibility, playlist, NULL, after, fname, pabort, callback, user_data);
 }
 
 playItem_t *
@@ -3751,7 +5608,7 @@ plt_insert_dir2 (int visibility, playlist_t *plt, playItem_t *after, const char
     plt->follow_symlinks = conf_get_int ("add_folders_follow_symlinks", 0);
     plt->ignore_archives = conf_get_int ("ignore_archives", 1);
 
-    playItem_t *ret = plt_insert_dir_int (visibility, plt, NULL, after, dirname, pabort, callback, user_data);
+    playItem_t *ret = _plt_insert_dir_root (visibility, plt, after, dirname, pabort, callback, user_data);
 
     plt->follow_symlinks = prev_sl;
     plt->ignore_archives = 0;
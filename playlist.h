@@ -54,11 +54,17 @@ typedef struct playItem_s {
     struct playItem_s *next[PL_MAX_ITERATORS]; // next item in linked list
     struct playItem_s *prev[PL_MAX_ITERATORS]; // prev item in linked list
     struct DB_metaInfo_s *meta; // linked list storing metainfo
+    struct pl_meta_index_s *meta_index; // key atom -> meta lookup table, built on demand
+    struct pl_index_chunk_s *index_chunk[PL_MAX_ITERATORS]; // see playlist_t.index
+    int index_pos[PL_MAX_ITERATORS]; // position in index_chunk
+    uint32_t search_slot; // 1-based position in playlist_t.search_index, 0 if not indexed
+    uint32_t modification_stamp; // unique value, which changes each time the metadata changes, see pl_item_set_modified
     unsigned selected : 1;
     unsigned played : 1; // mark as played in shuffle mode
     unsigned in_playlist : 1; // 1 if item is in playlist
     unsigned has_startsample64 : 1;
     unsigned has_endsample64 : 1;
+    unsigned search_dirty : 1; // metadata changed since the item was added to the search index
 } playItem_t;
 
 typedef struct playlist_s {
@@ -69,8 +75,13 @@ typedef struct playlist_s {
     float seltime;
     int modification_idx; // this value gets incremented each time playlist changes, and requires to be saved
     int last_save_modification_idx; // a value of modification_idx at the time when the playlist was saved last time
+    int save_snapshot_idx; // incremented each time the playlist is copied for saving
+    int save_written_idx; // save_snapshot_idx of the copy which was written to disk last
     playItem_t *head[PL_MAX_ITERATORS]; // head of linked list
     playItem_t *tail[PL_MAX_ITERATORS]; // tail of linked list
+    struct pl_index_s *index[PL_MAX_ITERATORS]; // item <-> position lookup, built on demand
+    uintptr_t mutex; // see plt_lock
+    struct pl_search_index_s *search_index; // trigram index for plt_search_process2, built on demand
     int current_row[PL_MAX_ITERATORS]; // current row (cursor)
     int scroll;
     struct DB_metaInfo_s *meta; // linked list storing metainfo
@@ -103,11 +114,32 @@ pl_lock (void);
 void
 pl_unlock (void);
 
-//void
-//plt_lock (void);
-//
-//void
-//plt_unlock (void);
+// read-only access to the global state, released with pl_unlock.
+// see the comment above pl_lock in playlist.c
+void
+pl_lock_shared (void);
+
+// locks a single playlist, allowing other playlists to be accessed concurrently
+void
+plt_lock (playlist_t *plt);
+
+void
+plt_unlock (playlist_t *plt);
+
+// returns 1 if the current thread holds plt_lock, and not pl_lock
+int
+pl_lock_is_shared (void);
+
+// per-track reader/writer lock, only used when the current thread holds plt_lock.
+// doesn't nest, so only keep it around leaf accesses to a single track.
+void
+pl_item_rdlock (playItem_t *it);
+
+void
+pl_item_wrlock (playItem_t *it);
+
+void
+pl_item_unlock (playItem_t *it);
 
 // playlist management functions
 
@@ -175,6 +207,10 @@ plt_set_title (playlist_t *plt, const char *title);
 void
 plt_modified (playlist_t *plt);
 
+// drops the position index, must be called after relinking the list directly
+void
+plt_index_invalidate (playlist_t *plt, int iter);
+
 int
 plt_get_modification_idx (playlist_t *plt);
 
@@ -567,9 +603,22 @@ pl_meta_for_key (playItem_t *it, const char *key);
 DB_metaInfo_t *
 pl_meta_for_key_with_override (playItem_t *it, const char *key);
 
+// same as pl_meta_for_key_with_override, with the key atoms resolved by the caller,
+// see metacache_key_atom
+DB_metaInfo_t *
+pl_meta_for_atoms_with_override (playItem_t *it, const char *key, uint32_t atom, uint32_t override_atom);
+
+// marks the item metadata as changed, which invalidates the cached search and title formatting data
+void
+pl_item_set_modified (playItem_t *it);
+
 void
 pl_meta_free_values (DB_metaInfo_t *meta);
 
+// frees the key lookup table of the item, it will be rebuilt on the next access
+void
+pl_meta_index_free (playItem_t *it);
+
 void
 pl_add_meta_copy (playItem_t *it, DB_metaInfo_t *meta);
 
@@ -34,40 +34,173 @@
 #define LOCK {pl_lock();}
 #define UNLOCK {pl_unlock();}
 
+// metadata accessors which take pl_lock also need the per-track lock,
+// in case the caller holds plt_lock
+#define META_RDLOCK(it) {pl_lock (); pl_item_rdlock (it);}
+#define META_WRLOCK(it) {pl_lock (); pl_item_wrlock (it);}
+#define META_UNLOCK(it) {pl_item_unlock (it); pl_unlock ();}
+
+// Items with at least this many metadata fields get a key lookup table,
+// smaller ones are searched linearly.
+#define META_INDEX_MIN_FIELDS 8
+
+typedef struct {
+    uint32_t atom;
+    DB_metaInfo_t *meta;
+} pl_meta_index_entry_t;
+
+typedef struct pl_meta_index_s {
+    uint32_t size; // power of 2
+    uint32_t count;
+    pl_meta_index_entry_t entries[];
+} pl_meta_index_t;
+
+static pl_meta_index_t *
+_meta_index_alloc (uint32_t size) {
+    pl_meta_index_t *index = calloc (1, sizeof (pl_meta_index_t) + size * sizeof (pl_meta_index_entry_t));
+    index->size = size;
+    return index;
+}
+
+static void
+_meta_index_insert_atom (pl_meta_index_t *index, uint32_t atom, DB_metaInfo_t *meta) {
+    uint32_t idx = atom & (index->size-1);
+    while (index->entries[idx].atom) {
+        idx = (idx + 1) & (index->size-1);
+    }
+    index->entries[idx].atom = atom;
+    index->entries[idx].meta = meta;
+    index->count++;
+}
+
+static void
+_meta_index_insert (playItem_t *it, DB_metaInfo_t *meta) {
+    pl_meta_index_t *index = it->meta_index;
+    // keep load factor under 1/2
+    if ((index->count + 1) * 2 > index->size) {
+        pl_meta_index_t *grown = _meta_index_alloc (index->size * 2);
+        for (uint32_t i = 0; i < index->size; i++) {
+            if (index->entries[i].atom) {
+                _meta_index_insert_atom (grown, index->entries[i].atom, index->entries[i].meta);
+            }
+        }
+        free (index);
+        it->meta_index = index = grown;
+    }
+    _meta_index_insert_atom (index, metacache_key_atom (0, meta->key), meta);
+}
+
+static void
+_meta_index_build (playItem_t *it) {
+    it->meta_index = _meta_index_alloc (META_INDEX_MIN_FIELDS * 4);
+    for (DB_metaInfo_t *m = it->meta; m; m = m->next) {
+        _meta_index_insert (it, m);
+    }
+}
+
+void
+pl_meta_index_free (playItem_t *it) {
+    free (it->meta_index);
+    it->meta_index = NULL;
+}
+
+static int
+_meta_should_index (playItem_t *it) {
+    if (it->meta_index) {
+        return 1;
+    }
+    if (pl_lock_is_shared ()) {
+        // lookups may run concurrently with plt_lock, don't modify the track
+        return 0;
+    }
+    int n = 0;
+    for (DB_metaInfo_t *m = it->meta; m; m = m->next) {
+        if (++n >= META_INDEX_MIN_FIELDS) {
+            _meta_index_build (it);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Finds the field with the key equal to (prefix + key), case insensitive.
+// atom is the key atom for (prefix + key), or 0 if it needs to be looked up.
+static DB_metaInfo_t *
+_meta_find_atom (playItem_t *it, char prefix, const char *key, uint32_t atom) {
+    if (_meta_should_index (it)) {
+        pl_meta_index_t *index = it->meta_index;
+        if (!atom) {
+            atom = metacache_key_atom (prefix, key);
+        }
+        uint32_t idx = atom & (index->size-1);
+        while (index->entries[idx].atom) {
+            if (index->entries[idx].atom == atom) {
+                return index->entries[idx].meta;
+            }
+            idx = (idx + 1) & (index->size-1);
+        }
+        return NULL;
+    }
+
+    for (DB_metaInfo_t *m = it->meta; m; m = m->next) {
+        if (prefix) {
+            if (m->key[0] == prefix && !strcasecmp (key, m->key+1)) {
+                return m;
+            }
+        }
+        else if (!strcasecmp (key, m->key)) {
+            return m;
+        }
+    }
+    return NULL;
+}
+
+static DB_metaInfo_t *
+_meta_find (playItem_t *it, char prefix, const char *key) {
+    return _meta_find_atom (it, prefix, key, 0);
+}
+
 DB_metaInfo_t *
 pl_meta_for_key_with_override (playItem_t *it, const char *key) {
     pl_ensure_lock ();
-    DB_metaInfo_t *m = it->meta;
+    if (!key) {
+        return NULL;
+    }
 
     // try to find an override
-    while (m) {
-        if (m->key[0] == '!' && !strcasecmp (key, m->key+1)) {
-            return m;
-        }
-        m = m->next;
+    DB_metaInfo_t *m = _meta_find (it, '!', key);
+    if (m) {
+        return m;
     }
 
-    m = it->meta;
-    while (m) {
-        if (key && !strcasecmp (key, m->key)) {
-            return m;
-        }
-        m = m->next;
+    return _meta_find (it, 0, key);
+}
+
+
+DB_metaInfo_t *
+pl_meta_for_atoms_with_override (playItem_t *it, const char *key, uint32_t atom, uint32_t override_atom) {
+    pl_ensure_lock ();
+    DB_metaInfo_t *m = _meta_find_atom (it, '!', key, override_atom);
+    if (m) {
+        return m;
     }
-    return NULL;}
 
+    return _meta_find_atom (it, 0, key, atom);
+}
 
 DB_metaInfo_t *
 pl_meta_for_key (playItem_t *it, const char *key) {
     pl_ensure_lock ();
-    DB_metaInfo_t *m = it->meta;
-    while (m) {
-        if (!strcasecmp (key, m->key)) {
-            return m;
-        }
-        m = m->next;
-    }
-    return NULL;
+    return _meta_find (it, 0, key);
+}
+
+// incremented atomically, since the items can be modified concurrently under plt_lock
+static uint32_t modification_stamp;
+
+void
+pl_item_set_modified (playItem_t *it) {
+    it->search_dirty = 1;
+    it->modification_stamp = __sync_add_and_fetch (&modification_stamp, 1);
 }
 
 void
@@ -80,12 +213,18 @@ pl_meta_free_values (DB_metaInfo_t *meta) {
 DB_metaInfo_t *
 pl_add_empty_meta_for_key (playItem_t *it, const char *key) {
     // check if it's already set
+    int indexed = _meta_should_index (it);
+    if (indexed && _meta_find (it, 0, key)) {
+        // duplicate key
+        return NULL;
+    }
+
     DB_metaInfo_t *normaltail = NULL;
     DB_metaInfo_t *propstart = NULL;
     DB_metaInfo_t *tail = NULL;
     DB_metaInfo_t *m = it->meta;
     while (m) {
-        if (!strcasecmp (key, m->key)) {
+        if (!indexed && !strcasecmp (key, m->key)) {
             // duplicate key
             return NULL;
         }
@@ -104,6 +243,7 @@ pl_add_empty_meta_for_key (playItem_t *it, const char *key) {
     // add
     m = calloc (1, sizeof (DB_metaInfo_t));
     m->key = metacache_add_string (key);
+    pl_item_set_modified (it);
 
     if (key[0] == ':' || key[0] == '_' || key[0] == '!') {
         if (tail) {
@@ -123,6 +263,10 @@ pl_add_empty_meta_for_key (playItem_t *it, const char *key) {
         }
     }
 
+    if (it->meta_index) {
+        _meta_index_insert (it, m);
+    }
+
     return m;
 }
 
@@ -239,15 +383,16 @@ _combine_into_unique_multivalue (const char *value1, int size1, const char *valu
 // skip duplicates
 void
 pl_append_meta_full (playItem_t *it, const char *key, const char *value, int size) {
-    pl_lock ();
+    META_WRLOCK (it);
     DB_metaInfo_t *m = pl_meta_for_key (it, key);
     if (!m) {
         m = pl_add_empty_meta_for_key(it, key);
     }
+    pl_item_set_modified (it);
 
     if (!m->value) {
         _meta_set_value (m, value, size);
-        pl_unlock ();
+        META_UNLOCK (it);
         return;
     }
 
@@ -255,7 +400,7 @@ pl_append_meta_full (playItem_t *it, const char *key, const char *value, int siz
     char *buf = _combine_into_unique_multivalue(m->value, m->valuesize, value, size, &buflen);
 
     if (!buf) {
-        pl_unlock ();
+        META_UNLOCK (it);
         return;
     }
 
@@ -263,7 +408,7 @@ pl_append_meta_full (playItem_t *it, const char *key, const char *value, int siz
     m->value = metacache_add_value (buf, buflen);
     m->valuesize = (int)buflen;
     free (buf);
-    pl_unlock ();
+    META_UNLOCK (it);
 }
 
 void
@@ -273,22 +418,23 @@ pl_append_meta (playItem_t *it, const char *key, const char *value) {
 
 void
 pl_replace_meta (playItem_t *it, const char *key, const char *value) {
-    LOCK;
+    META_WRLOCK (it);
     // check if it's already set
     DB_metaInfo_t *m = pl_meta_for_key (it, key);
 
     if (m) {
         pl_meta_free_values (m);
+        pl_item_set_modified (it);
         int l = (int)strlen (value) + 1;
         m->value = metacache_add_value(value, l);
         m->valuesize = l;
-        UNLOCK;
+        META_UNLOCK (it);
         return;
     }
     else {
         pl_add_meta (it, key, value);
     }
-    UNLOCK;
+    META_UNLOCK (it);
 }
 
 void
@@ -314,7 +460,7 @@ pl_set_meta_float (playItem_t *it, const char *key, float value) {
 
 void
 pl_delete_meta (playItem_t *it, const char *key) {
-    pl_lock ();
+    META_WRLOCK (it);
     DB_metaInfo_t *prev = NULL;
     DB_metaInfo_t *m = it->meta;
     while (m) {
@@ -325,6 +471,8 @@ pl_delete_meta (playItem_t *it, const char *key) {
             else {
                 it->meta = m->next;
             }
+            pl_meta_index_free (it);
+            pl_item_set_modified (it);
             metacache_remove_string (m->key);
             pl_meta_free_values(m);
             free (m);
@@ -333,32 +481,27 @@ pl_delete_meta (playItem_t *it, const char *key) {
         prev = m;
         m = m->next;
     }
-    pl_unlock ();
+    META_UNLOCK (it);
 }
 
 const char *
 pl_find_meta (playItem_t *it, const char *key) {
     pl_ensure_lock ();
-    DB_metaInfo_t *m = it->meta;
-
-    if (key && key[0] == ':') {
-        // try to find an override
-        while (m) {
-            if (m->key[0] == '!' && !strcasecmp (key+1, m->key+1)) {
-                return m->value;
-            }
-            m = m->next;
-        }
+    if (!key) {
+        return NULL;
     }
 
-    m = it->meta;
-    while (m) {
-        if (key && !strcasecmp (key, m->key)) {
+    DB_metaInfo_t *m;
+    if (key[0] == ':') {
+        // try to find an override
+        m = _meta_find (it, '!', key+1);
+        if (m) {
             return m->value;
         }
-        m = m->next;
     }
-    return NULL;
+
+    m = _meta_find (it, 0, key);
+    return m ? m->value : NULL;
 }
 
 const char *
@@ -369,28 +512,28 @@ pl_find_meta_raw (playItem_t *it, const char *key) {
 
 int
 pl_find_meta_int (playItem_t *it, const char *key, int def) {
-    pl_lock ();
+    META_RDLOCK (it);
     const char *val = pl_find_meta (it, key);
     int res = val ? atoi (val) : def;
-    pl_unlock ();
+    META_UNLOCK (it);
     return res;
 }
 
 int64_t
 pl_find_meta_int64 (playItem_t *it, const char *key, int64_t def) {
-    pl_lock ();
+    META_RDLOCK (it);
     const char *val = pl_find_meta (it, key);
     int64_t res = val ? atoll (val) : def;
-    pl_unlock ();
+    META_UNLOCK (it);
     return res;
 }
 
 float
 pl_find_meta_float (playItem_t *it, const char *key, float def) {
-    pl_lock ();
+    META_RDLOCK (it);
     const char *val = pl_find_meta (it, key);
     float res = val ? (float)atof (val) : def;
-    pl_unlock ();
+    META_UNLOCK (it);
     return res;
 }
 
@@ -401,7 +544,7 @@ pl_get_metadata_head (playItem_t *it) {
 
 void
 pl_delete_metadata (playItem_t *it, DB_metaInfo_t *meta) {
-    pl_lock ();
+    META_WRLOCK (it);
     DB_metaInfo_t *prev = NULL;
     DB_metaInfo_t *m = it->meta;
     while (m) {
@@ -412,6 +555,8 @@ pl_delete_metadata (playItem_t *it, DB_metaInfo_t *meta) {
             else {
                 it->meta = m->next;
             }
+            pl_meta_index_free (it);
+            pl_item_set_modified (it);
             metacache_remove_string (m->key);
             pl_meta_free_values(m);
             free (m);
@@ -420,12 +565,13 @@ pl_delete_metadata (playItem_t *it, DB_metaInfo_t *meta) {
         prev = m;
         m = m->next;
     }
-    pl_unlock ();
+    META_UNLOCK (it);
 }
 
 void
 pl_delete_all_meta (playItem_t *it) {
     LOCK;
+    pl_item_wrlock (it);
     DB_metaInfo_t *m = it->meta;
     DB_metaInfo_t *prev = NULL;
     while (m) {
@@ -440,12 +586,15 @@ pl_delete_all_meta (playItem_t *it) {
             else {
                 it->meta = next;
             }
+            pl_meta_index_free (it);
+            pl_item_set_modified (it);
             metacache_remove_string (m->key);
             pl_meta_free_values (m);
             free (m);
         }
         m = next;
     }
+    pl_item_unlock (it);
 
     // delete replaygain fields
     extern const char *ddb_internal_rg_keys[];
@@ -463,36 +612,36 @@ pl_delete_all_meta (playItem_t *it) {
 int
 pl_get_meta (playItem_t *it, const char *key, char *val, int size) {
     *val = 0;
-    pl_lock ();
+    META_RDLOCK (it);
     const char *v = pl_find_meta (it, key);
     if (!v) {
-        pl_unlock ();
+        META_UNLOCK (it);
         return 0;
     }
     strncpy (val, v, size);
-    pl_unlock ();
+    META_UNLOCK (it);
     return 1;
 }
 
 int
 pl_get_meta_raw (playItem_t *it, const char *key, char *val, int size) {
     *val = 0;
-    pl_lock ();
+    META_RDLOCK (it);
     const char *v = pl_find_meta_raw (it, key);
     if (!v) {
-        pl_unlock ();
+        META_UNLOCK (it);
         return 0;
     }
     strncpy (val, v, size);
-    pl_unlock ();
+    META_UNLOCK (it);
     return 1;
 }
 
 int
 pl_meta_exists (playItem_t *it, const char *key) {
-    pl_lock ();
+    META_RDLOCK (it);
     const char *v = pl_find_meta (it, key);
-    pl_unlock ();
+    META_UNLOCK (it);
     return v ? 1 : 0;
 }
 
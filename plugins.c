@@ -506,6 +506,8 @@ static DB_functions_t deadbeef_api = {
     .streamer_get_shuffle = streamer_get_shuffle,
     .streamer_set_repeat = streamer_set_repeat,
     .streamer_get_repeat = streamer_get_repeat,
+
+    .vis_spectrum_listen2 = vis_spectrum_listen2,
 };
 
 DB_functions_t *deadbeef = &deadbeef_api;
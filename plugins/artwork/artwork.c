@@ -28,6 +28,7 @@
 #endif
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <ctype.h>
 #include <libgen.h>
@@ -85,13 +86,34 @@ typedef struct cover_callback_s {
 // list of unique queries
 typedef struct cover_query_s {
     cover_callback_t *callbacks;
+    DB_playItem_t *track; // NULL for cache reset
+    char *filepath;
+    char *album; // album, artist and key are evaluated by the fetcher thread
+    char *artist;
+    char *key; // queries with the same key are served by a single lookup
+    uint32_t key_hash;
+    int high_priority;
     struct cover_query_s *next;
 } cover_query_t;
 
-static cover_query_t *queue;
-static cover_query_t *queue_tail;
+typedef struct {
+    cover_query_t *head;
+    cover_query_t *tail;
+} query_queue_t;
+
+// local folder and embedded tag lookups are done by NUM_LOCAL_FETCHERS threads,
+// the queries which were not found locally move on to a single web lookup thread,
+// so that a slow server doesn't hold up local covers, and the web services are not flooded
+#define NUM_LOCAL_FETCHERS 4
+
+static query_queue_t local_queue;
+static query_queue_t network_queue;
+static cover_query_t *active_queries; // being looked up, new callbacks for the same album are attached to them
+static int reset_in_progress;
+static int64_t last_source_id;
 static int terminate;
-static intptr_t tid;
+static intptr_t local_tids[NUM_LOCAL_FETCHERS];
+static intptr_t network_tid;
 static uintptr_t queue_mutex;
 static uintptr_t queue_cond;
 
@@ -983,7 +1005,7 @@ make_cache_path (const char *filepath, const char *album, const char *artist, ch
     }
 
     int name_size = outsize - (int)strlen (outpath);
-    int max_album_chars = min (NAME_MAX, name_size) - (int)sizeof ("1.jpg.part");
+    int max_album_chars = min (NAME_MAX, name_size) - (int)sizeof ("1.jpg.part.XXXXXX");
     if (max_album_chars <= 0) {
         trace ("Path buffer not long enough for %s and filename\n", outpath);
         return -1;
@@ -1003,6 +1025,13 @@ make_cache_path (const char *filepath, const char *album, const char *artist, ch
 static void
 query_free (cover_query_t *query)
 {
+    free (query->filepath);
+    free (query->album);
+    free (query->artist);
+    free (query->key);
+    if (query->track) {
+        deadbeef->pl_item_unref (query->track);
+    }
     free (query);
 }
 
@@ -1049,56 +1078,198 @@ strings_equal (const char *s1, const char *s2)
     return (s1 == s2) || (s1 && s2 && !strcasecmp (s1, s2));
 }
 
+static int64_t
+query_source_id (ddb_cover_query_t *info) {
+    if (info->_size < offsetof (ddb_cover_query_t, source_id) + sizeof (info->source_id)) {
+        return 0;
+    }
+    return info->source_id;
+}
+
+static uint32_t
+key_hash (const char *key) {
+    uint32_t hash = 2166136261u;
+    for (const uint8_t *p = (const uint8_t *)key; *p; p++) {
+        hash = (hash ^ *p) * 16777619u;
+    }
+    return hash;
+}
+
 static int
-queries_equal (ddb_cover_query_t *q1, ddb_cover_query_t *q2) {
-    if (q1->track == q2->track) {
-        return 1;
+queries_equal (cover_query_t *q1, cover_query_t *q2) {
+    return q1->key && q2->key && q1->key_hash == q2->key_hash && !strcmp (q1->key, q2->key);
+}
+
+static cover_query_t *
+new_query (ddb_cover_query_t *info, ddb_cover_callback_t cb) {
+    cover_query_t *query = calloc (1, sizeof (cover_query_t));
+    if (!query) {
+        if (cb) {
+            cb (-1, info, NULL);
+        }
+        return NULL;
     }
-    return 0;
+
+    query->callbacks = new_query_callback (cb, info);
+
+    if (!info->track) {
+        return query;
+    }
+
+    query->track = info->track;
+    deadbeef->pl_item_ref (query->track);
+
+    deadbeef->pl_lock ();
+    query->filepath = strdup (deadbeef->pl_find_meta (info->track, ":URI"));
+    deadbeef->pl_unlock ();
+
+    query->high_priority = (info->flags & DDB_ARTWORK_FLAG_HIGH_PRIORITY) != 0;
+    if (!query->high_priority) {
+        DB_playItem_t *playing = deadbeef->streamer_get_playing_track ();
+        if (playing) {
+            query->high_priority = playing == info->track;
+            deadbeef->pl_item_unref (playing);
+        }
+    }
+
+    return query;
 }
 
+// called by the fetcher thread, the title formatting is too slow for the callers of cover_get
 static void
-enqueue_query (ddb_cover_query_t *new_query, const ddb_cover_callback_t cb)
-{
-    for (cover_query_t *q = queue; q; q = q->next) {
-        if (queries_equal (new_query, q->callbacks->info)) {
-            // append top existing pending query
-            cover_callback_t **last_callback = &q->callbacks;
-            while (*last_callback && (*last_callback)->cb != cache_reset_callback) {
-                last_callback = & (*last_callback)->next;
-            }
-            if (!*last_callback) {
-                *last_callback = new_query_callback (cb, new_query);
-                return;
-            }
+query_eval_key (cover_query_t *query, char **album, char **artist, char **key) {
+    char album_buf[1000];
+    char artist_buf[1000];
+    ddb_tf_context_t ctx = {
+        ._size = sizeof (ddb_tf_context_t),
+        .it = query->track,
+    };
+    deadbeef->tf_eval (&ctx, album_tf, album_buf, sizeof (album_buf));
+    deadbeef->tf_eval (&ctx, artist_tf, artist_buf, sizeof (artist_buf));
+    *album = strdup (album_buf);
+    *artist = strdup (artist_buf);
+
+    // all tracks of an album in the same folder share the cover, tracks without an album are looked up one by one
+    if (album_buf[0]) {
+        const char *slash = strrchr (query->filepath, '/');
+        int dirlen = slash ? (int)(slash - query->filepath) : 0;
+        size_t len = dirlen + strlen (album_buf) + strlen (artist_buf) + 3;
+        *key = malloc (len);
+        snprintf (*key, len, "%.*s\n%s\n%s", dirlen, query->filepath, album_buf, artist_buf);
+    }
+    else {
+        *key = strdup (query->filepath);
+    }
+}
+
+static void
+queue_insert (query_queue_t *queue, cover_query_t *query) {
+    // high priority queries go after the other high priority ones, the rest go to the end
+    cover_query_t *prev = queue->tail;
+    if (query->high_priority) {
+        prev = NULL;
+        for (cover_query_t *q = queue->head; q && q->high_priority; q = q->next) {
+            prev = q;
         }
     }
 
-    // add new query
-    cover_query_t *q = calloc (1, sizeof (cover_query_t));
-    if (q) {
-        q->callbacks = new_query_callback (cb, new_query);
+    query->next = prev ? prev->next : queue->head;
+    if (prev) {
+        prev->next = query;
     }
+    else {
+        queue->head = query;
+    }
+    if (!query->next) {
+        queue->tail = query;
+    }
+}
 
-    if (!q) {
-        if (cb) {
-            cb (-1, new_query, NULL);
+static void
+queue_remove (query_queue_t *queue, cover_query_t *query) {
+    cover_query_t *prev = NULL;
+    for (cover_query_t *q = queue->head; q != query; q = q->next) {
+        prev = q;
+    }
+
+    if (prev) {
+        prev->next = query->next;
+    }
+    else {
+        queue->head = query->next;
+    }
+    if (queue->tail == query) {
+        queue->tail = prev;
+    }
+    query->next = NULL;
+}
+
+static cover_query_t *
+queue_find (query_queue_t *queue, cover_query_t *query) {
+    for (cover_query_t *q = queue->head; q; q = q->next) {
+        if (q != query && (queries_equal (q, query) || (q->track && q->track == query->track))) {
+            return q;
         }
+    }
+    return NULL;
+}
 
-        return;
+// moves the callbacks of the query to the other one
+static void
+query_attach_callbacks (cover_query_t *existing, cover_query_t *query) {
+    cover_callback_t **last_callback = &existing->callbacks;
+    while (*last_callback) {
+        last_callback = &(*last_callback)->next;
     }
+    *last_callback = query->callbacks;
+    query->callbacks = NULL;
+}
 
-    if (queue_tail) {
-        queue_tail->next = q;
+// finds another query for the same album, which is waiting for the web lookup or being looked up
+static cover_query_t *
+find_same_album_query (cover_query_t *query, query_queue_t **queue) {
+    *queue = &network_queue;
+    cover_query_t *existing = queue_find (&network_queue, query);
+    if (existing) {
+        return existing;
     }
-    else {
-        queue = q;
+    *queue = NULL;
+    for (cover_query_t *q = active_queries; q; q = q->next) {
+        if (q != query && queries_equal (q, query)) {
+            return q;
+        }
+    }
+    return NULL;
+}
+
+// Returns 1 if the query was merged into a pending one, and needs to be freed by the caller.
+// Freeing unrefs the track, which takes the playlist lock, so it can't be done with the queue mutex held.
+static int
+enqueue_query (cover_query_t *query)
+{
+    // attach the callback to a pending lookup of the same track,
+    // the album is not known yet, the fetcher checks for the same album once it has evaluated it
+    cover_query_t *existing = query->track ? queue_find (&local_queue, query) : NULL;
+
+    if (existing) {
+        query_attach_callbacks (existing, query);
+
+        // e.g. an off-screen album scrolled into view
+        if (query->high_priority && !existing->high_priority) {
+            queue_remove (&local_queue, existing);
+            existing->high_priority = 1;
+            queue_insert (&local_queue, existing);
+        }
+        return 1;
     }
-    queue_tail = q;
-    deadbeef->cond_signal (queue_cond);
+
+    queue_insert (&local_queue, query);
+    deadbeef->cond_broadcast (queue_cond);
+    return 0;
 }
 
-static char *filter_custom_mask = NULL;
+// scandir filters take no context, and the local lookups run on several threads
+static __thread char *filter_custom_mask = NULL;
 
 static int
 filter_custom (const struct dirent *f)
@@ -1176,7 +1347,7 @@ scan_local_path (char *mask, const char *local_path, const char *uri, DB_vfs_t *
     return -1;
 }
 
-static const char *filter_strcasecmp_name = NULL;
+static __thread const char *filter_strcasecmp_name = NULL;
 
 static int
 filter_strcasecmp (const struct dirent *f)
@@ -1241,6 +1412,9 @@ local_image_file (const char *local_path, const char *uri, DB_vfs_t *vfsplug, dd
         else {
             path = get_case_insensitive_path (local_path, folder, vfsplug);
             folder += strlen (folder)+1;
+            if (!path) {
+                continue;
+            }
         }
         trace ("scanning %s for artwork\n", path);
         for (char *mask = filemask; mask < filemask_end; mask += strlen (mask)+1) {
@@ -1782,7 +1956,7 @@ recheck_missing_artwork (const char *input_fname, const time_t placeholder_mtime
 // Embedded cover: !cache_disabled ? save_to_cash&return_path : return blob
 // Web cover: save_to_local ? save_to_local&return_path : ( !cache_disabled ? save_to_cache&return_path : NOP )
 static int
-process_query (const char *filepath, const char *album, const char *artist, ddb_cover_info_t *cover)
+process_local_query (const char *filepath, const char *album, const char *artist, ddb_cover_info_t *cover)
 {
     char cache_path_buf[PATH_MAX];
     char *cache_path = NULL;
@@ -1859,9 +2033,36 @@ process_query (const char *filepath, const char *album, const char *artist, ddb_
 #endif
     }
 
-    if (!cache_path) {
+    return 0;
+}
+
+static int
+web_lookups_enabled (const char *filepath)
+{
+#ifdef USE_VFS_CURL
+    /* Web covers are only saved into the cache */
+    if (artwork_disable_cache) {
         return 0;
     }
+    if (artwork_enable_wos && strlen (filepath) > 3 && !strcasecmp (filepath+strlen (filepath)-3, ".ay")) {
+        return 1;
+    }
+    return artwork_enable_lfm || artwork_enable_mb || artwork_enable_aao;
+#else
+    return 0;
+#endif
+}
+
+// Called when nothing was found locally, also marks the cover as missing if the web lookups fail
+static int
+process_web_query (const char *filepath, char *album, const char *artist, ddb_cover_info_t *cover)
+{
+    if (artwork_disable_cache) {
+        return 0;
+    }
+
+    char cache_path[PATH_MAX];
+    make_cache_path (filepath, album, artist, cache_path, sizeof (cache_path));
 
 #ifdef USE_VFS_CURL
     /* Web lookups */
@@ -1918,25 +2119,24 @@ send_query_callbacks (cover_callback_t *callback, ddb_cover_info_t *cover) {
     }
 }
 
-static cover_query_t *
-query_pop (void) {
-    cover_query_t *query = queue;
-    queue = queue ? queue->next : NULL;
-    if (!queue) {
-        queue_tail = NULL;
-    }
-    return query;
-}
-
+// fails all the queries which are not being looked up yet
 static void
 queue_clear (void) {
-    while (queue) {
-        cover_query_t *next = queue->next;
-        send_query_callbacks (queue->callbacks, NULL);
-        query_free (queue);
-        queue = next;
+    deadbeef->mutex_lock (queue_mutex);
+    cover_query_t *queries[] = { local_queue.head, network_queue.head };
+    local_queue.head = local_queue.tail = NULL;
+    network_queue.head = network_queue.tail = NULL;
+    deadbeef->mutex_unlock (queue_mutex);
+
+    for (int i = 0; i < 2; i++) {
+        cover_query_t *query = queries[i];
+        while (query) {
+            cover_query_t *next = query->next;
+            send_query_callbacks (query->callbacks, NULL);
+            query_free (query);
+            query = next;
+        }
     }
-    queue_tail = NULL;
 }
 
 static void
@@ -1957,86 +2157,184 @@ cover_info_free (ddb_cover_info_t *cover) {
     free (cover);
 }
 
+// takes the next query to look up, or returns NULL if there's nothing to do right now
+static cover_query_t *
+query_pop (query_queue_t *queue) {
+    cover_query_t *query = queue->head;
+    if (!query || reset_in_progress) {
+        return NULL;
+    }
+    if (!query->track) {
+        /* Cache reset waits for the running lookups to finish, and blocks the queue until done */
+        if (active_queries) {
+            return NULL;
+        }
+        reset_in_progress = 1;
+    }
+
+    queue_remove (queue, query);
+    query->next = active_queries;
+    active_queries = query;
+    return query;
+}
+
 static void
-fetcher_thread (void *none)
-{
-#ifdef __linux__
-    prctl (PR_SET_NAME, "deadbeef-artwork", 0, 0, 0, 0);
-#endif
+active_remove (cover_query_t *query) {
+    cover_query_t **q = &active_queries;
+    while (*q != query) {
+        q = &(*q)->next;
+    }
+    *q = query->next;
+    query->next = NULL;
+}
 
-    /* Loop until external terminate command */
+// sends the results to everyone waiting for this query, and frees it
+static void
+query_complete (cover_query_t *query, ddb_cover_info_t *cover) {
     deadbeef->mutex_lock (queue_mutex);
-    while (!terminate) {
-        trace ("artwork fetcher: waiting for signal ...\n");
-        // FIXME: use deadbeef->cond_wait
-        pthread_cond_wait ((pthread_cond_t *)queue_cond, (pthread_mutex_t *)queue_mutex);
-        trace ("artwork fetcher: cond signalled, process queue\n");
+    active_remove (query);
+    cover_callback_t *callbacks = query->callbacks;
+    query->callbacks = NULL;
+    deadbeef->mutex_unlock (queue_mutex);
 
-        /* Loop until queue is empty */
-        while (queue) {
-            deadbeef->mutex_unlock (queue_mutex);
+    if (cover && !callbacks) {
+        /* All the callbacks were cancelled */
+        cover_info_free (cover);
+    }
+    else {
+        send_query_callbacks (callbacks, cover);
+    }
 
-            ddb_cover_query_t *info = queue->callbacks->info;
+    deadbeef->mutex_lock (queue_mutex);
+    if (!query->track) {
+        /* The cache reset was done by the callback, the other lookups can go on */
+        reset_in_progress = 0;
+    }
+    deadbeef->cond_broadcast (queue_cond);
+    deadbeef->mutex_unlock (queue_mutex);
+    query_free (query);
+}
 
-            if (!info->track) {
-                deadbeef->mutex_lock (queue_mutex);
-                cover_query_t *query = query_pop ();
-                deadbeef->mutex_unlock (queue_mutex);
+// Attaches the callbacks to another lookup of the same album, if there is one, and removes the query from the active ones.
+// Returns 1 if the query was merged, and needs to be freed by the caller.
+static int
+query_merge_same_album (cover_query_t *query) {
+    query_queue_t *queue;
+    cover_query_t *existing = find_same_album_query (query, &queue);
+    if (!existing) {
+        return 0;
+    }
 
-                send_query_callbacks (query->callbacks, NULL);
-                query_free (query);
+    query_attach_callbacks (existing, query);
+    if (queue && query->high_priority && !existing->high_priority) {
+        queue_remove (queue, existing);
+        existing->high_priority = 1;
+        queue_insert (queue, existing);
+    }
+    active_remove (query);
+    return 1;
+}
 
-                /* Look for what to do next */
-                deadbeef->mutex_lock (queue_mutex);
-                continue;
-            }
+// passes a query which was not found locally on to the web lookup thread
+static void
+query_to_network (cover_query_t *query) {
+    deadbeef->mutex_lock (queue_mutex);
+    int merged = query_merge_same_album (query);
+    if (!merged) {
+        active_remove (query);
+        queue_insert (&network_queue, query);
+        deadbeef->cond_broadcast (queue_cond);
+    }
+    deadbeef->mutex_unlock (queue_mutex);
+    if (merged) {
+        query_free (query);
+    }
+}
 
-            /* Process this query, hopefully writing a file into cache */
-            ddb_cover_info_t *cover = calloc (sizeof (ddb_cover_info_t), 1);
+static void
+lookup_query (query_queue_t *queue, cover_query_t *query) {
+    if (!query->track) {
+        /* Cache reset, done by the callback */
+        query_complete (query, NULL);
+        return;
+    }
 
-            if (!album_tf) {
-                album_tf = deadbeef->tf_compile ("%album%");
-            }
-            if (!artist_tf) {
-                artist_tf = deadbeef->tf_compile ("%artist%");
-            }
+    if (!query->key) {
+        char *album, *artist, *key;
+        query_eval_key (query, &album, &artist, &key);
 
-            deadbeef->pl_lock ();
-            char *filepath = strdupa (deadbeef->pl_find_meta (info->track, ":URI"));
-            deadbeef->pl_unlock ();
-
-            char album[1000];
-            char artist[1000];
-            ddb_tf_context_t ctx;
-            ctx._size = sizeof (ddb_tf_context_t);
-            ctx.it = info->track;
-            deadbeef->tf_eval (&ctx, album_tf, album, sizeof (album));
-            deadbeef->tf_eval (&ctx, artist_tf, artist, sizeof (artist));
-            
-            int cover_found = process_query (filepath, album, artist, cover);
+        /* The other threads only look at the key with the queue mutex held */
+        deadbeef->mutex_lock (queue_mutex);
+        query->album = album;
+        query->artist = artist;
+        query->key = key;
+        query->key_hash = key_hash (key);
+        int merged = query_merge_same_album (query);
+        deadbeef->mutex_unlock (queue_mutex);
+        if (merged) {
+            query_free (query);
+            return;
+        }
+    }
 
-            deadbeef->mutex_lock (queue_mutex);
-            cover_query_t *query = query_pop ();
-            deadbeef->mutex_unlock (queue_mutex);
+    /* Process this query, hopefully writing a file into cache */
+    ddb_cover_info_t *cover = calloc (sizeof (ddb_cover_info_t), 1);
+    cover->refc = 1;
 
-            if (!query) {
-                break;
+    int cover_found;
+    if (queue == &local_queue) {
+        cover_found = process_local_query (query->filepath, query->album, query->artist, cover);
+        if (!cover_found) {
+            if (web_lookups_enabled (query->filepath)) {
+                cover_info_free (cover);
+                query_to_network (query);
+                return;
             }
+            /* Nothing to look up on the web, only marks the cover as missing */
+            cover_found = process_web_query (query->filepath, query->album, query->artist, cover);
+        }
+    }
+    else {
+        cover_found = process_web_query (query->filepath, query->album, query->artist, cover);
+    }
 
-            /* Make all the callbacks (and free the chain), with data if a file was written */
-            if (cover_found) {
-                trace ("artwork fetcher: cover art file found: %s\n", cover->filename);
-                send_query_callbacks (query->callbacks, cover);
-            }
-            else {
-                trace ("artwork fetcher: no cover art found\n");
-                send_query_callbacks (query->callbacks, NULL);
-            }
-            query_free (query);
+    /* Make all the callbacks (and free the chain), with data if a file was written */
+    if (cover_found) {
+        trace ("artwork fetcher: cover art file found: %s\n", cover->filename);
+        query_complete (query, cover);
+    }
+    else {
+        trace ("artwork fetcher: no cover art found\n");
+        cover_info_free (cover);
+        query_complete (query, NULL);
+    }
+}
 
-            /* Look for what to do next */
-            deadbeef->mutex_lock (queue_mutex);
+// serves either the local or the network queue
+static void
+fetcher_thread (void *ctx)
+{
+    query_queue_t *queue = ctx;
+#ifdef __linux__
+    prctl (PR_SET_NAME, queue == &local_queue ? "deadbeef-artwork" : "deadbeef-artweb", 0, 0, 0, 0);
+#endif
+
+    /* Loop until external terminate command */
+    deadbeef->mutex_lock (queue_mutex);
+    while (!terminate) {
+        cover_query_t *query = query_pop (queue);
+        if (!query) {
+            trace ("artwork fetcher: waiting for signal ...\n");
+            // FIXME: use deadbeef->cond_wait
+            pthread_cond_wait ((pthread_cond_t *)queue_cond, (pthread_mutex_t *)queue_mutex);
+            continue;
         }
+        deadbeef->mutex_unlock (queue_mutex);
+
+        lookup_query (queue, query);
+
+        /* Look for what to do next */
+        deadbeef->mutex_lock (queue_mutex);
     }
     deadbeef->mutex_unlock (queue_mutex);
     trace ("artwork fetcher: terminate thread\n");
@@ -2044,17 +2342,102 @@ fetcher_thread (void *none)
 
 static void
 cover_get (ddb_cover_query_t *query, ddb_cover_callback_t callback) {
+    cover_query_t *q = new_query (query, callback);
+    if (!q) {
+        return;
+    }
     deadbeef->mutex_lock (queue_mutex);
-    enqueue_query (query, callback);
+    int merged = enqueue_query (q);
     deadbeef->mutex_unlock (queue_mutex);
+    if (merged) {
+        query_free (q);
+    }
 }
 
 static void
 artwork_reset (void) {
     trace ("artwork: reset queue\n");
-    deadbeef->mutex_lock (queue_mutex);
     queue_clear ();
+}
+
+static int64_t
+allocate_source_id (void) {
+    deadbeef->mutex_lock (queue_mutex);
+    int64_t source_id = ++last_source_id;
     deadbeef->mutex_unlock (queue_mutex);
+    return source_id;
+}
+
+// moves the callbacks with the given source_id into the cancelled list
+static void
+query_cancel_callbacks (cover_query_t *query, int64_t source_id, cover_callback_t **cancelled) {
+    cover_callback_t **c = &query->callbacks;
+    while (*c) {
+        cover_callback_t *callback = *c;
+        if (query_source_id (callback->info) == source_id) {
+            *c = callback->next;
+            callback->next = *cancelled;
+            *cancelled = callback;
+        }
+        else {
+            c = &callback->next;
+        }
+    }
+}
+
+// the queries nobody waits for anymore are moved into the dropped list
+static void
+queue_cancel (query_queue_t *queue, int64_t source_id, cover_callback_t **cancelled, cover_query_t **dropped) {
+    cover_query_t *prev = NULL;
+    cover_query_t *q = queue->head;
+    while (q) {
+        cover_query_t *next = q->next;
+        int had_callbacks = q->callbacks != NULL;
+        query_cancel_callbacks (q, source_id, cancelled);
+        if (had_callbacks && !q->callbacks) {
+            /* Nobody is waiting for it anymore */
+            if (prev) {
+                prev->next = next;
+            }
+            else {
+                queue->head = next;
+            }
+            if (queue->tail == q) {
+                queue->tail = prev;
+            }
+            q->next = *dropped;
+            *dropped = q;
+        }
+        else {
+            prev = q;
+        }
+        q = next;
+    }
+}
+
+static void
+cancel_queries_with_source_id (int64_t source_id) {
+    if (!source_id) {
+        return;
+    }
+
+    cover_callback_t *cancelled = NULL;
+    cover_query_t *dropped = NULL;
+    deadbeef->mutex_lock (queue_mutex);
+    queue_cancel (&local_queue, source_id, &cancelled, &dropped);
+    queue_cancel (&network_queue, source_id, &cancelled, &dropped);
+    /* The running lookups complete anyway, the cover still gets cached */
+    for (cover_query_t *q = active_queries; q; q = q->next) {
+        query_cancel_callbacks (q, source_id, &cancelled);
+    }
+    deadbeef->mutex_unlock (queue_mutex);
+
+    while (dropped) {
+        cover_query_t *next = dropped->next;
+        query_free (dropped);
+        dropped = next;
+    }
+    send_query_callbacks (cancelled, NULL);
 }
 
 static void
@@ -2153,14 +2536,17 @@ artwork_configchanged (void)
         strcmp(old_artwork_folders, artwork_folders)
         ) {
         trace ("artwork config changed, invalidating cache...\n");
-        deadbeef->mutex_lock (queue_mutex);
 
         // Submit a query for NULL image, with a callback that would reset the cache,
         // on the correct thread.
         ddb_cover_query_t *q = calloc (sizeof (ddb_cover_query_t), 1);
         q->user_data = &cache_reset_time;
-        enqueue_query (q, cache_reset_callback);
+        cover_query_t *reset_query = new_query (q, cache_reset_callback);
 
+        deadbeef->mutex_lock (queue_mutex);
+        if (reset_query) {
+            enqueue_query (reset_query);
+        }
         artwork_abort_http_request ();
         deadbeef->mutex_unlock (queue_mutex);
     }
@@ -2239,22 +2625,32 @@ artwork_get_actions (DB_playItem_t *it)
 static int
 artwork_plugin_stop (void)
 {
-    if (tid) {
-        trace ("Stopping fetcher thread ... \n");
-        deadbeef->mutex_lock (queue_mutex);
+    if (queue_mutex && queue_cond) {
+        trace ("Stopping fetcher threads ... \n");
         queue_clear ();
+        deadbeef->mutex_lock (queue_mutex);
         terminate = 1;
-        deadbeef->cond_signal (queue_cond);
-        while (queue) {
+        deadbeef->cond_broadcast (queue_cond);
+        while (active_queries) {
             artwork_abort_http_request ();
             deadbeef->mutex_unlock (queue_mutex);
             usleep (10000);
             deadbeef->mutex_lock (queue_mutex);
         }
         deadbeef->mutex_unlock (queue_mutex);
-        deadbeef->thread_join (tid);
-        tid = 0;
-        trace ("Fetcher thread stopped\n");
+        for (int i = 0; i < NUM_LOCAL_FETCHERS; i++) {
+            if (local_tids[i]) {
+                deadbeef->thread_join (local_tids[i]);
+                local_tids[i] = 0;
+            }
+        }
+        if (network_tid) {
+            deadbeef->thread_join (network_tid);
+            network_tid = 0;
+        }
+        /* Queries passed on to the web lookup thread after it has stopped */
+        queue_clear ();
+        trace ("Fetcher threads stopped\n");
     }
     if (queue_mutex) {
         deadbeef->mutex_free (queue_mutex);
@@ -2296,13 +2692,22 @@ artwork_plugin_start (void)
     imlib_set_cache_size (0);
 #endif
 
+    album_tf = deadbeef->tf_compile ("%album%");
+    artist_tf = deadbeef->tf_compile ("%artist%");
+
     terminate = 0;
     queue_mutex = deadbeef->mutex_create_nonrecursive ();
     queue_cond = deadbeef->cond_create ();
-    if (queue_mutex && queue_cond) {
-        tid = deadbeef->thread_start_low_priority (fetcher_thread, NULL);
+    int started = queue_mutex && queue_cond;
+    for (int i = 0; started && i < NUM_LOCAL_FETCHERS; i++) {
+        local_tids[i] = deadbeef->thread_start_low_priority (fetcher_thread, &local_queue);
+        started = local_tids[i] != 0;
+    }
+    if (started) {
+        network_tid = deadbeef->thread_start_low_priority (fetcher_thread, &network_queue);
+        started = network_tid != 0;
     }
-    if (!tid) {
+    if (!started) {
         artwork_plugin_stop ();
         return -1;
     }
@@ -2384,6 +2789,8 @@ static ddb_artwork_plugin_t plugin = {
     .cover_get = cover_get,
     .reset = artwork_reset,
     .cover_info_free = cover_info_free,
+    .allocate_source_id = allocate_source_id,
+    .cancel_queries_with_source_id = cancel_queries_with_source_id,
 };
 
 DB_plugin_t *
@@ -25,7 +25,7 @@
 #define __ARTWORK_H
 
 #define DDB_ARTWORK_MAJOR_VERSION 2
-#define DDB_ARTWORK_MINOR_VERSION 0
+#define DDB_ARTWORK_MINOR_VERSION 1
 
 // The flags below can be used in the `flags` member of the `ddb_cover_query_t` structure,
 // and can be OR'ed together.
@@ -47,6 +47,10 @@ enum {
 
     // Don't allow writing files to disk cache, even if the cache is enabled in the settings
     DDB_ARTWORK_FLAG_NO_CACHE = 0x00000004,
+
+    // Process the query before the ones without this flag, e.g. for the covers which are currently visible.
+    // The queries for the currently playing track are always processed first.
+    DDB_ARTWORK_FLAG_HIGH_PRIORITY = 0x00000008,
 };
 
 // This structure needs to be passed to cover_get.
@@ -63,6 +67,10 @@ typedef struct ddb_cover_query_s {
     struct DB_playItem_s *track; // The track to load artwork for
 
     char *type; // WIP: front/back/all/..., can be NULL for default (front cover)
+
+    // Added in 2.1
+    int64_t source_id; // The queries with the same non-zero source_id can be cancelled together,
+                       // use allocate_source_id to get a unique value.
 } ddb_cover_query_t;
 
 // This structure is passed to the callback, when the artwork query has been processed.
@@ -112,6 +120,19 @@ typedef struct {
     // Free dynamically allocated data pointed by `cover`.
     void
     (*cover_info_free) (ddb_cover_info_t *cover);
+
+    // Added in 2.1
+
+    // Returns a new unique non-zero value for the `source_id` member of `ddb_cover_query_t`
+    int64_t
+    (*allocate_source_id) (void);
+
+    // Calls the callbacks of all the queries with the given `source_id` with no results,
+    // e.g. when the covers are no longer visible.
+    // Queries already being looked up by another query for the same album will complete anyway,
+    // but without these callbacks.
+    void
+    (*cancel_queries_with_source_id) (int64_t source_id);
 } ddb_artwork_plugin_t;
 
 #endif /*__ARTWORK_H*/
@@ -114,7 +114,8 @@ check_dir (const char *path)
     int good_dir = check_dir (dname);
     free (dir);
     free (dname);
-    return good_dir && !mkdir (path, 0755);
+    /* Another fetcher thread may have created it meanwhile */
+    return good_dir && (!mkdir (path, 0755) || errno == EEXIST);
 }
 
 // check if directory of a supplied file exists,
@@ -131,6 +132,24 @@ ensure_dir (const char *path) {
     return res;
 }
 
+// Opens a new uniquely named file next to `path`, to be renamed to `path` when complete.
+// Several fetcher threads can be writing the same cache file at the same time.
+static FILE *
+open_temp_file (const char *path, char *tmp_path, size_t size) {
+    snprintf (tmp_path, size, "%s.part.XXXXXX", path);
+    int fd = mkstemp (tmp_path);
+    if (fd == -1) {
+        return NULL;
+    }
+    fchmod (fd, 0644);
+    FILE *fp = fdopen (fd, "w+b");
+    if (!fp) {
+        close (fd);
+        unlink (tmp_path);
+    }
+    return fp;
+}
+
 #define BUFFER_SIZE 4096
 int
 copy_file (const char *in, const char *out) {
@@ -141,8 +160,7 @@ copy_file (const char *in, const char *out) {
     }
 
     char tmp_out[PATH_MAX];
-    snprintf (tmp_out, PATH_MAX, "%s.part", out);
-    FILE *fout = fopen (tmp_out, "w+b");
+    FILE *fout = open_temp_file (out, tmp_out, sizeof (tmp_out));
     if (!fout) {
         trace ("artwork: failed to open file %s for writing\n", tmp_out);
         return -1;
@@ -151,6 +169,7 @@ copy_file (const char *in, const char *out) {
     DB_FILE *request = new_http_request (in);
     if (!request) {
         fclose (fout);
+        unlink (tmp_out);
         trace ("artwork: failed to open file %s for reading\n", in);
         return -1;
     }
@@ -189,8 +208,7 @@ int write_file (const char *out, const char *data, const size_t data_length)
     }
 
     char tmp_path[PATH_MAX];
-    snprintf (tmp_path, sizeof (tmp_path), "%s.part", out);
-    FILE *fp = fopen (tmp_path, "w+b");
+    FILE *fp = open_temp_file (out, tmp_path, sizeof (tmp_path));
     if (!fp) {
         trace ("artwork: failed to open %s for writing\n", tmp_path);
         return -1;
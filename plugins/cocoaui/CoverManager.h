@@ -31,4 +31,9 @@
 - (NSImage *)defaultCover;
 - (NSImage *)getCoverForTrack:(DB_playItem_t *)track withCallbackWhenReady:(void (*) (NSImage *img, void *user_data))callback withUserDataForCallback:(void *)user_data;
 
+// The requests with the same sourceId can be cancelled together, the callback then gets a nil image
+- (NSImage *)getCoverForTrack:(DB_playItem_t *)track sourceId:(int64_t)sourceId withCallbackWhenReady:(void (*) (NSImage *img, void *user_data))callback withUserDataForCallback:(void *)user_data;
+- (int64_t)allocateSourceId;
+- (void)cancelCoversWithSourceId:(int64_t)sourceId;
+
 @end
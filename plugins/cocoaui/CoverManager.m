@@ -36,6 +36,7 @@ static CoverManager *g_DefaultCoverManager = nil;
     NSImage *_defaultCover;
     NSMutableDictionary *_cachedCovers[CACHE_SIZE];
     char *_name_tf;
+    NSMutableSet *_cancelledSourceIds;
 }
 
 - (void)dealloc {
@@ -58,6 +59,7 @@ static CoverManager *g_DefaultCoverManager = nil;
     // This however would duplicate the same image, for every track in every album, if the custom grouping is set per file.
     //_name_tf = deadbeef->tf_compile ("b:%album%-a:%artist%-t:%title%");
     _name_tf = deadbeef->tf_compile ("%_path_raw%");
+    _cancelledSourceIds = [NSMutableSet new];
     return self;
 }
 
@@ -82,6 +84,25 @@ typedef struct {
     void *real_user_data;
 } cover_callback_info_t;
 
+- (BOOL)supportsSourceId {
+    return _artwork_plugin && _artwork_plugin->plugin.plugin.version_minor >= 1;
+}
+
+- (int64_t)allocateSourceId {
+    if (![self supportsSourceId]) {
+        return 0;
+    }
+    return _artwork_plugin->allocate_source_id ();
+}
+
+- (void)cancelCoversWithSourceId:(int64_t)sourceId {
+    if (!sourceId || ![self supportsSourceId]) {
+        return;
+    }
+    [_cancelledSourceIds addObject:@(sourceId)];
+    _artwork_plugin->cancel_queries_with_source_id (sourceId);
+}
+
 static void cover_loaded_callback (int error, ddb_cover_query_t *query, ddb_cover_info_t *cover) {
     // We want to load the images in background, to keep UI responsive
     CoverManager *cm = [CoverManager defaultCoverManager];
@@ -99,7 +120,12 @@ static void cover_loaded_callback (int error, ddb_cover_query_t *query, ddb_cove
     }
 
     dispatch_async(dispatch_get_main_queue(), ^{
-        if (img) {
+        if (!cover && query->source_id && [cm->_cancelledSourceIds containsObject:@(query->source_id)]) {
+            // cancelled, not a missing cover
+            cover_callback_info_t *info = query->user_data;
+            info->real_callback (nil, info->real_user_data);
+        }
+        else if (img) {
             [cm addCoverForTrack:query->track withImage:img];
             cover_callback_info_t *info = query->user_data;
             info->real_callback (img, info->real_user_data);
@@ -148,6 +174,10 @@ static void cover_loaded_callback (int error, ddb_cover_query_t *query, ddb_cove
 }
 
 - (NSImage *)getCoverForTrack:(DB_playItem_t *)track withCallbackWhenReady:(void (*) (NSImage *img, void *user_data))callback withUserDataForCallback:(void *)user_data {
+    return [self getCoverForTrack:track sourceId:0 withCallbackWhenReady:callback withUserDataForCallback:user_data];
+}
+
+- (NSImage *)getCoverForTrack:(DB_playItem_t *)track sourceId:(int64_t)sourceId withCallbackWhenReady:(void (*) (NSImage *img, void *user_data))callback withUserDataForCallback:(void *)user_data {
     if (!_artwork_plugin) {
         callback (nil, user_data);
         return nil;
@@ -169,6 +199,11 @@ static void cover_loaded_callback (int error, ddb_cover_query_t *query, ddb_cove
     ddb_cover_query_t *query = calloc (sizeof (ddb_cover_query_t), 1);
     query->_size = sizeof (ddb_cover_query_t);
     query->track = track;
+    if ([self supportsSourceId]) {
+        // the covers are requested when drawing, so they are visible
+        query->flags = DDB_ARTWORK_FLAG_HIGH_PRIORITY;
+        query->source_id = sourceId;
+    }
     deadbeef->pl_item_ref (track);
 
     cover_callback_info_t *info = calloc (sizeof (cover_callback_info_t), 1);
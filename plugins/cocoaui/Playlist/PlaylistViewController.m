@@ -56,11 +56,15 @@ extern DB_functions_t *deadbeef;
     char *_group_str;
     char *_group_bytecode;
     BOOL _pin_groups;
+    int64_t _coverSourceId;
 }
 
 - (void)cleanup {
     [self clearGrouping];
 
+    [[CoverManager defaultCoverManager] cancelCoversWithSourceId:_coverSourceId];
+    _coverSourceId = 0;
+
     if (self.playPosUpdateTimer) {
         [self.playPosUpdateTimer invalidate];
         self.playPosUpdateTimer = nil;
@@ -824,8 +828,10 @@ typedef struct {
 static void coverAvailCallback (NSImage *__strong img, void *user_data) {
     cover_avail_info_t *info = user_data;
     PlaylistViewController *ctl = (__bridge_transfer PlaylistViewController *)info->ctl;
-    PlaylistView *lv = (PlaylistView *)ctl.view;
-    [lv.contentView drawGroup:info->grp];
+    if (img) {
+        PlaylistView *lv = (PlaylistView *)ctl.view;
+        [lv.contentView drawGroup:info->grp];
+    }
     free (info);
 }
 
@@ -844,7 +850,7 @@ static void coverAvailCallback (NSImage *__strong img, void *user_data) {
     cover_avail_info_t *inf = calloc (sizeof (cover_avail_info_t), 1);
     inf->ctl = (__bridge_retained void *)self;
     inf->grp = groupIndex;
-    NSImage *image = [[CoverManager defaultCoverManager] getCoverForTrack:it withCallbackWhenReady:coverAvailCallback withUserDataForCallback:inf];
+    NSImage *image = [[CoverManager defaultCoverManager] getCoverForTrack:it sourceId:_coverSourceId withCallbackWhenReady:coverAvailCallback withUserDataForCallback:inf];
     if (!image) {
         // FIXME: the problem here is that if the cover is not found (yet) -- it won't draw anything, but the rect is already invalidated, and will come out as background color
         return;
@@ -1005,6 +1011,11 @@ static void coverAvailCallback (NSImage *__strong img, void *user_data) {
 }
 
 - (void)setupPlaylist:(PlaylistView *)listview {
+    // the covers requested for the previous playlist are not going to be drawn
+    CoverManager *coverManager = [CoverManager defaultCoverManager];
+    [coverManager cancelCoversWithSourceId:_coverSourceId];
+    _coverSourceId = [coverManager allocateSourceId];
+
     ddb_playlist_t *plt = deadbeef->plt_get_curr ();
     if (plt) {
         deadbeef->pl_lock ();
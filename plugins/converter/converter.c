@@ -37,6 +37,12 @@
 #include <unistd.h>
 #include <inttypes.h>
 #include <errno.h>
+#include <sys/time.h>
+#ifndef _WIN32
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#endif
 #include "converter.h"
 #include "../../deadbeef.h"
 #include "../../strdupa.h"
@@ -50,6 +56,14 @@ static ddb_converter_t plugin;
 
 #define min(x,y) ((x)<(y)?(x):(y))
 
+#ifndef _WIN32
+// DDB_ENCODER_METHOD_FILE encoders read from a named pipe, while the track is being decoded
+#define CONVERTER_USE_FIFO 1
+#endif
+
+// how much decoded data may be queued for the encoder, when writing to a pipe
+#define ENCODER_PIPE_BUFFER_SIZE (1024*1024)
+
 #define trace(...) { deadbeef->log_detailed (&plugin.misc.plugin, 0, __VA_ARGS__); }
 #define trace_err(...) { deadbeef->log_detailed (&plugin.misc.plugin, DDB_LOG_LAYER_DEFAULT, __VA_ARGS__); }
 
@@ -146,6 +160,9 @@ encoder_preset_load (const char *fname) {
         else if (!strcmp (str, "tag_mp4")) {
             p->tag_mp4 = atoi (item);
         }
+        else if (!strcmp (str, "seekable_input")) {
+            p->seekable_input = atoi (item);
+        }
     }
 
     if (!p->title) {
@@ -215,6 +232,7 @@ encoder_preset_save (ddb_encoder_preset_t *p, int overwrite) {
     fprintf (fp, "tag_flac %d\n", p->tag_flac);
     fprintf (fp, "tag_oggvorbis %d\n", p->tag_oggvorbis);
     fprintf (fp, "tag_mp4 %d\n", p->tag_mp4);
+    fprintf (fp, "seekable_input %d\n", p->seekable_input);
 
     fclose (fp);
     return 0;
@@ -234,6 +252,7 @@ encoder_preset_copy (ddb_encoder_preset_t *to, ddb_encoder_preset_t *from) {
     to->tag_mp4 = from->tag_mp4;
     to->tag_mp3xing = from->tag_mp3xing;
     to->id3v2_version = from->id3v2_version;
+    to->seekable_input = from->seekable_input;
 }
 
 ddb_encoder_preset_t *
@@ -305,7 +324,7 @@ dsp_preset_alloc (void) {
     return p;
 }
 
-void
+static void
 dsp_preset_free (ddb_dsp_preset_t *p) {
     if (p) {
         if (p->title) {
@@ -347,7 +366,7 @@ dsp_preset_get_list (void) {
     return dsp_presets;
 }
 
-ddb_dsp_preset_t *
+static ddb_dsp_preset_t *
 dsp_preset_load (const char *fname) {
     ddb_dsp_preset_t *p = dsp_preset_alloc ();
     if (!p) {
@@ -377,7 +396,7 @@ dsp_preset_load (const char *fname) {
     return p;
 }
 
-int
+static int
 dsp_preset_save (ddb_dsp_preset_t *p, int overwrite) {
     if (!p->title || !p->title[0]) {
         trace ("dsp_preset_save: empty title\n");
@@ -849,7 +868,7 @@ static const unsigned char format_id_pcm[] = {
 };
 
 static int64_t
-_write_wav (DB_playItem_t *it, DB_decoder_t *dec, DB_fileinfo_t *fileinfo, ddb_dsp_preset_t *dsp_preset, ddb_encoder_preset_t *encoder_preset, int *abort, int fd, int output_bps, int output_is_float) {
+_write_wav (DB_playItem_t *it, DB_decoder_t *dec, DB_fileinfo_t *fileinfo, ddb_dsp_preset_t *dsp_preset, ddb_encoder_preset_t *encoder_preset, int *abort, int fd, int seekable, int output_bps, int output_is_float) {
     int64_t res = -1;
     char *buffer = NULL;
     char *dspbuffer = NULL;
@@ -861,6 +880,7 @@ _write_wav (DB_playItem_t *it, DB_decoder_t *dec, DB_fileinfo_t *fileinfo, ddb_d
     char wavehdr[0x50];
     int header_written = 0;
     int64_t outsize = 0;
+    uint64_t datasize = 0;
     uint32_t outsr = fileinfo->fmt.samplerate;
     uint16_t outch = fileinfo->fmt.channels;
 
@@ -938,7 +958,11 @@ _write_wav (DB_playItem_t *it, DB_decoder_t *dec, DB_fileinfo_t *fileinfo, ddb_d
         if (!header_written) {
             int64_t startsample = deadbeef->pl_item_get_startsample (it);
             int64_t endsample = deadbeef->pl_item_get_endsample (it);
-            uint64_t size = (int64_t)(endsample-startsample) * outch * output_bps / 8;
+            uint64_t size = 0;
+            if (endsample > 0) {
+                // endsample is inclusive
+                size = (uint64_t)(endsample - startsample + 1) * outch * output_bps / 8;
+            }
             if (!size) {
                 size = (double)deadbeef->pl_get_item_duration (it) * fileinfo->fmt.samplerate * outch * output_bps / 8;
 
@@ -950,6 +974,7 @@ _write_wav (DB_playItem_t *it, DB_decoder_t *dec, DB_fileinfo_t *fileinfo, ddb_d
                 temp /= fileinfo->fmt.samplerate;
                 size  = temp;
             }
+            datasize = size;
 
             uint64_t chunksize;
             chunksize = size + 40;
@@ -1029,10 +1054,16 @@ _write_wav (DB_playItem_t *it, DB_decoder_t *dec, DB_fileinfo_t *fileinfo, ddb_d
         }
     }
 
+    if (!seekable && encoder_preset->method == DDB_ENCODER_METHOD_FILE && (uint64_t)outsize != datasize) {
+        // the encoder has already consumed the header, which can't be rewritten in a pipe
+        trace_err ("converter: %"PRId64" bytes written, while the wave header says %"PRIu64"\n", outsize, datasize);
+        goto error;
+    }
+
     res = outsize;
 
     // rewrite wave data size
-    if (encoder_preset->method == DDB_ENCODER_METHOD_FILE) {
+    if (seekable) {
         uint32_t writesize;
 
         // RIFF chunk size
@@ -1315,8 +1346,80 @@ _converter_write_tags (ddb_encoder_preset_t *encoder_preset, DB_playItem_t *it,
     return err;
 }
 
+static void
+_set_pipe_buffer_size (int fd) {
+#ifdef F_SETPIPE_SZ
+    // best effort, the default is only 64KB, which makes the decoder and the encoder wait on each other
+    (void)fcntl (fd, F_SETPIPE_SZ, ENCODER_PIPE_BUFFER_SIZE);
+#endif
+}
+
+#if CONVERTER_USE_FIFO
+static void
+_consume_pending_sigpipe (void) {
+    sigset_t pending;
+    sigpending (&pending);
+    if (sigismember (&pending, SIGPIPE)) {
+        sigset_t sigpipe_set;
+        sigemptyset (&sigpipe_set);
+        sigaddset (&sigpipe_set, SIGPIPE);
+        int sig;
+        sigwait (&sigpipe_set, &sig);
+    }
+}
+#endif
+
+// Runs the encoder with the default SIGPIPE handling, even though the calling thread blocks SIGPIPE
+static FILE *
+_popen_encoder (const char *cmd) {
+#if CONVERTER_USE_FIFO
+    sigset_t sigpipe_set, oldset;
+    sigemptyset (&sigpipe_set);
+    sigaddset (&sigpipe_set, SIGPIPE);
+    _consume_pending_sigpipe ();
+    pthread_sigmask (SIG_UNBLOCK, &sigpipe_set, &oldset);
+    FILE *fp = popen (cmd, "w");
+    pthread_sigmask (SIG_SETMASK, &oldset, NULL);
+    return fp;
+#else
+    return popen (cmd, "w");
+#endif
+}
+
+#if CONVERTER_USE_FIFO
+// Waits for the encoder to open the named pipe for reading.
+// Returns the write end of the pipe, or -1 if the encoder has exited without opening it, or on abort.
 static int
-convert2 (ddb_converter_settings_t *settings, DB_playItem_t *it, const char *out, int *pabort) {
+_open_fifo_for_encoder (const char *path, FILE *enc_pipe, int *pabort) {
+    for (;;) {
+        int fd = open (path, O_WRONLY | O_NONBLOCK);
+        if (fd != -1) {
+            fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) & ~O_NONBLOCK);
+            _set_pipe_buffer_size (fd);
+            return fd;
+        }
+        if (errno != ENXIO && errno != EINTR) {
+            return -1;
+        }
+        if (pabort && *pabort) {
+            return -1;
+        }
+
+        // the encoder's stdin gets closed when it exits
+        struct pollfd pfd = {
+            .fd = fileno (enc_pipe),
+            .events = POLLOUT,
+        };
+        if (poll (&pfd, 1, 0) > 0 && (pfd.revents & (POLLERR | POLLHUP))) {
+            return -1;
+        }
+        usleep (10000);
+    }
+}
+#endif
+
+static int
+_convert (ddb_converter_settings_t *settings, DB_playItem_t *it, const char *out, int *pabort, int allow_streaming, int *streamed) {
     int output_bps = settings->output_bps;
     int output_is_float = settings->output_is_float;
     ddb_encoder_preset_t *encoder_preset = settings->encoder_preset;
@@ -1359,6 +1462,7 @@ convert2 (ddb_converter_settings_t *settings, DB_playItem_t *it, const char *out
     int err = -1;
     FILE *enc_pipe = NULL;
     int temp_file = -1;
+    int streaming = 0;
     DB_decoder_t *dec = NULL;
     DB_fileinfo_t *fileinfo = NULL;
     char input_file_name[PATH_MAX] = "";
@@ -1403,6 +1507,14 @@ convert2 (ddb_converter_settings_t *settings, DB_playItem_t *it, const char *out
                         snprintf (input_file_name, sizeof (input_file_name), "%s/ddbconvXXXXXX", tmp);
                         (void)mktemp (input_file_name);
                         strcat (input_file_name, ".wav");
+#if CONVERTER_USE_FIFO
+                        // the wave header can't be fixed up in a pipe, so only stream when the data size is known exactly:
+                        // the track has an end sample, and no dsp can change the sample count
+                        if (allow_streaming && encoder_preset->encoder[0] && !encoder_preset->seekable_input
+                            && deadbeef->pl_item_get_endsample (it) > 0 && (!dsp_preset || !dsp_preset->chain)) {
+                            streaming = !mkfifo (input_file_name, S_IRUSR | S_IWUSR);
+                        }
+#endif
                     }
                         break;
                     case DDB_ENCODER_METHOD_PIPE:
@@ -1427,6 +1539,21 @@ convert2 (ddb_converter_settings_t *settings, DB_playItem_t *it, const char *out
                         goto error;
                     }
                 }
+#if CONVERTER_USE_FIFO
+                else if (streaming) {
+                    enc_pipe = _popen_encoder (enc);
+                    if (!enc_pipe) {
+                        trace ("Failed to execute the encoder, command used:\n%s\n", enc);
+                        goto error;
+                    }
+                    *streamed = 1;
+                    temp_file = _open_fifo_for_encoder (input_file_name, enc_pipe, pabort);
+                    if (temp_file == -1) {
+                        trace ("The encoder didn't open its input file, command used:\n%s\n", enc);
+                        goto error;
+                    }
+                }
+#endif
                 else if (encoder_preset->method == DDB_ENCODER_METHOD_FILE) {
                     temp_file = open (input_file_name, O_LARGEFILE | O_WRONLY | O_CREAT | O_TRUNC, wrmode);
                     if (temp_file == -1) {
@@ -1435,11 +1562,12 @@ convert2 (ddb_converter_settings_t *settings, DB_playItem_t *it, const char *out
                     }
                 }
                 else {
-                    enc_pipe = popen (enc, "w");
+                    enc_pipe = _popen_encoder (enc);
                     if (!enc_pipe) {
                         trace ("Failed to execute the encoder, command used:\n%s\n", enc[0] ? enc : "internal RIFF WAVE writer");
                         goto error;
                     }
+                    _set_pipe_buffer_size (fileno (enc_pipe));
                 }
 
                 if (encoder_preset->method == DDB_ENCODER_METHOD_FILE || encoder_preset->method == DDB_ENCODER_METHOD_PIPE) {
@@ -1449,7 +1577,7 @@ convert2 (ddb_converter_settings_t *settings, DB_playItem_t *it, const char *out
                 }
 
                 if (temp_file > 0) {
-                    int64_t outsize = _write_wav (it, dec, fileinfo, dsp_preset, encoder_preset, pabort, temp_file, output_bps, output_is_float);
+                    int64_t outsize = _write_wav (it, dec, fileinfo, dsp_preset, encoder_preset, pabort, temp_file, encoder_preset->method == DDB_ENCODER_METHOD_FILE && !streaming, output_bps, output_is_float);
 
                     if (outsize < 0) {
                         goto error;
@@ -1475,8 +1603,8 @@ convert2 (ddb_converter_settings_t *settings, DB_playItem_t *it, const char *out
         }
     }
 
-    if (enc[0] && (encoder_preset->method == DDB_ENCODER_METHOD_FILE || encoder_preset->method == DDB_ENCODER_METHOD_FILENAME)) {
-        enc_pipe = popen (enc, "w");
+    if (enc[0] && !streaming && (encoder_preset->method == DDB_ENCODER_METHOD_FILE || encoder_preset->method == DDB_ENCODER_METHOD_FILENAME)) {
+        enc_pipe = _popen_encoder (enc);
     }
 
     err = 0;
@@ -1486,9 +1614,8 @@ error:
         temp_file = -1;
     }
     if (enc_pipe) {
-        err = pclose (enc_pipe);
-        err = WEXITSTATUS(err);
-        if (err) {
+        int status = pclose (enc_pipe);
+        if (WEXITSTATUS(status)) {
             trace ("Failed to execute the encoder, command used:\n%s\n", enc[0] ? enc : "internal RIFF WAVE writer");
             err = -1;
         }
@@ -1513,6 +1640,50 @@ error:
     return err;
 }
 
+static int
+_convert_timed (ddb_converter_settings_t *settings, DB_playItem_t *it, const char *out, int *pabort, float *realtime) {
+#if CONVERTER_USE_FIFO
+    // an encoder exiting early would otherwise kill the player with SIGPIPE, instead of failing the write
+    sigset_t sigpipe_set, oldset;
+    sigemptyset (&sigpipe_set);
+    sigaddset (&sigpipe_set, SIGPIPE);
+    pthread_sigmask (SIG_BLOCK, &sigpipe_set, &oldset);
+#endif
+
+    struct timeval tm1, tm2;
+    gettimeofday (&tm1, NULL);
+
+    int streamed = 0;
+    int res = _convert (settings, it, out, pabort, 1, &streamed);
+    if (res && streamed && !(pabort && *pabort)) {
+        // some encoders can't read from a pipe
+        trace ("converter: failed to stream %s to the encoder, retrying with a temporary file\n", out);
+        res = _convert (settings, it, out, pabort, 0, &streamed);
+    }
+
+    gettimeofday (&tm2, NULL);
+    float elapsed = (tm2.tv_sec - tm1.tv_sec) + (tm2.tv_usec - tm1.tv_usec) / 1000000.f;
+    float speed = 0;
+    if (!res && elapsed > 0) {
+        speed = deadbeef->pl_get_item_duration (it) / elapsed;
+        deadbeef->log_detailed (&plugin.misc.plugin, DDB_LOG_LAYER_INFO, "converter: %s converted at %.1fx realtime\n", out, speed);
+    }
+    if (realtime) {
+        *realtime = speed;
+    }
+
+#if CONVERTER_USE_FIFO
+    _consume_pending_sigpipe ();
+    pthread_sigmask (SIG_SETMASK, &oldset, NULL);
+#endif
+    return res;
+}
+
+static int
+convert2 (ddb_converter_settings_t *settings, DB_playItem_t *it, const char *out, int *pabort) {
+    return _convert_timed (settings, it, out, pabort, NULL);
+}
+
 static int
 convert (DB_playItem_t *it, const char *out, int output_bps, int output_is_float, ddb_encoder_preset_t *encoder_preset, ddb_dsp_preset_t *dsp_preset, int *abort) {
     ddb_converter_settings_t settings = {
@@ -1532,6 +1703,172 @@ convert_1_0 (DB_playItem_t *it, const char *outfolder, const char *outfile, int
     return -1;
 }
 
+typedef struct {
+    ddb_converter_batch_t *batch;
+    int *pabort;
+    uintptr_t mutex;
+    int next; // next track to start
+    int next_report; // next track to report the progress for
+    int *results;
+    char **outpaths; // output paths of the started tracks
+    uintptr_t cond; // signaled when a track has finished
+    int failed;
+} convert_batch_state_t;
+
+#define CONVERT_BATCH_PENDING -100
+
+// Called with the mutex locked, reports the progress for the finished tracks in order
+static void
+convert_batch_report (convert_batch_state_t *state) {
+    ddb_converter_batch_t *batch = state->batch;
+    while (state->next_report < batch->count && state->results[state->next_report] != CONVERT_BATCH_PENDING) {
+        int result = state->results[state->next_report];
+        if (result == DDB_CONVERTER_RESULT_FAILED) {
+            state->failed++;
+        }
+        if (batch->results) {
+            batch->results[state->next_report] = result;
+        }
+        if (batch->progress) {
+            batch->progress (batch->user_data, state->next_report, result);
+        }
+        state->next_report++;
+    }
+}
+
+static void
+convert_batch_worker (void *ctx) {
+    convert_batch_state_t *state = ctx;
+    ddb_converter_batch_t *batch = state->batch;
+
+    // the DSP plugin instances keep state, so each thread needs its own copy of the chain
+    ddb_converter_settings_t settings = *batch->settings;
+    if (settings.dsp_preset) {
+        settings.dsp_preset = dsp_preset_alloc ();
+        dsp_preset_copy (settings.dsp_preset, batch->settings->dsp_preset);
+    }
+
+    for (;;) {
+        char outpath[PATH_MAX];
+        int result = DDB_CONVERTER_RESULT_OK;
+
+        deadbeef->mutex_lock (state->mutex);
+        int idx = state->next;
+        if (idx >= batch->count) {
+            deadbeef->mutex_unlock (state->mutex);
+            break;
+        }
+        state->next++;
+        if (state->pabort && *state->pabort) {
+            result = DDB_CONVERTER_RESULT_CANCELLED;
+        }
+        else if (batch->prepare) {
+            outpath[0] = 0;
+            if (batch->prepare (batch->user_data, idx, outpath, sizeof (outpath))) {
+                result = DDB_CONVERTER_RESULT_SKIPPED;
+            }
+        }
+        else {
+            snprintf (outpath, sizeof (outpath), "%s", batch->outpaths[idx]);
+        }
+        if (result == DDB_CONVERTER_RESULT_OK) {
+            // the tracks with the same output path are converted one after another, in order,
+            // all the previous tracks have been started at this point
+            state->outpaths[idx] = strdup (outpath);
+            for (int i = 0; i < idx; i++) {
+                while (state->results[i] == CONVERT_BATCH_PENDING && state->outpaths[i] && !strcmp (state->outpaths[i], outpath)) {
+                    // deadbeef->cond_wait would lock the mutex again
+                    pthread_cond_wait ((pthread_cond_t *)state->cond, (pthread_mutex_t *)state->mutex);
+                }
+            }
+        }
+        deadbeef->mutex_unlock (state->mutex);
+
+        float realtime = 0;
+        if (result == DDB_CONVERTER_RESULT_OK) {
+            if (_convert_timed (&settings, batch->items[idx], outpath, state->pabort, &realtime)) {
+                result = state->pabort && *state->pabort ? DDB_CONVERTER_RESULT_CANCELLED : DDB_CONVERTER_RESULT_FAILED;
+            }
+        }
+
+        if (batch->realtime) {
+            batch->realtime[idx] = realtime;
+        }
+
+        deadbeef->mutex_lock (state->mutex);
+        state->results[idx] = result;
+        convert_batch_report (state);
+        deadbeef->cond_broadcast (state->cond);
+        deadbeef->mutex_unlock (state->mutex);
+    }
+
+    if (settings.dsp_preset) {
+        dsp_preset_free (settings.dsp_preset);
+    }
+}
+
+static int
+convert_batch_cpu_count (void) {
+#ifdef _SC_NPROCESSORS_ONLN
+    long n = sysconf (_SC_NPROCESSORS_ONLN);
+    if (n > 0) {
+        return (int)n;
+    }
+#endif
+    return 1;
+}
+
+static int
+convert_batch (ddb_converter_batch_t *batch, int *pabort) {
+    if (!batch->settings || !batch->items || (!batch->prepare && !batch->outpaths)) {
+        return -1;
+    }
+    if (batch->count <= 0) {
+        return 0;
+    }
+
+    int numthreads = batch->numthreads;
+    if (numthreads <= 0) {
+        numthreads = convert_batch_cpu_count ();
+    }
+    if (numthreads > batch->count) {
+        numthreads = batch->count;
+    }
+    if (numthreads < 1) {
+        numthreads = 1;
+    }
+
+    convert_batch_state_t state = {
+        .batch = batch,
+        .pabort = pabort,
+        .mutex = deadbeef->mutex_create_nonrecursive (),
+        .cond = deadbeef->cond_create (),
+    };
+    state.results = malloc (batch->count * sizeof (int));
+    state.outpaths = calloc (batch->count, sizeof (char *));
+    for (int i = 0; i < batch->count; i++) {
+        state.results[i] = CONVERT_BATCH_PENDING;
+    }
+
+    intptr_t *tids = malloc (numthreads * sizeof (intptr_t));
+    for (int i = 0; i < numthreads; i++) {
+        tids[i] = deadbeef->thread_start (convert_batch_worker, &state);
+    }
+    for (int i = 0; i < numthreads; i++) {
+        deadbeef->thread_join (tids[i]);
+    }
+    free (tids);
+
+    deadbeef->cond_free (state.cond);
+    deadbeef->mutex_free (state.mutex);
+    for (int i = 0; i < batch->count; i++) {
+        free (state.outpaths[i]);
+    }
+    free (state.outpaths);
+    free (state.results);
+    return state.failed;
+}
+
 int
 converter_cmd (int cmd, ...) {
     return -1;
@@ -1557,7 +1894,7 @@ static ddb_converter_t plugin = {
     .misc.plugin.api_vmajor = DB_API_VERSION_MAJOR,
     .misc.plugin.api_vminor = DB_API_VERSION_MINOR,
     .misc.plugin.version_major = 1,
-    .misc.plugin.version_minor = 5,
+    .misc.plugin.version_minor = 6,
     .misc.plugin.flags = DDB_PLUGIN_FLAG_LOGGING,
     .misc.plugin.type = DB_PLUGIN_MISC,
     .misc.plugin.name = "Converter",
@@ -1624,6 +1961,8 @@ static ddb_converter_t plugin = {
     .get_output_path2 = get_output_path2,
     // 1.5 entry points
     .convert2 = convert2,
+    // 1.6 entry points
+    .convert_batch = convert_batch,
 };
 
 DB_plugin_t *
@@ -26,6 +26,9 @@
 #include <stdint.h>
 #include "../../deadbeef.h"
 
+// changes in 1.6:
+//   added `convert_batch` function, which converts multiple tracks on a pool of worker threads
+//   DDB_ENCODER_METHOD_FILE encoders are fed through a named pipe while decoding, unless `seekable_input` is set
 // changes in 1.5:
 //   added mp4 tagging support
 //   added converter option to copy files without conversion, if file format isn't changing
@@ -74,6 +77,9 @@ typedef struct ddb_encoder_preset_s {
 
     // added in converter-1.3
     int readonly; // this means the preset cannot be edited
+
+    // added in converter-1.6
+    int seekable_input; // DDB_ENCODER_METHOD_FILE encoder needs a seekable temporary file, instead of a named pipe
 } ddb_encoder_preset_t;
 
 typedef struct ddb_dsp_preset_s {
@@ -102,6 +108,50 @@ typedef struct ddb_converter_settings_s {
     int rewrite_tags_after_copy;
 } ddb_converter_settings_t;
 
+// added in converter-1.6
+enum {
+    DDB_CONVERTER_RESULT_OK = 0,
+    DDB_CONVERTER_RESULT_FAILED = -1,
+    DDB_CONVERTER_RESULT_SKIPPED = 1,
+    DDB_CONVERTER_RESULT_CANCELLED = 2,
+};
+
+// added in converter-1.6
+typedef struct ddb_converter_batch_s {
+    // converter settings, used for all the tracks
+    ddb_converter_settings_t *settings;
+
+    // number of tracks
+    int count;
+
+    // tracks to convert
+    DB_playItem_t **items;
+
+    // fully qualified output paths for each track, used when `prepare` is NULL.
+    // the tracks with the same output path are converted one after another, in the order of the tracks.
+    const char **outpaths;
+
+    // optional, called before converting each track, in the order of the tracks, never concurrently.
+    // should write the output path for the track idx to `outpath`,
+    // and return 0 to convert the track, or non-zero to skip it.
+    int (*prepare) (void *user_data, int idx, char *outpath, int size);
+
+    // optional, called when a track has been processed, in the order of the tracks, never concurrently.
+    // result is one of DDB_CONVERTER_RESULT_*
+    void (*progress) (void *user_data, int idx, int result);
+
+    void *user_data;
+
+    // number of worker threads, 0 to use the number of CPUs
+    int numthreads;
+
+    // optional, receives DDB_CONVERTER_RESULT_* for each track
+    int *results;
+
+    // optional, receives the conversion speed of each track, as a multiple of realtime, or 0 if it wasn't converted
+    float *realtime;
+} ddb_converter_batch_t;
+
 typedef struct {
     DB_misc_t misc;
 
@@ -266,6 +316,14 @@ typedef struct {
          // *pabort will be checked regularly, conversion will be interrupted if it's non-zero
          int *pabort
     );
+
+    // since 1.6
+    // Converts the tracks concurrently, using `convert2` on a pool of worker threads,
+    // and returns when all of them are processed.
+    // Setting *pabort to non-zero interrupts the tracks being converted, and cancels the rest.
+    // Returns the number of tracks which failed to convert.
+    int
+    (*convert_batch) (ddb_converter_batch_t *batch, int *pabort);
 } ddb_converter_t;
 
 #endif
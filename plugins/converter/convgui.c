@@ -168,6 +168,49 @@ overwrite_prompt (const char *outpath) {
     return ctl.result;
 }
 
+typedef struct {
+    converter_ctx_t *conv;
+    const char *root;
+} converter_batch_ctx_t;
+
+// called by the converter for each track, before it's queued for conversion
+static int
+converter_batch_prepare (void *user_data, int idx, char *outpath, int size) {
+    converter_batch_ctx_t *bctx = user_data;
+    converter_ctx_t *conv = bctx->conv;
+    DB_playItem_t *it = conv->convert_items[idx];
+
+    update_progress_info_t *info = malloc (sizeof (update_progress_info_t));
+    info->entry = conv->progress_entry;
+    g_object_ref (info->entry);
+    deadbeef->pl_lock ();
+    info->text = strdup (deadbeef->pl_find_meta (it, ":URI"));
+    deadbeef->pl_unlock ();
+    g_idle_add (update_progress_cb, info);
+
+    converter_plugin->get_output_path2 (it, conv->convert_playlist, conv->outfolder, conv->outfile, conv->encoder_preset, conv->preserve_folder_structure, bctx->root, conv->write_to_source_folder, outpath, size);
+
+    int skip = 0;
+    char *real_out = realpath(outpath, NULL);
+    if (real_out) {
+        skip = 1;
+        deadbeef->pl_lock();
+        char *real_in = realpath(deadbeef->pl_find_meta(it, ":URI"), NULL);
+        deadbeef->pl_unlock();
+        const int paths_match = real_in && !strcmp(real_in, real_out);
+        free(real_in);
+        free(real_out);
+        if (paths_match) {
+            fprintf (stderr, "converter: destination file is the same as source file, skipping\n");
+        }
+        else if (conv->overwrite_action == 2 || (conv->overwrite_action == 1 && overwrite_prompt(outpath))) {
+            unlink (outpath);
+            skip = 0;
+        }
+    }
+    return skip;
+}
+
 static void
 converter_worker (void *ctx) {
     deadbeef->background_job_increment ();
@@ -218,46 +261,23 @@ converter_worker (void *ctx) {
         .rewrite_tags_after_copy = conv->retag_after_copy,
     };
 
-    for (int n = 0; n < conv->convert_items_count; n++) {
-        update_progress_info_t *info = malloc (sizeof (update_progress_info_t));
-        info->entry = conv->progress_entry;
-        g_object_ref (info->entry);
-        deadbeef->pl_lock ();
-        info->text = strdup (deadbeef->pl_find_meta (conv->convert_items[n], ":URI"));
-        deadbeef->pl_unlock ();
-        g_idle_add (update_progress_cb, info);
-
-        char outpath[2000];
-        converter_plugin->get_output_path2 (conv->convert_items[n], conv->convert_playlist, conv->outfolder, conv->outfile, conv->encoder_preset, conv->preserve_folder_structure, root, conv->write_to_source_folder, outpath, sizeof (outpath));
-
-        int skip = 0;
-        char *real_out = realpath(outpath, NULL);
-        if (real_out) {
-            skip = 1;
-            deadbeef->pl_lock();
-            char *real_in = realpath(deadbeef->pl_find_meta(conv->convert_items[n], ":URI"), NULL);
-            deadbeef->pl_unlock();
-            const int paths_match = real_in && !strcmp(real_in, real_out);
-            free(real_in);
-            free(real_out);
-            if (paths_match) {
-                fprintf (stderr, "converter: destination file is the same as source file, skipping\n");
-            }
-            else if (conv->overwrite_action == 2 || (conv->overwrite_action == 1 && overwrite_prompt(outpath))) {
-                unlink (outpath);
-                skip = 0;
-            }
-        }
+    converter_batch_ctx_t bctx = {
+        .conv = conv,
+        .root = root,
+    };
 
-        if (!skip) {
-            converter_plugin->convert2 (&settings, conv->convert_items[n], outpath, &conv->cancelled);
-        }
-        if (conv->cancelled) {
-            for (; n < conv->convert_items_count; n++) {
-                deadbeef->pl_item_unref (conv->convert_items[n]);
-            }
-            break;
-        }
+    ddb_converter_batch_t batch = {
+        .settings = &settings,
+        .count = conv->convert_items_count,
+        .items = conv->convert_items,
+        .prepare = converter_batch_prepare,
+        .user_data = &bctx,
+        .numthreads = deadbeef->conf_get_int ("converter.threads", 1),
+    };
+
+    converter_plugin->convert_batch (&batch, &conv->cancelled);
+
+    for (int n = 0; n < conv->convert_items_count; n++) {
         deadbeef->pl_item_unref (conv->convert_items[n]);
     }
     g_idle_add (destroy_progress_cb, conv->progress);
@@ -590,6 +610,7 @@ converter_show_cb (void *data) {
     gtk_widget_set_sensitive (lookup_widget (conv->converter, "output_folder"), !write_to_source_folder);
     gtk_widget_set_sensitive (lookup_widget (conv->converter, "preserve_folders"), !write_to_source_folder);
     gtk_combo_box_set_active (GTK_COMBO_BOX (lookup_widget (conv->converter, "overwrite_action")), deadbeef->conf_get_int ("converter.overwrite_action", 0));
+    gtk_spin_button_set_value (GTK_SPIN_BUTTON (lookup_widget (conv->converter, "numthreads")), deadbeef->conf_get_int ("converter.threads", 1));
     deadbeef->conf_unlock ();
 
     GtkComboBox *combo;
@@ -1816,7 +1837,7 @@ convgui_connect (void) {
         fprintf (stderr, "convgui: converter plugin not found\n");
         return -1;
     }
-#define REQ_CONV_VERSION 4
+#define REQ_CONV_VERSION 6
     if (!PLUG_TEST_COMPAT(&converter_plugin->misc.plugin, 1, REQ_CONV_VERSION)) {
         fprintf (stderr, "convgui: need converter>=1.%d, but found %d.%d\n", REQ_CONV_VERSION, converter_plugin->misc.plugin.version_major, converter_plugin->misc.plugin.version_minor);
         return -1;
@@ -1846,7 +1867,7 @@ convgui_start (void) {
 DB_misc_t plugin = {
     DDB_PLUGIN_SET_API_VERSION
     .plugin.version_major = 1,
-    .plugin.version_minor = 2,
+    .plugin.version_minor = 3,
     .plugin.type = DB_PLUGIN_MISC,
 #if GTK_CHECK_VERSION(3,0,0)
     .plugin.name = "Converter GTK3 UI",
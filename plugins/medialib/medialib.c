@@ -22,13 +22,22 @@
 */
 
 #include <sys/time.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
 #include <limits.h>
 #include <assert.h>
 #include "../../deadbeef.h"
+#include "medialib.h"
 
-DB_functions_t *deadbeef;
+//#define trace(...) { fprintf(stderr, __VA_ARGS__); }
+#define trace(fmt,...)
+
+static DB_functions_t *deadbeef;
 
 static int filter_id;
 
@@ -123,10 +132,269 @@ REG_COL_DEF(artist);
 REG_COL_DEF(genre);
 REG_COL_DEF(folder);
 
-DB_playItem_t *(*plt_insert_dir) (ddb_playlist_t *plt, DB_playItem_t *after, const char *dirname, int *pabort, int (*cb)(DB_playItem_t *it, void *data), void *user_data);
+// Modification time and size of each scanned file and folder, persisted in medialib.stat.
+// Used to only re-read the files which have changed since the previous scan:
+// if a folder mtime didn't change, no files were added to or removed from it,
+// so its files are neither stat'ed, nor re-read. Otherwise the known files are
+// checked for mtime / size changes, and the new ones are added.
+typedef struct ml_stat_s {
+    const char *path; // metacache string
+    int64_t mtime; // -1 if the path doesn't exist anymore
+    int64_t size;
+    int scan_id; // the last scan which checked this path
+    int changed; // the result of that check
+    struct ml_stat_s *bucket_next;
+} ml_stat_t;
+
+#define ML_STAT_HASH_SIZE 65536
+
+static ml_stat_t *folder_stats[ML_STAT_HASH_SIZE];
+static ml_stat_t *file_stats[ML_STAT_HASH_SIZE];
+static int scan_id;
+static time_t scan_start;
+
+static uint32_t
+ml_stat_hash (const char *path) {
+    uintptr_t h = (uintptr_t)path;
+    return (uint32_t)((h >> 4) ^ (h >> 20)) & (ML_STAT_HASH_SIZE-1);
+}
+
+// path must be a metacache string
+static ml_stat_t *
+ml_stat_find (ml_stat_t **hash, const char *path) {
+    for (ml_stat_t *st = hash[ml_stat_hash (path)]; st; st = st->bucket_next) {
+        if (st->path == path) {
+            return st;
+        }
+    }
+    return NULL;
+}
+
+// path must be a metacache string, the entry holds its own reference
+static ml_stat_t *
+ml_stat_add (ml_stat_t **hash, const char *path) {
+    uint32_t h = ml_stat_hash (path);
+    ml_stat_t *st = calloc (1, sizeof (ml_stat_t));
+    deadbeef->metacache_ref (path);
+    st->path = path;
+    st->mtime = -1;
+    st->bucket_next = hash[h];
+    hash[h] = st;
+    return st;
+}
+
+static void
+ml_free_stats (void) {
+    for (int i = 0; i < ML_STAT_HASH_SIZE; i++) {
+        ml_stat_t **hashes[] = { folder_stats, file_stats };
+        for (int n = 0; n < 2; n++) {
+            ml_stat_t *st = hashes[n][i];
+            while (st) {
+                ml_stat_t *next = st->bucket_next;
+                deadbeef->metacache_unref (st->path);
+                free (st);
+                st = next;
+            }
+            hashes[n][i] = NULL;
+        }
+    }
+}
+
+static int
+ml_is_local_path (const char *path) {
+    return !strstr (path, "://");
+}
+
+// Checks the path against the previous scan, the result is cached for the current scan.
+// The paths unknown to the previous scan are reported as changed, unless new_is_unchanged is set.
+static int
+ml_stat_check (ml_stat_t **hash, const char *path, int new_is_unchanged) {
+    const char *s = deadbeef->metacache_add_string (path);
+    ml_stat_t *st = ml_stat_find (hash, s);
+    int is_new = 0;
+    if (!st) {
+        st = ml_stat_add (hash, s);
+        is_new = 1;
+    }
+    deadbeef->metacache_unref (s);
+
+    if (st->scan_id == scan_id) {
+        return st->changed;
+    }
+
+    struct stat buf;
+    int64_t mtime = -1;
+    int64_t size = 0;
+    if (!stat (path, &buf)) {
+        mtime = (int64_t)buf.st_mtime;
+        size = S_ISDIR (buf.st_mode) ? 0 : (int64_t)buf.st_size;
+    }
+    if (mtime < 0) {
+        st->changed = 1;
+    }
+    else if (is_new) {
+        st->changed = !new_is_unchanged;
+    }
+    else {
+        st->changed = st->mtime != mtime || st->size != size;
+    }
+    st->mtime = mtime;
+    st->size = size;
+    st->scan_id = scan_id;
+    return st->changed;
+}
+
+// Returns 1 if files were added to or removed from the folder since the previous scan
+static int
+ml_folder_changed (const char *fname) {
+    char folder[PATH_MAX];
+    const char *slash = strrchr (fname, '/');
+    if (!slash || slash - fname >= sizeof (folder)) {
+        return 1;
+    }
+    memcpy (folder, fname, slash-fname);
+    folder[slash-fname] = 0;
+    return ml_stat_check (folder_stats, folder, 0);
+}
+
+// Returns 1 if the file was modified or removed since the previous scan.
+// The files indexed before medialib.stat existed are assumed to be unchanged.
+static int
+ml_file_changed (const char *fname) {
+    return ml_stat_check (file_stats, fname, 1);
+}
+
+#define ML_STAT_MAGIC "DBML"
+#define ML_STAT_MAJOR_VER 1
+#define ML_STAT_MINOR_VER 0
+
+// File format: magic, majorver:byte, minorver:byte, count:uint32,
+// followed by count records of is_folder:byte, pathlen:uint16, path, mtime:int64, size:int64
+static int
+ml_load_stats (const char *fname) {
+    FILE *fp = fopen (fname, "rb");
+    if (!fp) {
+        return -1;
+    }
+    char magic[4];
+    uint8_t ver[2];
+    uint32_t cnt;
+    if (fread (magic, 1, 4, fp) != 4 || memcmp (magic, ML_STAT_MAGIC, 4)) {
+        goto load_fail;
+    }
+    if (fread (ver, 1, 2, fp) != 2 || ver[0] != ML_STAT_MAJOR_VER) {
+        goto load_fail;
+    }
+    if (fread (&cnt, 1, 4, fp) != 4) {
+        goto load_fail;
+    }
+    char path[PATH_MAX];
+    for (uint32_t i = 0; i < cnt; i++) {
+        uint8_t is_folder;
+        uint16_t l;
+        int64_t mtime, size;
+        if (fread (&is_folder, 1, 1, fp) != 1 || fread (&l, 1, 2, fp) != 2) {
+            goto load_fail;
+        }
+        if (l >= sizeof (path) || fread (path, 1, l, fp) != l) {
+            goto load_fail;
+        }
+        path[l] = 0;
+        if (fread (&mtime, 1, 8, fp) != 8 || fread (&size, 1, 8, fp) != 8) {
+            goto load_fail;
+        }
+        const char *s = deadbeef->metacache_add_string (path);
+        ml_stat_t *st = ml_stat_add (is_folder ? folder_stats : file_stats, s);
+        deadbeef->metacache_unref (s);
+        st->mtime = mtime;
+        st->size = size;
+    }
+    fclose (fp);
+    return 0;
+load_fail:
+    trace ("medialib: failed to load %s\n", fname);
+    fclose (fp);
+    ml_free_stats ();
+    return -1;
+}
+
+// Saves the paths which exist, and were seen by the current scan
+static int
+ml_save_stats (const char *fname) {
+    char tempfile[PATH_MAX];
+    snprintf (tempfile, sizeof (tempfile), "%s.tmp", fname);
+    FILE *fp = fopen (tempfile, "w+b");
+    if (!fp) {
+        return -1;
+    }
+    uint8_t ver[2] = { ML_STAT_MAJOR_VER, ML_STAT_MINOR_VER };
+    uint32_t cnt = 0;
+    if (fwrite (ML_STAT_MAGIC, 1, 4, fp) != 4 || fwrite (ver, 1, 2, fp) != 2 || fwrite (&cnt, 1, 4, fp) != 4) {
+        goto save_fail;
+    }
+    for (uint8_t is_folder = 0; is_folder < 2; is_folder++) {
+        ml_stat_t **hash = is_folder ? folder_stats : file_stats;
+        for (int i = 0; i < ML_STAT_HASH_SIZE; i++) {
+            for (ml_stat_t *st = hash[i]; st; st = st->bucket_next) {
+                if (st->scan_id != scan_id || st->mtime < 0) {
+                    continue;
+                }
+                // mtime has 1 second resolution, so the folders modified in the same second
+                // as the scan may have been changed after they were listed, recheck them next time
+                if (is_folder && st->mtime >= scan_start) {
+                    continue;
+                }
+                uint16_t l = (uint16_t)strlen (st->path);
+                if (fwrite (&is_folder, 1, 1, fp) != 1
+                    || fwrite (&l, 1, 2, fp) != 2
+                    || fwrite (st->path, 1, l, fp) != l
+                    || fwrite (&st->mtime, 1, 8, fp) != 8
+                    || fwrite (&st->size, 1, 8, fp) != 8) {
+                    goto save_fail;
+                }
+                cnt++;
+            }
+        }
+    }
+    if (fseek (fp, 6, SEEK_SET) || fwrite (&cnt, 1, 4, fp) != 4) {
+        goto save_fail;
+    }
+    fclose (fp);
+    if (rename (tempfile, fname) != 0) {
+        fprintf (stderr, "medialib: rename %s -> %s failed: %s\n", tempfile, fname, strerror (errno));
+        return -1;
+    }
+    return 0;
+save_fail:
+    fclose (fp);
+    unlink (tempfile);
+    return -1;
+}
 
-uintptr_t tid;
-int scanner_terminate;
+// Removes the tracks of the files which were modified or removed since the previous scan,
+// so that they get re-read by plt_insert_dir
+static void
+ml_remove_changed_tracks (void) {
+    int nremoved = 0;
+    DB_playItem_t *it = deadbeef->plt_get_first (ml_playlist, PL_MAIN);
+    while (it) {
+        DB_playItem_t *next = deadbeef->pl_get_next (it, PL_MAIN);
+        const char *uri = deadbeef->pl_find_meta (it, ":URI");
+        // modifying a file doesn't change its folder, so each file has to be checked
+        if (uri && ml_is_local_path (uri) && ml_file_changed (uri)) {
+            deadbeef->plt_remove_item (ml_playlist, it);
+            nremoved++;
+        }
+        deadbeef->pl_item_unref (it);
+        it = next;
+    }
+    trace ("medialib: %d changed tracks removed\n", nremoved);
+}
+
+static DB_playItem_t *(*plt_insert_dir) (ddb_playlist_t *plt, DB_playItem_t *after, const char *dirname, int *pabort, int (*cb)(DB_playItem_t *it, void *data), void *user_data);
+
+static uintptr_t tid;
+static int scanner_terminate;
 
 static int
 add_file_info_cb (DB_playItem_t *it, void *data) {
@@ -271,6 +539,8 @@ static void
 scanner_thread (void *none) {
     char plpath[PATH_MAX];
     snprintf (plpath, sizeof (plpath), "%s/medialib.dbpl", deadbeef->get_system_dir (DDB_SYS_DIR_CONFIG));
+    char statpath[PATH_MAX];
+    snprintf (statpath, sizeof (statpath), "%s/medialib.stat", deadbeef->get_system_dir (DDB_SYS_DIR_CONFIG));
 
     struct timeval tm1, tm2;
 
@@ -284,10 +554,9 @@ scanner_thread (void *none) {
         long ms = (tm2.tv_sec*1000+tm2.tv_usec/1000) - (tm1.tv_sec*1000+tm1.tv_usec/1000);
         fprintf (stderr, "ml playlist load time: %f seconds\n", ms / 1000.f);
 
+        // the stats are only valid together with the tracks they were collected for
         if (plt_head) {
-//            for (int i = 0; i < 100; i++) {
-                ml_index ();
-//            }
+            ml_load_stats (statpath);
         }
     }
 
@@ -298,6 +567,11 @@ scanner_thread (void *none) {
         return;
     }
 
+    scan_id++;
+    scan_start = time (NULL);
+    ml_remove_changed_tracks ();
+    ml_index ();
+
     printf ("adding dir: %s\n", musicdir);
     plt_insert_dir (ml_playlist, NULL, musicdir, &scanner_terminate, add_file_info_cb, NULL);
 
@@ -305,14 +579,22 @@ scanner_thread (void *none) {
     long ms = (tm2.tv_sec*1000+tm2.tv_usec/1000) - (tm1.tv_sec*1000+tm1.tv_usec/1000);
     fprintf (stderr, "scan time: %f seconds (%d tracks)\n", ms / 1000.f, deadbeef->plt_get_item_count (ml_playlist, PL_MAIN));
 
-    deadbeef->plt_save (ml_playlist, NULL, NULL, plpath, NULL, NULL, NULL);
+    // an interrupted scan may have skipped the new files in the changed folders
+    if (!deadbeef->plt_save (ml_playlist, NULL, NULL, plpath, NULL, NULL, NULL) && !scanner_terminate) {
+        ml_save_stats (statpath);
+    }
+}
+
+ddb_playlist_t *
+ml_scan (void) {
+    scanner_thread (NULL);
+    return ml_playlist;
 }
 
 //#define FILTER_PERF
 
-// intention is to skip the files which are already indexed
-// how to speed this up:
-// first check if a folder exists (early out?)
+// intention is to skip the files which are already indexed,
+// and all files in the folders which didn't change since the previous scan
 static int
 ml_fileadd_filter (ddb_file_found_data_t *data, void *user_data) {
     int res = 0;
@@ -326,24 +608,31 @@ ml_fileadd_filter (ddb_file_found_data_t *data, void *user_data) {
     gettimeofday (&tm1, NULL);
 #endif
 
-    const char *s = deadbeef->metacache_get_string (data->filename);
-    if (!s) {
-        return 0;
-    }
+    int is_local = ml_is_local_path (data->filename);
 
-    uint32_t hash = (((uint32_t)(s))>>1) & (ML_HASH_SIZE-1);
-
-    if (!db.filename_hash[hash]) {
-        return 0;
+    // no files were added to an unchanged folder, so only the files which ml_remove_changed_tracks
+    // found to be modified need to be read again (ml_file_changed returns the cached result)
+    if (is_local && !ml_folder_changed (data->filename) && !ml_file_changed (data->filename)) {
+        return -1;
     }
 
-    ml_entry_t *en = db.filename_hash[hash];
-    while (en) {
-        if (en->file == s) {
-            res = -1;
-            break;
+    const char *s = deadbeef->metacache_get_string (data->filename);
+    if (s) {
+        uint32_t hash = (((uint32_t)(s))>>1) & (ML_HASH_SIZE-1);
+
+        ml_entry_t *en = db.filename_hash[hash];
+        while (en) {
+            if (en->file == s) {
+                res = -1;
+                break;
+            }
+            en = en->bucket_next;
         }
-        en = en->bucket_next;
+    }
+
+    // a new file, remember its mtime and size for the next scan
+    if (!res && is_local) {
+        ml_file_changed (data->filename);
     }
 
 #if FILTER_PERF
@@ -351,14 +640,16 @@ ml_fileadd_filter (ddb_file_found_data_t *data, void *user_data) {
     long ms = (tm2.tv_sec*1000+tm2.tv_usec/1000) - (tm1.tv_sec*1000+tm1.tv_usec/1000);
 
     if (!res) {
-        fprintf (stderr, "ADD %s: file presence check took %f sec\n", s, ms / 1000.f);
+        fprintf (stderr, "ADD %s: file presence check took %f sec\n", data->filename, ms / 1000.f);
     }
     else {
-        fprintf (stderr, "SKIP %s: file presence check took %f sec\n", s, ms / 1000.f);
+        fprintf (stderr, "SKIP %s: file presence check took %f sec\n", data->filename, ms / 1000.f);
     }
 #endif
 
-    deadbeef->metacache_unref (s);
+    if (s) {
+        deadbeef->metacache_unref (s);
+    }
 
     return res;
 }
@@ -399,8 +690,11 @@ ml_stop (void) {
 
     if (ml_playlist) {
         deadbeef->plt_free (ml_playlist);
+        ml_playlist = NULL;
     }
 
+    ml_free_stats ();
+
     return 0;
 }
 
@@ -27,6 +27,11 @@
 #include <stdlib.h>
 #include <limits.h>
 #include <unistd.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include <dirent.h>
+#include <utime.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include "../../deadbeef.h"
 #include "../../strdupa.h"
@@ -57,6 +62,200 @@ FILE *out;
 static DB_decoder_t plugin;
 DB_functions_t *deadbeef;
 
+#define SEEKINDEX_CACHE_MAGIC "DDBMP3SI"
+#define SEEKINDEX_CACHE_VERSION 2
+
+// seek index cache file header, followed by the file path, the results of the initial parse, and the seek points
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t pathlen;
+    int64_t fsize;
+    int64_t mtime;
+    uint32_t startoffs;
+    uint32_t mp3flags;
+    uint32_t infosize;
+    uint32_t count;
+} seekindex_cache_header_t;
+
+// Fills in the header for a local file, and returns the name of its cache file.
+static int
+_seekindex_cache_init (const char *fname, uint32_t startoffs, uint32_t mp3flags, seekindex_cache_header_t *hdr, char *path, int size) {
+    if (fname[0] != '/') {
+        return -1;
+    }
+    struct stat st;
+    if (stat (fname, &st)) {
+        return -1;
+    }
+
+    memset (hdr, 0, sizeof (seekindex_cache_header_t));
+    memcpy (hdr->magic, SEEKINDEX_CACHE_MAGIC, sizeof (hdr->magic));
+    hdr->version = SEEKINDEX_CACHE_VERSION;
+    hdr->pathlen = (uint32_t)strlen (fname);
+    hdr->fsize = st.st_size;
+    hdr->mtime = st.st_mtime;
+    hdr->startoffs = startoffs;
+    hdr->mp3flags = mp3flags;
+    hdr->infosize = sizeof (mp3info_t);
+
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (const char *c = fname; *c; c++) {
+        hash ^= (uint8_t)*c;
+        hash *= 1099511628211ULL;
+    }
+    const char *cachedir = deadbeef->get_system_dir (DDB_SYS_DIR_CACHE);
+    if (snprintf (path, size, "%s/mp3seekindex/%016" PRIx64, cachedir, hash) >= size) {
+        return -1;
+    }
+    return 0;
+}
+
+// deletes the least recently used index files, until the cache fits the configured size
+static void
+_seekindex_cache_trim (const char *dir) {
+    DIR *d = opendir (dir);
+    if (!d) {
+        return;
+    }
+
+    typedef struct {
+        char name[20];
+        time_t mtime;
+        int64_t size;
+    } entry_t;
+    entry_t *entries = NULL;
+    int count = 0;
+    int alloc = 0;
+    int64_t total = 0;
+    struct dirent *de;
+    while ((de = readdir (d))) {
+        // the index files are named by a 16 digit hash
+        size_t l = strlen (de->d_name);
+        if (l != 16 || strspn (de->d_name, "0123456789abcdef") != l) {
+            continue;
+        }
+        char path[PATH_MAX];
+        struct stat st;
+        snprintf (path, sizeof (path), "%s/%s", dir, de->d_name);
+        if (stat (path, &st)) {
+            continue;
+        }
+        if (count == alloc) {
+            alloc = alloc ? alloc * 2 : 64;
+            entries = realloc (entries, alloc * sizeof (entry_t));
+        }
+        strcpy (entries[count].name, de->d_name);
+        entries[count].mtime = st.st_mtime;
+        entries[count].size = st.st_size;
+        total += st.st_size;
+        count++;
+    }
+    closedir (d);
+
+    int64_t limit = (int64_t)deadbeef->conf_get_int ("mp3.seek_index_cache_size", 16) * 1024 * 1024;
+    while (total > limit && count > 0) {
+        int oldest = 0;
+        for (int i = 1; i < count; i++) {
+            if (entries[i].mtime < entries[oldest].mtime) {
+                oldest = i;
+            }
+        }
+        char path[PATH_MAX];
+        snprintf (path, sizeof (path), "%s/%s", dir, entries[oldest].name);
+        trace ("mp3: removing %s from seek index cache\n", path);
+        unlink (path);
+        total -= entries[oldest].size;
+        entries[oldest] = entries[--count];
+    }
+    free (entries);
+}
+
+// Loads the seek index, and the results of the initial parse, returns 0 on success.
+static int
+_seekindex_cache_load (mp3_info_t *info, const char *fname) {
+    seekindex_cache_header_t hdr, filehdr;
+    char path[PATH_MAX];
+    if (_seekindex_cache_init (fname, info->startoffs, info->mp3flags, &hdr, path, sizeof (path))) {
+        return -1;
+    }
+
+    FILE *fp = fopen (path, "rb");
+    if (!fp) {
+        return -1;
+    }
+    int res = -1;
+    char *storedname = NULL;
+    mp3_seekpoint_t *points = NULL;
+    if (fread (&filehdr, sizeof (filehdr), 1, fp) != 1
+        || memcmp (&hdr, &filehdr, offsetof (seekindex_cache_header_t, count))
+        || filehdr.count == 0) {
+        goto error;
+    }
+    storedname = malloc (filehdr.pathlen);
+    if (fread (storedname, filehdr.pathlen, 1, fp) != 1 || memcmp (storedname, fname, filehdr.pathlen)) {
+        goto error;
+    }
+    mp3info_t mp3info;
+    if (fread (&mp3info, sizeof (mp3info_t), 1, fp) != 1) {
+        goto error;
+    }
+    points = malloc (filehdr.count * sizeof (mp3_seekpoint_t));
+    if (!points || fread (points, sizeof (mp3_seekpoint_t), filehdr.count, fp) != filehdr.count) {
+        goto error;
+    }
+    info->mp3info = mp3info;
+    mp3_seekindex_free (&info->seekindex);
+    info->seekindex.points = points;
+    info->seekindex.count = info->seekindex.alloc = filehdr.count;
+    points = NULL;
+    res = 0;
+error:
+    free (points);
+    free (storedname);
+    fclose (fp);
+    if (!res) {
+        // mark as recently used
+        utime (path, NULL);
+    }
+    return res;
+}
+
+static void
+_seekindex_cache_save (mp3_info_t *info, const char *fname) {
+    seekindex_cache_header_t hdr;
+    char path[PATH_MAX];
+    if (!info->seekindex.modified || _seekindex_cache_init (fname, info->startoffs, info->mp3flags, &hdr, path, sizeof (path))) {
+        return;
+    }
+    hdr.count = info->seekindex.count;
+
+    char dir[PATH_MAX];
+    snprintf (dir, sizeof (dir), "%s", path);
+    char *sep = strrchr (dir, '/');
+    *sep = 0;
+    mkdir (deadbeef->get_system_dir (DDB_SYS_DIR_CACHE), 0755);
+    mkdir (dir, 0755);
+
+    // write a temporary file, and rename, so that a concurrent load never sees a partial index
+    char tmppath[PATH_MAX+10];
+    snprintf (tmppath, sizeof (tmppath), "%s.%d.part", path, (int)getpid ());
+    FILE *fp = fopen (tmppath, "wb");
+    if (!fp) {
+        return;
+    }
+    int res = fwrite (&hdr, sizeof (hdr), 1, fp) == 1
+        && fwrite (fname, hdr.pathlen, 1, fp) == 1
+        && fwrite (&info->mp3info, sizeof (mp3info_t), 1, fp) == 1
+        && fwrite (info->seekindex.points, sizeof (mp3_seekpoint_t), hdr.count, fp) == hdr.count;
+    if (fclose (fp) || !res || rename (tmppath, path)) {
+        unlink (tmppath);
+        return;
+    }
+    _seekindex_cache_trim (dir);
+}
+
 int
 cmp3_seek_stream (DB_fileinfo_t *_info, int sample) {
     mp3_info_t *info = (mp3_info_t *)_info;
@@ -69,7 +268,7 @@ cmp3_seek_stream (DB_fileinfo_t *_info, int sample) {
 #endif
 
     mp3info_t mp3info;
-    int res = mp3_parse_file(&mp3info, info->mp3flags, info->file, deadbeef->fgetlength(info->file), info->startoffs, info->endoffs, sample);
+    int res = mp3_parse_file_indexed(&mp3info, info->mp3flags, info->file, deadbeef->fgetlength(info->file), info->startoffs, info->endoffs, sample, &info->seekindex);
 
     if (!res) {
         deadbeef->fseek (info->file, mp3info.packet_offs, SEEK_SET);
@@ -257,10 +456,13 @@ cmp3_init (DB_fileinfo_t *_info, DB_playItem_t *it) {
         if (info->startoffs > 0) {
             trace ("mp3: skipping %d(%xH) bytes of junk\n", info->startoffs, info->endoffs);
         }
-        int res = mp3_parse_file(&info->mp3info, info->mp3flags, info->file, deadbeef->fgetlength(info->file), info->startoffs, info->endoffs, -1);
-        if (res < 0) {
-            trace ("mp3: cmp3_init: initial mp3_parse_file failed\n");
-            return -1;
+        // the cached results of the initial parse save scanning the whole file
+        if (!deadbeef->conf_get_int ("mp3.seek_index_cache", 0) || _seekindex_cache_load (info, uri)) {
+            int res = mp3_parse_file_indexed(&info->mp3info, info->mp3flags, info->file, deadbeef->fgetlength(info->file), info->startoffs, info->endoffs, -1, &info->seekindex);
+            if (res < 0) {
+                trace ("mp3: cmp3_init: initial mp3_parse_file failed\n");
+                return -1;
+            }
         }
         info->currentsample = info->mp3info.pcmsample;
 
@@ -413,6 +615,13 @@ cmp3_decode (mp3_info_t *info) {
 static void
 cmp3_free (DB_fileinfo_t *_info) {
     mp3_info_t *info = (mp3_info_t *)_info;
+    if (info->it && info->seekindex.modified && deadbeef->conf_get_int ("mp3.seek_index_cache", 0)) {
+        deadbeef->pl_lock ();
+        const char *uri = strdupa (deadbeef->pl_find_meta (info->it, ":URI"));
+        deadbeef->pl_unlock ();
+        _seekindex_cache_save (info, uri);
+    }
+    mp3_seekindex_free (&info->seekindex);
     if (info->it) {
         deadbeef->pl_item_unref (info->it);
     }
@@ -710,6 +919,8 @@ static const char *exts[] = {
 
 static const char settings_dlg[] =
     "property \"Force 16 bit output\" checkbox mp3.force16bit 0;\n"
+    "property \"Cache seek positions on disk\" checkbox mp3.seek_index_cache 0;\n"
+    "property \"Seek position cache size (MB)\" entry mp3.seek_index_cache_size 16;\n"
 #if defined(USE_LIBMAD) && defined(USE_LIBMPG123)
     "property \"Backend\" select[2] mp3.backend 0 mpg123 mad;\n"
 #endif
@@ -43,6 +43,9 @@ extern DB_functions_t *deadbeef;
 #define MAX_INVALID_BYTES 1000000
 #define MAX_INVALID_BYTES_STREAM 1000
 
+// distance between the seek index points, in samples
+#define SEEKINDEX_STEP (MAX_PACKET_SAMPLES*32)
+
 static const int vertbl[] = {3, -1, 2, 1}; // 3 is 2.5
 static const int ltbl[] = { -1, 3, 2, 1 };
 
@@ -374,8 +377,59 @@ _packet_same_fmt (mp3packet_t *ref_packet, mp3packet_t *packet) {
         && packet->ver == ref_packet->ver;
 }
 
+static void
+_seekindex_add (mp3_seekindex_t *index, int64_t offs, int64_t pcmsample) {
+    if (index->count > 0 && pcmsample < index->points[index->count-1].pcmsample + SEEKINDEX_STEP) {
+        return;
+    }
+    if (index->count == 0 && pcmsample < SEEKINDEX_STEP) {
+        return;
+    }
+    if (index->count == index->alloc) {
+        int alloc = index->alloc ? index->alloc * 2 : 256;
+        mp3_seekpoint_t *points = realloc (index->points, alloc * sizeof (mp3_seekpoint_t));
+        if (!points) {
+            return;
+        }
+        index->points = points;
+        index->alloc = alloc;
+    }
+    index->points[index->count].offs = offs;
+    index->points[index->count].pcmsample = pcmsample;
+    index->count++;
+    index->modified = 1;
+}
+
+// the last point before the sample, so that the scan still finds the packet containing it
+static mp3_seekpoint_t *
+_seekindex_find (mp3_seekindex_t *index, int64_t sample) {
+    int lo = 0;
+    int hi = index->count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (index->points[mid].pcmsample < sample) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo > 0 ? &index->points[lo-1] : NULL;
+}
+
+void
+mp3_seekindex_free (mp3_seekindex_t *index) {
+    free (index->points);
+    memset (index, 0, sizeof (mp3_seekindex_t));
+}
+
 int
 mp3_parse_file (mp3info_t *info, uint32_t flags, DB_FILE *fp, int64_t fsize, int startoffs, int endoffs, int64_t seek_to_sample) {
+    return mp3_parse_file_indexed (info, flags, fp, fsize, startoffs, endoffs, seek_to_sample, NULL);
+}
+
+int
+mp3_parse_file_indexed (mp3info_t *info, uint32_t flags, DB_FILE *fp, int64_t fsize, int startoffs, int endoffs, int64_t seek_to_sample, mp3_seekindex_t *index) {
 #if PERFORMANCE_STATS
     struct timeval start_tv;
     struct timeval end_tv;
@@ -418,6 +472,33 @@ mp3_parse_file (mp3info_t *info, uint32_t flags, DB_FILE *fp, int64_t fsize, int
     int prev_br = -1;
     int vbr = 0;
 
+    // number of samples in the accepted packets, which is what pcmsample counts when seeking
+    int64_t scan_sample = 0;
+
+    mp3_seekpoint_t *seekpoint = NULL;
+    if (index && seek_to_sample > 0 && fsize > 0) {
+        seekpoint = _seekindex_find (index, seek_to_sample);
+    }
+    if (seekpoint) {
+        // resume the scan from the indexed packet, as if all the packets before it were processed
+        uint8_t fhdr[4];
+        deadbeef->fseek (fp, seekpoint->offs, SEEK_SET);
+        info->num_seeks++;
+        if (deadbeef->fread (fhdr, 1, sizeof (fhdr), fp) != sizeof (fhdr)
+            || _parse_packet (&info->ref_packet, fhdr) < 0) {
+            goto error;
+        }
+        info->num_reads++;
+        info->bytes_read += sizeof (fhdr);
+        fileoffs = seekpoint->offs + sizeof (fhdr);
+        offs = seekpoint->offs;
+        info->checked_xing_header = 1;
+        info->npackets = 1;
+        info->valid_packets = 1;
+        info->pcmsample = seekpoint->pcmsample;
+        scan_sample = seekpoint->pcmsample;
+    }
+
     while (fsize > 0 || fsize < 0) {
         int64_t readsize = 4; // fe ff + frame header
         if (fsize > 0 && offs + readsize >= fsize - endoffs) {
@@ -527,6 +608,10 @@ mp3_parse_file (mp3info_t *info, uint32_t flags, DB_FILE *fp, int64_t fsize, int
             }
 
             if (!got_xing) {
+                if (index && fsize > 0) {
+                    _seekindex_add (index, offs, scan_sample);
+                }
+
                 // interrupt if the current packet contains the sample being seeked to
                 if (seek_to_sample > 0 && info->pcmsample+packet.samples_per_frame >= seek_to_sample) {
                     goto end;
@@ -535,6 +620,7 @@ mp3_parse_file (mp3info_t *info, uint32_t flags, DB_FILE *fp, int64_t fsize, int
                 if (_process_packet (info, &packet, seek_to_sample) > 0) {
                     goto end;
                 }
+                scan_sample += packet.samples_per_frame;
                 memcpy (&info->prev_packet, &packet, sizeof (packet));
             }
 
@@ -553,7 +639,7 @@ mp3_parse_file (mp3info_t *info, uint32_t flags, DB_FILE *fp, int64_t fsize, int
                 goto end;
             }
             // Calculate CBR duration from file size
-            else if (!vbr && !info->have_xing_header && !(flags & MP3_PARSE_FULLSCAN) && info->npackets >= 200) {
+            else if (!vbr && !info->have_xing_header && seek_to_sample < 0 && !(flags & MP3_PARSE_FULLSCAN) && info->npackets >= 200) {
                 // calculate total number of packets from file size
                 // 8876 - 9485
                 int64_t npackets = ceil(datasize/(float)info->ref_packet.packetlength);
@@ -98,6 +98,22 @@ typedef struct {
     uint64_t bytes_read;
 } mp3info_t;
 
+// A packet position recorded while scanning the stream
+typedef struct {
+    int64_t offs; // stream position of the packet
+    int64_t pcmsample; // sample position of the packet, as it would be reported in mp3info_t.pcmsample
+} mp3_seekpoint_t;
+
+// Sparse index of packet positions, sorted by sample position.
+// It's extended by every scan which gets further than the last point,
+// and allows the seek scans to start at the nearest point, instead of the beginning of the stream.
+typedef struct {
+    mp3_seekpoint_t *points;
+    int count;
+    int alloc;
+    int modified; // set when points are added
+} mp3_seekindex_t;
+
 // Params:
 // seek_to_sample: -1 means to the end (scan whole file), otherwise a sample to seek to
 // When seeking, the packet offset returned will be the one containing seek_to_sample, not accounting for delay.
@@ -113,4 +129,13 @@ typedef struct {
 int
 mp3_parse_file (mp3info_t *info, uint32_t flags, DB_FILE *fp, int64_t fsize, int startoffs, int endoffs, int64_t seek_to_sample);
 
+// Same as mp3_parse_file, but uses the seek index to find the starting point of the seek scan,
+// and adds the packets found while scanning to the index.
+// The index must only be used with the same stream, and the same startoffs.
+int
+mp3_parse_file_indexed (mp3info_t *info, uint32_t flags, DB_FILE *fp, int64_t fsize, int startoffs, int endoffs, int64_t seek_to_sample, mp3_seekindex_t *index);
+
+void
+mp3_seekindex_free (mp3_seekindex_t *index);
+
 #endif /* mp3parser_h */
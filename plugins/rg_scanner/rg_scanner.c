@@ -29,7 +29,9 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <math.h>
+#include <sys/time.h>
 
 #include "../../deadbeef.h"
 #include "ebur128/ebur128.h"
@@ -42,45 +44,86 @@ static const char *album_signature = "$if2(%album artist% - %album%,%filename%)"
 static ddb_rg_scanner_t plugin;
 static DB_functions_t *deadbeef;
 
+// shared by all the scanning workers
 typedef struct {
-    int track_index;
     ddb_rg_scanner_settings_t *settings;
     ebur128_state **gain_state;
-    ebur128_state **peak_state;
-} track_state_t;
 
-void
-rg_calc_thread(void *ctx) {
+    // index of the next track to scan, protected by settings->sync_mutex
+    int next_track;
+
+    // whether the caller's settings struct has the fields added in 1.1
+    int has_progress_counters;
+    struct timeval start_tv;
+} scan_queue_t;
+
+// a scanning thread, the buffers are reused for all the tracks it scans
+typedef struct {
+    scan_queue_t *queue;
+    char *buffer;
+    int buffer_size;
+    float *bufferf;
+    int bufferf_size;
+} scan_worker_t;
+
+static void *
+_grow_buffer (void *buffer, int *size, int needed) {
+    if (*size >= needed) {
+        return buffer;
+    }
+    free (buffer);
+    *size = needed;
+    return malloc (needed);
+}
+
+static void
+_update_progress (scan_queue_t *queue, int numsamples, int samplerate) {
+    ddb_rg_scanner_settings_t *settings = queue->settings;
+    deadbeef->mutex_lock (settings->sync_mutex);
+    settings->cd_samples_processed += numsamples * 44100 / samplerate;
+    if (queue->has_progress_counters) {
+        struct timeval tv;
+        gettimeofday (&tv, NULL);
+        float elapsed = (tv.tv_sec - queue->start_tv.tv_sec) + (tv.tv_usec - queue->start_tv.tv_usec) / 1000000.f;
+        if (elapsed > 0) {
+            settings->speed = settings->cd_samples_processed / 44100.f / elapsed;
+        }
+    }
+    deadbeef->mutex_unlock (settings->sync_mutex);
+}
+
+static void
+_rg_scan_track (scan_worker_t *worker, int track_index) {
     DB_decoder_t *dec = NULL;
     DB_fileinfo_t *fileinfo = NULL;
 
-    char *buffer = NULL;
-    float *bufferf = NULL;
+    scan_queue_t *queue = worker->queue;
+    ddb_rg_scanner_settings_t *settings = queue->settings;
+    ebur128_state **gain_state = &queue->gain_state[track_index];
 
-    track_state_t *st = (track_state_t *)ctx;
-    if (st->settings->pabort && *(st->settings->pabort)) {
+    if (settings->pabort && *(settings->pabort)) {
         return;
     }
-    if (deadbeef->pl_get_item_duration (st->settings->tracks[st->track_index]) <= 0) {
-        st->settings->results[st->track_index].scan_result = DDB_RG_SCAN_RESULT_INVALID_FILE;
+    if (deadbeef->pl_get_item_duration (settings->tracks[track_index]) <= 0) {
+        settings->results[track_index].scan_result = DDB_RG_SCAN_RESULT_INVALID_FILE;
         return;
     }
 
 
     deadbeef->pl_lock ();
-    dec = (DB_decoder_t *)deadbeef->plug_get_for_id (deadbeef->pl_find_meta (st->settings->tracks[st->track_index], ":DECODER"));
+    dec = (DB_decoder_t *)deadbeef->plug_get_for_id (deadbeef->pl_find_meta (settings->tracks[track_index], ":DECODER"));
     deadbeef->pl_unlock ();
 
     if (dec) {
         fileinfo = dec->open (DDB_DECODER_HINT_RAW_SIGNAL);
 
-        if (!fileinfo || dec->init (fileinfo, DB_PLAYITEM (st->settings->tracks[st->track_index])) != 0) {
-            st->settings->results[st->track_index].scan_result = DDB_RG_SCAN_RESULT_FILE_NOT_FOUND;
+        if (!fileinfo || dec->init (fileinfo, DB_PLAYITEM (settings->tracks[track_index])) != 0) {
+            settings->results[track_index].scan_result = DDB_RG_SCAN_RESULT_FILE_NOT_FOUND;
             goto error;
         }
 
-        st->gain_state[st->track_index] = ebur128_init(fileinfo->fmt.channels, fileinfo->fmt.samplerate, EBUR128_MODE_I);
-        st->peak_state[st->track_index] = ebur128_init(fileinfo->fmt.channels, fileinfo->fmt.samplerate, EBUR128_MODE_SAMPLE_PEAK);
+        // a single state measures both the loudness and the peak, so that the data is filtered once
+        *gain_state = ebur128_init(fileinfo->fmt.channels, fileinfo->fmt.samplerate, EBUR128_MODE_I | EBUR128_MODE_SAMPLE_PEAK);
 
         // speaker mask mapping from WAV to EBUR128
         static const int chmap[18] = {
@@ -112,14 +155,12 @@ rg_calc_thread(void *ctx) {
             if (i < 18) {
                 if (channelmask & (1<<i))
                 {
-                    ebur128_set_channel (st->gain_state[st->track_index], ch, chmap[i]);
-                    ebur128_set_channel (st->peak_state[st->track_index], ch, chmap[i]);
+                    ebur128_set_channel (*gain_state, ch, chmap[i]);
                     ch++;
                 }
             }
             else {
-                ebur128_set_channel (st->gain_state[st->track_index], ch, EBUR128_UNUSED);
-                ebur128_set_channel (st->peak_state[st->track_index], ch, EBUR128_UNUSED);
+                ebur128_set_channel (*gain_state, ch, EBUR128_UNUSED);
                 ch++;
             }
         }
@@ -129,10 +170,13 @@ rg_calc_thread(void *ctx) {
         int bs = 2000 * samplesize;
         ddb_waveformat_t fmt;
 
-        buffer = malloc (bs);
+        worker->buffer = _grow_buffer (worker->buffer, &worker->buffer_size, bs);
+        char *buffer = worker->buffer;
+        float *bufferf;
 
         if (!fileinfo->fmt.is_float) {
-            bufferf = malloc (2000 * sizeof (float) * fileinfo->fmt.channels);
+            worker->bufferf = _grow_buffer (worker->bufferf, &worker->bufferf_size, 2000 * sizeof (float) * fileinfo->fmt.channels);
+            bufferf = worker->bufferf;
             memcpy (&fmt, &fileinfo->fmt, sizeof (fmt));
             fmt.bps = 32;
             fmt.is_float = 1;
@@ -146,17 +190,14 @@ rg_calc_thread(void *ctx) {
             if (eof) {
                 break;
             }
-            if (st->settings->pabort && *(st->settings->pabort)) {
+            if (settings->pabort && *(settings->pabort)) {
                 break;
             }
 
             int sz = dec->read (fileinfo, buffer, bs); // read one block
 
-            deadbeef->mutex_lock (st->settings->sync_mutex);
-            int samplesize = fileinfo->fmt.channels * (fileinfo->fmt.bps >> 3);
-            int numsamples = sz / samplesize;
-            st->settings->cd_samples_processed += numsamples * 44100 / fileinfo->fmt.samplerate;
-            deadbeef->mutex_unlock (st->settings->sync_mutex);
+            int frames = sz / samplesize;
+            _update_progress (queue, frames, fileinfo->fmt.samplerate);
 
             if (sz != bs) {
                 eof = 1;
@@ -168,20 +209,17 @@ rg_calc_thread(void *ctx) {
                 deadbeef->pcm_convert (&fileinfo->fmt, buffer, &fmt, (char *)bufferf, sz);
             }
 
-            int frames = sz / samplesize;
-
-            ebur128_add_frames_float (st->gain_state[st->track_index], bufferf, frames); // collect data
-            ebur128_add_frames_float (st->peak_state[st->track_index], bufferf, frames); // collect data
+            ebur128_add_frames_float (*gain_state, bufferf, frames); // collect data
         }
 
-        if (!st->settings->pabort || !(*(st->settings->pabort))) {
+        if (!settings->pabort || !(*(settings->pabort))) {
             // calculating track peak
             // libEBUR128 calculates peak per channel, so we have to pick the highest value
             double tr_peak = 0;
             double ch_peak = 0;
             int res;
             for (int ch = 0; ch < fileinfo->fmt.channels; ++ch) {
-                res = ebur128_sample_peak (st->peak_state[st->track_index], ch, &ch_peak);
+                res = ebur128_sample_peak (*gain_state, ch, &ch_peak);
                 //trace ("rg_scanner: peak for ch %d: %f\n", ch, ch_peak);
                 if (ch_peak > tr_peak) {
                     //trace ("rg_scanner: %f > %f\n", ch_peak, tr_peak);
@@ -189,11 +227,11 @@ rg_calc_thread(void *ctx) {
                 }
             }
 
-            st->settings->results[st->track_index].track_peak = (float) tr_peak;
+            settings->results[track_index].track_peak = (float) tr_peak;
 
             // calculate track loudness
-            double loudness = st->settings->ref_loudness;
-            ebur128_loudness_global (st->gain_state[st->track_index], &loudness);
+            double loudness = settings->ref_loudness;
+            ebur128_loudness_global (*gain_state, &loudness);
             /*
              * EBUR128 sets the target level to -23 LUFS = 84dB
              * -> -23 - loudness = track gain to get to 84dB
@@ -202,9 +240,15 @@ rg_calc_thread(void *ctx) {
              * -> the above + (loudness - 84) = track gain to get to 89dB (or user specified)
              */
             if (loudness != -HUGE_VAL) {
-                st->settings->results[st->track_index].track_gain = -23 - loudness + st->settings->ref_loudness - 84;
+                settings->results[track_index].track_gain = -23 - loudness + settings->ref_loudness - 84;
             }
         }
+
+        // album gain is calculated from all the track states when the scan is finished,
+        // otherwise the state is not needed anymore
+        if (settings->mode == DDB_RG_SCAN_MODE_TRACK) {
+            ebur128_destroy (gain_state);
+        }
     }
 
 error:
@@ -212,15 +256,34 @@ error:
     if (fileinfo) {
         dec->free (fileinfo);
     }
+}
 
-    if (buffer && buffer != (char *)bufferf) {
-        free (buffer);
-        buffer = NULL;
-    }
+static void
+_rg_scan_worker (void *ctx) {
+    scan_worker_t *worker = ctx;
+    scan_queue_t *queue = worker->queue;
+    ddb_rg_scanner_settings_t *settings = queue->settings;
+
+    for (;;) {
+        // take the next track from the queue, so that the threads stay busy regardless of the track lengths
+        deadbeef->mutex_lock (settings->sync_mutex);
+        if (queue->next_track >= settings->num_tracks || (settings->pabort && *(settings->pabort))) {
+            deadbeef->mutex_unlock (settings->sync_mutex);
+            break;
+        }
+        int track_index = queue->next_track++;
+        if (settings->progress_callback) {
+            settings->progress_callback (track_index, settings->progress_cb_user_data);
+        }
+        deadbeef->mutex_unlock (settings->sync_mutex);
 
-    if (bufferf) {
-        free (bufferf);
-        bufferf = NULL;
+        _rg_scan_track (worker, track_index);
+
+        if (queue->has_progress_counters) {
+            deadbeef->mutex_lock (settings->sync_mutex);
+            settings->num_tracks_scanned++;
+            deadbeef->mutex_unlock (settings->sync_mutex);
+        }
     }
 }
 
@@ -259,7 +322,8 @@ _update_album_gain (ddb_rg_scanner_settings_t *settings, int i, int album_start,
 
 int
 rg_scan (ddb_rg_scanner_settings_t *settings) {
-    if (settings->_size != sizeof (ddb_rg_scanner_settings_t)) {
+    // rg_scanner 1.0 settings end at sync_mutex
+    if (settings->_size != sizeof (ddb_rg_scanner_settings_t) && settings->_size != offsetof (ddb_rg_scanner_settings_t, num_tracks_scanned)) {
         return -1;
     }
 
@@ -278,7 +342,6 @@ rg_scan (ddb_rg_scanner_settings_t *settings) {
     //trace ("rg_scanner: using %d thread(s)\n", settings->num_threads);
 
     ebur128_state **gain_state = NULL;
-    ebur128_state **peak_state = NULL;
 
     if (settings->ref_loudness == 0) {
         settings->ref_loudness = DDB_RG_SCAN_DEFAULT_LOUDNESS;
@@ -288,50 +351,43 @@ rg_scan (ddb_rg_scanner_settings_t *settings) {
 
     // allocate status array
     gain_state = calloc (settings->num_tracks, sizeof (ebur128_state *));
-    peak_state = calloc (settings->num_tracks, sizeof (ebur128_state *));
-
-    // used for joining threads
-    intptr_t *rg_threads = calloc (settings->num_tracks, sizeof (intptr_t));
-    track_state_t *track_states = calloc (settings->num_tracks, sizeof (track_state_t));
-
-    // calculate gain for each track and album
-    for (int i = 0; i < settings->num_tracks; ++i) {
-        if (settings->progress_callback) {
-            settings->progress_callback (i, settings->progress_cb_user_data);
-        }
-        // limit number of parallel threads
-        if (i >= settings->num_threads) {
-            // simple blocking mechanism: join the 'oldest' thread
-            deadbeef->thread_join(rg_threads[i - settings->num_threads]);
-            rg_threads[i - settings->num_threads] = 0;
-        }
 
-        if (settings->pabort && *(settings->pabort)) {
-            goto cleanup;
-        }
+    scan_queue_t queue = {
+        .settings = settings,
+        .gain_state = gain_state,
+        .has_progress_counters = settings->_size == sizeof (ddb_rg_scanner_settings_t),
+    };
+    gettimeofday (&queue.start_tv, NULL);
+    if (queue.has_progress_counters) {
+        settings->num_tracks_scanned = 0;
+        settings->speed = 0;
+    }
 
-        // initialize arguments
-        track_states[i].track_index = i;
-        track_states[i].settings = settings;
-        track_states[i].gain_state = gain_state;
-        track_states[i].peak_state = peak_state;
+    // a fixed pool of threads, taking the tracks from the queue
+    int num_workers = settings->num_threads;
+    if (num_workers > settings->num_tracks) {
+        num_workers = settings->num_tracks;
+    }
+    intptr_t *rg_threads = calloc (num_workers, sizeof (intptr_t));
+    scan_worker_t *workers = calloc (num_workers, sizeof (scan_worker_t));
 
-        // run thread
-        rg_threads[i] = deadbeef->thread_start(&rg_calc_thread, (void*)(&track_states[i]));
+    for (int i = 0; i < num_workers; i++) {
+        workers[i].queue = &queue;
+        rg_threads[i] = deadbeef->thread_start (_rg_scan_worker, &workers[i]);
     }
 
-    // wait for remaining threads to join
-    int remaining_thread_id = settings->num_tracks - settings->num_threads;
-    if (remaining_thread_id < 0) {
-        remaining_thread_id = 0;
+    for (int i = 0; i < num_workers; i++) {
+        deadbeef->thread_join (rg_threads[i]);
+        free (workers[i].buffer);
+        free (workers[i].bufferf);
     }
-    for (int i = remaining_thread_id; i < settings->num_tracks; ++i) {
-        deadbeef->thread_join(rg_threads[i]);
-        rg_threads[i] = 0;
+    free (rg_threads);
+    rg_threads = NULL;
+    free (workers);
+    workers = NULL;
 
-        if (settings->pabort && *(settings->pabort)) {
-            goto cleanup;
-        }
+    if (settings->pabort && *(settings->pabort)) {
+        goto cleanup;
     }
 
     if (settings->mode == DDB_RG_SCAN_MODE_ALBUMS_FROM_TAGS) {
@@ -381,25 +437,6 @@ rg_scan (ddb_rg_scanner_settings_t *settings) {
     }
 
 cleanup:
-    // free thread storage
-    if (rg_threads) {
-        // join the still-active threads
-        for (int i = 0; i < settings->num_tracks; i++) {
-            if (rg_threads[i]) {
-                deadbeef->thread_join (rg_threads[i]);
-                rg_threads[i] = 0;
-            }
-        }
-
-        free (rg_threads);
-        rg_threads = NULL;
-    }
-
-    if (track_states) {
-        free (track_states);
-        track_states = NULL;
-    }
-
     if (gain_state) {
         for (int i = 0; i < settings->num_tracks; ++i) {
             if (gain_state[i]) {
@@ -410,16 +447,6 @@ cleanup:
         gain_state = NULL;
     }
 
-    if (peak_state) {
-        for (int i = 0; i < settings->num_tracks; ++i) {
-            if (peak_state[i]) {
-                ebur128_destroy (&peak_state[i]);
-            }
-        }
-        free (peak_state);
-        peak_state = NULL;
-    }
-
     if (album_signature_tf) {
         deadbeef->tf_free (album_signature_tf);
         album_signature_tf = NULL;
@@ -528,7 +555,7 @@ static ddb_rg_scanner_t plugin = {
     .misc.plugin.api_vmajor = DB_API_VERSION_MAJOR,
     .misc.plugin.api_vminor = DB_API_VERSION_MINOR,
     .misc.plugin.version_major = 1,
-    .misc.plugin.version_minor = 0,
+    .misc.plugin.version_minor = 1,
     .misc.plugin.flags = DDB_PLUGIN_FLAG_LOGGING,
     .misc.plugin.type = DB_PLUGIN_MISC,
     .misc.plugin.name = "ReplayGain Scanner",
@@ -68,13 +68,14 @@ typedef struct {
     // Preferred config variable: rg_scanner.target_db=89
     float ref_loudness;
 
-    // Max number of concurrent threads
+    // Number of scanning threads, the tracks are distributed between them as they become free
     int num_threads;
 
     // Optional pointer to the abort flag; the scanner will abort if the pointed value is non-zero
     int *pabort;
 
-    // Optional progress callback, with the current track index.
+    // Optional progress callback, with the index of the track which is being started.
+    // The tracks are started in order, and the callback may be called from any of the scanning threads.
     void (*progress_callback) (int current_track, void *user_data);
 
     // An additional user-defined parameter, which will be passed to the progress_callback.
@@ -86,6 +87,15 @@ typedef struct {
 
     // Internal mutex, used for thread syncronization
     uintptr_t sync_mutex;
+
+    // The fields below were added in rg_scanner-1.1
+
+    // How many tracks have been completely scanned.
+    // Set by the scanner, can be used in the progress callback.
+    int num_tracks_scanned;
+
+    // Scanning speed, relative to realtime playback, updated by the scanner along with cd_samples_processed.
+    float speed;
 } ddb_rg_scanner_settings_t;
 
 typedef struct {
@@ -26,9 +26,17 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
+#include <pthread.h>
 #include <assert.h>
 #include <curl/curlver.h>
 #include <time.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <utime.h>
+#include <sys/stat.h>
 #include "vfs_curl.h"
 
 #define trace(...) { deadbeef->log_detailed (&plugin.plugin, 0, __VA_ARGS__); }
@@ -63,6 +71,390 @@ http_cancel_abort (uint64_t identifier);
 static void
 vfs_curl_abort_with_identifier (uint64_t identifier);
 
+// The disk cache keeps the downloaded data of seekable (non-icy, with known length) streams,
+// identified by url, and validated by ETag (or Last-Modified) and length.
+// Each entry is a sparse data file, and an index with a bitmap of the complete blocks.
+#define CACHE_BLOCK_SIZE (256*1024)
+#define CACHE_INDEX_VERSION 1
+#define PREFETCH_SIZE (4*CACHE_BLOCK_SIZE) // how much of the next track to fetch in advance
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t block_size;
+    int64_t length;
+    uint32_t urllen;
+    uint32_t validatorlen;
+} http_cache_header_t;
+
+typedef struct http_cache_s {
+    char path[PATH_MAX]; // without extension
+    char *url;
+    char *validator;
+    int64_t length;
+    int fd;
+    uint8_t *bitmap;
+    size_t bitmap_size;
+    // the range written contiguously, used to mark the blocks as complete
+    int64_t run_start;
+    int64_t run_end;
+    int modified;
+    struct http_cache_s *next;
+} http_cache_t;
+
+// The entries opened by the streams of this process, protected by cache_mutex.
+// A file entry is shared by all open streams of the same version of a resource,
+// and is never reset or trimmed while any of them is open.
+static uintptr_t cache_mutex;
+static http_cache_t *open_cache_entries;
+
+static int
+http_cache_enabled (void) {
+    return deadbeef->conf_get_int ("vfs_curl.disk_cache", 0);
+}
+
+static void
+http_cache_get_dir (char *dir, size_t size) {
+    snprintf (dir, size, "%s/vfs_curl", deadbeef->get_system_dir (DDB_SYS_DIR_CACHE));
+}
+
+static void
+http_cache_fill_header (http_cache_header_t *hdr, const char *url, const char *validator, int64_t length) {
+    memset (hdr, 0, sizeof (http_cache_header_t));
+    memcpy (hdr->magic, "DDBHTTPC", 8);
+    hdr->version = CACHE_INDEX_VERSION;
+    hdr->block_size = CACHE_BLOCK_SIZE;
+    hdr->length = length;
+    hdr->urllen = (uint32_t)strlen (url);
+    hdr->validatorlen = (uint32_t)strlen (validator);
+}
+
+// ORs the bitmap of the index file into the given bitmap,
+// returns 0 if the index exists and belongs to the same version of the resource
+static int
+http_cache_load_bitmap (const char *path, const char *url, const char *validator, int64_t length, uint8_t *bitmap, size_t bitmap_size) {
+    char idx[PATH_MAX+10];
+    snprintf (idx, sizeof (idx), "%s.idx", path);
+    FILE *fp = fopen (idx, "rb");
+    if (!fp) {
+        return -1;
+    }
+    http_cache_header_t hdr, filehdr;
+    http_cache_fill_header (&hdr, url, validator, length);
+    int res = -1;
+    char *strings = NULL;
+    uint8_t *stored = NULL;
+    if (fread (&filehdr, sizeof (filehdr), 1, fp) != 1 || memcmp (&hdr, &filehdr, sizeof (hdr))) {
+        goto error;
+    }
+    strings = malloc (hdr.urllen + hdr.validatorlen);
+    if (fread (strings, hdr.urllen + hdr.validatorlen, 1, fp) != 1
+        || memcmp (strings, url, hdr.urllen)
+        || memcmp (strings + hdr.urllen, validator, hdr.validatorlen)) {
+        goto error;
+    }
+    stored = malloc (bitmap_size);
+    if (fread (stored, bitmap_size, 1, fp) != 1) {
+        goto error;
+    }
+    for (size_t i = 0; i < bitmap_size; i++) {
+        bitmap[i] |= stored[i];
+    }
+    res = 0;
+error:
+    free (stored);
+    free (strings);
+    fclose (fp);
+    return res;
+}
+
+static int
+http_cache_has_block (http_cache_t *c, int64_t block) {
+    return (c->bitmap[block >> 3] >> (block & 7)) & 1;
+}
+
+static http_cache_t *
+http_cache_find_open (const char *path) {
+    for (http_cache_t *c = open_cache_entries; c; c = c->next) {
+        if (!strcmp (c->path, path)) {
+            return c;
+        }
+    }
+    return NULL;
+}
+
+// deletes the least recently used entries, until the cache fits the configured size,
+// must be called with cache_mutex locked
+static void
+http_cache_trim (void) {
+    char dir[PATH_MAX];
+    http_cache_get_dir (dir, sizeof (dir));
+    DIR *d = opendir (dir);
+    if (!d) {
+        return;
+    }
+
+    typedef struct {
+        char name[30];
+        time_t mtime;
+        int64_t size;
+    } entry_t;
+    entry_t *entries = NULL;
+    int count = 0;
+    int alloc = 0;
+    int64_t total = 0;
+    struct dirent *de;
+    while ((de = readdir (d))) {
+        size_t l = strlen (de->d_name);
+        if (l < 5 || l >= sizeof (entries->name) || strcmp (de->d_name + l - 4, ".idx")) {
+            continue;
+        }
+        char path[PATH_MAX];
+        struct stat idx_st, data_st;
+        snprintf (path, sizeof (path), "%s/%s", dir, de->d_name);
+        if (stat (path, &idx_st)) {
+            continue;
+        }
+        snprintf (path, sizeof (path), "%s/%.*s.data", dir, (int)(l-4), de->d_name);
+        if (stat (path, &data_st)) {
+            continue;
+        }
+        if (count == alloc) {
+            alloc = alloc ? alloc * 2 : 64;
+            entries = realloc (entries, alloc * sizeof (entry_t));
+        }
+        memcpy (entries[count].name, de->d_name, l-4);
+        entries[count].name[l-4] = 0;
+        entries[count].mtime = idx_st.st_mtime;
+#ifdef _WIN32
+        entries[count].size = data_st.st_size;
+#else
+        entries[count].size = (int64_t)data_st.st_blocks * 512; // the data files are sparse
+#endif
+        total += entries[count].size;
+        count++;
+    }
+    closedir (d);
+
+    int64_t limit = (int64_t)deadbeef->conf_get_int ("vfs_curl.disk_cache_size", 512) * 1024 * 1024;
+    while (total > limit && count > 0) {
+        int oldest = 0;
+        for (int i = 1; i < count; i++) {
+            if (entries[i].mtime < entries[oldest].mtime) {
+                oldest = i;
+            }
+        }
+        char path[PATH_MAX];
+        snprintf (path, sizeof (path), "%s/%s", dir, entries[oldest].name);
+        if (!http_cache_find_open (path)) {
+            trace ("vfs_curl: removing %s from disk cache\n", path);
+            char fname[PATH_MAX+10];
+            snprintf (fname, sizeof (fname), "%s.idx", path);
+            unlink (fname);
+            snprintf (fname, sizeof (fname), "%s.data", path);
+            unlink (fname);
+            total -= entries[oldest].size;
+        }
+        entries[oldest] = entries[--count];
+    }
+    free (entries);
+}
+
+static http_cache_t *
+http_cache_open (const char *url, const char *validator, int64_t length) {
+    char dir[PATH_MAX];
+    http_cache_get_dir (dir, sizeof (dir));
+    mkdir (deadbeef->get_system_dir (DDB_SYS_DIR_CACHE), 0755);
+    mkdir (dir, 0755);
+
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (const char *c = url; *c; c++) {
+        hash ^= (uint8_t)*c;
+        hash *= 1099511628211ULL;
+    }
+
+    http_cache_t *c = calloc (1, sizeof (http_cache_t));
+    if (snprintf (c->path, sizeof (c->path), "%s/%016" PRIx64, dir, hash) >= sizeof (c->path)) {
+        free (c);
+        return NULL;
+    }
+    c->length = length;
+    c->bitmap_size = (size_t)(((length + CACHE_BLOCK_SIZE - 1) / CACHE_BLOCK_SIZE + 7) / 8);
+    c->bitmap = calloc (1, c->bitmap_size);
+    c->run_start = c->run_end = -1;
+
+    char data[PATH_MAX+10];
+    char idx[PATH_MAX+10];
+    snprintf (data, sizeof (data), "%s.data", c->path);
+    snprintf (idx, sizeof (idx), "%s.idx", c->path);
+
+    deadbeef->mutex_lock (cache_mutex);
+    http_cache_t *other = http_cache_find_open (c->path);
+    if (other && (strcmp (other->url, url) || strcmp (other->validator, validator) || other->length != length)) {
+        // another stream still writes a different version of the resource into this entry
+        deadbeef->mutex_unlock (cache_mutex);
+        trace ("vfs_curl: disk cache entry %s is in use, not caching %s\n", c->path, url);
+        free (c->bitmap);
+        free (c);
+        return NULL;
+    }
+    int reuse = !http_cache_load_bitmap (c->path, url, validator, length, c->bitmap, c->bitmap_size);
+    if (!reuse && !other) {
+        // missing, or a different version of the resource
+        unlink (idx);
+        unlink (data);
+    }
+    c->fd = open (data, O_RDWR | O_CREAT | O_BINARY, 0644);
+    if (c->fd < 0) {
+        deadbeef->mutex_unlock (cache_mutex);
+        free (c->bitmap);
+        free (c);
+        return NULL;
+    }
+    struct stat st;
+    if (reuse && !fstat (c->fd, &st)) {
+        // don't trust the blocks which are not in the data file anymore
+        for (int64_t b = 0; b * CACHE_BLOCK_SIZE < length; b++) {
+            if (min ((b + 1) * CACHE_BLOCK_SIZE, length) > st.st_size) {
+                c->bitmap[b >> 3] &= ~(1 << (b & 7));
+            }
+        }
+    }
+    c->url = strdup (url);
+    c->validator = strdup (validator);
+    c->next = open_cache_entries;
+    open_cache_entries = c;
+    deadbeef->mutex_unlock (cache_mutex);
+    trace ("vfs_curl: %s disk cache entry %s for %s\n", reuse || other ? "using" : "created", c->path, url);
+    return c;
+}
+
+static void
+http_cache_save_index (http_cache_t *c) {
+    // merge with the blocks written by other streams of the same resource since opening
+    http_cache_load_bitmap (c->path, c->url, c->validator, c->length, c->bitmap, c->bitmap_size);
+
+    http_cache_header_t hdr;
+    http_cache_fill_header (&hdr, c->url, c->validator, c->length);
+    char idx[PATH_MAX+10];
+    char tmppath[PATH_MAX+30];
+    snprintf (idx, sizeof (idx), "%s.idx", c->path);
+    snprintf (tmppath, sizeof (tmppath), "%s.%d.part", idx, (int)getpid ());
+    FILE *fp = fopen (tmppath, "wb");
+    if (!fp) {
+        return;
+    }
+    int res = fwrite (&hdr, sizeof (hdr), 1, fp) == 1
+        && fwrite (c->url, hdr.urllen, 1, fp) == 1
+        && fwrite (c->validator, hdr.validatorlen, 1, fp) == 1
+        && fwrite (c->bitmap, c->bitmap_size, 1, fp) == 1;
+    if (fclose (fp) || !res || rename (tmppath, idx)) {
+        unlink (tmppath);
+    }
+}
+
+static void
+http_cache_close (http_cache_t *c) {
+    close (c->fd);
+    deadbeef->mutex_lock (cache_mutex);
+    if (c->modified) {
+        http_cache_save_index (c);
+    }
+    else {
+        // mark as recently used
+        char idx[PATH_MAX+10];
+        snprintf (idx, sizeof (idx), "%s.idx", c->path);
+        utime (idx, NULL);
+    }
+    http_cache_t *prev = NULL;
+    for (http_cache_t *e = open_cache_entries; e; prev = e, e = e->next) {
+        if (e == c) {
+            if (prev) {
+                prev->next = c->next;
+            }
+            else {
+                open_cache_entries = c->next;
+            }
+            break;
+        }
+    }
+    if (c->modified) {
+        http_cache_trim ();
+    }
+    deadbeef->mutex_unlock (cache_mutex);
+    free (c->url);
+    free (c->validator);
+    free (c->bitmap);
+    free (c);
+}
+
+// returns the offset of the first byte at or after offs, which is not in the cache
+static int64_t
+http_cache_next_missing (http_cache_t *c, int64_t offs) {
+    int64_t block = offs / CACHE_BLOCK_SIZE;
+    while (block * CACHE_BLOCK_SIZE < c->length && http_cache_has_block (c, block)) {
+        block++;
+    }
+    return max (offs, min (block * CACHE_BLOCK_SIZE, c->length));
+}
+
+// reads the cached data at offs, returns the number of bytes read
+static size_t
+http_cache_read (http_cache_t *c, int64_t offs, void *ptr, size_t size) {
+    size = (size_t)min ((int64_t)size, http_cache_next_missing (c, offs) - offs);
+    if (!size || lseek (c->fd, offs, SEEK_SET) != offs) {
+        return 0;
+    }
+    ssize_t rb = read (c->fd, ptr, size);
+    return rb > 0 ? rb : 0;
+}
+
+static void
+http_cache_write (http_cache_t *c, int64_t offs, const void *ptr, size_t size) {
+    if (offs + size > c->length || lseek (c->fd, offs, SEEK_SET) != offs || write (c->fd, ptr, size) != size) {
+        c->run_start = c->run_end = -1;
+        return;
+    }
+    if (offs != c->run_end) {
+        c->run_start = offs;
+    }
+    c->run_end = offs + size;
+
+    // mark the blocks fully covered by the current run
+    int64_t first = (c->run_start + CACHE_BLOCK_SIZE - 1) / CACHE_BLOCK_SIZE;
+    int64_t last = c->run_end == c->length ? (c->length + CACHE_BLOCK_SIZE - 1) / CACHE_BLOCK_SIZE : c->run_end / CACHE_BLOCK_SIZE;
+    for (int64_t b = max (first, offs / CACHE_BLOCK_SIZE); b < last; b++) {
+        if (!http_cache_has_block (c, b)) {
+            c->bitmap[b >> 3] |= 1 << (b & 7);
+            c->modified = 1;
+        }
+    }
+}
+
+// attaches the disk cache entry to the stream, after the response headers were received
+static void
+http_cache_attach (HTTP_FILE *fp) {
+    const char *validator = fp->etag;
+    if (fp->cache) {
+        if (!validator || strcmp (fp->cache->validator, validator) || fp->cache->length != fp->length) {
+            // the resource has changed since the stream was opened
+            trace ("vfs_curl: %s has changed, dropping disk cache\n", fp->url);
+            http_cache_close (fp->cache);
+            fp->cache = NULL;
+        }
+        return;
+    }
+    if (!validator || fp->length <= 0 || fp->icy_metaint || fp->icyheader || !http_cache_enabled ()) {
+        return;
+    }
+    fp->cache = http_cache_open (fp->url, validator, fp->length);
+}
+
 static size_t
 http_curl_write_wrapper (HTTP_FILE *fp, void *ptr, size_t size) {
     size_t avail = size;
@@ -84,6 +476,9 @@ http_curl_write_wrapper (HTTP_FILE *fp, void *ptr, size_t size) {
 
         if (sz > 5000) { // wait until there are at least 5k bytes free
             size_t cp = min (avail, sz);
+            if (fp->cache) {
+                http_cache_write (fp->cache, fp->pos + fp->remaining, ptr, cp);
+            }
             int writepos = (fp->pos + fp->remaining) & BUFFER_MASK;
             // copy 1st portion (before end of buffer
             size_t part1 = BUFFER_SIZE - writepos;
@@ -245,6 +640,7 @@ http_stream_reset (HTTP_FILE *fp) {
     fp->icyheader = 0;
     fp->gotsomeheader = 0;
     fp->remaining = 0;
+    fp->bufstart = fp->pos;
     fp->metadata_size = 0;
     fp->metadata_have_size = 0;
     fp->skipbytes = 0;
@@ -343,7 +739,22 @@ http_content_header_handler_int (void *ptr, size_t size, void *stream, int *end_
             fp->content_type = strdup ((char *)value);
         }
         else if (!strcasecmp ((char *)key, "Content-Length")) {
-            fp->length = atoi ((char *)value);
+            // the length of the requested range
+            fp->length = fp->request_start + atoll ((char *)value);
+        }
+        else if (!strcasecmp ((char *)key, "Accept-Ranges")) {
+            fp->no_ranges = !strcasecmp ((char *)value, "none");
+        }
+        else if (!strcasecmp ((char *)key, "ETag")) {
+            free (fp->etag);
+            fp->etag = strdup ((char *)value);
+        }
+        else if (!strcasecmp ((char *)key, "Last-Modified")) {
+            // weaker validator, used if there's no ETag
+            if (!fp->etag) {
+                fp->etag = malloc (strlen ((char *)value) + 4);
+                sprintf (fp->etag, "lm:%s", (char *)value);
+            }
         }
         else if (!strcasecmp ((char *)key, "icy-name")) {
             if (fp->track) {
@@ -545,6 +956,7 @@ http_curl_write (void *_ptr, size_t size, size_t nmemb, void *stream) {
     deadbeef->mutex_lock (fp->mutex);
     if (fp->status == STATUS_INITIAL && fp->gotheader) {
         fp->status = STATUS_READING;
+        http_cache_attach (fp);
     }
     deadbeef->mutex_unlock (fp->mutex);
 
@@ -615,6 +1027,10 @@ vfs_curl_free_file (HTTP_FILE *fp) {
     if (fp->url) {
         free (fp->url);
     }
+    free (fp->etag);
+    if (fp->cache) {
+        http_cache_close (fp->cache);
+    }
     if (fp->mutex) {
         deadbeef->mutex_free (fp->mutex);
     }
@@ -626,7 +1042,6 @@ http_thread_func (void *ctx) {
     HTTP_FILE *fp = (HTTP_FILE *)ctx;
     CURL *curl;
     curl = curl_easy_init ();
-    fp->length = -1;
     fp->status = STATUS_INITIAL;
     fp->curl = curl;
 
@@ -634,6 +1049,29 @@ http_thread_func (void *ctx) {
 
     trace ("vfs_curl: started loading data %s\n", fp->url);
     for (;;) {
+        deadbeef->mutex_lock (fp->mutex);
+        // the buffer is empty, so start the request at the skip target
+        fp->pos += fp->skipbytes;
+        fp->skipbytes = 0;
+        fp->bufstart = fp->pos;
+        fp->request_start = 0;
+        int64_t resume_from = 0;
+        if (fp->pos > 0 && fp->length >= 0 && fp->no_ranges) {
+            // download from the start, and skip to the seek position
+            fp->skipbytes = fp->pos;
+            fp->pos = 0;
+            fp->bufstart = 0;
+        }
+        else if (fp->pos > 0 && fp->length >= 0) {
+            resume_from = fp->request_start = fp->pos;
+        }
+        int eof = fp->length >= 0 && fp->pos >= fp->length && fp->pos > 0;
+        deadbeef->mutex_unlock (fp->mutex);
+        if (eof) {
+            trace ("vfs_curl: seek to the end of stream\n");
+            break;
+        }
+
         struct curl_slist *headers = NULL;
         struct curl_slist *ok_aliases = curl_slist_append (NULL, "ICY 200 OK");
 
@@ -660,9 +1098,11 @@ http_thread_func (void *ctx) {
         headers = curl_slist_append (headers, "Icy-Metadata:1");
         curl_easy_setopt (curl, CURLOPT_HTTPHEADER, headers);
         curl_easy_setopt (curl, CURLOPT_HTTP200ALIASES, ok_aliases);
-        if (fp->pos > 0 && fp->length >= 0) {
-            curl_easy_setopt (curl, CURLOPT_RESUME_FROM, (long)fp->pos);
+        if (resume_from > 0) {
+            curl_easy_setopt (curl, CURLOPT_RESUME_FROM_LARGE, (curl_off_t)resume_from);
         }
+        free (fp->etag);
+        fp->etag = NULL;
         if (deadbeef->conf_get_int ("network.proxy", 0)) {
             deadbeef->conf_lock ();
             curl_easy_setopt (curl, CURLOPT_PROXY, deadbeef->conf_get_str_fast ("network.proxy.address", ""));
@@ -714,10 +1154,18 @@ http_thread_func (void *ctx) {
         gettimeofday (&fp->last_read_time, NULL);
         status = curl_easy_perform (curl);
         trace ("vfs_curl: curl_easy_perform retval=%d\n", status);
+        curl_slist_free_all (headers);
+        curl_slist_free_all (ok_aliases);
         if (status != 0) {
             trace ("curl error:\n%s\n", fp->http_err);
         }
         deadbeef->mutex_lock (fp->mutex);
+        if (status == CURLE_RANGE_ERROR && fp->status != STATUS_ABORTED && fp->status != STATUS_SEEK) {
+            trace ("vfs_curl: server doesn't support range requests, reading from the start\n");
+            fp->no_ranges = 1;
+            http_stream_reset (fp);
+            fp->status = STATUS_SEEK;
+        }
         if (fp->status != STATUS_SEEK) {
             trace ("vfs_curl: break loop\n");
             deadbeef->mutex_unlock (fp->mutex);
@@ -725,12 +1173,12 @@ http_thread_func (void *ctx) {
         }
         else {
             trace ("vfs_curl: restart loop\n");
-            fp->skipbytes = 0;
             fp->status = STATUS_INITIAL;
             trace ("seeking to %lld\n", fp->pos);
             if (fp->length < 0) {
                 // icy -- need full restart
                 fp->pos = 0;
+                fp->skipbytes = 0;
                 if (fp->content_type) {
                     free (fp->content_type);
                     fp->content_type = NULL;
@@ -744,8 +1192,6 @@ http_thread_func (void *ctx) {
             }
         }
         deadbeef->mutex_unlock (fp->mutex);
-        curl_slist_free_all (headers);
-        curl_slist_free_all (ok_aliases);
     }
     fp->curl = NULL;
     curl_easy_cleanup (curl);
@@ -755,20 +1201,98 @@ http_thread_func (void *ctx) {
     if (fp->status == STATUS_ABORTED) {
         trace ("vfs_curl: thread ended due to abort signal\n");
     }
-    else {
+    else if (fp->status != STATUS_SEEK || (fp->length >= 0 && fp->pos >= fp->length)) {
         trace ("vfs_curl: thread ended normally\n");
         fp->status = STATUS_FINISHED;
     }
+    fp->thread_finished = 1;
     deadbeef->mutex_unlock (fp->mutex);
 }
 
 static void
 http_start_streamer (HTTP_FILE *fp) {
-    fp->mutex = deadbeef->mutex_create ();
+    if (!fp->mutex) {
+        fp->mutex = deadbeef->mutex_create ();
+    }
     fp->tid = deadbeef->thread_start (http_thread_func, fp);
 //    deadbeef->thread_detach (fp->tid);
 }
 
+// starts the http thread, or restarts it if it has already finished, and the stream was seeked
+static void
+http_ensure_streamer (HTTP_FILE *fp) {
+    if (fp->tid && fp->thread_finished && fp->status == STATUS_SEEK) {
+        deadbeef->thread_join (fp->tid);
+        fp->tid = 0;
+        fp->thread_finished = 0;
+    }
+    if (!fp->tid) {
+        http_start_streamer (fp);
+    }
+}
+
+// moves the network stream to the offset, reusing the buffered data when possible
+static void
+http_stream_seek (HTTP_FILE *fp, int64_t offset) {
+    if (fp->pos == offset) {
+        fp->skipbytes = 0;
+    }
+    else if (fp->pos < offset && fp->pos + BUFFER_SIZE > offset) {
+        fp->skipbytes = offset - fp->pos;
+    }
+    else if (fp->pos-offset >= 0 && fp->pos-offset <= BUFFER_SIZE-fp->remaining && offset >= fp->bufstart) {
+        fp->skipbytes = 0;
+        fp->remaining += fp->pos - offset;
+        fp->pos = offset;
+    }
+    else {
+        // reset stream, and start over
+        fp->pos = offset;
+        http_stream_reset (fp);
+        fp->status = STATUS_SEEK;
+    }
+}
+
+// reads from the disk cache at the current position, and moves the network stream
+// past the cached data, so that it continues where the cached data ends
+static size_t
+http_read_cached (HTTP_FILE *fp, uint8_t *ptr, size_t size) {
+    size_t rb = 0;
+    deadbeef->mutex_lock (fp->mutex);
+    if (fp->reading_cache) {
+        // stop at the network stream position
+        int64_t netpos = fp->pos + fp->skipbytes;
+        size = (size_t)min ((int64_t)size, netpos - fp->cachepos);
+        if (fp->cache) {
+            rb = http_cache_read (fp->cache, fp->cachepos, ptr, size);
+        }
+        fp->cachepos += rb;
+        if (fp->cachepos == netpos) {
+            fp->reading_cache = 0;
+        }
+        else if (rb < size) {
+            // the cache was dropped, or couldn't be read
+            fp->reading_cache = 0;
+            http_stream_seek (fp, fp->cachepos);
+        }
+    }
+    else if (fp->cache && (fp->remaining == 0 || fp->skipbytes > 0)) {
+        // the network stream doesn't have the data yet
+        int64_t pos = fp->pos + fp->skipbytes;
+        rb = http_cache_read (fp->cache, pos, ptr, size);
+        if (rb > 0) {
+            int64_t next = http_cache_next_missing (fp->cache, pos);
+            if (next > pos + rb) {
+                fp->reading_cache = 1;
+                fp->cachepos = pos + rb;
+            }
+            http_stream_seek (fp, next);
+        }
+    }
+    deadbeef->mutex_unlock (fp->mutex);
+    return rb;
+}
+
 static DB_FILE *
 http_open (const char *fname) {
     if (!allow_new_streams) {
@@ -822,20 +1346,34 @@ http_read (void *ptr, size_t size, size_t nmemb, DB_FILE *stream) {
     HTTP_FILE *fp = (HTTP_FILE *)stream;
 //    trace ("http_read %d (status=%d)\n", size*nmemb, fp->status);
     fp->seektoend = 0;
+    size_t sz = size * nmemb;
+    if (fp->tid) {
+        size_t rb = http_read_cached (fp, ptr, sz);
+        ptr += rb;
+        sz -= rb;
+        if (!sz) {
+            return nmemb;
+        }
+    }
     if (fp->status == STATUS_ABORTED || (fp->status == STATUS_FINISHED && fp->remaining == 0)) {
         errno = ECONNABORTED;
-        return 0;
-    }
-    if (!fp->tid) {
-        http_start_streamer (fp);
+        return (size * nmemb - sz) / size;
     }
+    http_ensure_streamer (fp);
 
-    size_t sz = size * nmemb;
     while ((fp->remaining > 0 || (fp->status != STATUS_FINISHED && fp->status != STATUS_ABORTED)) && sz > 0)
     {
         // wait until data is available
         while ((fp->remaining == 0 || fp->skipbytes > 0) && fp->status != STATUS_FINISHED && fp->status != STATUS_ABORTED) {
 //            trace ("vfs_curl: readwait, status: %d..\n", fp->status);
+            http_ensure_streamer (fp);
+            if (size * nmemb == sz) {
+                // nothing was read yet, the data may be in the disk cache
+                size_t rb = http_read_cached (fp, ptr, sz);
+                if (rb) {
+                    return rb / size;
+                }
+            }
             deadbeef->mutex_lock (fp->mutex);
             if (fp->status == STATUS_READING) {
                 struct timeval tm;
@@ -923,32 +1461,17 @@ http_seek (DB_FILE *stream, int64_t offset, int whence) {
     }
     deadbeef->mutex_lock (fp->mutex);
     if (whence == SEEK_CUR) {
-        whence = SEEK_SET;
-        offset = fp->pos + offset;
+        offset = (fp->reading_cache ? fp->cachepos : fp->pos + fp->skipbytes) + offset;
     }
-    if (whence == SEEK_SET) {
-        if (fp->pos == offset) {
-            fp->skipbytes = 0;
-            deadbeef->mutex_unlock (fp->mutex);
-            return 0;
-        }
-        else if (fp->pos < offset && fp->pos + BUFFER_SIZE > offset) {
-            fp->skipbytes = offset - fp->pos;
-            deadbeef->mutex_unlock (fp->mutex);
-            return 0;
-        }
-        else if (fp->pos-offset >= 0 && fp->pos-offset <= BUFFER_SIZE-fp->remaining) {
-            fp->skipbytes = 0;
-            fp->remaining += fp->pos - offset;
-            fp->pos = offset;
-            deadbeef->mutex_unlock (fp->mutex);
-            return 0;
-        }
+    fp->reading_cache = 0;
+    if (fp->cache && http_cache_next_missing (fp->cache, offset) > offset
+        && !(offset >= fp->pos && offset < fp->pos + fp->remaining)) {
+        // read from the disk cache, and download the data following it
+        fp->reading_cache = 1;
+        fp->cachepos = offset;
+        offset = http_cache_next_missing (fp->cache, offset);
     }
-    // reset stream, and start over
-    http_stream_reset (fp);
-    fp->pos = offset;
-    fp->status = STATUS_SEEK;
+    http_stream_seek (fp, offset);
 
     deadbeef->mutex_unlock (fp->mutex);
     return 0;
@@ -961,6 +1484,9 @@ http_tell (DB_FILE *stream) {
     if (fp->seektoend) {
         return fp->length;
     }
+    if (fp->reading_cache) {
+        return fp->cachepos;
+    }
     return fp->pos + fp->skipbytes;
 }
 
@@ -972,8 +1498,9 @@ http_rewind (DB_FILE *stream) {
     if (fp->tid) {
         deadbeef->mutex_lock (fp->mutex);
         fp->status = STATUS_SEEK;
-        http_stream_reset (fp);
         fp->pos = 0;
+        http_stream_reset (fp);
+        fp->reading_cache = 0;
         deadbeef->mutex_unlock (fp->mutex);
     }
 }
@@ -987,9 +1514,7 @@ http_getlength (DB_FILE *stream) {
         trace ("length: -1\n");
         return -1;
     }
-    if (!fp->tid) {
-        http_start_streamer (fp);
-    }
+    http_ensure_streamer (fp);
     while (fp->status == STATUS_INITIAL) {
         usleep (3000);
     }
@@ -1054,20 +1579,142 @@ http_cancel_abort (uint64_t identifier) {
     deadbeef->mutex_unlock (biglock);
 }
 
+// The prefetch thread downloads the beginning of the next track into the disk cache,
+// while the current one is playing
+static uintptr_t prefetch_mutex;
+static uintptr_t prefetch_cond;
+static intptr_t prefetch_tid;
+static char *prefetch_url;
+static uint64_t prefetch_identifier;
+static int prefetch_terminate;
+
+static void
+http_prefetch_thread (void *ctx) {
+    for (;;) {
+        deadbeef->mutex_lock (prefetch_mutex);
+        while (!prefetch_url && !prefetch_terminate) {
+            pthread_cond_wait ((pthread_cond_t *)prefetch_cond, (pthread_mutex_t *)prefetch_mutex);
+        }
+        if (prefetch_terminate) {
+            deadbeef->mutex_unlock (prefetch_mutex);
+            break;
+        }
+        char *url = prefetch_url;
+        prefetch_url = NULL;
+        DB_FILE *f = http_open (url);
+        if (f) {
+            prefetch_identifier = ((HTTP_FILE *)f)->identifier;
+        }
+        deadbeef->mutex_unlock (prefetch_mutex);
+
+        if (f) {
+            trace ("vfs_curl: prefetching %s\n", url);
+            char buf[0x4000];
+            int64_t total = 0;
+            size_t rb;
+            while (total < PREFETCH_SIZE && (rb = http_read (buf, 1, sizeof (buf), f)) > 0) {
+                total += rb;
+                if (!((HTTP_FILE *)f)->cache) {
+                    break; // not cacheable
+                }
+            }
+            deadbeef->mutex_lock (prefetch_mutex);
+            prefetch_identifier = 0;
+            deadbeef->mutex_unlock (prefetch_mutex);
+            http_close (f);
+        }
+        free (url);
+    }
+}
+
+static void
+http_prefetch_next (DB_playItem_t *it) {
+    DB_playItem_t *next = NULL;
+    if (deadbeef->playqueue_get_count () > 0) {
+        next = deadbeef->playqueue_get_item (0);
+    }
+    if (!next) {
+        next = deadbeef->pl_get_next (it, PL_MAIN);
+    }
+    if (!next) {
+        return;
+    }
+    char *url = NULL;
+    deadbeef->pl_lock ();
+    const char *uri = deadbeef->pl_find_meta (next, ":URI");
+    // only files with known duration, radio streams can't be cached
+    if (uri && (!strncasecmp (uri, "http://", 7) || !strncasecmp (uri, "https://", 8))
+        && deadbeef->pl_get_item_duration (next) > 0) {
+        url = strdup (uri);
+    }
+    deadbeef->pl_unlock ();
+    deadbeef->pl_item_unref (next);
+    if (!url) {
+        return;
+    }
+
+    deadbeef->mutex_lock (prefetch_mutex);
+    free (prefetch_url);
+    prefetch_url = url;
+    if (prefetch_identifier) {
+        // the previous prefetch is not needed anymore
+        vfs_curl_abort_with_identifier (prefetch_identifier);
+    }
+    deadbeef->mutex_unlock (prefetch_mutex);
+    deadbeef->cond_signal (prefetch_cond);
+}
+
+static int
+vfs_curl_message (uint32_t id, uintptr_t ctx, uint32_t p1, uint32_t p2) {
+    if (id == DB_EV_SONGSTARTED && http_cache_enabled ()) {
+        ddb_event_track_t *ev = (ddb_event_track_t *)ctx;
+        if (ev->track) {
+            http_prefetch_next (ev->track);
+        }
+    }
+    return 0;
+}
+
 static int
 vfs_curl_start (void) {
     allow_new_streams = 1;
     biglock = deadbeef->mutex_create ();
+    cache_mutex = deadbeef->mutex_create ();
+    prefetch_mutex = deadbeef->mutex_create ();
+    prefetch_cond = deadbeef->cond_create ();
+    prefetch_terminate = 0;
+    prefetch_tid = deadbeef->thread_start (http_prefetch_thread, NULL);
     return 0;
 }
 
 static int
 vfs_curl_stop (void) {
     allow_new_streams = 0;
+    if (prefetch_tid) {
+        deadbeef->mutex_lock (prefetch_mutex);
+        prefetch_terminate = 1;
+        if (prefetch_identifier) {
+            vfs_curl_abort_with_identifier (prefetch_identifier);
+        }
+        deadbeef->cond_signal (prefetch_cond);
+        deadbeef->mutex_unlock (prefetch_mutex);
+        deadbeef->thread_join (prefetch_tid);
+        prefetch_tid = 0;
+        free (prefetch_url);
+        prefetch_url = NULL;
+        deadbeef->cond_free (prefetch_cond);
+        deadbeef->mutex_free (prefetch_mutex);
+        prefetch_cond = 0;
+        prefetch_mutex = 0;
+    }
     if (biglock) {
         deadbeef->mutex_free (biglock);
         biglock = 0;
     }
+    if (cache_mutex) {
+        deadbeef->mutex_free (cache_mutex);
+        cache_mutex = 0;
+    }
     return 0;
 }
 
@@ -1120,13 +1767,15 @@ vfs_curl_abort_with_identifier (uint64_t identifier) {
 
 static const char settings_dlg[] =
     "property \"Enable logging\" checkbox vfs_curl.trace 0;\n"
+    "property \"Cache downloaded files on disk\" checkbox vfs_curl.disk_cache 0;\n"
+    "property \"Disk cache size (MB)\" entry vfs_curl.disk_cache_size 512;\n"
 ;
 
 
 static DB_vfs_t plugin = {
     DDB_PLUGIN_SET_API_VERSION
     .plugin.version_major = 1,
-    .plugin.version_minor = 0,
+    .plugin.version_minor = 1,
     .plugin.type = DB_PLUGIN_VFS,
 //    .plugin.flags = DDB_PLUGIN_FLAG_LOGGING,
     .plugin.id = "vfs_curl",
@@ -1158,6 +1807,7 @@ static DB_vfs_t plugin = {
     .plugin.configdialog = settings_dlg,
     .plugin.start = vfs_curl_start,
     .plugin.stop = vfs_curl_stop,
+    .plugin.message = vfs_curl_message,
     .open = http_open,
     .set_track = http_set_track,
     .close = http_close,
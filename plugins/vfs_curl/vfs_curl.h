@@ -59,6 +59,17 @@ typedef struct {
 
     uint64_t identifier;
 
+    int64_t request_start; // stream offset the current http request started from
+    int64_t bufstart; // stream offset of the oldest valid data in the buffer, for seeking backwards
+    int no_ranges; // the server can't do range requests, seeking has to read from the start
+    int thread_finished; // the http thread has exited, and needs to be restarted for seeking
+    char *etag;
+
+    // disk cache entry of the stream, when enabled and the stream is cacheable
+    struct http_cache_s *cache;
+    int reading_cache; // reads are served from the disk cache at cachepos, instead of the buffer
+    int64_t cachepos;
+
     // flags (bitfields to save some space)
     unsigned seektoend : 1; // indicates that next tell must return length
     unsigned gotheader : 1; // tells that all headers (including ICY) were processed (to start reading body)
@@ -23,8 +23,10 @@
 
 #include <string.h>
 #include <zip.h>
+#include <zlib.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <sys/stat.h>
 #include "../../deadbeef.h"
 
 //#define trace(...) { fprintf(stderr, __VA_ARGS__); }
@@ -41,13 +43,64 @@ static DB_vfs_t plugin;
 #define ZIP_BUFFER_SIZE 8192
 #endif
 
+// Deflated members are inflated using zlib directly, and the inflate state is
+// saved every ZIP_CHECKPOINT_SPAN bytes of output while reading, so that seeks
+// can resume from the nearest checkpoint instead of from the start of the member.
+#define ZIP_CHECKPOINT_SPAN (1024*1024)
+#define ZIP_WINDOW_SIZE 32768
+#define ZIP_INPUT_SIZE 16384
+
+// how many unused archive handles to keep open
+#define ZIP_MAX_IDLE_ARCHIVES 4
+
+typedef struct {
+    int64_t in; // offset in the compressed data
+    int64_t out; // offset in the uncompressed data
+    int bits; // number of bits of the byte at (in-1) belonging to the next block
+    uint8_t window[ZIP_WINDOW_SIZE];
+} ddb_zip_checkpoint_t;
+
+// checkpoints of one member, shared by all files opening it
+typedef struct ddb_zip_member_index_s {
+    int index;
+    ddb_zip_checkpoint_t **checkpoints;
+    int num_checkpoints;
+    struct ddb_zip_member_index_s *next;
+} ddb_zip_member_index_t;
+
+// Archive handle shared by all files opened from the same zip.
+// libzip handles may not be used from several threads at once, hence the mutex,
+// which also protects the member indexes.
+typedef struct ddb_zip_archive_s {
+    char *fname;
+    struct zip *z;
+    uintptr_t mutex;
+    int refc;
+    int stale;
+    time_t mtime;
+    off_t size;
+    ddb_zip_member_index_t *members;
+    struct ddb_zip_archive_s *next;
+} ddb_zip_archive_t;
+
 typedef struct {
     DB_FILE file;
-    struct zip* z;
+    ddb_zip_archive_t *archive;
     struct zip_file *zf;
     int64_t offset;
     int index;
     int64_t size;
+    int stored;
+
+    // raw inflate state, used for deflated members
+    int use_inflate;
+    int stream_end;
+    z_stream strm;
+    int64_t in_offset;
+    int64_t out_offset;
+    ddb_zip_member_index_t *member;
+    uint8_t input[ZIP_INPUT_SIZE];
+    uint8_t window[ZIP_WINDOW_SIZE]; // ring buffer with the last inflated bytes
 
 #if ENABLE_CACHE
     uint8_t buffer[ZIP_BUFFER_SIZE];
@@ -56,6 +109,17 @@ typedef struct {
 #endif
 } ddb_zip_file_t;
 
+static ddb_zip_archive_t *archives;
+static uintptr_t archives_mutex;
+// the number of archives with open files, including the stale ones
+static int referenced_archives;
+// set when the plugin was stopped while some files were still open,
+// the last release frees archives_mutex then
+static int stopping;
+
+void
+vfs_zip_close (DB_FILE *f);
+
 static const char *scheme_names[] = { "zip://", NULL };
 
 const char **
@@ -68,6 +132,305 @@ vfs_zip_is_streaming (void) {
     return 0;
 }
 
+static void
+_archive_free (ddb_zip_archive_t *a) {
+    trace ("vfs_zip: closing archive %s\n", a->fname);
+    while (a->members) {
+        ddb_zip_member_index_t *next = a->members->next;
+        for (int i = 0; i < a->members->num_checkpoints; i++) {
+            free (a->members->checkpoints[i]);
+        }
+        free (a->members->checkpoints);
+        free (a->members);
+        a->members = next;
+    }
+    if (a->z) {
+        zip_close (a->z);
+    }
+    if (a->mutex) {
+        deadbeef->mutex_free (a->mutex);
+    }
+    free (a->fname);
+    free (a);
+}
+
+// returns a referenced archive handle, reusing an open one if the file didn't change
+static ddb_zip_archive_t *
+_archive_open (const char *fname) {
+    struct stat st;
+    if (stat (fname, &st) || !S_ISREG (st.st_mode)) {
+        return NULL;
+    }
+
+    deadbeef->mutex_lock (archives_mutex);
+    ddb_zip_archive_t *prev = NULL;
+    ddb_zip_archive_t *a;
+    for (a = archives; a; prev = a, a = a->next) {
+        if (!strcmp (a->fname, fname)) {
+            break;
+        }
+    }
+
+    if (a) {
+        // unlink, it will be re-added to the head of the list
+        if (prev) {
+            prev->next = a->next;
+        }
+        else {
+            archives = a->next;
+        }
+        a->next = NULL;
+
+        if (a->mtime != st.st_mtime || a->size != st.st_size) {
+            // the file has changed, the last user will free the old handle
+            a->stale = 1;
+            if (!a->refc) {
+                _archive_free (a);
+            }
+            a = NULL;
+        }
+    }
+
+    if (!a) {
+        struct zip *z = zip_open (fname, 0, NULL);
+        if (z) {
+            a = calloc (1, sizeof (ddb_zip_archive_t));
+            a->fname = strdup (fname);
+            a->z = z;
+            a->mutex = deadbeef->mutex_create ();
+            a->mtime = st.st_mtime;
+            a->size = st.st_size;
+        }
+    }
+
+    if (a) {
+        if (!a->refc++) {
+            referenced_archives++;
+        }
+        a->next = archives;
+        archives = a;
+    }
+    deadbeef->mutex_unlock (archives_mutex);
+    return a;
+}
+
+static void
+_archive_release (ddb_zip_archive_t *a) {
+    deadbeef->mutex_lock (archives_mutex);
+    if (!--a->refc) {
+        referenced_archives--;
+    }
+    if (a->stale) {
+        if (!a->refc) {
+            _archive_free (a);
+        }
+    }
+    else if (!a->refc) {
+        // the list is in most recently used order, close the oldest idle handles
+        int idle = 0;
+        ddb_zip_archive_t *prev = NULL;
+        ddb_zip_archive_t *i = archives;
+        while (i) {
+            ddb_zip_archive_t *next = i->next;
+            if (!i->refc && ++idle > ZIP_MAX_IDLE_ARCHIVES) {
+                if (prev) {
+                    prev->next = next;
+                }
+                else {
+                    archives = next;
+                }
+                _archive_free (i);
+            }
+            else {
+                prev = i;
+            }
+            i = next;
+        }
+    }
+    if (stopping && !referenced_archives) {
+        deadbeef->mutex_unlock (archives_mutex);
+        deadbeef->mutex_free (archives_mutex);
+        archives_mutex = 0;
+        stopping = 0;
+        return;
+    }
+    deadbeef->mutex_unlock (archives_mutex);
+}
+
+// must be called with the archive mutex locked
+static int
+_member_open (ddb_zip_file_t *zf) {
+    if (zf->zf) {
+        zip_fclose (zf->zf);
+    }
+    zf->zf = zip_fopen_index (zf->archive->z, zf->index, zf->use_inflate ? ZIP_FL_COMPRESSED : 0);
+    return zf->zf ? 0 : -1;
+}
+
+// must be called with the archive mutex locked
+static ddb_zip_member_index_t *
+_member_index_get (ddb_zip_archive_t *a, int index) {
+    ddb_zip_member_index_t *m;
+    for (m = a->members; m; m = m->next) {
+        if (m->index == index) {
+            return m;
+        }
+    }
+    m = calloc (1, sizeof (ddb_zip_member_index_t));
+    m->index = index;
+    m->next = a->members;
+    a->members = m;
+    return m;
+}
+
+static int64_t
+_member_read (ddb_zip_file_t *zf, void *buf, int64_t size) {
+    deadbeef->mutex_lock (zf->archive->mutex);
+    int64_t rb = zf->zf ? zip_fread (zf->zf, buf, size) : -1;
+    deadbeef->mutex_unlock (zf->archive->mutex);
+    return rb;
+}
+
+static void
+_inflate_update_window (ddb_zip_file_t *zf, const uint8_t *data, int64_t size) {
+    int64_t pos = zf->out_offset;
+    if (size > ZIP_WINDOW_SIZE) {
+        data += size - ZIP_WINDOW_SIZE;
+        pos += size - ZIP_WINDOW_SIZE;
+        size = ZIP_WINDOW_SIZE;
+    }
+    while (size > 0) {
+        int64_t p = pos % ZIP_WINDOW_SIZE;
+        int64_t n = min (size, ZIP_WINDOW_SIZE - p);
+        memcpy (zf->window + p, data, n);
+        data += n;
+        pos += n;
+        size -= n;
+    }
+}
+
+// must be called with the archive mutex locked
+static void
+_inflate_add_checkpoint (ddb_zip_file_t *zf) {
+    ddb_zip_member_index_t *m = zf->member;
+    trace ("vfs_zip: checkpoint %d at %lld\n", m->num_checkpoints, (long long)zf->out_offset);
+    ddb_zip_checkpoint_t *cp = malloc (sizeof (ddb_zip_checkpoint_t));
+    cp->in = zf->in_offset - zf->strm.avail_in;
+    cp->out = zf->out_offset;
+    cp->bits = zf->strm.data_type & 7;
+    int64_t p = zf->out_offset % ZIP_WINDOW_SIZE;
+    memcpy (cp->window, zf->window + p, ZIP_WINDOW_SIZE - p);
+    memcpy (cp->window + ZIP_WINDOW_SIZE - p, zf->window, p);
+
+    if (!(m->num_checkpoints % 16)) {
+        m->checkpoints = realloc (m->checkpoints, (m->num_checkpoints + 16) * sizeof (ddb_zip_checkpoint_t *));
+    }
+    m->checkpoints[m->num_checkpoints++] = cp;
+}
+
+static int64_t
+_inflate_read (ddb_zip_file_t *zf, uint8_t *out, int64_t size) {
+    zf->strm.next_out = out;
+    zf->strm.avail_out = (uInt)size;
+    while (zf->strm.avail_out > 0 && !zf->stream_end) {
+        if (zf->strm.avail_in == 0) {
+            int64_t rb = _member_read (zf, zf->input, ZIP_INPUT_SIZE);
+            if (rb <= 0) {
+                break;
+            }
+            zf->in_offset += rb;
+            zf->strm.next_in = zf->input;
+            zf->strm.avail_in = (uInt)rb;
+        }
+
+        // Z_BLOCK stops at each deflate block boundary, which is where checkpoints can be made
+        uint8_t *start = zf->strm.next_out;
+        int ret = inflate (&zf->strm, Z_BLOCK);
+        if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+            trace ("vfs_zip: inflate error %d\n", ret);
+            break;
+        }
+        int64_t produced = zf->strm.next_out - start;
+        _inflate_update_window (zf, start, produced);
+        zf->out_offset += produced;
+
+        if (ret == Z_STREAM_END) {
+            zf->stream_end = 1;
+            break;
+        }
+
+        // block boundary, which is not the end of the stream
+        if ((zf->strm.data_type & 128) && !(zf->strm.data_type & 64)) {
+            deadbeef->mutex_lock (zf->archive->mutex);
+            ddb_zip_member_index_t *m = zf->member;
+            int64_t last = m->num_checkpoints ? m->checkpoints[m->num_checkpoints-1]->out : 0;
+            if (zf->out_offset - last >= ZIP_CHECKPOINT_SPAN) {
+                _inflate_add_checkpoint (zf);
+            }
+            deadbeef->mutex_unlock (zf->archive->mutex);
+        }
+    }
+    return size - zf->strm.avail_out;
+}
+
+// restart inflating from the checkpoint, or from the start of the member if cp is NULL
+static int
+_inflate_restore (ddb_zip_file_t *zf, ddb_zip_checkpoint_t *cp) {
+    int64_t in = cp ? cp->in - (cp->bits ? 1 : 0) : 0;
+
+    deadbeef->mutex_lock (zf->archive->mutex);
+    int res = 0;
+    if (!zf->zf || zip_fseek (zf->zf, in, SEEK_SET)) {
+        // the compressed data is not seekable with this libzip, skip to the checkpoint,
+        // which is still much cheaper than inflating
+        res = _member_open (zf);
+        int64_t n = in;
+        while (!res && n > 0) {
+            int64_t rb = zip_fread (zf->zf, zf->input, min (n, ZIP_INPUT_SIZE));
+            if (rb <= 0) {
+                res = -1;
+            }
+            n -= rb;
+        }
+    }
+    deadbeef->mutex_unlock (zf->archive->mutex);
+    if (res) {
+        return -1;
+    }
+
+    inflateReset (&zf->strm);
+    zf->strm.next_in = zf->input;
+    zf->strm.avail_in = 0;
+    zf->in_offset = in;
+    zf->out_offset = 0;
+    zf->stream_end = 0;
+
+    if (cp) {
+        if (cp->bits) {
+            uint8_t ch;
+            if (_member_read (zf, &ch, 1) != 1) {
+                return -1;
+            }
+            zf->in_offset++;
+            inflatePrime (&zf->strm, cp->bits, ch >> (8 - cp->bits));
+        }
+        inflateSetDictionary (&zf->strm, cp->window, ZIP_WINDOW_SIZE);
+        zf->out_offset = cp->out;
+        int64_t p = cp->out % ZIP_WINDOW_SIZE;
+        memcpy (zf->window + p, cp->window, ZIP_WINDOW_SIZE - p);
+        memcpy (zf->window, cp->window + ZIP_WINDOW_SIZE - p, p);
+    }
+    return 0;
+}
+
+static int64_t
+_read_raw (ddb_zip_file_t *zf, void *buf, int64_t size) {
+    if (zf->use_inflate) {
+        return _inflate_read (zf, buf, size);
+    }
+    return _member_read (zf, buf, size);
+}
+
 // fname must have form of zip://full_filepath.zip:full_filepath_in_zip
 DB_FILE*
 vfs_zip_open (const char *fname) {
@@ -78,7 +441,7 @@ vfs_zip_open (const char *fname) {
 
     fname += 6;
 
-    struct zip *z = NULL;
+    ddb_zip_archive_t *a = NULL;
     struct zip_stat st;
 
     const char *colon = fname;
@@ -95,38 +458,52 @@ vfs_zip_open (const char *fname) {
 
         colon = colon+1;
 
-        z = zip_open (zipname, 0, NULL);
-        if (!z) {
+        a = _archive_open (zipname);
+        if (!a) {
             continue;
         }
         memset (&st, 0, sizeof (st));
 
-        int res = zip_stat(z, colon, 0, &st);
+        deadbeef->mutex_lock (a->mutex);
+        int res = zip_stat(a->z, colon, 0, &st);
+        deadbeef->mutex_unlock (a->mutex);
         if (res != 0) {
-            zip_close (z);
+            _archive_release (a);
             return NULL;
         }
 
         break;
     }
 
-    if (!z) {
-        return NULL;
-    }
-
-    struct zip_file *zf = zip_fopen_index (z, st.index, 0);
-    if (!zf) {
-        zip_close (z);
+    if (!a) {
         return NULL;
     }
 
     ddb_zip_file_t *f = malloc (sizeof (ddb_zip_file_t));
     memset (f, 0, sizeof (ddb_zip_file_t));
     f->file.vfs = &plugin;
-    f->z = z;
-    f->zf = zf;
+    f->archive = a;
     f->index = st.index;
     f->size = st.size;
+
+    if (st.valid & ZIP_STAT_COMP_METHOD) {
+        int encrypted = (st.valid & ZIP_STAT_ENCRYPTION_METHOD) && st.encryption_method != ZIP_EM_NONE;
+        f->stored = st.comp_method == ZIP_CM_STORE && !encrypted;
+        if (st.comp_method == ZIP_CM_DEFLATE && !encrypted && inflateInit2 (&f->strm, -MAX_WBITS) == Z_OK) {
+            f->use_inflate = 1;
+        }
+    }
+
+    deadbeef->mutex_lock (a->mutex);
+    if (f->use_inflate) {
+        f->member = _member_index_get (a, f->index);
+    }
+    int res = _member_open (f);
+    deadbeef->mutex_unlock (a->mutex);
+    if (res) {
+        vfs_zip_close ((DB_FILE *)f);
+        return NULL;
+    }
     trace ("vfs_zip: end open %s\n", fname);
     return (DB_FILE*)f;
 }
@@ -136,11 +513,14 @@ vfs_zip_close (DB_FILE *f) {
     trace ("vfs_zip: close\n");
     ddb_zip_file_t *zf = (ddb_zip_file_t *)f;
     if (zf->zf) {
+        deadbeef->mutex_lock (zf->archive->mutex);
         zip_fclose (zf->zf);
+        deadbeef->mutex_unlock (zf->archive->mutex);
     }
-    if (zf->z) {
-        zip_close (zf->z);
+    if (zf->use_inflate) {
+        inflateEnd (&zf->strm);
     }
+    _archive_release (zf->archive);
     free (zf);
 }
 
@@ -154,7 +534,7 @@ vfs_zip_read (void *ptr, size_t size, size_t nmemb, DB_FILE *f) {
     while (sz) {
         if (zf->buffer_remaining == 0) {
             zf->buffer_pos = 0;
-            int rb = zip_fread (zf->zf, zf->buffer, ZIP_BUFFER_SIZE);
+            int rb = (int)_read_raw (zf, zf->buffer, ZIP_BUFFER_SIZE);
             if (rb <= 0) {
                 break;
             }
@@ -169,9 +549,11 @@ vfs_zip_read (void *ptr, size_t size, size_t nmemb, DB_FILE *f) {
         ptr += from_buf;
     }
 #else
-    rb = zip_fread (zf->zf, ptr, sz);
-    sz -= rb;
-    zf->offset += rb;
+    int64_t rb = _read_raw (zf, ptr, sz);
+    if (rb > 0) {
+        sz -= rb;
+        zf->offset += rb;
+    }
 #endif
 
     return (size * nmemb - sz) / size;
@@ -220,31 +602,65 @@ vfs_zip_seek (DB_FILE *f, int64_t offset, int whence) {
 //    }
 
     zf->offset += zf->buffer_remaining;
+    zf->buffer_pos = 0;
+    zf->buffer_remaining = 0;
 #endif
+    if (zf->use_inflate) {
+        // resume from the last checkpoint before the target, unless reading on is closer
+        ddb_zip_checkpoint_t *cp = NULL;
+        deadbeef->mutex_lock (zf->archive->mutex);
+        ddb_zip_member_index_t *m = zf->member;
+        int lo = 0, hi = m->num_checkpoints;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (m->checkpoints[mid]->out <= offset) {
+                cp = m->checkpoints[mid];
+                lo = mid + 1;
+            }
+            else {
+                hi = mid;
+            }
+        }
+        deadbeef->mutex_unlock (zf->archive->mutex);
+        if (offset < zf->offset || (cp && cp->out > zf->offset)) {
+            if (_inflate_restore (zf, cp)) {
+                return -1;
+            }
+            zf->offset = zf->out_offset;
+        }
+    }
+    else if (zf->stored && offset <= zf->size) {
+        // uncompressed data can be seeked directly
+        deadbeef->mutex_lock (zf->archive->mutex);
+        int res = zip_fseek (zf->zf, offset, SEEK_SET);
+        deadbeef->mutex_unlock (zf->archive->mutex);
+        if (!res) {
+            zf->offset = offset;
+            return 0;
+        }
+    }
+
     if (offset < zf->offset) {
         // reopen
-        zip_fclose (zf->zf);
-        zf->zf = zip_fopen_index (zf->z, zf->index, 0);
-        if (!zf->zf) {
+        deadbeef->mutex_lock (zf->archive->mutex);
+        int res = _member_open (zf);
+        deadbeef->mutex_unlock (zf->archive->mutex);
+        if (res) {
             return -1;
         }
         zf->offset = 0;
     }
-#if ENABLE_CACHE
-    zf->buffer_pos = 0;
-    zf->buffer_remaining = 0;
-#endif
     char buf[4096];
     int64_t n = offset - zf->offset;
     while (n > 0) {
         int sz = min (n, sizeof (buf));
-        ssize_t rb = zip_fread (zf->zf, buf, sz);
+        int64_t rb = _read_raw (zf, buf, sz);
+        if (rb <= 0) {
+            break;
+        }
         n -= rb;
         assert (n >= 0);
         zf->offset += rb;
-        if (rb != sz) {
-            break;
-        }
     }
     if (n > 0) {
         return -1;
@@ -260,14 +676,7 @@ vfs_zip_tell (DB_FILE *f) {
 
 void
 vfs_zip_rewind (DB_FILE *f) {
-    ddb_zip_file_t *zf = (ddb_zip_file_t *)f;
-    zip_fclose (zf->zf);
-    zf->zf = zip_fopen_index (zf->z, zf->index, 0);
-    assert (zf->zf); // FIXME: better error handling?
-    zf->offset = 0;
-#if ENABLE_CACHE
-    zf->buffer_remaining = 0;
-#endif
+    vfs_zip_seek (f, 0, SEEK_SET);
 }
 
 int64_t
@@ -279,13 +688,14 @@ vfs_zip_getlength (DB_FILE *f) {
 int
 vfs_zip_scandir (const char *dir, struct dirent ***namelist, int (*selector) (const struct dirent *), int (*cmp) (const struct dirent **, const struct dirent **)) {
     trace ("vfs_zip_scandir: %s\n", dir);
-    int error;
-    struct zip *z = zip_open (dir, 0, &error);
-    if (!z) {
-        trace ("zip_open failed (code: %d)\n", error);
+    ddb_zip_archive_t *a = _archive_open (dir);
+    if (!a) {
+        trace ("zip_open failed\n");
         return -1;
     }
 
+    deadbeef->mutex_lock (a->mutex);
+    struct zip *z = a->z;
     int num_files = 0;
     const int n = zip_get_num_files(z);
     *namelist = malloc(sizeof(void *) * n);
@@ -301,8 +711,9 @@ vfs_zip_scandir (const char *dir, struct dirent ***namelist, int (*selector) (co
             trace("vfs_zip: %s\n", nm);
         }
     }
+    deadbeef->mutex_unlock (a->mutex);
 
-    zip_close (z);
+    _archive_release (a);
     trace ("vfs_zip: scandir done\n");
     return num_files;
 }
@@ -320,10 +731,48 @@ vfs_zip_get_scheme_for_name (const char *fname) {
     return scheme_names[0];
 }
 
+static int
+vfs_zip_start (void) {
+    if (archives_mutex) {
+        // restarted before the files open at stop were closed
+        deadbeef->mutex_lock (archives_mutex);
+        stopping = 0;
+        deadbeef->mutex_unlock (archives_mutex);
+        return 0;
+    }
+    archives_mutex = deadbeef->mutex_create ();
+    return 0;
+}
+
+static int
+vfs_zip_stop (void) {
+    deadbeef->mutex_lock (archives_mutex);
+    while (archives) {
+        ddb_zip_archive_t *next = archives->next;
+        if (archives->refc) {
+            archives->stale = 1;
+        }
+        else {
+            _archive_free (archives);
+        }
+        archives = next;
+    }
+    if (referenced_archives) {
+        // the stale archives still need the mutex to be released
+        stopping = 1;
+        deadbeef->mutex_unlock (archives_mutex);
+        return 0;
+    }
+    deadbeef->mutex_unlock (archives_mutex);
+    deadbeef->mutex_free (archives_mutex);
+    archives_mutex = 0;
+    return 0;
+}
+
 static DB_vfs_t plugin = {
     DDB_PLUGIN_SET_API_VERSION
     .plugin.version_major = 1,
-    .plugin.version_minor = 0,
+    .plugin.version_minor = 1,
     .plugin.type = DB_PLUGIN_VFS,
     .plugin.id = "vfs_zip",
     .plugin.name = "ZIP vfs",
@@ -351,6 +800,8 @@ static DB_vfs_t plugin = {
         "3. This notice may not be removed or altered from any source distribution.\n"
     ,
     .plugin.website = "http://deadbeef.sf.net",
+    .plugin.start = vfs_zip_start,
+    .plugin.stop = vfs_zip_stop,
     .open = vfs_zip_open,
     .close = vfs_zip_close,
     .read = vfs_zip_read,
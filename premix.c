@@ -525,6 +525,175 @@ remap_fn_t remappers[8][8] = {
     }
 };
 
+// Vectorized converters for the case when the channels are not remapped,
+// so that the samples can be processed as one continuous array of nvalues = nsamples * channels.
+// They are selected at runtime based on the CPU features, and must produce exactly the same output as the scalar code,
+// which handles the tails and the CPUs without SSE2.
+// Float to int conversions use the current (round to nearest) SSE rounding mode, just like ftoi, and saturate the same way.
+typedef void (*convert_fn_t) (const char * restrict input, char * restrict output, int nvalues);
+
+static convert_fn_t convert_16_to_float;
+static convert_fn_t convert_float_to_16;
+static convert_fn_t convert_24_to_32;
+static int simd_initialized;
+static int simd_disabled;
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PCM_CONVERT_SIMD 1
+#include <immintrin.h>
+
+__attribute__((target("sse2"))) static void
+convert_16_to_float_sse2 (const char * restrict input, char * restrict output, int nvalues) {
+    const int16_t *in = (const int16_t *)input;
+    float *out = (float *)output;
+    const __m128 scale = _mm_set1_ps (1.f / 0x8000);
+    int i = 0;
+    for (; i + 8 <= nvalues; i += 8) {
+        __m128i s = _mm_loadu_si128 ((const __m128i *)(in + i));
+        __m128i lo = _mm_srai_epi32 (_mm_unpacklo_epi16 (s, s), 16);
+        __m128i hi = _mm_srai_epi32 (_mm_unpackhi_epi16 (s, s), 16);
+        _mm_storeu_ps (out + i, _mm_mul_ps (_mm_cvtepi32_ps (lo), scale));
+        _mm_storeu_ps (out + i + 4, _mm_mul_ps (_mm_cvtepi32_ps (hi), scale));
+    }
+    for (; i < nvalues; i++) {
+        out[i] = in[i] / (float)0x8000;
+    }
+}
+
+__attribute__((target("sse2"))) static void
+convert_float_to_16_sse2 (const char * restrict input, char * restrict output, int nvalues) {
+    const float *in = (const float *)input;
+    int16_t *out = (int16_t *)output;
+    const __m128 scale = _mm_set1_ps (0x8000);
+    int i = 0;
+    for (; i + 8 <= nvalues; i += 8) {
+        // out of range values convert to 0x80000000, which saturates to -0x8000, same as in the scalar code
+        __m128i lo = _mm_cvtps_epi32 (_mm_mul_ps (_mm_loadu_ps (in + i), scale));
+        __m128i hi = _mm_cvtps_epi32 (_mm_mul_ps (_mm_loadu_ps (in + i + 4), scale));
+        _mm_storeu_si128 ((__m128i *)(out + i), _mm_packs_epi32 (lo, hi));
+    }
+    for (; i < nvalues; i++) {
+        int isample = _mm_cvtss_si32 (_mm_set_ss (in[i] * 0x8000));
+        out[i] = (int16_t)(isample > 0x7fff ? 0x7fff : isample < -0x8000 ? -0x8000 : isample);
+    }
+}
+
+static void
+convert_24_to_32_tail (const char * restrict input, char * restrict output, int nvalues) {
+    for (int i = 0; i < nvalues; i++) {
+        output[4*i] = 0;
+        output[4*i+1] = input[3*i];
+        output[4*i+2] = input[3*i+1];
+        output[4*i+3] = input[3*i+2];
+    }
+}
+
+__attribute__((target("ssse3"))) static void
+convert_24_to_32_ssse3 (const char * restrict input, char * restrict output, int nvalues) {
+    const __m128i shuffle = _mm_setr_epi8 (-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+    int i = 0;
+    // each load reads 16 bytes to get 4 samples, so stop while there are at least 2 more samples after them
+    for (; i + 6 <= nvalues; i += 4) {
+        __m128i s = _mm_loadu_si128 ((const __m128i *)(input + 3 * i));
+        _mm_storeu_si128 ((__m128i *)(output + 4 * i), _mm_shuffle_epi8 (s, shuffle));
+    }
+    convert_24_to_32_tail (input + 3 * i, output + 4 * i, nvalues - i);
+}
+
+__attribute__((target("avx2"))) static void
+convert_16_to_float_avx2 (const char * restrict input, char * restrict output, int nvalues) {
+    const int16_t *in = (const int16_t *)input;
+    float *out = (float *)output;
+    const __m256 scale = _mm256_set1_ps (1.f / 0x8000);
+    int i = 0;
+    for (; i + 16 <= nvalues; i += 16) {
+        __m256i lo = _mm256_cvtepi16_epi32 (_mm_loadu_si128 ((const __m128i *)(in + i)));
+        __m256i hi = _mm256_cvtepi16_epi32 (_mm_loadu_si128 ((const __m128i *)(in + i + 8)));
+        _mm256_storeu_ps (out + i, _mm256_mul_ps (_mm256_cvtepi32_ps (lo), scale));
+        _mm256_storeu_ps (out + i + 8, _mm256_mul_ps (_mm256_cvtepi32_ps (hi), scale));
+    }
+    convert_16_to_float_sse2 ((const char *)(in + i), (char *)(out + i), nvalues - i);
+}
+
+__attribute__((target("avx2"))) static void
+convert_float_to_16_avx2 (const char * restrict input, char * restrict output, int nvalues) {
+    const float *in = (const float *)input;
+    int16_t *out = (int16_t *)output;
+    const __m256 scale = _mm256_set1_ps (0x8000);
+    int i = 0;
+    for (; i + 16 <= nvalues; i += 16) {
+        __m256i lo = _mm256_cvtps_epi32 (_mm256_mul_ps (_mm256_loadu_ps (in + i), scale));
+        __m256i hi = _mm256_cvtps_epi32 (_mm256_mul_ps (_mm256_loadu_ps (in + i + 8), scale));
+        // packs works within 128 bit lanes, so the 64 bit quarters need to be put back in order
+        __m256i packed = _mm256_permute4x64_epi64 (_mm256_packs_epi32 (lo, hi), 0xd8);
+        _mm256_storeu_si256 ((__m256i *)(out + i), packed);
+    }
+    convert_float_to_16_sse2 ((const char *)(in + i), (char *)(out + i), nvalues - i);
+}
+
+__attribute__((target("avx2"))) static void
+convert_24_to_32_avx2 (const char * restrict input, char * restrict output, int nvalues) {
+    const __m256i shuffle = _mm256_setr_epi8 (-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11,
+                                              -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+    int i = 0;
+    for (; i + 10 <= nvalues; i += 8) {
+        __m128i lo = _mm_loadu_si128 ((const __m128i *)(input + 3 * i));
+        __m128i hi = _mm_loadu_si128 ((const __m128i *)(input + 3 * i + 12));
+        __m256i s = _mm256_inserti128_si256 (_mm256_castsi128_si256 (lo), hi, 1);
+        _mm256_storeu_si256 ((__m256i *)(output + 4 * i), _mm256_shuffle_epi8 (s, shuffle));
+    }
+    convert_24_to_32_ssse3 (input + 3 * i, output + 4 * i, nvalues - i);
+}
+#endif
+
+static void
+pcm_convert_simd_init (void) {
+    convert_16_to_float = NULL;
+    convert_float_to_16 = NULL;
+    convert_24_to_32 = NULL;
+#if PCM_CONVERT_SIMD
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("avx2")) {
+        convert_16_to_float = convert_16_to_float_avx2;
+        convert_float_to_16 = convert_float_to_16_avx2;
+        convert_24_to_32 = convert_24_to_32_avx2;
+    }
+    else if (__builtin_cpu_supports ("sse2")) {
+        convert_16_to_float = convert_16_to_float_sse2;
+        convert_float_to_16 = convert_float_to_16_sse2;
+        if (__builtin_cpu_supports ("ssse3")) {
+            convert_24_to_32 = convert_24_to_32_ssse3;
+        }
+    }
+#endif
+    simd_initialized = 1;
+}
+
+void
+pcm_convert_set_simd_enabled (int enabled) {
+    simd_disabled = !enabled;
+}
+
+static convert_fn_t
+pcm_get_simd_converter (int inidx, int outidx) {
+    if (simd_disabled) {
+        return NULL;
+    }
+    if (!simd_initialized) {
+        pcm_convert_simd_init ();
+    }
+    if (inidx == 1 && outidx == 7) {
+        return convert_16_to_float;
+    }
+    if (inidx == 7 && outidx == 1) {
+        return convert_float_to_16;
+    }
+    if (inidx == 2 && outidx == 3) {
+        return convert_24_to_32;
+    }
+    return NULL;
+}
+
 int
 pcm_convert (const ddb_waveformat_t * restrict inputfmt, const char * restrict input, const ddb_waveformat_t * restrict outputfmt, char * restrict output, int inputsize) {
     // calculate output size
@@ -581,7 +750,19 @@ pcm_convert (const ddb_waveformat_t * restrict inputfmt, const char * restrict i
 
         int outidx = ((outputfmt->bps >> 3) - 1) | (outputfmt->is_float << 2);
         int inidx = ((inputfmt->bps >> 3) - 1) | (inputfmt->is_float << 2);
-        if (remappers[inidx][outidx]) {
+
+        int identity = inputfmt->channels == outputfmt->channels && outchannels == outputfmt->channelmask;
+        for (int i = 0; identity && i < inputfmt->channels; i++) {
+            if (channelmap[i] != i) {
+                identity = 0;
+            }
+        }
+        convert_fn_t convert = identity ? pcm_get_simd_converter (inidx, outidx) : NULL;
+
+        if (convert) {
+            convert (input, output, nsamples * inputfmt->channels);
+        }
+        else if (remappers[inidx][outidx]) {
             remappers[inidx][outidx] (inputfmt, input, outputfmt, output, nsamples, channelmap, outputsamplesize);
         }
         else {
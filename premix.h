@@ -32,4 +32,8 @@
 int
 pcm_convert (const ddb_waveformat_t * restrict inputfmt, const char * restrict input, const ddb_waveformat_t * restrict outputfmt, char * restrict output, int inputsize);
 
+// Enables or disables the vectorized converters (enabled by default), used for testing them against the scalar code
+void
+pcm_convert_set_simd_enabled (int enabled);
+
 #endif
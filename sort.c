@@ -25,11 +25,13 @@
 #include <ctype.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include "utf8.h"
 #include "sort.h"
 #include "tf.h"
 #include "pltmeta.h"
 #include "messagepump.h"
+#include "threading.h"
 
 //#define trace(...) { fprintf(stderr, __VA_ARGS__); }
 #define trace(fmt,...)
@@ -48,94 +50,362 @@ plt_sort (playlist_t *playlist, int iter, int id, const char *format, int order)
     plt_sort_internal (playlist, iter, id, format, order, 0);
 }
 
-static int pl_sort_is_duration;
-static int pl_sort_is_track;
-static int pl_sort_ascending;
-static int pl_sort_id;
-static int pl_sort_version; // 0: use pl_sort_format, 1: use pl_sort_tf_bytecode
-static const char *pl_sort_format;
-static char *pl_sort_tf_bytecode;
-static ddb_tf_context_t pl_sort_tf_ctx;
+// Sorting precomputes a key for each track, and then sorts the keys with a
+// stable merge sort. Title formatting runs once per track, instead of twice per
+// comparison. For large playlists, both steps are split between worker threads.
+#define PL_SORT_MIN_ITEMS_PER_THREAD 4096
+#define PL_SORT_MAX_THREADS 16
+#define PL_SORT_KEY_SIZE 1024
+
+typedef struct {
+    int is_duration;
+    int is_track;
+    int ascending;
+    int id;
+    int version; // 0: use format, 1: use tf_bytecode
+    const char *format;
+    char *tf_bytecode;
+    playlist_t *plt;
+    int iter;
+    int has_index; // the position in the array is the list index of the track
+    int shared_lock; // key workers must take pl_lock in shared mode
+} pl_sort_params_t;
+
+typedef struct {
+    playItem_t *it;
+    const char *str; // case-folded result of title formatting
+    int num_len; // number of leading digits in str
+    int num; // value of the leading digits
+    float duration;
+    int track;
+} pl_sort_key_t;
+
+typedef struct {
+    const pl_sort_params_t *params;
+    pl_sort_key_t *keys;
+    pl_sort_key_t *tmp;
+    int start;
+    int mid;
+    int end;
+    char *strings;
+    size_t strings_size;
+    size_t strings_reserved;
+} pl_sort_job_t;
 
 static int
-strcasecmp_numeric (const char *a, const char *b) {
-    if (isdigit (*a) && isdigit (*b)) {
-        int anum = *a-'0';
-        const char *ae = a+1;
-        while (*ae && isdigit (*ae)) {
-            anum *= 10;
-            anum += *ae-'0';
-            ae++;
+_sort_cpu_count (void) {
+#ifdef _SC_NPROCESSORS_ONLN
+    long n = sysconf (_SC_NPROCESSORS_ONLN);
+    if (n > 0) {
+        return n > PL_SORT_MAX_THREADS ? PL_SORT_MAX_THREADS : (int)n;
+    }
+#endif
+    return 1;
+}
+
+static int
+_sort_thread_count (int count) {
+    int n = count / PL_SORT_MIN_ITEMS_PER_THREAD;
+    int cpus = _sort_cpu_count ();
+    if (n > cpus) {
+        n = cpus;
+    }
+    return n < 1 ? 1 : n;
+}
+
+// Runs fn for each job, using one thread per job except the first, which runs in the caller.
+static void
+_sort_run_jobs (void (*fn)(void *ctx), pl_sort_job_t *jobs, int count) {
+    intptr_t tids[PL_SORT_MAX_THREADS];
+    for (int i = 1; i < count; i++) {
+        tids[i] = thread_start (fn, &jobs[i]);
+    }
+    fn (&jobs[0]);
+    for (int i = 1; i < count; i++) {
+        if (tids[i]) {
+            thread_join (tids[i]);
         }
-        int bnum = *b-'0';
-        const char *be = b+1;
-        while (*be && isdigit (*be)) {
-            bnum *= 10;
-            bnum += *be-'0';
-            be++;
+        else {
+            fn (&jobs[i]);
         }
-        if (anum == bnum) {
-            return u8_strcasecmp (ae, be);
+    }
+}
+
+// Lowercases the string the same way as u8_strcasecmp. Since each character maps
+// to a single character, comparing the results with strcmp gives the same order.
+static void
+_sort_fold_string (const char *in, char *out, int outsize) {
+    char *end = out + outsize - 8;
+    while (*in && out < end) {
+        int32_t i = 0;
+        u8_nextchar (in, &i);
+        if (i <= 0) {
+            break;
         }
-        return anum - bnum;
+        out += u8_tolower ((const signed char *)in, i, out);
+        in += i;
     }
-    return u8_strcasecmp (a,b);
+    *out = 0;
 }
 
-static int
-pl_sort_compare_str (playItem_t *a, playItem_t *b) {
-    if (pl_sort_is_duration) {
-        float dur_a = a->_duration * 100000;
-        float dur_b = b->_duration * 100000;
-        return !pl_sort_ascending ? dur_b - dur_a : dur_a - dur_b;
-    }
-    else if (pl_sort_is_track) {
-        int t1;
-        int t2;
-        const char *t;
-        t = pl_find_meta_raw (a, "track");
+static void
+_sort_compute_key (const pl_sort_params_t *params, ddb_tf_context_t *ctx, pl_sort_key_t *key, int idx, pl_sort_job_t *job) {
+    playItem_t *it = key->it;
+    if (params->is_duration) {
+        key->duration = it->_duration * 100000;
+        return;
+    }
+    if (params->is_track) {
+        const char *t = pl_find_meta_raw (it, "track");
         if (t && !isdigit (*t)) {
-            t1 = 999999;
+            key->track = 999999;
         }
         else {
-            t1 = t ? atoi (t) : -1;
+            key->track = t ? atoi (t) : -1;
         }
-        t = pl_find_meta_raw (b, "track");
-        if (t && !isdigit (*t)) {
-            t2 = 999999;
+        return;
+    }
+
+    char tmp[PL_SORT_KEY_SIZE];
+    char folded[PL_SORT_KEY_SIZE * 2];
+    if (params->version == 0) {
+        pl_format_title (it, params->has_index ? idx : -1, tmp, sizeof (tmp), params->id, params->format);
+    }
+    else {
+        ctx->it = (ddb_playItem_t *)it;
+        ctx->idx = params->has_index ? idx : -1;
+        tf_eval (ctx, params->tf_bytecode, tmp, sizeof (tmp));
+    }
+    _sort_fold_string (tmp, folded, sizeof (folded));
+
+    key->num_len = 0;
+    key->num = 0;
+    for (const char *p = folded; isdigit (*p); p++) {
+        key->num *= 10;
+        key->num += *p-'0';
+        key->num_len++;
+    }
+
+    // the strings are appended to the job's buffer, which may be reallocated,
+    // so store the offset, and convert to a pointer after all keys are done
+    size_t len = strlen (folded) + 1;
+    if (job->strings_size + len > job->strings_reserved) {
+        job->strings_reserved = (job->strings_size + len) * 2;
+        job->strings = realloc (job->strings, job->strings_reserved);
+    }
+    memcpy (job->strings + job->strings_size, folded, len);
+    key->str = (const char *)(uintptr_t)job->strings_size;
+    job->strings_size += len;
+}
+
+static void
+_sort_compute_keys_job (void *ctx) {
+    pl_sort_job_t *job = ctx;
+    const pl_sort_params_t *params = job->params;
+
+    if (params->shared_lock) {
+        pl_lock_shared ();
+    }
+
+    ddb_tf_context_t tf_ctx;
+    memset (&tf_ctx, 0, sizeof (tf_ctx));
+    tf_ctx._size = sizeof (tf_ctx);
+    tf_ctx.plt = (ddb_playlist_t *)params->plt;
+    tf_ctx.iter = params->iter;
+    tf_ctx.id = params->id;
+    tf_ctx.idx = -1;
+    if (params->has_index) {
+        tf_ctx.flags |= DDB_TF_CONTEXT_HAS_INDEX;
+    }
+
+    for (int i = job->start; i < job->end; i++) {
+        _sort_compute_key (params, &tf_ctx, &job->keys[i], i, job);
+    }
+
+    if (params->shared_lock) {
+        pl_unlock ();
+    }
+
+    if (!params->is_duration && !params->is_track) {
+        for (int i = job->start; i < job->end; i++) {
+            job->keys[i].str = job->strings + (uintptr_t)job->keys[i].str;
         }
-        else {
-            t2 = t ? atoi (t) : -1;
+    }
+}
+
+static int
+_sort_compare_keys (const pl_sort_params_t *params, const pl_sort_key_t *a, const pl_sort_key_t *b) {
+    int res;
+    if (params->is_duration) {
+        res = a->duration - b->duration;
+    }
+    else if (params->is_track) {
+        res = a->track - b->track;
+    }
+    else if (a->num_len && b->num_len) {
+        // numbers at the start of the strings are compared by value
+        res = a->num - b->num;
+        if (!res) {
+            res = strcmp (a->str + a->num_len, b->str + b->num_len);
         }
-        return !pl_sort_ascending ? t2 - t1 : t1 - t2;
     }
     else {
-        char tmp1[1024];
-        char tmp2[1024];
-        if (pl_sort_version == 0) {
-            pl_format_title (a, -1, tmp1, sizeof (tmp1), pl_sort_id, pl_sort_format);
-            pl_format_title (b, -1, tmp2, sizeof (tmp2), pl_sort_id, pl_sort_format);
+        res = strcmp (a->str, b->str);
+    }
+    return params->ascending ? res : -res;
+}
+
+static void
+_sort_merge (const pl_sort_params_t *params, const pl_sort_key_t *src, int start, int mid, int end, pl_sort_key_t *dst) {
+    int i = start;
+    int j = mid;
+    int k = start;
+    while (i < mid && j < end) {
+        if (_sort_compare_keys (params, &src[j], &src[i]) < 0) {
+            dst[k++] = src[j++];
         }
         else {
-            pl_sort_tf_ctx.id = pl_sort_id;
-            pl_sort_tf_ctx.it = (ddb_playItem_t *)a;
-            tf_eval(&pl_sort_tf_ctx, pl_sort_tf_bytecode, tmp1, sizeof(tmp1));
-            pl_sort_tf_ctx.it = (ddb_playItem_t *)b;
-            tf_eval(&pl_sort_tf_ctx, pl_sort_tf_bytecode, tmp2, sizeof(tmp2));
+            dst[k++] = src[i++];
         }
-        int res = strcasecmp_numeric (tmp1, tmp2);
-        if (!pl_sort_ascending) {
-            res = -res;
+    }
+    memcpy (dst + k, src + i, (mid - i) * sizeof (pl_sort_key_t));
+    k += mid - i;
+    memcpy (dst + k, src + j, (end - j) * sizeof (pl_sort_key_t));
+}
+
+// Sorts the range of dst, using the same range of src as scratch space.
+// Both arrays must have the same contents in the range.
+static void
+_sort_keys_range (const pl_sort_params_t *params, pl_sort_key_t *src, pl_sort_key_t *dst, int start, int end) {
+    if (end - start <= 16) {
+        for (int i = start + 1; i < end; i++) {
+            pl_sort_key_t key = dst[i];
+            int j = i;
+            for (; j > start && _sort_compare_keys (params, &key, &dst[j-1]) < 0; j--) {
+                dst[j] = dst[j-1];
+            }
+            dst[j] = key;
         }
-        return res;
+        return;
     }
+    int mid = start + (end - start) / 2;
+    _sort_keys_range (params, dst, src, start, mid);
+    _sort_keys_range (params, dst, src, mid, end);
+    _sort_merge (params, src, start, mid, end, dst);
 }
 
-static int
-qsort_cmp_func (const void *a, const void *b) {
-    playItem_t *aa = *((playItem_t **)a);
-    playItem_t *bb = *((playItem_t **)b);
-    return pl_sort_compare_str (aa, bb);
+static void
+_sort_keys_job (void *ctx) {
+    pl_sort_job_t *job = ctx;
+    memcpy (job->tmp + job->start, job->keys + job->start, (job->end - job->start) * sizeof (pl_sort_key_t));
+    _sort_keys_range (job->params, job->tmp, job->keys, job->start, job->end);
+}
+
+static void
+_sort_merge_job (void *ctx) {
+    pl_sort_job_t *job = ctx;
+    _sort_merge (job->params, job->keys, job->start, job->mid, job->end, job->tmp);
+}
+
+// Computes the keys for the tracks, and sorts them.
+// Returns the sorted keys, which must be freed by the caller.
+static pl_sort_key_t *
+_sort_tracks (const pl_sort_params_t *params, playItem_t **tracks, int count, char **strings, int *num_strings) {
+    pl_sort_key_t *keys = calloc (count, sizeof (pl_sort_key_t));
+    pl_sort_key_t *tmp = malloc (count * sizeof (pl_sort_key_t));
+    for (int i = 0; i < count; i++) {
+        keys[i].it = tracks[i];
+    }
+
+    int nthreads = _sort_thread_count (count);
+    pl_sort_job_t jobs[PL_SORT_MAX_THREADS];
+    memset (jobs, 0, sizeof (jobs));
+    int bounds[PL_SORT_MAX_THREADS+1];
+    for (int i = 0; i <= nthreads; i++) {
+        bounds[i] = (int)((int64_t)count * i / nthreads);
+    }
+    for (int i = 0; i < nthreads; i++) {
+        jobs[i].params = params;
+        jobs[i].keys = keys;
+        jobs[i].tmp = tmp;
+        jobs[i].start = bounds[i];
+        jobs[i].end = bounds[i+1];
+    }
+
+    // title formatting can only run concurrently with the lock in shared mode
+    if (params->shared_lock || nthreads == 1) {
+        _sort_run_jobs (_sort_compute_keys_job, jobs, nthreads);
+    }
+    else {
+        for (int i = 0; i < nthreads; i++) {
+            _sort_compute_keys_job (&jobs[i]);
+        }
+    }
+    for (int i = 0; i < nthreads; i++) {
+        strings[i] = jobs[i].strings;
+    }
+    *num_strings = nthreads;
+
+    // sort each part, and merge the sorted parts in pairs
+    _sort_run_jobs (_sort_keys_job, jobs, nthreads);
+    int nparts = nthreads;
+    while (nparts > 1) {
+        int njobs = 0;
+        int nbounds = 0;
+        for (int i = 0; i < nparts; i += 2) {
+            pl_sort_job_t *job = &jobs[njobs++];
+            job->keys = keys;
+            job->tmp = tmp;
+            job->start = bounds[i];
+            job->mid = bounds[i+1];
+            job->end = i + 1 < nparts ? bounds[i+2] : bounds[i+1];
+            bounds[nbounds++] = job->start;
+        }
+        bounds[nbounds] = count;
+        _sort_run_jobs (_sort_merge_job, jobs, njobs);
+        pl_sort_key_t *t = keys;
+        keys = tmp;
+        tmp = t;
+        nparts = njobs;
+    }
+
+    free (tmp);
+    return keys;
+}
+
+static void
+_sort_free_strings (char **strings, int count) {
+    for (int i = 0; i < count; i++) {
+        free (strings[i]);
+    }
+}
+
+static void
+_sort_init_params (pl_sort_params_t *params, playlist_t *plt, int id, const char *format, int ascending, int version) {
+    memset (params, 0, sizeof (pl_sort_params_t));
+    params->ascending = ascending;
+    params->id = id;
+    params->plt = plt;
+    params->version = version;
+    if (version == 0) {
+        params->format = format;
+    }
+    else {
+        params->tf_bytecode = tf_compile (format);
+    }
+
+    if (format && id == -1
+        && ((version == 0 && !strcmp (format, "%l"))
+            || (version == 1 && !strcmp (format, "%length%")))
+        ) {
+        params->is_duration = 1;
+    }
+    if (format && id == -1
+        && ((version == 0 && !strcmp (format, "%n"))
+            || (version == 1 && (!strcmp (format, "%track number%") || !strcmp (format, "%tracknumber%"))))
+        ) {
+        params->is_track = 1;
+    }
 }
 
 void
@@ -145,7 +415,7 @@ plt_sort_random (playlist_t *playlist, int iter) {
         return;
     }
 
-    pl_lock ();
+    plt_lock (playlist);
 
     const int playlist_count = playlist->count[iter];
     playItem_t **array = calloc (playlist_count, sizeof (playItem_t *));
@@ -184,12 +454,13 @@ plt_sort_random (playlist_t *playlist, int iter) {
         prev = it;
     }
     playlist->tail[iter] = array[playlist->count[iter]-1];
+    plt_index_invalidate (playlist, iter);
 
     free (array);
 
     plt_modified (playlist);
 
-    pl_unlock ();
+    plt_unlock (playlist);
 }
 
 // version 0: title formatting v1
@@ -206,69 +477,42 @@ plt_sort_internal (playlist_t *playlist, int iter, int id, const char *format, i
     if (format == NULL || id == DB_COLUMN_FILENUMBER || !playlist->head[iter] || !playlist->head[iter]->next[iter]) {
         return;
     }
-    pl_lock ();
+    plt_lock (playlist);
     struct timeval tm1;
     gettimeofday (&tm1, NULL);
-    pl_sort_ascending = ascending;
     trace ("ascending: %d\n", ascending);
-    pl_sort_id = id;
 
-    pl_sort_version = version;
-    if (version == 0) {
-        pl_sort_format = format;
-        pl_sort_tf_bytecode = NULL;
-    }
-    else {
+    if (version == 1) {
         plt_replace_meta (playlist, "autosort_mode", "tf");
         plt_replace_meta (playlist, "autosort_tf", format);
-        pl_sort_format = NULL;
-        pl_sort_tf_bytecode = tf_compile (format);
-        pl_sort_tf_ctx._size = sizeof (pl_sort_tf_ctx);
-        pl_sort_tf_ctx.it = NULL;
-        pl_sort_tf_ctx.plt = (ddb_playlist_t *)playlist;
-        pl_sort_tf_ctx.idx = -1;
-        pl_sort_tf_ctx.id = id;
     }
 
-    if (format && id == -1
-        && ((version == 0 && !strcmp (format, "%l"))
-            || (version == 1 && !strcmp (format, "%length%")))
-        ) {
-        pl_sort_is_duration = 1;
-    }
-    else {
-        pl_sort_is_duration = 0;
-    }
-    if (format && id == -1
-        && ((version == 0 && !strcmp (format, "%n"))
-            || (version == 1 && (!strcmp (format, "%track number%") || !strcmp (format, "%tracknumber%"))))
-        ) {
-        pl_sort_is_track = 1;
-    }
-    else {
-        pl_sort_is_track = 0;
-    }
+    pl_sort_params_t params;
+    _sort_init_params (&params, playlist, id, format, ascending, version);
+    params.iter = iter;
+    params.has_index = 1;
+    params.shared_lock = pl_lock_is_shared ();
 
     int cursor = plt_get_cursor (playlist, PL_MAIN);
     playItem_t *track_under_cursor = NULL;
     if (cursor != -1) {
         track_under_cursor = plt_get_item_for_idx (playlist, cursor, PL_MAIN);
     }
-    playItem_t **array = malloc (playlist->count[iter] * sizeof (playItem_t *));
+    const int count = playlist->count[iter];
+    playItem_t **array = malloc (count * sizeof (playItem_t *));
     int idx = 0;
     for (playItem_t *it = playlist->head[iter]; it; it = it->next[iter], idx++) {
         array[idx] = it;
     }
 
-#if HAVE_MERGESORT
-    mergesort (array, playlist->count[iter], sizeof (playItem_t *), qsort_cmp_func);
-#else
-    qsort (array, playlist->count[iter], sizeof (playItem_t *), qsort_cmp_func);
-#endif
+    char *strings[PL_SORT_MAX_THREADS];
+    int num_strings = 0;
+    pl_sort_key_t *keys = _sort_tracks (&params, array, count, strings, &num_strings);
+
     playItem_t *prev = NULL;
     playlist->head[iter] = 0;
-    for (idx = 0; idx < playlist->count[iter]; idx++) {
-        playItem_t *it = array[idx];
+    for (idx = 0; idx < count; idx++) {
+        playItem_t *it = keys[idx].it;
         it->prev[iter] = prev;
         it->next[iter] = NULL;
         if (!prev) {
@@ -280,8 +524,11 @@ plt_sort_internal (playlist_t *playlist, int iter, int id, const char *format, i
         prev = it;
     }
 
-    playlist->tail[iter] = array[playlist->count[iter]-1];
+    playlist->tail[iter] = prev;
+    plt_index_invalidate (playlist, iter);
 
+    free (keys);
+    _sort_free_strings (strings, num_strings);
     free (array);
 
     if (track_under_cursor) {
@@ -292,17 +539,11 @@ plt_sort_internal (playlist_t *playlist, int iter, int id, const char *format, i
 
     plt_modified (playlist);
 
-    if (version == 0) {
-        pl_sort_format = NULL;
-    }
-
-    if (version == 1) {
-        tf_free (pl_sort_tf_bytecode);
-        pl_sort_tf_bytecode = NULL;
-        memset (&pl_sort_tf_ctx, 0, sizeof (pl_sort_tf_ctx));
+    if (params.tf_bytecode) {
+        tf_free (params.tf_bytecode);
     }
 
-    pl_unlock ();
+    plt_unlock (playlist);
 }
 
 void
@@ -317,43 +558,22 @@ sort_track_array (playlist_t *playlist, playItem_t **tracks, int num_tracks, con
         return;
     }
 
+    // the tracks can belong to any playlist, so this needs the exclusive lock,
+    // and the keys are computed on the calling thread
     pl_lock ();
-    pl_sort_ascending = ascending;
-    pl_sort_id = -1;
-
-    pl_sort_version = 1;
-    pl_sort_format = NULL;
-    pl_sort_tf_bytecode = tf_compile (format);
-    pl_sort_tf_ctx._size = sizeof (pl_sort_tf_ctx);
-    pl_sort_tf_ctx.it = NULL;
-    pl_sort_tf_ctx.plt = (ddb_playlist_t *)playlist;
-    pl_sort_tf_ctx.idx = -1;
-    pl_sort_tf_ctx.id = -1;
-
-    if (format
-        && !strcmp (format, "%length%")) {
-        pl_sort_is_duration = 1;
-    }
-    else {
-        pl_sort_is_duration = 0;
-    }
-    if (format
-        && (!strcmp (format, "%track number%") || !strcmp (format, "%tracknumber%"))) {
-        pl_sort_is_track = 1;
-    }
-    else {
-        pl_sort_is_track = 0;
-    }
+    pl_sort_params_t params;
+    _sort_init_params (&params, playlist, -1, format, ascending, 1);
 
-#if HAVE_MERGESORT
-    mergesort (tracks, num_tracks, sizeof (playItem_t *), qsort_cmp_func);
-#else
-    qsort (tracks, num_tracks, sizeof (playItem_t *), qsort_cmp_func);
-#endif
+    char *strings[PL_SORT_MAX_THREADS];
+    int num_strings = 0;
+    pl_sort_key_t *keys = _sort_tracks (&params, tracks, num_tracks, strings, &num_strings);
+    for (int i = 0; i < num_tracks; i++) {
+        tracks[i] = keys[i].it;
+    }
+    free (keys);
+    _sort_free_strings (strings, num_strings);
 
-    tf_free (pl_sort_tf_bytecode);
-    pl_sort_tf_bytecode = NULL;
-    memset (&pl_sort_tf_ctx, 0, sizeof (pl_sort_tf_ctx));
+    tf_free (params.tf_bytecode);
 
     pl_unlock ();
 }
@@ -82,6 +82,8 @@ static int conf_streamer_use_dependent_samplerate = 0;
 static int conf_streamer_samplerate = 44100;
 static int conf_streamer_samplerate_mult_48 = 48000;
 static int conf_streamer_samplerate_mult_44 = 44100;
+static int conf_streamer_readahead_local_ms = 5000;
+static int conf_streamer_readahead_remote_ms = 30000;
 
 static int trace_bufferfill = 0;
 
@@ -125,23 +127,117 @@ static DB_vfs_t *new_fileinfo_file_vfs;
 #define AUDIO_STALL_WAIT 20
 static int _audio_stall_count;
 
+// The streamer thread sleeps on the handler until there's something to do:
+// a message, a consumed block, a stall/format change reported by streamer_read, or termination.
+// The timeout is only a safety net against missed wakeups.
+#define STREAMER_IDLE_TIMEOUT_MS 1000
+
 // to allow interruption of stall file requests
 static uint64_t streamer_file_identifier;
 static DB_vfs_t *streamer_file_vfs;
 
-// We always decode the entire block, 16384 bytes of input PCM
-// after DSP that can become really big.
-// Think converting from 8KHz/8 bit to 192KHz/32 bit, thats 96x size increase,
-// which gives us the need of 1.5MB buffer.
+// DSP stage.
+// The DSP thread takes decoded blocks from the streamreader, runs them through the DSP chain,
+// converts them to the output format, and queues the results as chunks for streamer_read,
+// which only copies the data out, and applies soft volume.
+// Each chunk holds one whole block after DSP, which can become really big:
+// converting 16384 bytes from 8KHz/8 bit to 192KHz/32 bit is a 96x size increase, so the buffers grow as needed.
 //
-// It's guaranteed that outbuffer contains only samples from the files with same wave format.
+// The chunks form a single-producer/single-consumer ring, the DSP thread is the producer, the output thread is the consumer.
+// The queue is bounded in time by DSP_QUEUE_MAX_MS, which is also the latency of DSP chain and settings changes.
+// The streamer mutex is only held to pick the next block, the DSP pass runs with _dsp_pass_mutex locked instead,
+// which serializes it with the DSP chain changes, resets and flushes, so the streamer mutex isn't held for long.
+// Whoever needs both takes the streamer mutex first.
+// streamer_reset invalidates the queued chunks by incrementing _dsp_generation, and the consumer skips the stale ones.
+// A requeue of the next track only invalidates its chunks, by setting them to an old generation.
 //
-#define OUTPUT_BUFFER_SIZE (512*1024) // FIXME: need to be able to calculate that size from DSP chain
-static char *_output_buffer;
-static size_t _output_buffer_size;
-static int _outbuffer_remaining;
+// It's guaranteed that the queue contains only samples from the files with same wave format,
+// the DSP thread waits for the queue to drain before requesting a format change.
+#define DSP_QUEUE_SIZE 64 // must be a power of 2
+#define DSP_QUEUE_MAX_MS 250
+#define DSP_IDLE_TIMEOUT_MS 1000
+
+typedef struct {
+    char *buf;
+    int bufsize;
+    int size;
+    int pos; // read position, owned by the consumer
+    unsigned generation;
+    playItem_t *track;
+    int first;
+    int last;
+    int bitrate;
+    float dspratio;
+    int duration_us;
+    ddb_waveformat_t fmt; // output format the data was converted to
+} dsp_chunk_t;
+
+static dsp_chunk_t _dsp_queue[DSP_QUEUE_SIZE];
+static unsigned _dsp_head;
+static unsigned _dsp_tail;
+static int _dsp_queued_us;
+static unsigned _dsp_generation;
+static int _dsp_format_blocked; // the next block has a different format, and the queue needs to drain first
+
+static intptr_t _dsp_tid;
+static int _dsp_terminate;
+static uintptr_t _dsp_mutex;
+static uintptr_t _dsp_pass_mutex;
+static uintptr_t _dsp_cond;
+static int _dsp_wakeup;
+static int _dsp_sleeping;
+
+static void
+_dsp_wake (void);
+
+static int
+_dsp_num_chunks_ready (void);
 
-// A buffer used in streamer_read.
+static void
+_dsp_stage_init (void);
+
+static void
+_dsp_stage_free (void);
+
+// Visualization tap.
+// streamer_read copies the output data into a single-producer/single-consumer ring of fixed size slots,
+// without locking or allocating, and the data which doesn't fit is dropped and counted.
+// The low priority viz thread drains the ring at the analysis rate (streamer.vis_rate, per second),
+// converts the data to float and calls the waveform listeners, then runs the FFT only on the most recent
+// window for the spectrum listeners, with the resolution and window function requested by each listener.
+// The listeners are called on the viz thread with wdl_mutex locked, so a slow visualizer can't stall the playback.
+#define VIZ_QUEUE_SIZE 64 // must be a power of 2
+#define VIZ_SLOT_SIZE 8192
+#define VIZ_DEFAULT_RATE 60
+
+typedef struct {
+    char buf[VIZ_SLOT_SIZE];
+    int size;
+    ddb_waveformat_t fmt;
+} viz_slot_t;
+
+static viz_slot_t _viz_queue[VIZ_QUEUE_SIZE];
+static unsigned _viz_head;
+static unsigned _viz_tail;
+static int64_t _viz_frames_dropped;
+static int conf_streamer_vis_rate = VIZ_DEFAULT_RATE;
+
+static intptr_t _viz_tid;
+static int _viz_terminate;
+static uintptr_t _viz_mutex;
+static uintptr_t _viz_cond;
+static int _viz_wakeup;
+
+static void
+_viz_init (void);
+
+static void
+_viz_free (void);
+
+static void
+_viz_wake (void);
+
+// A buffer used by the viz thread.
 static float *_temp_audio_buffer;
 static size_t _temp_audio_buffer_size;
 
@@ -149,10 +245,17 @@ static size_t _temp_audio_buffer_size;
 #include "equalizer.h"
 #endif
 
-static float freq_data[DDB_FREQ_BANDS * DDB_FREQ_MAX_CHANNELS];
-static float audio_data[DDB_FREQ_BANDS * 2 * DDB_FREQ_MAX_CHANNELS];
-static int audio_data_fill = 0;
-static int audio_data_channels = 0;
+// The spectrum is calculated from the history of the latest frames of each channel,
+// so that the listeners can request different resolutions from the same data.
+// The buffers are allocated by the viz thread when the first spectrum listener shows up.
+#define VIZ_HISTORY_FRAMES (DDB_FREQ_MAX_BANDS * 2)
+static float *history_data; // ring of VIZ_HISTORY_FRAMES frames per channel, non-interleaved
+static int history_pos;
+static int history_fill;
+static int history_new_frames; // added since the last analysis tick
+static ddb_waveformat_t history_fmt;
+static float *fft_data; // the latest window of one channel, in order
+static float *freq_data;
 
 // message queue
 static struct handler_s *handler;
@@ -161,6 +264,8 @@ static struct handler_s *handler;
 typedef struct wavedata_listener_s {
     void *ctx;
     void (*callback)(void *ctx, ddb_audio_data_t *data);
+    int nbands; // spectrum listeners only
+    int window;
     struct wavedata_listener_s *next;
 } wavedata_listener_t;
 
@@ -190,6 +295,20 @@ streamer_unlock (void) {
     mutex_unlock (mutex);
 }
 
+void
+streamer_lock_dsp (void) {
+    if (_dsp_pass_mutex) {
+        mutex_lock (_dsp_pass_mutex);
+    }
+}
+
+void
+streamer_unlock_dsp (void) {
+    if (_dsp_pass_mutex) {
+        mutex_unlock (_dsp_pass_mutex);
+    }
+}
+
 static void
 play_index (int idx, int startpaused);
 
@@ -349,47 +468,57 @@ streamer_get_buffering_track (void) {
     return it;
 }
 
-int
-str_get_idx_of (playItem_t *it) {
+// streamer_playlist can only be changed under exclusive pl_lock.
+// It's chosen at init, and re-chosen when the playlist is deleted, so it's only NULL
+// when there are no playlists. Must not be called under plt_lock.
+static void
+str_init_streamer_playlist (void) {
     pl_lock ();
     if (!streamer_playlist) {
         playlist_t *plt = plt_get_curr ();
         streamer_set_streamer_playlist (plt);
-        plt_unref (plt);
-    }
-    playItem_t *c = streamer_playlist->head[PL_MAIN];
-    int idx = 0;
-    while (c && c != it) {
-        c = c->next[PL_MAIN];
-        idx++;
+        if (plt) {
+            plt_unref (plt);
+        }
     }
-    if (!c) {
+    pl_unlock ();
+}
+
+// Locks streamer_playlist with plt_lock, so that looking up tracks doesn't need to wait
+// for long operations on other playlists. Release with plt_unlock + pl_unlock.
+// Returns NULL, with nothing locked, if there are no playlists: the shared lock can't be
+// upgraded to set streamer_playlist up here.
+static playlist_t *
+str_lock_streamer_playlist (void) {
+    pl_lock_shared ();
+    if (!streamer_playlist) {
         pl_unlock ();
+        return NULL;
+    }
+    plt_lock (streamer_playlist);
+    return streamer_playlist;
+}
+
+int
+str_get_idx_of (playItem_t *it) {
+    playlist_t *plt = str_lock_streamer_playlist ();
+    if (!plt) {
         return -1;
     }
+    int idx = plt_get_item_idx (plt, it, PL_MAIN);
+    plt_unlock (plt);
     pl_unlock ();
     return idx;
 }
 
 playItem_t *
 str_get_for_idx (int idx) {
-    pl_lock ();
-    if (!streamer_playlist) {
-        playlist_t *plt = plt_get_curr ();
-        streamer_set_streamer_playlist (plt);
-        plt_unref (plt);
-    }
-    playItem_t *it = streamer_playlist->head[PL_MAIN];
-    while (idx--) {
-        if (!it) {
-            pl_unlock ();
-            return NULL;
-        }
-        it = it->next[PL_MAIN];
-    }
-    if (it) {
-        pl_item_ref (it);
+    playlist_t *plt = str_lock_streamer_playlist ();
+    if (!plt) {
+        return NULL;
     }
+    playItem_t *it = plt_get_item_for_idx (plt, idx, PL_MAIN);
+    plt_unlock (plt);
     pl_unlock ();
     return it;
 }
@@ -455,11 +584,7 @@ stop_after_album_check (playItem_t *cur, playItem_t *next) {
 
 static playItem_t *
 get_random_track (void) {
-    if (!streamer_playlist) {
-        playlist_t *plt = plt_get_curr ();
-        streamer_set_streamer_playlist (plt);
-        plt_unref (plt);
-    }
+    str_init_streamer_playlist ();
     playlist_t *plt = streamer_playlist;
     int cnt = plt->count[PL_MAIN];
     if (!cnt) {
@@ -480,12 +605,8 @@ get_random_track (void) {
 
 static playItem_t *
 get_next_track (playItem_t *curr, ddb_shuffle_t shuffle, ddb_repeat_t repeat) {
+    str_init_streamer_playlist ();
     pl_lock ();
-    if (!streamer_playlist) {
-        playlist_t *plt = plt_get_curr ();
-        streamer_set_streamer_playlist (plt);
-        plt_unref (plt);
-    }
 
     while (playqueue_getcount ()) {
         trace ("playqueue_getnext\n");
@@ -613,6 +734,7 @@ get_next_track (playItem_t *curr, ddb_shuffle_t shuffle, ddb_repeat_t repeat) {
 
 static playItem_t *
 get_prev_track (playItem_t *curr, ddb_shuffle_t shuffle, ddb_repeat_t repeat) {
+    str_init_streamer_playlist ();
     pl_lock ();
     
     // check if prev song is in this playlist
@@ -620,12 +742,6 @@ get_prev_track (playItem_t *curr, ddb_shuffle_t shuffle, ddb_repeat_t repeat) {
         curr = NULL;
     }
 
-    if (!streamer_playlist) {
-        playlist_t *plt = plt_get_curr ();
-        streamer_set_streamer_playlist (plt);
-        plt_unref (plt);
-    }
-    
     playlist_t *plt = streamer_playlist;
 
     if (!plt->head[PL_MAIN]) {
@@ -1223,6 +1339,9 @@ m3u_error:
     }
 success:
     streamer_play_failed (NULL);
+    if (it) {
+        streamreader_set_readahead (is_remote_stream (it) ? conf_streamer_readahead_remote_ms : conf_streamer_readahead_local_ms);
+    }
     if (new_fileinfo) {
         fileinfo_curr = new_fileinfo;
         new_fileinfo = NULL;
@@ -1352,7 +1471,7 @@ streamer_seek_real (float seekpos) {
 
 static void
 _update_buffering_state () {
-    int blocks_ready = streamreader_num_blocks_ready ();
+    int blocks_ready = streamreader_num_blocks_ready () + _dsp_num_chunks_ready ();
     int buffering = (blocks_ready < 4) && streaming_track;
 
     if (buffering != streamer_is_buffering) {
@@ -1450,15 +1569,22 @@ streamer_set_output_format (ddb_waveformat_t *fmt) {
     }
 }
 
+static void
+_dsp_flush_after (playItem_t *it);
+
 static void
 _streamer_requeue_after_current (ddb_repeat_t repeat, ddb_shuffle_t shuffle) {
     if (!playing_track) {
         return;
     }
     streamer_lock ();
-    streamreader_flush_after (playing_track);
+    streamer_lock_dsp ();
+    int flushed = streamreader_flush_after (playing_track);
+    _dsp_flush_after (playing_track);
+    streamer_unlock_dsp ();
 
-    if (playing_track == streaming_track) {
+    // when the whole playlist fits into the readahead, the streaming track can be a later instance of the playing one
+    if (playing_track == streaming_track && !flushed) {
         streamer_unlock ();
         return;
     }
@@ -1500,6 +1626,7 @@ streamer_thread (void *unused) {
 #if defined(__linux__) && !defined(ANDROID)
     prctl (PR_SET_NAME, "deadbeef-stream", 0, 0, 0, 0);
 #endif
+    vfs_set_thread_usage (VFS_USAGE_PLAYBACK);
 
     ddb_shuffle_t shuffle = (ddb_shuffle_t)-1;
     ddb_repeat_t repeat = (ddb_repeat_t)-1;
@@ -1536,7 +1663,11 @@ streamer_thread (void *unused) {
                 streamer_set_current_playlist_real (p1);
                 break;
             case STR_EV_DSP_RELOAD:
+                streamer_lock ();
+                streamer_lock_dsp ();
                 streamer_dsp_postinit ();
+                streamer_unlock_dsp ();
+                streamer_unlock ();
                 break;
             case STR_EV_SET_DSP_CHAIN:
                 streamer_set_dsp_chain_real ((ddb_dsp_context_t *)ctx);
@@ -1569,9 +1700,7 @@ streamer_thread (void *unused) {
         }
 
         if (output && output->state () == DDB_PLAYBACK_STATE_STOPPED) {
-            if (!handler_hasmessages (handler)) {
-                usleep (50000);
-            }
+            handler_wait_timeout (handler, STREAMER_IDLE_TIMEOUT_MS);
             continue;
         }
 
@@ -1586,6 +1715,7 @@ streamer_thread (void *unused) {
             }
             _format_change_wait = 0;
             streamer_unlock ();
+            _dsp_wake ();
         }
 
         _update_buffering_state ();
@@ -1603,25 +1733,26 @@ streamer_thread (void *unused) {
                 streamer_unlock ();
                 continue;
             }
-            usleep (50000); // nothing is streaming -- about to stop
+            handler_wait_timeout (handler, STREAMER_IDLE_TIMEOUT_MS); // nothing is streaming -- about to stop
             continue;
         }
 
         streamblock_t *block = streamreader_get_next_block ();
 
         if (!block) {
-            usleep (50000); // all blocks are full
+            handler_wait_timeout (handler, STREAMER_IDLE_TIMEOUT_MS); // all blocks are full
             continue;
         }
 
-        // streamreader_read_block will lock the mutex after success
-        int res = streamreader_read_block (block, streaming_track, fileinfo_curr, mutex);
+        // the block is filled and published without taking the streamer mutex,
+        // after enqueueing, it belongs to the output thread
+        int res = streamreader_read_block (block, streaming_track, fileinfo_curr);
         int last = 0;
 
         if (res >= 0) {
-            streamreader_enqueue_block (block);
             last = block->last;
-            streamer_unlock ();
+            streamreader_enqueue_block (block);
+            _dsp_wake ();
         }
 
         if (res < 0 || last) {
@@ -1629,7 +1760,7 @@ streamer_thread (void *unused) {
 
             // handle stop after current
             int stop = 0;
-            if (block->last) {
+            if (last) {
                 if (stop_after_current) {
                     stop = 1;
                 }
@@ -1692,17 +1823,22 @@ streamer_init (void) {
 #endif
     mutex = mutex_create ();
     wdl_mutex = mutex_create ();
+    _viz_init ();
 
     streamreader_init();
 
     streamer_dsp_init ();
 
+    _dsp_stage_init ();
+
     ctmap_init_mutex ();
     conf_get_str ("network.ctmapping", DDB_DEFAULT_CTMAPPING, conf_network_ctmapping, sizeof (conf_network_ctmapping));
     ddb_ctmap_free (streamer_ctmap);
     streamer_ctmap = NULL;
     streamer_ctmap = ddb_ctmap_init_from_string (conf_network_ctmapping);
 
+    str_init_streamer_playlist ();
+
     streamer_tid = thread_start (streamer_thread, NULL);
     return 0;
 }
@@ -1715,8 +1851,11 @@ streamer_free (void) {
 
     streamer_abort_files ();
     streaming_terminate = 1;
+    handler_wakeup (handler);
     thread_join (streamer_tid);
 
+    _dsp_stage_free ();
+
     streamreader_free ();
 
     if (first_failed_track) {
@@ -1747,6 +1886,7 @@ streamer_free (void) {
 
     mutex_free (mutex);
     mutex = 0;
+    _viz_free ();
     mutex_free (wdl_mutex);
     wdl_mutex = 0;
 
@@ -1762,27 +1902,118 @@ streamer_free (void) {
     playpos = 0;
     playtime = 0;
 
-    free (_output_buffer);
-    _output_buffer = NULL;
-    _output_buffer_size = 0;
-    _outbuffer_remaining = 0;
+}
 
-    free (_temp_audio_buffer);
-    _temp_audio_buffer = NULL;
-    _temp_audio_buffer_size = 0;
+static void
+_dsp_wake (void) {
+    mutex_lock (_dsp_mutex);
+    _dsp_wakeup = 1;
+    mutex_unlock (_dsp_mutex);
+    cond_signal (_dsp_cond);
 }
 
-static char *
-_get_output_buffer (size_t size) {
-    if (_output_buffer) {
-        if (_output_buffer_size >= size) {
-            return _output_buffer;
+static int
+_dsp_queue_full (void) {
+    unsigned tail = __atomic_load_n (&_dsp_tail, __ATOMIC_RELAXED);
+    return tail - __atomic_load_n (&_dsp_head, __ATOMIC_ACQUIRE) >= DSP_QUEUE_SIZE
+    || __atomic_load_n (&_dsp_queued_us, __ATOMIC_RELAXED) >= DSP_QUEUE_MAX_MS * 1000;
+}
+
+static int
+_dsp_queue_empty (void) {
+    return __atomic_load_n (&_dsp_tail, __ATOMIC_RELAXED) == __atomic_load_n (&_dsp_head, __ATOMIC_ACQUIRE);
+}
+
+// Whether the DSP thread can make progress, can be called without locking
+static int
+_dsp_has_work (void) {
+    if (_format_change_wait) {
+        return 0; // waiting for the streamer to reconfigure the output
+    }
+    if (_dsp_format_blocked) {
+        return _dsp_queue_empty ();
+    }
+    return !_dsp_queue_full () && streamreader_num_blocks_ready () > 0;
+}
+
+// Current chunk with data for the output, skipping the ones invalidated by streamer_reset.
+// Can return NULL.
+static dsp_chunk_t *
+_dsp_curr_chunk (void);
+
+// Release the current chunk, and move to the next one
+static void
+_dsp_next_chunk (void) {
+    unsigned head = __atomic_load_n (&_dsp_head, __ATOMIC_RELAXED);
+    dsp_chunk_t *chunk = &_dsp_queue[head & (DSP_QUEUE_SIZE-1)];
+    __atomic_sub_fetch (&_dsp_queued_us, chunk->duration_us, __ATOMIC_RELAXED);
+    __atomic_store_n (&_dsp_head, head + 1, __ATOMIC_SEQ_CST);
+    // only take the mutex if the DSP thread is actually waiting for space
+    if (__atomic_load_n (&_dsp_sleeping, __ATOMIC_SEQ_CST)) {
+        _dsp_wake ();
+    }
+}
+
+static int
+_dsp_chunk_is_valid (dsp_chunk_t *chunk) {
+    return __atomic_load_n (&chunk->generation, __ATOMIC_ACQUIRE) == __atomic_load_n (&_dsp_generation, __ATOMIC_ACQUIRE);
+}
+
+static dsp_chunk_t *
+_dsp_curr_chunk (void) {
+    for (;;) {
+        unsigned head = __atomic_load_n (&_dsp_head, __ATOMIC_RELAXED);
+        if (head == __atomic_load_n (&_dsp_tail, __ATOMIC_ACQUIRE)) {
+            return NULL;
         }
-        free (_output_buffer);
+        dsp_chunk_t *chunk = &_dsp_queue[head & (DSP_QUEUE_SIZE-1)];
+        if (_dsp_chunk_is_valid (chunk)) {
+            return chunk;
+        }
+        _dsp_next_chunk ();
     }
-    _output_buffer_size = size;
-    _output_buffer = malloc (_output_buffer_size);
-    return _output_buffer;
+}
+
+// Invalidates the queued chunks starting from the first one of another track, including its `first` chunk.
+// Must be called with the DSP pass mutex locked, so that no chunk is being produced meanwhile,
+// and with the streamer mutex locked, which the output thread needs to get past the `first` chunk.
+static void
+_dsp_flush_after (playItem_t *it) {
+    if (!_dsp_pass_mutex) {
+        return;
+    }
+    unsigned head = __atomic_load_n (&_dsp_head, __ATOMIC_ACQUIRE);
+    unsigned tail = __atomic_load_n (&_dsp_tail, __ATOMIC_RELAXED);
+    while (head != tail && _dsp_queue[head & (DSP_QUEUE_SIZE-1)].track == it) {
+        head++;
+    }
+    if (head == tail) {
+        return;
+    }
+    for (; head != tail; head++) {
+        dsp_chunk_t *chunk = &_dsp_queue[head & (DSP_QUEUE_SIZE-1)];
+        // don't count the dropped chunks as queued, so that the DSP thread can refill the queue right away
+        __atomic_sub_fetch (&_dsp_queued_us, chunk->duration_us, __ATOMIC_RELAXED);
+        chunk->duration_us = 0;
+        __atomic_store_n (&chunk->generation, _dsp_generation - 1, __ATOMIC_RELEASE);
+    }
+    _dsp_wake ();
+}
+
+static int
+_dsp_num_chunks_ready (void) {
+    unsigned tail = __atomic_load_n (&_dsp_tail, __ATOMIC_ACQUIRE);
+    return (int)(tail - __atomic_load_n (&_dsp_head, __ATOMIC_ACQUIRE));
+}
+
+static char *
+_dsp_chunk_buffer (dsp_chunk_t *chunk, int size) {
+    if (chunk->bufsize < size) {
+        free (chunk->buf);
+        chunk->buf = malloc (size);
+        chunk->bufsize = size;
+    }
+    return chunk->buf;
 }
 
 void
@@ -1793,30 +2024,42 @@ streamer_reset (int full) { // must be called when current song changes by exter
     }
 
     streamer_lock();
+    streamer_lock_dsp ();
     streamreader_reset ();
     dsp_reset ();
-    _outbuffer_remaining = 0;
+    __atomic_add_fetch (&_dsp_generation, 1, __ATOMIC_RELEASE);
+    streamer_unlock_dsp ();
+    _dsp_format_blocked = 0;
+    _update_buffering_state ();
     streamer_unlock();
+    handler_wakeup (handler);
+    if (_dsp_mutex) {
+        _dsp_wake ();
+    }
 }
 
+// Runs the block through the DSP chain, and converts it to the output format into the chunk.
+// Called on the DSP thread with the DSP pass mutex locked.
+// Returns 1 if the block was used up, and released.
 static int
-process_output_block (streamblock_t *block, char *bytes) {
+process_output_block (streamblock_t *block, dsp_chunk_t *chunk) {
     DB_output_t *output = plug_get_output ();
 
-    // handle change of track
-    if (block->last) {
-        update_stop_after_current ();
-    }
-    if (block->first) {
-        handle_track_change (playing_track, block->track);
-    }
-
-    // A block with 0 size is a valid block, and needs to be processed as usual (code above this line).
+    chunk->size = 0;
+    chunk->pos = 0;
+    chunk->track = block->track;
+    chunk->first = block->first;
+    chunk->last = block->last;
+    chunk->bitrate = block->bitrate;
+    chunk->dspratio = 1;
+    chunk->duration_us = 0;
+    memcpy (&chunk->fmt, &output->fmt, sizeof (ddb_waveformat_t));
+
+    // A block with 0 size is a valid block, and needs to be passed to the output as usual, to handle track changes.
     // But here we do early exit, because there's no data to process in it.
     if (!block->size) {
         streamreader_next_block ();
-        _update_buffering_state ();
-        return 0;
+        return 1;
     }
 
     int sz = block->size - block->pos;
@@ -1872,6 +2115,11 @@ process_output_block (streamblock_t *block, char *bytes) {
     }
 #endif
 
+    int in_frame_size = datafmt.channels * datafmt.bps / 8;
+    int out_frame_size = output->fmt.channels * output->fmt.bps / 8;
+    int nframes = in_frame_size ? sz / in_frame_size : 0;
+    char *bytes = _dsp_chunk_buffer (chunk, nframes * out_frame_size);
+
     if (memcmp (&output->fmt, &datafmt, sizeof (ddb_waveformat_t))) {
         sz = pcm_convert (&datafmt, dspbytes, &output->fmt, bytes, sz);
     }
@@ -1879,15 +2127,125 @@ process_output_block (streamblock_t *block, char *bytes) {
         memcpy (bytes, dspbytes, sz);
     }
 
-    playpos += (float)sz/output->fmt.samplerate/((output->fmt.bps>>3)*output->fmt.channels) * dspratio;
-    playtime += (float)sz/output->fmt.samplerate/((output->fmt.bps>>3)*output->fmt.channels) * dspratio;
+    chunk->size = sz;
+    chunk->dspratio = dspratio;
+    if (output->fmt.samplerate > 0 && out_frame_size > 0) {
+        chunk->duration_us = (int)((int64_t)sz / out_frame_size * 1000000 / output->fmt.samplerate * dspratio);
+    }
 
     if (block->pos >= block->size) {
         streamreader_next_block ();
+        return 1;
+    }
+    return 0;
+}
+
+// Processes the next decoded block into the output queue.
+// Returns 1 if a block was processed, 0 if there's nothing to do.
+static int
+_dsp_process_next_block (void) {
+    if (_format_change_wait || _dsp_queue_full ()) {
+        return 0;
+    }
+
+    streamer_lock ();
+    streamblock_t *block = streamreader_get_curr_block ();
+    if (!block) {
+        streamer_unlock ();
+        return 0;
+    }
+
+    // play out the queued data before the output format changes
+    if (memcmp (&block->fmt, &last_block_fmt, sizeof (ddb_waveformat_t))) {
+        if (_dsp_queue_empty ()) {
+            _dsp_format_blocked = 0;
+            _format_change_wait = 1;
+            handler_wakeup (handler);
+        }
+        else {
+            _dsp_format_blocked = 1;
+        }
+        streamer_unlock ();
+        return 0;
+    }
+    _dsp_format_blocked = 0;
+
+    // the block can't be flushed or reset while the DSP pass mutex is locked
+    mutex_lock (_dsp_pass_mutex);
+    streamer_unlock ();
+
+    unsigned tail = __atomic_load_n (&_dsp_tail, __ATOMIC_RELAXED);
+    dsp_chunk_t *chunk = &_dsp_queue[tail & (DSP_QUEUE_SIZE-1)];
+    int block_done = process_output_block (block, chunk);
+    chunk->generation = _dsp_generation;
+
+    __atomic_add_fetch (&_dsp_queued_us, chunk->duration_us, __ATOMIC_RELAXED);
+    __atomic_store_n (&_dsp_tail, tail + 1, __ATOMIC_RELEASE);
+    mutex_unlock (_dsp_pass_mutex);
+
+    if (block_done) {
+        handler_wakeup (handler);
+        streamer_lock ();
         _update_buffering_state ();
+        streamer_unlock ();
     }
+    return 1;
+}
 
-    return sz;
+static void
+_dsp_thread (void *ctx) {
+#if defined(__linux__) && !defined(ANDROID)
+    prctl (PR_SET_NAME, "deadbeef-dsp", 0, 0, 0, 0);
+#endif
+
+    while (!_dsp_terminate) {
+        while (!_dsp_terminate && _dsp_process_next_block ()) {
+        }
+
+        mutex_lock (_dsp_mutex);
+        __atomic_store_n (&_dsp_sleeping, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence (__ATOMIC_SEQ_CST);
+        if (!_dsp_wakeup && !_dsp_terminate && !_dsp_has_work ()) {
+            cond_wait_timeout (_dsp_cond, _dsp_mutex, DSP_IDLE_TIMEOUT_MS);
+        }
+        __atomic_store_n (&_dsp_sleeping, 0, __ATOMIC_SEQ_CST);
+        _dsp_wakeup = 0;
+        mutex_unlock (_dsp_mutex);
+    }
+}
+
+static void
+_dsp_stage_init (void) {
+    _dsp_head = _dsp_tail = 0;
+    _dsp_queued_us = 0;
+    _dsp_format_blocked = 0;
+    _dsp_terminate = 0;
+    _dsp_wakeup = 0;
+    _dsp_mutex = mutex_create_nonrecursive ();
+    _dsp_pass_mutex = mutex_create ();
+    _dsp_cond = cond_create ();
+    _dsp_tid = thread_start (_dsp_thread, NULL);
+}
+
+static void
+_dsp_stage_free (void) {
+    _dsp_terminate = 1;
+    _dsp_wake ();
+    thread_join (_dsp_tid);
+    _dsp_tid = 0;
+    mutex_free (_dsp_mutex);
+    _dsp_mutex = 0;
+    mutex_free (_dsp_pass_mutex);
+    _dsp_pass_mutex = 0;
+    cond_free (_dsp_cond);
+    _dsp_cond = 0;
+    for (int i = 0; i < DSP_QUEUE_SIZE; i++) {
+        free (_dsp_queue[i].buf);
+        _dsp_queue[i].buf = NULL;
+        _dsp_queue[i].bufsize = 0;
+    }
+    _dsp_head = _dsp_tail = 0;
+    _dsp_queued_us = 0;
 }
 
 
@@ -1989,70 +2347,217 @@ _get_temp_audio_buffer (size_t size) {
     return _temp_audio_buffer;
 }
 
+// Called on the viz thread for each slot taken from the ring
 static void
-viz_process (char * restrict bytes, int bytes_size, DB_output_t *output) {
-    if (waveform_listeners || spectrum_listeners) {
-        int in_frame_size = (output->fmt.bps >> 3) * output->fmt.channels;
-        int in_frames = bytes_size / in_frame_size;
-        ddb_waveformat_t out_fmt = {
-            .bps = 32,
-            .channels = output->fmt.channels,
-            .samplerate = output->fmt.samplerate,
-            .channelmask = output->fmt.channelmask,
-            .is_float = 1,
-            .is_bigendian = 0
-        };
+viz_process_slot (viz_slot_t *slot) {
+    int in_frame_size = (slot->fmt.bps >> 3) * slot->fmt.channels;
+    int in_frames = slot->size / in_frame_size;
+    ddb_waveformat_t out_fmt = {
+        .bps = 32,
+        .channels = slot->fmt.channels,
+        .samplerate = slot->fmt.samplerate,
+        .channelmask = slot->fmt.channelmask,
+        .is_float = 1,
+        .is_bigendian = 0
+    };
+
+    float *temp_audio_data = _get_temp_audio_buffer (in_frames * out_fmt.channels * sizeof (float));
+    pcm_convert (&slot->fmt, slot->buf, &out_fmt, (char *)temp_audio_data, slot->size);
+    ddb_audio_data_t waveform_data = {
+        .fmt = &out_fmt,
+        .data = temp_audio_data,
+        .nframes = in_frames
+    };
+    mutex_lock (wdl_mutex);
+    for (wavedata_listener_t *l = waveform_listeners; l; l = l->next) {
+        l->callback (l->ctx, &waveform_data);
+    }
+    mutex_unlock (wdl_mutex);
+
+    if (!spectrum_listeners) {
+        history_fill = 0;
+        return;
+    }
+
+    if (!history_data) {
+        history_data = malloc (VIZ_HISTORY_FRAMES * DDB_FREQ_MAX_CHANNELS * sizeof (float));
+        fft_data = malloc (VIZ_HISTORY_FRAMES * sizeof (float));
+        freq_data = malloc (DDB_FREQ_MAX_BANDS * DDB_FREQ_MAX_CHANNELS * sizeof (float));
+    }
+
+    if (out_fmt.channels != history_fmt.channels || out_fmt.samplerate != history_fmt.samplerate) {
+        history_fill = 0;
+        history_pos = 0;
+    }
+    history_fmt = out_fmt;
+
+    int channels = min (out_fmt.channels, DDB_FREQ_MAX_CHANNELS);
+    int start = max (0, in_frames - VIZ_HISTORY_FRAMES);
+    for (int s = start; s < in_frames; s++) {
+        for (int c = 0; c < channels; c++) {
+            history_data[VIZ_HISTORY_FRAMES * c + history_pos] = temp_audio_data[s * out_fmt.channels + c];
+        }
+        history_pos = (history_pos + 1) & (VIZ_HISTORY_FRAMES - 1);
+    }
+    history_fill = min (VIZ_HISTORY_FRAMES, history_fill + in_frames - start);
+    history_new_frames += in_frames - start;
+}
+
+// Calculates the spectrum of the latest window for each spectrum listener, called once per analysis tick
+static void
+viz_analyze (void) {
+    if (!history_new_frames) {
+        return;
+    }
+    history_new_frames = 0;
 
-        float *temp_audio_data = _get_temp_audio_buffer (in_frames * out_fmt.channels * sizeof (float));
-        pcm_convert (&output->fmt, bytes, &out_fmt, (char *)temp_audio_data, bytes_size);
-        ddb_audio_data_t waveform_data = {
-            .fmt = &out_fmt,
-            .data = temp_audio_data,
-            .nframes = in_frames
+    int channels = min (history_fmt.channels, DDB_FREQ_MAX_CHANNELS);
+    int nbands = 0;
+    int window = -1;
+
+    mutex_lock (wdl_mutex);
+    for (wavedata_listener_t *l = spectrum_listeners; l; l = l->next) {
+        int nframes = l->nbands * 2;
+        if (history_fill < nframes) {
+            continue;
+        }
+        // listeners usually use the same settings, reuse the previous result in that case
+        if (l->nbands != nbands || l->window != window) {
+            nbands = l->nbands;
+            window = l->window;
+            for (int c = 0; c < channels; c++) {
+                const float *ch = &history_data[VIZ_HISTORY_FRAMES * c];
+                int from = (history_pos - nframes) & (VIZ_HISTORY_FRAMES - 1);
+                int n1 = min (nframes, VIZ_HISTORY_FRAMES - from);
+                memcpy (fft_data, ch + from, n1 * sizeof (float));
+                memcpy (fft_data + n1, ch, (nframes - n1) * sizeof (float));
+                calc_freq_ex (fft_data, &freq_data[nbands * c], nbands, window);
+            }
+        }
+        ddb_audio_data_t spectrum_data = {
+            .fmt = &history_fmt,
+            .data = freq_data,
+            .nframes = nbands
         };
-        mutex_lock (wdl_mutex);
-        for (wavedata_listener_t *l = waveform_listeners; l; l = l->next) {
-            l->callback (l->ctx, &waveform_data);
+        l->callback (l->ctx, &spectrum_data);
+    }
+    mutex_unlock (wdl_mutex);
+}
+
+// Called from streamer_read, only copies the data into the ring
+static void
+viz_process (char * restrict bytes, int bytes_size, DB_output_t *output) {
+    if (!waveform_listeners && !spectrum_listeners) {
+        return;
+    }
+    int frame_size = (output->fmt.bps >> 3) * output->fmt.channels;
+    int slot_size = VIZ_SLOT_SIZE - VIZ_SLOT_SIZE % frame_size;
+    unsigned tail = __atomic_load_n (&_viz_tail, __ATOMIC_RELAXED);
+    while (bytes_size >= frame_size) {
+        if (tail - __atomic_load_n (&_viz_head, __ATOMIC_ACQUIRE) >= VIZ_QUEUE_SIZE) {
+            __atomic_add_fetch (&_viz_frames_dropped, bytes_size / frame_size, __ATOMIC_RELAXED);
+            break;
         }
-        mutex_unlock (wdl_mutex);
+        viz_slot_t *slot = &_viz_queue[tail & (VIZ_QUEUE_SIZE-1)];
+        int sz = min (bytes_size, slot_size);
+        sz -= sz % frame_size;
+        memcpy (slot->buf, bytes, sz);
+        slot->size = sz;
+        slot->fmt = output->fmt;
+        bytes += sz;
+        bytes_size -= sz;
+        tail++;
+        __atomic_store_n (&_viz_tail, tail, __ATOMIC_RELEASE);
+    }
+}
+
+static void
+_viz_thread (void *ctx) {
+#if defined(__linux__) && !defined(ANDROID)
+    prctl (PR_SET_NAME, "deadbeef-viz", 0, 0, 0, 0);
+#endif
 
-        if (out_fmt.channels != audio_data_channels || !spectrum_listeners) {
-            audio_data_fill = 0;
-            audio_data_channels = out_fmt.channels;
+    mutex_lock (_viz_mutex);
+    while (!_viz_terminate) {
+        int timeout = -1;
+        if (waveform_listeners || spectrum_listeners) {
+            int rate = conf_streamer_vis_rate > 0 ? conf_streamer_vis_rate : VIZ_DEFAULT_RATE;
+            timeout = max (1, 1000 / rate);
         }
+        if (!_viz_wakeup) {
+            cond_wait_timeout (_viz_cond, _viz_mutex, timeout);
+        }
+        _viz_wakeup = 0;
+        if (_viz_terminate) {
+            break;
+        }
+        mutex_unlock (_viz_mutex);
 
-        if (spectrum_listeners) {
-            int remaining = in_frames;
-            do {
-                int sz = DDB_FREQ_BANDS * 2 -audio_data_fill;
-                sz = min (sz, remaining);
-                for (int c = 0; c < audio_data_channels; c++) {
-                    for (int s = 0; s < sz; s++) {
-                        audio_data[DDB_FREQ_BANDS * 2 * c + audio_data_fill + s] = temp_audio_data[(in_frames-remaining + s) * audio_data_channels + c];
-                    }
-                }
-                //            memcpy (&audio_data[audio_data_fill], &temp_audio_data[in_frames-remaining], sz * sizeof (float));
-                audio_data_fill += sz;
-                remaining -= sz;
-                if (audio_data_fill == DDB_FREQ_BANDS * 2) {
-                    for (int c = 0; c < audio_data_channels; c++) {
-                        calc_freq (&audio_data[DDB_FREQ_BANDS * 2 * c], &freq_data[DDB_FREQ_BANDS * c]);
-                    }
-                    ddb_audio_data_t spectrum_data = {
-                        .fmt = &out_fmt,
-                        .data = freq_data,
-                        .nframes = DDB_FREQ_BANDS
-                    };
-                    mutex_lock (wdl_mutex);
-                    for (wavedata_listener_t *l = spectrum_listeners; l; l = l->next) {
-                        l->callback (l->ctx, &spectrum_data);
-                    }
-                    mutex_unlock (wdl_mutex);
-                    audio_data_fill = 0;
-                }
-            } while (remaining > 0);
+        unsigned head = __atomic_load_n (&_viz_head, __ATOMIC_RELAXED);
+        while (head != __atomic_load_n (&_viz_tail, __ATOMIC_ACQUIRE)) {
+            viz_process_slot (&_viz_queue[head & (VIZ_QUEUE_SIZE-1)]);
+            head++;
+            __atomic_store_n (&_viz_head, head, __ATOMIC_RELEASE);
         }
+        viz_analyze ();
+
+        mutex_lock (_viz_mutex);
     }
+    mutex_unlock (_viz_mutex);
+}
+
+static void
+_viz_wake (void) {
+    mutex_lock (_viz_mutex);
+    _viz_wakeup = 1;
+    mutex_unlock (_viz_mutex);
+    cond_signal (_viz_cond);
+}
+
+static void
+_viz_init (void) {
+    _viz_head = _viz_tail = 0;
+    _viz_frames_dropped = 0;
+    _viz_terminate = 0;
+    _viz_wakeup = 0;
+    _viz_mutex = mutex_create_nonrecursive ();
+    _viz_cond = cond_create ();
+    _viz_tid = thread_start_low_priority (_viz_thread, NULL);
+}
+
+static void
+_viz_free (void) {
+    mutex_lock (_viz_mutex);
+    _viz_terminate = 1;
+    mutex_unlock (_viz_mutex);
+    cond_signal (_viz_cond);
+    thread_join (_viz_tid);
+    _viz_tid = 0;
+    mutex_free (_viz_mutex);
+    _viz_mutex = 0;
+    cond_free (_viz_cond);
+    _viz_cond = 0;
+
+    free (_temp_audio_buffer);
+    _temp_audio_buffer = NULL;
+    _temp_audio_buffer_size = 0;
+
+    free (history_data);
+    history_data = NULL;
+    free (fft_data);
+    fft_data = NULL;
+    free (freq_data);
+    freq_data = NULL;
+    history_fill = 0;
+    history_pos = 0;
+    history_new_frames = 0;
+    memset (&history_fmt, 0, sizeof (history_fmt));
+    fft_free ();
+}
+
+int64_t
+vis_get_frames_dropped (void) {
+    return __atomic_load_n (&_viz_frames_dropped, __ATOMIC_RELAXED);
 }
 
 int
@@ -2063,16 +2568,26 @@ streamer_read (char *bytes, int size) {
 #endif
     DB_output_t *output = plug_get_output ();
 
-    if (_format_change_wait) {
+    int frame_size = output->fmt.channels * output->fmt.bps / 8;
+    if (_format_change_wait || frame_size <= 0) {
         memset (bytes, 0, size);
         return size;
     }
 
-    streamer_lock ();
-    streamblock_t *block = streamreader_get_curr_block();
-    if (!block) {
+    dsp_chunk_t *chunk = _dsp_curr_chunk ();
+
+    // Buffer starvation doesn't need the lock, since the chunk queue can be checked without it.
+    // This keeps the output thread from waiting for the mutex when it has nothing to play anyway.
+    if (!chunk && streaming_track) {
+        streamreader_underrun ();
+        memset (bytes, 0, size);
+        return size;
+    }
+
+    if (!chunk) {
         // NULL streaming_track means playback stopped,
         // otherwise just a buffer starvation (e.g. after seeking)
+        streamer_lock ();
         if (!streaming_track) {
             update_stop_after_current ();
             _handle_playback_stopped();
@@ -2081,11 +2596,6 @@ streamer_read (char *bytes, int size) {
             avg_bitrate = -1;
             last_seekpos = -1;
         }
-        else {
-            // this message is printed in more cases, than if output is broken, so disable it
-            // but keep for reference -- this is a good place to set breakpoint
-//            fprintf (stderr, "streamer: streamer_read has starved. The current output plugin might be broken\n");
-        }
         streamer_unlock();
 
         if (streaming_track) {
@@ -2093,59 +2603,71 @@ streamer_read (char *bytes, int size) {
             return size;
         }
         _audio_stall_count++;
+        if (_audio_stall_count >= AUDIO_STALL_WAIT) {
+            handler_wakeup (handler);
+        }
         return 0;
     }
 
     _audio_stall_count = 0;
 
     int block_bitrate = -1;
+    int sz = 0;
 
-    // only decode until the next format change
-    if (!memcmp (&block->fmt, &last_block_fmt, sizeof (ddb_waveformat_t))) {
-        // decode enough blocks to fill the output buffer
-        while (block != NULL && _outbuffer_remaining < size && !memcmp (&block->fmt, &last_block_fmt, sizeof (ddb_waveformat_t))) {
-            char *outbuffer = _get_output_buffer (OUTPUT_BUFFER_SIZE);
-            int rb = process_output_block (block, outbuffer + _outbuffer_remaining);
-            if (rb <= 0) {
+    // copy out the processed data
+    while (chunk != NULL && sz < size) {
+        // handle change of track, when the first chunk of the track starts playing
+        if (chunk->first || chunk->last) {
+            streamer_lock ();
+            if (chunk->last) {
+                update_stop_after_current ();
+            }
+            // the chunk could have been invalidated by a requeue while waiting for the lock
+            if (!_dsp_chunk_is_valid (chunk)) {
+                streamer_unlock ();
+                chunk = _dsp_curr_chunk ();
+                continue;
+            }
+            if (chunk->first) {
+                handle_track_change (playing_track, chunk->track);
+            }
+            chunk->first = chunk->last = 0;
+            streamer_unlock ();
+        }
+
+        if (memcmp (&chunk->fmt, &output->fmt, sizeof (ddb_waveformat_t))) {
+            // the output format has changed after this chunk was processed, it can't be played
+            chunk->pos = chunk->size;
+        }
+        else {
+            int n = min (size - sz, chunk->size - chunk->pos);
+            n -= n % frame_size;
+            if (n <= 0 && chunk->pos < chunk->size) {
                 break;
             }
-            _outbuffer_remaining += rb;
-            block_bitrate = block->bitrate;
-            block = streamreader_get_curr_block();
+            memcpy (bytes + sz, chunk->buf + chunk->pos, n);
+            chunk->pos += n;
+            sz += n;
+
+            float dt = (float)n/output->fmt.samplerate/frame_size * chunk->dspratio;
+            playpos += dt;
+            playtime += dt;
+            block_bitrate = chunk->bitrate;
         }
-    }
-    // empty buffer and the next block format differs? request format change!
 
-    if (!_outbuffer_remaining && block && memcmp (&block->fmt, &last_block_fmt, sizeof (ddb_waveformat_t))) {
-        _format_change_wait = 1;
-        streamer_unlock();
-        memset (bytes, 0, size);
-        return size;
+        if (chunk->pos < chunk->size) {
+            break;
+        }
+        _dsp_next_chunk ();
+        chunk = _dsp_curr_chunk ();
     }
-    streamer_unlock ();
 
-    // consume decoded data
-    int sz = min (size, _outbuffer_remaining);
     if (!sz) {
         // no data available
         memset (bytes, 0, size);
         return size;
     }
 
-    // clip to frame size
-    int ss = output->fmt.channels * output->fmt.bps / 8;
-    if ((sz % ss) != 0) {
-        sz -= (sz % ss);
-    }
-
-    char *outbuffer = _get_output_buffer(OUTPUT_BUFFER_SIZE);
-
-    memcpy (bytes, outbuffer, sz);
-    if (sz < _outbuffer_remaining) {
-        memmove (outbuffer, outbuffer + sz, _outbuffer_remaining - sz);
-    }
-    _outbuffer_remaining -= sz;
-
     // approximate bitrate
     if (block_bitrate != -1) {
         if (avg_bitrate == -1) {
@@ -2263,6 +2785,10 @@ streamer_configchanged (void) {
     conf_streamer_samplerate_mult_48 = new_conf_streamer_samplerate_mult_48;
     conf_streamer_samplerate_mult_44 = new_conf_streamer_samplerate_mult_44;
 
+    conf_streamer_readahead_local_ms = conf_get_int ("streamer.readahead_local_ms", 5000);
+    conf_streamer_readahead_remote_ms = conf_get_int ("streamer.readahead_remote_ms", 30000);
+    conf_streamer_vis_rate = conf_get_int ("streamer.vis_rate", VIZ_DEFAULT_RATE);
+
     streamer_unlock ();
 
     streamreader_configchanged ();
@@ -2532,6 +3058,9 @@ streamer_set_current_playlist_real (int plt) {
         plt_unref (streamer_playlist);
     }
     streamer_playlist = plt_get_for_idx (plt);
+    if (!streamer_playlist) {
+        streamer_playlist = plt_get_curr ();
+    }
     pl_unlock ();
 }
 
@@ -2542,10 +3071,8 @@ streamer_set_current_playlist (int plt) {
 
 int
 streamer_get_current_playlist (void) {
+    str_init_streamer_playlist ();
     pl_lock ();
-    if (!streamer_playlist) {
-        streamer_playlist = plt_get_curr ();
-    }
     int idx = plt_get_idx_of (streamer_playlist);
     pl_unlock ();
     return idx;
@@ -2553,10 +3080,10 @@ streamer_get_current_playlist (void) {
 
 void
 streamer_notify_playlist_deleted (playlist_t *plt) {
-    // this is only called from playlist code, no lock required
+    // this is only called from plt_remove under pl_lock, after the playlist was unlinked
     if (plt == streamer_playlist) {
         plt_unref (streamer_playlist);
-        streamer_playlist = NULL;
+        streamer_playlist = plt_get_curr ();
     }
 }
 
@@ -2621,6 +3148,7 @@ vis_waveform_listen (void *ctx, void (*callback)(void *ctx, ddb_audio_data_t *da
     l->next = waveform_listeners;
     waveform_listeners = l;
     mutex_unlock (wdl_mutex);
+    _viz_wake (); // start the analysis ticks
 }
 
 void
@@ -2644,14 +3172,31 @@ vis_waveform_unlisten (void *ctx) {
 
 void
 vis_spectrum_listen (void *ctx, void (*callback)(void *ctx, ddb_audio_data_t *data)) {
+    vis_spectrum_listen2 (ctx, DDB_FREQ_BANDS, DDB_FFT_WINDOW_DEFAULT, callback);
+}
+
+void
+vis_spectrum_listen2 (void *ctx, int nbands, int window, void (*callback)(void *ctx, ddb_audio_data_t *data)) {
+    // round up to a supported power of 2
+    int bands = 64;
+    while (bands < nbands && bands < DDB_FREQ_MAX_BANDS) {
+        bands <<= 1;
+    }
+    if (window < 0 || window >= DDB_FFT_WINDOW_COUNT) {
+        window = DDB_FFT_WINDOW_DEFAULT;
+    }
+
     mutex_lock (wdl_mutex);
     wavedata_listener_t *l = malloc (sizeof (wavedata_listener_t));
     memset (l, 0, sizeof (wavedata_listener_t));
     l->ctx = ctx;
     l->callback = callback;
+    l->nbands = bands;
+    l->window = window;
     l->next = spectrum_listeners;
     spectrum_listeners = l;
     mutex_unlock (wdl_mutex);
+    _viz_wake (); // start the analysis ticks
 }
 
 void
@@ -2783,6 +3328,7 @@ streamer_set_output (DB_output_t *output) {
     if (mutex) {
         streamer_unlock ();
     }
+    handler_wakeup (handler);
     messagepump_push (DB_EV_OUTPUTCHANGED, 0, 0, 0);
 }
 
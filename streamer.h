@@ -62,6 +62,14 @@ streamer_lock (void);
 void
 streamer_unlock (void);
 
+// Serializes the DSP chain changes and resets with the DSP thread, which runs the DSP chain without the streamer mutex.
+// Must be called with the streamer mutex locked.
+void
+streamer_lock_dsp (void);
+
+void
+streamer_unlock_dsp (void);
+
 // song == -1 means "stop and clear streamer message queue"
 void
 streamer_set_nextsong (int song, int startpaused);
@@ -169,9 +177,16 @@ vis_waveform_unlisten (void *ctx);
 void
 vis_spectrum_listen (void *ctx, void (*callback)(void *ctx, ddb_audio_data_t *data));
 
+void
+vis_spectrum_listen2 (void *ctx, int nbands, int window, void (*callback)(void *ctx, ddb_audio_data_t *data));
+
 void
 vis_spectrum_unlisten (void *ctx);
 
+// Number of output frames which didn't fit into the visualization ring, and weren't analyzed.
+int64_t
+vis_get_frames_dropped (void);
+
 void
 streamer_set_playing_track (playItem_t *it);
 
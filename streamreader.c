@@ -24,21 +24,54 @@
 #include <string.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <sys/time.h>
 #include "streamreader.h"
 #include "replaygain.h"
-#include "threading.h"
 
-// read ahead about 5 sec at 44100/16/2
 #define BLOCK_SIZE 16384
-#define BLOCK_COUNT 48
 
-static streamblock_t *blocks; // list of all blocks
-
-static streamblock_t *block_data; // first available block with data (can be NULL)
-
-static streamblock_t *block_next; // next block available to be read into / queued
-
-static int numblocks_ready;
+// The read-ahead is sized in time, and converted to a number of blocks for the format being decoded.
+// MAX_BLOCK_COUNT must be a power of 2, so that the ring indices stay consistent when they wrap around.
+#define MIN_BLOCK_COUNT 8
+#define MAX_BLOCK_COUNT 2048 // 32MB
+#define DEFAULT_READAHEAD_MS 5000
+
+// The read-ahead target is scaled up (up to MAX_READAHEAD_SCALE times) on underruns, or when the decoder is slow,
+// and scaled down again after SHRINK_AFTER_MS of audio has been decoded without problems.
+#define MAX_READAHEAD_SCALE 8
+#define SLOW_DECODE_LOAD 0.5f
+#define FAST_DECODE_LOAD 0.25f
+#define SHRINK_AFTER_MS 60000
+
+// The blocks form a single-producer/single-consumer ring.
+// The streamer thread is the producer: it fills the block at `_tail`, and publishes it by incrementing `_tail`.
+// The output thread is the consumer: it plays the block at `_head`, and releases it by incrementing `_head`.
+// Both counters grow monotonically, and are used modulo MAX_BLOCK_COUNT.
+// The producer never needs the streamer mutex, and the consumer can check for data without it.
+// streamreader_reset and streamreader_flush_after move both ends, and must be called with the streamer mutex
+// and the DSP pass mutex locked, which the consumer holds while processing a block.
+//
+// Only the slots in [_buf_tail, _buf_head) own a buffer, which covers all queued blocks.
+// When the producer moves past _buf_head, it takes the buffer of an already played slot at _buf_tail,
+// or allocates a new one if the read-ahead has grown. When it has shrunk, played buffers are freed.
+static streamblock_t *blocks;
+
+static unsigned _head;
+static unsigned _tail;
+static unsigned _buf_tail;
+static unsigned _buf_head;
+
+// producer state of the adaptive read-ahead
+static int _readahead_ms = DEFAULT_READAHEAD_MS;
+static int _readahead_scale = 1;
+static unsigned _target_size = MIN_BLOCK_COUNT; // number of blocks to read ahead
+static float _decode_load; // moving average of decoding time / decoded audio time
+static float _calm_ms; // audio decoded since the last change of _readahead_scale
+static int _seen_underruns;
+
+// consumer state
+static int _underruns;
+static int _primed; // set when the consumer got a block after the last reset
 
 static int curr_block_bitrate;
 
@@ -46,33 +79,60 @@ static playItem_t *_prev_rg_track;
 static int _rg_settingschanged = 1;
 static int _firstblock = 0;
 
+static inline unsigned
+_load_acquire (unsigned *p) {
+    return __atomic_load_n (p, __ATOMIC_ACQUIRE);
+}
+
+static inline void
+_store_release (unsigned *p, unsigned value) {
+    __atomic_store_n (p, value, __ATOMIC_RELEASE);
+}
+
+static inline streamblock_t *
+_block_at (unsigned index) {
+    return &blocks[index & (MAX_BLOCK_COUNT - 1)];
+}
+
+static void
+_streamreader_release_block (streamblock_t *block) {
+    block->pos = -1;
+    block->track = NULL;
+    block->queued = 0;
+}
+
 void
 streamreader_init (void) {
     _prev_rg_track = NULL;
     _rg_settingschanged = 1;
-    for (int i = 0; i < BLOCK_COUNT; i++) {
-        streamblock_t *b = calloc (1, sizeof (streamblock_t));
-        b->pos = -1;
-        b->buf = malloc (BLOCK_SIZE);
-        b->next = blocks;
-        blocks = b;
+    blocks = calloc (MAX_BLOCK_COUNT, sizeof (streamblock_t));
+    for (int i = 0; i < MAX_BLOCK_COUNT; i++) {
+        blocks[i].pos = -1;
     }
-    block_next = blocks;
-    numblocks_ready = 0;
+    _head = _tail = 0;
+    _buf_tail = _buf_head = 0;
+    _target_size = MIN_BLOCK_COUNT;
+    _readahead_ms = DEFAULT_READAHEAD_MS;
+    _readahead_scale = 1;
+    _decode_load = 0;
+    _calm_ms = 0;
+    _underruns = _seen_underruns = 0;
+    _primed = 0;
     _firstblock = 0;
 }
 
 void
 streamreader_free (void) {
     streamreader_reset ();
-    while (blocks) {
-        streamblock_t *next = blocks->next;
-        free (blocks->buf);
+    if (blocks) {
+        for (int i = 0; i < MAX_BLOCK_COUNT; i++) {
+            free (blocks[i].buf);
+        }
         free (blocks);
-        blocks = next;
+        blocks = NULL;
     }
-    block_next = block_data = NULL;
-    numblocks_ready = 0;
+    _head = _tail = 0;
+    _buf_tail = _buf_head = 0;
     _prev_rg_track = NULL;
     _rg_settingschanged = 1;
     _firstblock = 0;
@@ -80,10 +140,90 @@ streamreader_free (void) {
 
 streamblock_t *
 streamreader_get_next_block (void) {
-    if (block_next->pos >= 0) {
+    unsigned tail = __atomic_load_n (&_tail, __ATOMIC_RELAXED);
+    unsigned head = _load_acquire (&_head);
+    if (tail - head >= _target_size) {
         return NULL; // all buffers full
     }
-    return block_next;
+
+    streamblock_t *block = _block_at (tail);
+    if (tail == _buf_head) {
+        streamblock_t *played = _block_at (_buf_tail);
+        if (_buf_head - _buf_tail >= _target_size && (int)(head - _buf_tail) > 0) {
+            char *buf = played->buf;
+            played->buf = NULL;
+            block->buf = buf;
+            _buf_tail++;
+        }
+        else {
+            block->buf = malloc (BLOCK_SIZE);
+        }
+        _buf_head++;
+    }
+
+    // release the buffers above the target
+    while (_buf_head - _buf_tail > _target_size && (int)(head - _buf_tail) > 0) {
+        streamblock_t *played = _block_at (_buf_tail);
+        free (played->buf);
+        played->buf = NULL;
+        _buf_tail++;
+    }
+
+    return block;
+}
+
+void
+streamreader_set_readahead (int ms) {
+    _readahead_ms = ms > 0 ? ms : DEFAULT_READAHEAD_MS;
+}
+
+int
+streamreader_get_readahead_blocks (void) {
+    return (int)_target_size;
+}
+
+// Updates the read-ahead target after decoding a block
+static void
+_streamreader_adapt (const ddb_waveformat_t *fmt, int size, float decode_ms) {
+    int bytes_per_sec = fmt->samplerate * fmt->channels * (fmt->bps >> 3);
+    if (bytes_per_sec <= 0) {
+        return;
+    }
+
+    if (size > 0) {
+        float audio_ms = size * 1000.f / bytes_per_sec;
+        _decode_load = _decode_load * 0.9f + decode_ms / audio_ms * 0.1f;
+        _calm_ms += audio_ms;
+    }
+
+    int underruns = __atomic_load_n (&_underruns, __ATOMIC_RELAXED);
+    int target_ms = _readahead_ms * _readahead_scale;
+    if (underruns != _seen_underruns) {
+        _seen_underruns = underruns;
+        if (_readahead_scale < MAX_READAHEAD_SCALE) {
+            _readahead_scale *= 2;
+        }
+        _calm_ms = 0;
+    }
+    else if (_decode_load > SLOW_DECODE_LOAD && _calm_ms >= target_ms && _readahead_scale < MAX_READAHEAD_SCALE) {
+        // at most once per buffer length, to let the larger buffer fill up
+        _readahead_scale *= 2;
+        _calm_ms = 0;
+    }
+    else if (_decode_load < FAST_DECODE_LOAD && _calm_ms >= SHRINK_AFTER_MS && _readahead_scale > 1) {
+        _readahead_scale /= 2;
+        _calm_ms = 0;
+    }
+
+    int64_t bytes = (int64_t)_readahead_ms * _readahead_scale * bytes_per_sec / 1000;
+    int64_t n = (bytes + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    if (n < MIN_BLOCK_COUNT) {
+        n = MIN_BLOCK_COUNT;
+    }
+    else if (n > MAX_BLOCK_COUNT) {
+        n = MAX_BLOCK_COUNT;
+    }
+    _target_size = (unsigned)n;
 }
 
 void
@@ -92,7 +232,7 @@ streamreader_configchanged (void) {
 }
 
 int
-streamreader_read_block (streamblock_t *block, playItem_t *track, DB_fileinfo_t *fileinfo, uint64_t mutex) {
+streamreader_read_block (streamblock_t *block, playItem_t *track, DB_fileinfo_t *fileinfo) {
     int size = BLOCK_SIZE;
     if (!fileinfo->plugin) {
         // return dummy block for a failed track
@@ -122,14 +262,17 @@ streamreader_read_block (streamblock_t *block, playItem_t *track, DB_fileinfo_t
     curr_block_bitrate = -1;
     int rb;
     if (size > 0) {
+        struct timeval tm1, tm2;
+        gettimeofday (&tm1, NULL);
         rb = fileinfo->plugin->read (fileinfo, block->buf, size);
+        gettimeofday (&tm2, NULL);
+        float decode_ms = (tm2.tv_sec - tm1.tv_sec) * 1000.f + (tm2.tv_usec - tm1.tv_usec) / 1000.f;
+        _streamreader_adapt (&fileinfo->fmt, rb, decode_ms);
     }
     else {
         rb = -1;
     }
 
-    mutex_lock (mutex);
-
     block->bitrate = curr_block_bitrate;
 
     block->pos = 0;
@@ -174,17 +317,10 @@ void
 streamreader_enqueue_block (streamblock_t *block) {
     // block is passed just for sanity checking
     assert (block->track);
-    if (!block_data) {
-        block_data = block_next;
-    }
-
-    block_next = block_next->next;
-    if (!block_next) {
-        block_next = blocks;
-    }
-
+    unsigned tail = __atomic_load_n (&_tail, __ATOMIC_RELAXED);
+    assert (block == _block_at (tail));
     block->queued = 1;
-    numblocks_ready++;
+    _store_release (&_tail, tail + 1);
 }
 
 void
@@ -194,86 +330,70 @@ streamer_set_bitrate (int bitrate) {
 
 streamblock_t *
 streamreader_get_curr_block (void) {
-    return block_data;
-}
-
-static void
-_streamreader_release_block (streamblock_t *block) {
-    block->pos = -1;
-    block->track = NULL;
-    block->queued = 0;
-
-    numblocks_ready--;
-    if (numblocks_ready < 0) {
-        numblocks_ready = 0;
+    unsigned head = __atomic_load_n (&_head, __ATOMIC_RELAXED);
+    if (head == _load_acquire (&_tail)) {
+        return NULL; // no available blocks with data
     }
+    _primed = 1;
+    return _block_at (head);
 }
 
 void
 streamreader_next_block (void) {
-    if (block_data) {
-        _streamreader_release_block (block_data);
-
-        block_data = block_data->next;
-        if (!block_data) {
-            block_data = blocks;
-        }
+    unsigned head = __atomic_load_n (&_head, __ATOMIC_RELAXED);
+    if (head == _load_acquire (&_tail)) {
+        return;
     }
+    _streamreader_release_block (_block_at (head));
+    _store_release (&_head, head + 1);
+}
 
-    if (block_data && !block_data->queued) {
-        block_data = NULL; // no available blocks with data
+void
+streamreader_underrun (void) {
+    // only count the queue running dry during playback, not the refill after a reset
+    if (_primed) {
+        _primed = 0;
+        __atomic_add_fetch (&_underruns, 1, __ATOMIC_RELAXED);
     }
 }
 
-
 void
 streamreader_reset (void) {
-    streamblock_t *b = blocks;
-    while (b) {
-        b->pos = -1;
-        if (b->track) {
-            b->track = NULL;
-        }
-        b->queued = 0;
-        b = b->next;
+    unsigned head = __atomic_load_n (&_head, __ATOMIC_RELAXED);
+    unsigned tail = _load_acquire (&_tail);
+    for (; head != tail; head++) {
+        _streamreader_release_block (_block_at (head));
     }
-    block_next = blocks;
-    block_data = NULL;
-    numblocks_ready = 0;
+    _store_release (&_head, tail);
+    _primed = 0;
     _firstblock = 0;
 }
 
 int
 streamreader_num_blocks_ready (void) {
-    return numblocks_ready;
+    unsigned tail = _load_acquire (&_tail);
+    return (int)(tail - _load_acquire (&_head));
 }
 
-void
+int
 streamreader_flush_after (playItem_t *it) {
-    if (!block_data) {
-        return;
-    }
-
-    streamblock_t *b = block_data;
+    unsigned head = __atomic_load_n (&_head, __ATOMIC_RELAXED);
+    unsigned tail = __atomic_load_n (&_tail, __ATOMIC_RELAXED);
 
-    int n = numblocks_ready;
-    while (b->track == it && n > 0) {
-        b = b->next;
-        if (!b) {
-            b = blocks;
-        }
-        n--;
+    // keep the blocks of `it`
+    while (head != tail && _block_at (head)->track == it) {
+        head++;
     }
 
-    block_next = b;
+    if (head == tail) {
+        return 0;
+    }
 
-    while (n > 0) {
-        _streamreader_release_block (b);
-        _firstblock = 1;
-        b = b->next;
-        if (!b) {
-            b = blocks;
-        }
-        n--;
+    // drop the rest
+    _store_release (&_tail, head);
+    for (; head != tail; head++) {
+        _streamreader_release_block (_block_at (head));
     }
+    _firstblock = 1;
+    return 1;
 }
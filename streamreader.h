@@ -28,7 +28,6 @@
 #include "playlist.h"
 
 typedef struct streamblock_s {
-    struct streamblock_s *next;
     char *buf;
     int size; // how much bytes total in the buffer, up to BLOCK_SIZE, but can be less
     int pos; // read position in the buffer
@@ -53,13 +52,12 @@ streamblock_t *
 streamreader_get_next_block (void);
 
 // Reads data from stream to the specified block.
-// The mutex must NOT be locked when this function is called.
-// It will get locked if successful.
+// The block is owned by the calling (producer) thread until it's enqueued, so no locking is needed.
 // Returns negative value on error.
 int
-streamreader_read_block (streamblock_t *block, playItem_t *track, DB_fileinfo_t *fileinfo, uint64_t mutex);
+streamreader_read_block (streamblock_t *block, playItem_t *track, DB_fileinfo_t *fileinfo);
 
-// Appends (enqueues) the block to the list of blocks containing data.
+// Appends (enqueues) the block to the list of blocks containing data, making it visible to the consumer.
 // The passed block pointer must be the same as returned by `streamreader_get_next_block`.
 void
 streamreader_enqueue_block (streamblock_t *block);
@@ -73,7 +71,8 @@ streamreader_get_curr_block (void);
 void
 streamreader_next_block (void);
 
-// Resets the queue
+// Resets the queue.
+// Must be called with the streamer mutex locked.
 void
 streamreader_reset (void);
 
@@ -85,8 +84,24 @@ streamreader_num_blocks_ready (void);
 void
 streamreader_configchanged (void);
 
-// Remove any blocks after the ones referencing `it`
+// Sets the read-ahead target for the track being streamed, in milliseconds.
+// The actual number of blocks depends on the decoded format, and grows on underruns or slow decoding.
+// Must be called from the producer thread.
 void
+streamreader_set_readahead (int ms);
+
+// Current read-ahead target, in blocks
+int
+streamreader_get_readahead_blocks (void);
+
+// Called by the consumer when it finds the queue empty during playback
+void
+streamreader_underrun (void);
+
+// Remove any blocks after the ones referencing `it`.
+// Must be called from the producer thread, with the streamer mutex locked.
+// Returns 1 if any blocks were removed.
+int
 streamreader_flush_after (playItem_t *it);
 
 #endif /* streamreader_h */
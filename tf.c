@@ -33,14 +33,16 @@
 //  1: function call
 //   func_idx:byte, num_args:byte, arg1_len:uint16[,arg2_len:byte[,...]]
 //  2: meta field
-//   len:byte, data
+//   len:byte, field_id:byte, atom:uint32, override_atom:uint32, data, 0
 //  3: if_defined block
 //   len:int32, data
-//  4: pre-interpreted text
+//  4: plain text, runs of plain text are merged into one block by the compiler
 //   len:int32, data
 //  5: text dimming block
 //   dim_amount:int8, len:int32, data
 // !0: plain text
+//
+// tf_compile allocates a tf_code_header_t in front of the bytecode, see tf_eval_cached
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
@@ -64,6 +66,8 @@
 #include "gettext.h"
 #include "plugins.h"
 #include "junklib.h"
+#include "metacache.h"
+#include "threading.h"
 #include "external/wcwidth/wcwidth.h"
 
 #define min(x,y) ((x)<(y)?(x):(y))
@@ -74,10 +78,156 @@
 // check the presence of `dimmed` field in context, based on reported size
 #define HAS_DIMMED(ctx) (ctx->_size > (char *)&ctx->dimmed - (char *)ctx)
 
+typedef enum {
+    TF_FIELD_META, // any other field is looked up in the track metadata
+    TF_FIELD_ALBUM_ARTIST,
+    TF_FIELD_ARTIST,
+    TF_FIELD_ALBUM,
+    TF_FIELD_TRACK_ARTIST,
+    TF_FIELD_TRACKNUMBER,
+    TF_FIELD_TITLE,
+    TF_FIELD_DISCNUMBER,
+    TF_FIELD_TOTALDISCS,
+    TF_FIELD_TRACK_NUMBER,
+    TF_FIELD_DATE,
+    TF_FIELD_SAMPLERATE,
+    TF_FIELD_PLAYBACK_BITRATE,
+    TF_FIELD_BITRATE,
+    TF_FIELD_FILESIZE,
+    TF_FIELD_FILESIZE_NATURAL,
+    TF_FIELD_CHANNELS,
+    TF_FIELD_CODEC,
+    TF_FIELD_REPLAYGAIN_ALBUM_GAIN,
+    TF_FIELD_REPLAYGAIN_ALBUM_PEAK,
+    TF_FIELD_REPLAYGAIN_TRACK_GAIN,
+    TF_FIELD_REPLAYGAIN_TRACK_PEAK,
+    TF_FIELD_PLAYBACK_TIME,
+    TF_FIELD_PLAYBACK_TIME_SECONDS,
+    TF_FIELD_PLAYBACK_TIME_REMAINING,
+    TF_FIELD_PLAYBACK_TIME_REMAINING_SECONDS,
+    TF_FIELD_PLAYBACK_TIME_MS,
+    TF_FIELD_LENGTH,
+    TF_FIELD_LENGTH_EX,
+    TF_FIELD_LENGTH_SECONDS,
+    TF_FIELD_LENGTH_SECONDS_FP,
+    TF_FIELD_LENGTH_SAMPLES,
+    TF_FIELD_ISPLAYING,
+    TF_FIELD_ISPAUSED,
+    TF_FIELD_FILENAME,
+    TF_FIELD_FILENAME_EXT,
+    TF_FIELD_DIRECTORYNAME,
+    TF_FIELD_PATH_RAW,
+    TF_FIELD_PATH,
+    TF_FIELD_LIST_INDEX,
+    TF_FIELD_LIST_TOTAL,
+    TF_FIELD_QUEUE_INDEX,
+    TF_FIELD_QUEUE_INDEXES,
+    TF_FIELD_QUEUE_TOTAL,
+    TF_FIELD_DEADBEEF_VERSION,
+    TF_FIELD_PLAYLIST_NAME,
+    TF_FIELD_SELECTION_PLAYBACK_TIME,
+    TF_FIELD_COUNT
+} tf_field_t;
+
+// field names are resolved to tf_field_t by the compiler
+static const char *tf_field_names[TF_FIELD_COUNT] = {
+    [TF_FIELD_META] = NULL,
+    [TF_FIELD_ALBUM_ARTIST] = "album artist",
+    [TF_FIELD_ARTIST] = "artist",
+    [TF_FIELD_ALBUM] = "album",
+    [TF_FIELD_TRACK_ARTIST] = "track artist",
+    [TF_FIELD_TRACKNUMBER] = "tracknumber",
+    [TF_FIELD_TITLE] = "title",
+    [TF_FIELD_DISCNUMBER] = "discnumber",
+    [TF_FIELD_TOTALDISCS] = "totaldiscs",
+    [TF_FIELD_TRACK_NUMBER] = "track number",
+    [TF_FIELD_DATE] = "date",
+    [TF_FIELD_SAMPLERATE] = "samplerate",
+    [TF_FIELD_PLAYBACK_BITRATE] = "playback_bitrate",
+    [TF_FIELD_BITRATE] = "bitrate",
+    [TF_FIELD_FILESIZE] = "filesize",
+    [TF_FIELD_FILESIZE_NATURAL] = "filesize_natural",
+    [TF_FIELD_CHANNELS] = "channels",
+    [TF_FIELD_CODEC] = "codec",
+    [TF_FIELD_REPLAYGAIN_ALBUM_GAIN] = "replaygain_album_gain",
+    [TF_FIELD_REPLAYGAIN_ALBUM_PEAK] = "replaygain_album_peak",
+    [TF_FIELD_REPLAYGAIN_TRACK_GAIN] = "replaygain_track_gain",
+    [TF_FIELD_REPLAYGAIN_TRACK_PEAK] = "replaygain_track_peak",
+    [TF_FIELD_PLAYBACK_TIME] = "playback_time",
+    [TF_FIELD_PLAYBACK_TIME_SECONDS] = "playback_time_seconds",
+    [TF_FIELD_PLAYBACK_TIME_REMAINING] = "playback_time_remaining",
+    [TF_FIELD_PLAYBACK_TIME_REMAINING_SECONDS] = "playback_time_remaining_seconds",
+    [TF_FIELD_PLAYBACK_TIME_MS] = "playback_time_ms",
+    [TF_FIELD_LENGTH] = "length",
+    [TF_FIELD_LENGTH_EX] = "length_ex",
+    [TF_FIELD_LENGTH_SECONDS] = "length_seconds",
+    [TF_FIELD_LENGTH_SECONDS_FP] = "length_seconds_fp",
+    [TF_FIELD_LENGTH_SAMPLES] = "length_samples",
+    [TF_FIELD_ISPLAYING] = "isplaying",
+    [TF_FIELD_ISPAUSED] = "ispaused",
+    [TF_FIELD_FILENAME] = "filename",
+    [TF_FIELD_FILENAME_EXT] = "filename_ext",
+    [TF_FIELD_DIRECTORYNAME] = "directoryname",
+    [TF_FIELD_PATH_RAW] = "_path_raw",
+    [TF_FIELD_PATH] = "path",
+    [TF_FIELD_LIST_INDEX] = "list_index",
+    [TF_FIELD_LIST_TOTAL] = "list_total",
+    [TF_FIELD_QUEUE_INDEX] = "queue_index",
+    [TF_FIELD_QUEUE_INDEXES] = "queue_indexes",
+    [TF_FIELD_QUEUE_TOTAL] = "queue_total",
+    [TF_FIELD_DEADBEEF_VERSION] = "_deadbeef_version",
+    [TF_FIELD_PLAYLIST_NAME] = "_playlist_name",
+    [TF_FIELD_SELECTION_PLAYBACK_TIME] = "selection_playback_time",
+};
+
+// the fields which depend on the playback state, or on the playlist, instead of the track
+static const uint8_t tf_field_is_dynamic[TF_FIELD_COUNT] = {
+    [TF_FIELD_PLAYBACK_BITRATE] = 1,
+    [TF_FIELD_PLAYBACK_TIME] = 1,
+    [TF_FIELD_PLAYBACK_TIME_SECONDS] = 1,
+    [TF_FIELD_PLAYBACK_TIME_REMAINING] = 1,
+    [TF_FIELD_PLAYBACK_TIME_REMAINING_SECONDS] = 1,
+    [TF_FIELD_PLAYBACK_TIME_MS] = 1,
+    [TF_FIELD_ISPLAYING] = 1,
+    [TF_FIELD_ISPAUSED] = 1,
+    [TF_FIELD_LIST_INDEX] = 1,
+    [TF_FIELD_LIST_TOTAL] = 1,
+    [TF_FIELD_QUEUE_INDEX] = 1,
+    [TF_FIELD_QUEUE_INDEXES] = 1,
+    [TF_FIELD_QUEUE_TOTAL] = 1,
+    [TF_FIELD_PLAYLIST_NAME] = 1,
+    [TF_FIELD_SELECTION_PLAYBACK_TIME] = 1,
+};
+
+// Results of the scripts which only depend on the track are cached, until the
+// track is modified (see pl_item_set_modified).
+// Each script's cache has its own mutex, so that it works under the shared pl_lock too.
+#define TF_CACHE_SIZE 512
+
+typedef struct {
+    playItem_t *it;
+    uint32_t stamp; // modification_stamp of the track
+    uint32_t flags; // ctx->flags
+    int outlen;
+    int dimmed;
+    int len;
+    char *value;
+} tf_cache_entry_t;
+
+typedef struct {
+    int cacheable;
+    uintptr_t mutex; // protects the cache, only created for cacheable scripts
+    tf_cache_entry_t *cache; // TF_CACHE_SIZE entries, allocated on first use
+} tf_code_header_t;
+
 typedef struct {
     const char *i;
     uint8_t *o;
     int eol;
+    uint8_t *text; // the plain text block which is currently being written
+    uint8_t *text_end; // end of the text block, more text can only be appended at this position
+    int32_t text_len;
+    int dynamic; // the script uses dynamic fields or functions, and its output can't be cached
 } tf_compiler_t;
 
 /*
@@ -139,6 +289,17 @@ snprintf_clip (char *buf, size_t len, const char *fmt, ...) {
     return (int)min (n, len-1);
 }
 
+// Returns the cache slot for the track, must be called with header->mutex locked.
+static tf_cache_entry_t *
+_tf_cache_entry (tf_code_header_t *header, playItem_t *it) {
+    if (!header->cache) {
+        header->cache = calloc (TF_CACHE_SIZE, sizeof (tf_cache_entry_t));
+    }
+    uintptr_t h = (uintptr_t)it;
+    h ^= h >> 12;
+    return &header->cache[(h >> 4) & (TF_CACHE_SIZE-1)];
+}
+
 /*
  * @param outlen bytes available in the buffer `out`, including the terminating null byte
  */
@@ -170,10 +331,12 @@ tf_eval (ddb_tf_context_t *ctx, const char *code, char *out, int outlen) {
         ctx->plt = (ddb_playlist_t *)&empty_playlist;
     }
 
+    tf_code_header_t *header = code != empty_code ? (tf_code_header_t *)code - 1 : NULL;
     int32_t codelen = *((int32_t *)code);
     code += 4;
     memset (out, 0, outlen);
     int l = 0;
+    char *init_out = out;
 
     int bool_out = 0;
     int id = -1;
@@ -185,6 +348,28 @@ tf_eval (ddb_tf_context_t *ctx, const char *code, char *out, int outlen) {
         ctx->dimmed = 0;
     }
 
+    tf_cache_entry_t *cache_entry = NULL;
+    uint32_t stamp = 0;
+    if (header && header->cacheable && !null_it && id != DB_COLUMN_FILENUMBER && id != DB_COLUMN_PLAYING) {
+        playItem_t *it = (playItem_t *)ctx->it;
+        stamp = __atomic_load_n (&it->modification_stamp, __ATOMIC_RELAXED);
+        mutex_lock (header->mutex);
+        cache_entry = _tf_cache_entry (header, it);
+        if (cache_entry->it == it && cache_entry->stamp == stamp && cache_entry->flags == ctx->flags && cache_entry->outlen == outlen) {
+            l = cache_entry->len;
+            memcpy (out, cache_entry->value, l + 1);
+            if (HAS_DIMMED (ctx)) {
+                ctx->dimmed = cache_entry->dimmed;
+            }
+            mutex_unlock (header->mutex);
+            if (null_plt) {
+                ctx->plt = NULL;
+            }
+            return l;
+        }
+        mutex_unlock (header->mutex);
+    }
+
     switch (id) {
     case DB_COLUMN_FILENUMBER:
         if (ctx->flags & DDB_TF_CONTEXT_HAS_INDEX) {
@@ -216,6 +401,19 @@ tf_eval (ddb_tf_context_t *ctx, const char *code, char *out, int outlen) {
         }
     }
 
+    if (cache_entry && l >= 0) {
+        mutex_lock (header->mutex);
+        cache_entry->it = (playItem_t *)ctx->it;
+        cache_entry->stamp = stamp;
+        cache_entry->flags = ctx->flags;
+        cache_entry->outlen = outlen;
+        cache_entry->dimmed = HAS_DIMMED (ctx) ? ctx->dimmed : 0;
+        cache_entry->len = l;
+        cache_entry->value = realloc (cache_entry->value, l + 1);
+        memcpy (cache_entry->value, init_out, l + 1);
+        mutex_unlock (header->mutex);
+    }
+
     if (null_it) {
         ctx->it = NULL;
     }
@@ -2465,9 +2663,7 @@ tf_func_def tf_funcs[TF_MAX_FUNCS] = {
 };
 
 static const char *
-_tf_get_combined_value (playItem_t *it, const char *key, int *needs_free) {
-    DB_metaInfo_t *meta = pl_meta_for_key_with_override (it, key);
-
+_tf_combine_meta_values (DB_metaInfo_t *meta, int *needs_free) {
     if (!meta) {
         *needs_free = 0;
         return NULL;
@@ -2512,6 +2708,11 @@ _tf_get_combined_value (playItem_t *it, const char *key, int *needs_free) {
     return out;
 }
 
+static const char *
+_tf_get_combined_value (playItem_t *it, const char *key, int *needs_free) {
+    return _tf_combine_meta_values (pl_meta_for_key_with_override (it, key), needs_free);
+}
+
 static int
 format_playback_time (char *out, int outlen, float t) {
     int daystotal = (int)t / (3600*24);
@@ -2604,12 +2805,14 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                 code++;
                 size--;
                 uint8_t len = *code;
-                code++;
-                size--;
+                tf_field_t field = code[1];
+                uint32_t atoms[2];
+                memcpy (atoms, code + 2, sizeof (atoms));
+                code += 2 + sizeof (atoms);
+                size -= 2 + sizeof (atoms);
 
-                char name[len+1];
-                memcpy (name, code, len);
-                name[len] = 0;
+                // stored with the terminating 0
+                const char *name = code;
 
                 // special cases
                 // most if not all of this stuff is to make tf scripts
@@ -2627,22 +2830,22 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                 // temp vars used for strcmp optimizations
                 int tmp_a = 0, tmp_b = 0, tmp_c = 0, tmp_d = 0, tmp_e = 0;
 
-                if (!strcmp (name, aa_fields[0])) {
+                if (field == TF_FIELD_ALBUM_ARTIST) {
                     for (int i = 0; !val && aa_fields[i]; i++) {
                         val = _tf_get_combined_value(it, aa_fields[i], &needs_free);
                     }
                 }
-                else if (!strcmp (name, a_fields[0])) {
+                else if (field == TF_FIELD_ARTIST) {
                     for (int i = 0; !val && a_fields[i]; i++) {
                         val = _tf_get_combined_value(it, a_fields[i], &needs_free);
                     }
                 }
-                else if (!strcmp (name, "album")) {
+                else if (field == TF_FIELD_ALBUM) {
                     for (int i = 0; !val && alb_fields[i]; i++) {
                         val = _tf_get_combined_value (it, alb_fields[i], &needs_free);
                     }
                 }
-                else if (!strcmp (name, "track artist")) {
+                else if (field == TF_FIELD_TRACK_ARTIST) {
                     const char *aa = NULL;
                     for (int i = 0; !val && aa_fields[i]; i++) {
                         val = _tf_get_combined_value (it, aa_fields[i], &needs_free);
@@ -2656,7 +2859,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                         val = NULL;
                     }
                 }
-                else if (!strcmp (name, "tracknumber")) {
+                else if (field == TF_FIELD_TRACKNUMBER) {
                     const char *v = pl_find_meta_raw (it, "track");
                     if (v) {
                         const char *p = v;
@@ -2677,7 +2880,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                         }
                     }
                 }
-                else if (!strcmp (name, "title")) {
+                else if (field == TF_FIELD_TITLE) {
                     val = _tf_get_combined_value (it, "title", &needs_free);
                     if (!val) {
                         const char *v = pl_find_meta_raw (it, ":URI");
@@ -2704,27 +2907,27 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                         }
                     }
                 }
-                else if (!strcmp (name, "discnumber")) {
+                else if (field == TF_FIELD_DISCNUMBER) {
                     val = pl_find_meta_raw (it, "disc");
                 }
-                else if (!strcmp (name, "totaldiscs")) {
+                else if (field == TF_FIELD_TOTALDISCS) {
                     val = pl_find_meta_raw (it, "numdiscs");
                 }
-                else if (!strcmp (name, "track number")) {
+                else if (field == TF_FIELD_TRACK_NUMBER) {
                     const char *v = pl_find_meta_raw (it, "track");
                     if (v) {
                         val = v;
                     }
                 }
-                else if (!strcmp (name, "date")) {
+                else if (field == TF_FIELD_DATE) {
                     // NOTE: foobar2000 uses "date" instead of "year"
                     // so for %date% we simply return the content of "year"
                     val = pl_find_meta_raw (it, "year");
                 }
-                else if (!strcmp (name, "samplerate")) {
+                else if (field == TF_FIELD_SAMPLERATE) {
                     val = pl_find_meta_raw (it, ":SAMPLERATE");
                 }
-                else if (!strcmp (name, "playback_bitrate")) {
+                else if (field == TF_FIELD_PLAYBACK_BITRATE) {
                     playItem_t *playing_track = streamer_get_playing_track();
                     if (playing_track) {
                         int br = streamer_get_apx_bitrate();
@@ -2737,13 +2940,13 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                         pl_item_unref (playing_track);
                     }
                 }
-                else if (!strcmp (name, "bitrate")) {
+                else if (field == TF_FIELD_BITRATE) {
                     val = pl_find_meta_raw (it, ":BITRATE");
                 }
-                else if (!strcmp (name, "filesize")) {
+                else if (field == TF_FIELD_FILESIZE) {
                     val = pl_find_meta_raw (it, ":FILE_SIZE");
                 }
-                else if (!strcmp (name, "filesize_natural")) {
+                else if (field == TF_FIELD_FILESIZE_NATURAL) {
                     const char *v = pl_find_meta_raw (it, ":FILE_SIZE");
                     if (v) {
                         int64_t bs = atoll (v);
@@ -2768,25 +2971,25 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                         skip_out = 1;
                     }
                 }
-                else if (!strcmp (name, "channels")) {
+                else if (field == TF_FIELD_CHANNELS) {
                     val = tf_get_channels_string_for_track (it);
                 }
-                else if (!strcmp (name, "codec")) {
+                else if (field == TF_FIELD_CODEC) {
                     val = pl_find_meta (it, ":FILETYPE");
                 }
-                else if (!strcmp (name, "replaygain_album_gain")) {
+                else if (field == TF_FIELD_REPLAYGAIN_ALBUM_GAIN) {
                     val = pl_find_meta_raw (it, ":REPLAYGAIN_ALBUMGAIN");
                 }
-                else if (!strcmp (name, "replaygain_album_peak")) {
+                else if (field == TF_FIELD_REPLAYGAIN_ALBUM_PEAK) {
                     val = pl_find_meta_raw (it, ":REPLAYGAIN_ALBUMPEAK");
                 }
-                else if (!strcmp (name, "replaygain_track_gain")) {
+                else if (field == TF_FIELD_REPLAYGAIN_TRACK_GAIN) {
                     val = pl_find_meta_raw (it, ":REPLAYGAIN_TRACKGAIN");
                 }
-                else if (!strcmp (name, "replaygain_track_peak")) {
+                else if (field == TF_FIELD_REPLAYGAIN_TRACK_PEAK) {
                     val = pl_find_meta_raw (it, ":REPLAYGAIN_TRACKPEAK");
                 }
-                else if ((tmp_a = !strcmp (name, "playback_time")) || (tmp_b = !strcmp (name, "playback_time_seconds")) || (tmp_c = !strcmp (name, "playback_time_remaining")) || (tmp_d = !strcmp (name, "playback_time_remaining_seconds")) || (tmp_e = !strcmp (name, "playback_time_ms"))) {
+                else if ((tmp_a = (field == TF_FIELD_PLAYBACK_TIME)) || (tmp_b = (field == TF_FIELD_PLAYBACK_TIME_SECONDS)) || (tmp_c = (field == TF_FIELD_PLAYBACK_TIME_REMAINING)) || (tmp_d = (field == TF_FIELD_PLAYBACK_TIME_REMAINING_SECONDS)) || (tmp_e = (field == TF_FIELD_PLAYBACK_TIME_MS))) {
                     playItem_t *playing = streamer_get_playing_track ();
                     if (it && playing == it && !(ctx->flags & DDB_TF_CONTEXT_NO_DYNAMIC)) {
                         float t = streamer_get_playpos ();
@@ -2833,7 +3036,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                         pl_item_unref (playing);
                     }
                 }
-                else if ((tmp_a = !strcmp (name, "length")) || (tmp_b = !strcmp (name, "length_ex"))) {
+                else if ((tmp_a = (field == TF_FIELD_LENGTH)) || (tmp_b = (field == TF_FIELD_LENGTH_EX))) {
                     float t = pl_get_item_duration (it);
                     if (tmp_a) {
                         t = roundf (t);
@@ -2868,7 +3071,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                         skip_out = 1;
                     }
                 }
-                else if ((tmp_a = !strcmp (name, "length_seconds") || (tmp_b = !strcmp (name, "length_seconds_fp")))) {
+                else if ((tmp_a = (field == TF_FIELD_LENGTH_SECONDS) || (tmp_b = (field == TF_FIELD_LENGTH_SECONDS_FP)))) {
                     float t = pl_get_item_duration (it);
                     if (t >= 0) {
                         int l;
@@ -2883,13 +3086,13 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                         skip_out = 1;
                     }
                 }
-                else if (!strcmp (name, "length_samples")) {
+                else if (field == TF_FIELD_LENGTH_SAMPLES) {
                     int l = snprintf_clip (out, outlen, "%lld", pl_item_get_endsample ((playItem_t *)ctx->it) - pl_item_get_startsample ((playItem_t *)ctx->it));
                     out += l;
                     outlen -= l;
                     skip_out = 1;
                 }
-                else if ((tmp_a = !strcmp (name, "isplaying")) || (tmp_b = !strcmp (name, "ispaused"))) {
+                else if ((tmp_a = (field == TF_FIELD_ISPLAYING)) || (tmp_b = (field == TF_FIELD_ISPAUSED))) {
                     playItem_t *playing = streamer_get_playing_track ();
                     
                     if (playing && 
@@ -2905,7 +3108,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                         pl_item_unref (playing);
                     }
                 }
-                else if (!strcmp (name, "filename")) {
+                else if (field == TF_FIELD_FILENAME) {
                     const char *v = pl_find_meta_raw (it, ":URI");
                     if (v) {
                         const char *start = strrchr (v, '/');
@@ -2922,7 +3125,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                         }
                     }
                 }
-                else if (!strcmp (name, "filename_ext")) {
+                else if (field == TF_FIELD_FILENAME_EXT) {
                     const char *v = pl_find_meta_raw (it, ":URI");
                     if (v) {
                         const char *start = strrchr (v, '/');
@@ -2936,7 +3139,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                         skip_out = 1;
                     }
                 }
-                else if (!strcmp (name, "directoryname")) {
+                else if (field == TF_FIELD_DIRECTORYNAME) {
                     const char *v = pl_find_meta_raw (it, ":URI");
                     if (v) {
                         const char *end = strrchr (v, '/');
@@ -2953,7 +3156,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                         }
                     }
                 }
-                else if (!strcmp (name, "_path_raw")) {
+                else if (field == TF_FIELD_PATH_RAW) {
                     const char *v = pl_find_meta_raw (it, ":URI");
 
                     if (v) {
@@ -2999,7 +3202,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                         skip_out = 1;
                     }
                 }
-                else if (!strcmp (name, "path")) {
+                else if (field == TF_FIELD_PATH) {
                     val = pl_find_meta_raw (it, ":URI");
 
                     // strip file://
@@ -3027,7 +3230,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
 #endif
                 }
                 // index of track in playlist (zero-padded)
-                else if (!strcmp (name, "list_index")) {
+                else if (field == TF_FIELD_LIST_INDEX) {
                     if (it) {
                         int total_tracks = plt_get_item_count ((playlist_t *)ctx->plt, ctx->iter);
                         int digits = 0;
@@ -3050,7 +3253,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                     }
                 }
                 // total number of tracks in playlist
-                else if (!strcmp (name, "list_total")) {
+                else if (field == TF_FIELD_LIST_TOTAL) {
                     int total_tracks = -1;
                     if (ctx->plt) {
                         total_tracks = plt_get_item_count ((playlist_t *)ctx->plt, ctx->iter);
@@ -3070,7 +3273,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                     }
                 }
                 // index of track in queue
-                else if (!strcmp (name, "queue_index")) {
+                else if (field == TF_FIELD_QUEUE_INDEX) {
                     if (it) {
                         int idx = playqueue_test (it) + 1;
                         if (idx >= 1) {
@@ -3082,7 +3285,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                     }
                 }
                 // indexes of track in queue
-                else if (!strcmp (name, "queue_indexes")) {
+                else if (field == TF_FIELD_QUEUE_INDEXES) {
                     if (it) {
                         int idx = playqueue_test (it) + 1;
                         if (idx >= 1) {
@@ -3106,7 +3309,7 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                     }
                 }
                 // total amount of tracks in queue
-                else if (!strcmp (name, "queue_total")) {
+                else if (field == TF_FIELD_QUEUE_TOTAL) {
                     int count = playqueue_getcount ();
                     if (count >= 0) {
                         int l = snprintf_clip (out, outlen, "%d", count);
@@ -3115,13 +3318,13 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                         skip_out = 1;
                     }
                 }
-                else if (!strcmp (name, "_deadbeef_version")) {
+                else if (field == TF_FIELD_DEADBEEF_VERSION) {
                     val = VERSION;
                 }
-                else if (!strcmp (name, "_playlist_name")) {
+                else if (field == TF_FIELD_PLAYLIST_NAME) {
                     val = ((playlist_t *)ctx->plt)->title;
                 }
-                else if (!strcmp (name, "selection_playback_time")) {
+                else if (field == TF_FIELD_SELECTION_PLAYBACK_TIME) {
                     float seltime = plt_get_selection_playback_time((playlist_t *)ctx->plt);
 
                     int l = format_playback_time (out, outlen, seltime);
@@ -3131,7 +3334,8 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                     skip_out = 1;
                 }
                 else {
-                    val = _tf_get_combined_value (it, name, &needs_free);
+                    DB_metaInfo_t *meta = pl_meta_for_atoms_with_override (it, name, atoms[0], atoms[1]);
+                    val = _tf_combine_meta_values (meta, &needs_free);
                 }
 
                 if (val || (!val && out > init_out)) {
@@ -3153,8 +3357,8 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                     free ((char *)val);
                 }
 
-                code += len;
-                size -= len;
+                code += len + 1;
+                size -= len + 1;
             }
             else if (*code == 3) { // conditional expression
                 code++;
@@ -3178,18 +3382,22 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
                 code += len;
                 size -= len;
             }
-            else if (*code == 4) { // preformatted text
+            else if (*code == 4) { // plain text block
                 code++;
                 size--;
                 int32_t len;
                 memcpy (&len, code, 4);
                 code += 4;
                 size -= 4;
-                int32_t l = u8_strnbcpy(out, code, len);
+                int32_t l = u8_strnbcpy(out, code, min (len, outlen));
                 out += l;
                 outlen -= l;
                 code += len;
                 size -= len;
+                if (l < len) {
+                    // out of space, same as with the plain text
+                    break;
+                }
             }
             else if (*code == 5) { // dimming of text
                 code++;
@@ -3264,6 +3472,22 @@ tf_eval_int (ddb_tf_context_t *ctx, const char *code, int size, char *out, int o
     return (int)(out-init_out);
 }
 
+// appends a plain text character, merging it into the preceding plain text block
+static void
+tf_compile_char (tf_compiler_t *c, char ch) {
+    if (!c->text || c->o != c->text_end) {
+        c->text = c->o;
+        c->text_len = 0;
+        *(c->o++) = 0;
+        *(c->o++) = 4;
+        c->o += 4;
+    }
+    *(c->o++) = ch;
+    c->text_len++;
+    memcpy (c->text + 2, &c->text_len, 4);
+    c->text_end = c->o;
+}
+
 int
 tf_compile_plain (tf_compiler_t *c);
 
@@ -3297,6 +3521,9 @@ tf_compile_func (tf_compiler_t *c) {
     if (!tf_funcs[i].name) {
         return -1;
     }
+    if (tf_funcs[i].func == tf_func_rand) {
+        c->dynamic = 1;
+    }
 
     char func_name[c->i - name_start + 1];
     memcpy (func_name, name_start, c->i-name_start);
@@ -3332,6 +3559,7 @@ tf_compile_func (tf_compiler_t *c) {
             arglens[*start] = (uint16_t)len;
             (*start)++; // num args++
             argstart = c->o;
+            c->text = NULL;
 
             if (*(c->i) == ')') {
                 break;
@@ -3357,30 +3585,46 @@ tf_compile_field (tf_compiler_t *c) {
     *(c->o++) = 2;
 
     const char *fstart = c->i;
-    uint8_t *plen = c->o;
-    c->o += 1;
-    while (*(c->i)) {
-        if (*(c->i) == '%') {
-            break;
-        }
-        else {
-            *(c->o++) = *(c->i++);
-        }
+    while (*(c->i) && *(c->i) != '%') {
+        c->i++;
     }
     if (*(c->i) != '%') {
         return -1;
     }
-    c->i++;
 
-    int32_t len = (int32_t)(c->o - plen - 1);
+    int32_t len = (int32_t)(c->i - fstart);
     if (len > 0xff) {
         return -1;
     }
-    *plen = (char)len;
+    c->i++;
 
     char field[len+1];
     memcpy (field, fstart, len);
     field[len] = 0;
+
+    tf_field_t id = TF_FIELD_META;
+    for (int i = TF_FIELD_META + 1; i < TF_FIELD_COUNT; i++) {
+        if (!strcmp (field, tf_field_names[i])) {
+            id = i;
+            break;
+        }
+    }
+    if (tf_field_is_dynamic[id]) {
+        c->dynamic = 1;
+    }
+
+    uint32_t atoms[2] = {0, 0};
+    if (id == TF_FIELD_META) {
+        atoms[0] = metacache_key_atom (0, field);
+        atoms[1] = metacache_key_atom ('!', field);
+    }
+
+    *(c->o++) = (uint8_t)len;
+    *(c->o++) = (uint8_t)id;
+    memcpy (c->o, atoms, sizeof (atoms));
+    c->o += sizeof (atoms);
+    memcpy (c->o, field, len + 1);
+    c->o += len + 1;
     return 0;
 }
 
@@ -3399,7 +3643,7 @@ tf_compile_ifdef (tf_compiler_t *c) {
         if (*(c->i) == '\\') {
             c->i++;
             if (*(c->i) != 0) {
-                *(c->o++) = *(c->i++);
+                tf_compile_char (c, *(c->i++));
             }
         }
         else if (*(c->i) == ']') {
@@ -3451,7 +3695,7 @@ tf_compile_text_dim (tf_compiler_t *c) {
         if (*(c->i) == '\\') {
             c->i++;
             if (*(c->i) != 0) {
-                *(c->o++) = *(c->i++);
+                tf_compile_char (c, *(c->i++));
             }
         }
         else if (*(c->i) == marker) {
@@ -3493,32 +3737,37 @@ tf_compile_plain (tf_compiler_t *c) {
     if (i == '$') {
         if (c->i[1] == '$') {
             c->i++;
-            *(c->o++) = *(c->i++);
+            tf_compile_char (c, *(c->i++));
         }
         else if (tf_compile_func (c)) {
             return -1;
         }
+        else {
+            c->text = NULL;
+        }
     }
     else if (i == '[') {
         if (tf_compile_ifdef (c)) {
             return -1;
         }
+        c->text = NULL;
     }
     else if (i == '%') {
         if (c->i[1] == '%') {
             c->i++;
-            *(c->o++) = *(c->i++);
+            tf_compile_char (c, *(c->i++));
             return 0;
         }
         if (tf_compile_field (c)) {
             return -1;
         }
+        c->text = NULL;
     }
     // FIXME this is not fb2k spec
     else if (*(c->i) == '\\') {
         c->i++;
         if (*(c->i) != 0) {
-            *(c->o++) = *(c->i++);
+            tf_compile_char (c, *(c->i++));
         }
     }
     else if (eol && i == '/' && c->i[1] == '/') {
@@ -3533,11 +3782,11 @@ tf_compile_plain (tf_compiler_t *c) {
         c->i++;
 
         if (c->i[0] == '\'') {
-            *(c->o++) = *(c->i++);
+            tf_compile_char (c, *(c->i++));
         }
         else {
             while (c->i[0] && c->i[0] != '\'') {
-                *(c->o++) = *(c->i++);
+                tf_compile_char (c, *(c->i++));
             }
             if (c->i[0] == '\'') {
                 c->i++;
@@ -3552,9 +3801,10 @@ tf_compile_plain (tf_compiler_t *c) {
         if (tf_compile_text_dim (c)) {
             return -1;
         }
+        c->text = NULL;
     }
     else {
-        *(c->o++) = *(c->i++);
+        tf_compile_char (c, *(c->i++));
     }
     return 0;
 }
@@ -3566,8 +3816,8 @@ tf_compile (const char *script) {
 
     c.i = script;
 
-    uint8_t code[strlen(script) * 3];
-    memset (code, 0, sizeof (code));
+    // each input character produces at most 8 bytes of bytecode
+    uint8_t *code = calloc (1, strlen (script) * 8 + 16);
 
     c.o = code;
 
@@ -3576,21 +3826,41 @@ tf_compile (const char *script) {
     while (*(c.i)) {
         if (tf_compile_plain (&c)) {
             trace ("tf: compilation failed <%s>\n", c.i);
+            free (code);
             return NULL;
         }
     }
 
     size_t size = c.o - code;
-    char *out = malloc (size + 8);
+    tf_code_header_t *header = calloc (1, sizeof (tf_code_header_t) + size + 8);
+    header->cacheable = !c.dynamic;
+    if (header->cacheable) {
+        header->mutex = mutex_create ();
+    }
+    char *out = (char *)(header + 1);
     memcpy (out + 4, code, size);
     memset (out + 4 + size, 0, 4); // FIXME: this is the padding for possible buffer overflow bug fix
     *((int32_t *)out) = (int32_t)(size);
+    free (code);
     return out;
 }
 
 void
 tf_free (char *code) {
-    free (code);
+    if (!code) {
+        return;
+    }
+    tf_code_header_t *header = (tf_code_header_t *)code - 1;
+    if (header->cache) {
+        for (int i = 0; i < TF_CACHE_SIZE; i++) {
+            free (header->cache[i].value);
+        }
+        free (header->cache);
+    }
+    if (header->mutex) {
+        mutex_free (header->mutex);
+    }
+    free (header);
 }
 
 void
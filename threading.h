@@ -68,11 +68,33 @@ cond_free (uintptr_t cond);
 int
 cond_wait (uintptr_t cond, uintptr_t mutex);
 
+// Unlike cond_wait, expects the mutex to be locked by the caller, and returns with the mutex locked.
+// Waits for up to timeout_ms milliseconds, or indefinitely if timeout_ms is negative.
+// Returns 0 when signalled, or ETIMEDOUT.
+int
+cond_wait_timeout (uintptr_t cond, uintptr_t mutex, int timeout_ms);
+
 int
 cond_signal (uintptr_t cond);
 
 int
 cond_broadcast (uintptr_t cond);
 
+// Reader/writer lock, not recursive.
+uintptr_t
+rwlock_create (void);
+
+void
+rwlock_free (uintptr_t rwlock);
+
+int
+rwlock_rdlock (uintptr_t rwlock);
+
+int
+rwlock_wrlock (uintptr_t rwlock);
+
+int
+rwlock_unlock (uintptr_t rwlock);
+
 #endif
 
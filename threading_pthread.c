@@ -29,6 +29,7 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <sys/time.h>
 #include "threading.h"
 #ifdef HAVE_CONFIG_H
 #include <config.h>
@@ -225,6 +226,29 @@ cond_wait (uintptr_t c, uintptr_t m) {
     return err;
 }
 
+int
+cond_wait_timeout (uintptr_t c, uintptr_t m, int timeout_ms) {
+    pthread_cond_t *cond = (pthread_cond_t *)c;
+    pthread_mutex_t *mutex = (pthread_mutex_t *)m;
+    int err;
+    if (timeout_ms < 0) {
+        err = pthread_cond_wait (cond, mutex);
+    }
+    else {
+        struct timeval tv;
+        gettimeofday (&tv, NULL);
+        struct timespec ts;
+        int64_t nsec = (int64_t)tv.tv_usec * 1000 + (int64_t)(timeout_ms % 1000) * 1000000;
+        ts.tv_sec = tv.tv_sec + timeout_ms / 1000 + (time_t)(nsec / 1000000000);
+        ts.tv_nsec = (long)(nsec % 1000000000);
+        err = pthread_cond_timedwait (cond, mutex, &ts);
+    }
+    if (err != 0 && err != ETIMEDOUT) {
+        fprintf (stderr, "pthread_cond_timedwait failed: %s\n", strerror (err));
+    }
+    return err;
+}
+
 int
 cond_signal (uintptr_t c) {
     pthread_cond_t *cond = (pthread_cond_t *)c;
@@ -244,3 +268,54 @@ cond_broadcast (uintptr_t c) {
     }
     return err;
 }
+
+uintptr_t
+rwlock_create (void) {
+    pthread_rwlock_t *rwlock = malloc (sizeof (pthread_rwlock_t));
+    int err = pthread_rwlock_init (rwlock, NULL);
+    if (err != 0) {
+        fprintf (stderr, "pthread_rwlock_init failed: %s\n", strerror (err));
+        free (rwlock);
+        return 0;
+    }
+    return (uintptr_t)rwlock;
+}
+
+void
+rwlock_free (uintptr_t l) {
+    if (l) {
+        pthread_rwlock_t *rwlock = (pthread_rwlock_t *)l;
+        pthread_rwlock_destroy (rwlock);
+        free (rwlock);
+    }
+}
+
+int
+rwlock_rdlock (uintptr_t l) {
+    pthread_rwlock_t *rwlock = (pthread_rwlock_t *)l;
+    int err = pthread_rwlock_rdlock (rwlock);
+    if (err != 0) {
+        fprintf (stderr, "pthread_rwlock_rdlock failed: %s\n", strerror (err));
+    }
+    return err;
+}
+
+int
+rwlock_wrlock (uintptr_t l) {
+    pthread_rwlock_t *rwlock = (pthread_rwlock_t *)l;
+    int err = pthread_rwlock_wrlock (rwlock);
+    if (err != 0) {
+        fprintf (stderr, "pthread_rwlock_wrlock failed: %s\n", strerror (err));
+    }
+    return err;
+}
+
+int
+rwlock_unlock (uintptr_t l) {
+    pthread_rwlock_t *rwlock = (pthread_rwlock_t *)l;
+    int err = pthread_rwlock_unlock (rwlock);
+    if (err != 0) {
+        fprintf (stderr, "pthread_rwlock_unlock failed: %s\n", strerror (err));
+    }
+    return err;
+}
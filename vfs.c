@@ -32,6 +32,8 @@
 //#define trace(...) { fprintf(stderr, __VA_ARGS__); }
 #define trace(fmt,...)
 
+static __thread int thread_usage;
+
 #if defined(HAVE_XGUI)
 extern int android_use_only_wifi;
 extern int android_wifi_status;
@@ -174,3 +176,15 @@ vfs_abort_with_identifier (DB_vfs_t *vfs, uint64_t identifier) {
         vfs->abort_with_identifier (identifier);
     }
 }
+
+int
+vfs_set_thread_usage (int usage) {
+    int prev = thread_usage;
+    thread_usage = usage;
+    return prev;
+}
+
+int
+vfs_get_thread_usage (void) {
+    return thread_usage;
+}
@@ -43,4 +43,16 @@ void vfs_fabort (DB_FILE *stream);
 uint64_t vfs_get_identifier (DB_FILE *stream);
 void vfs_abort_with_identifier (DB_vfs_t *vfs, uint64_t identifier);
 
+// Hints how the files opened by the current thread are going to be read,
+// used by the local file backend to choose buffering and readahead.
+enum {
+    VFS_USAGE_DEFAULT, // tag reading and other short random accesses
+    VFS_USAGE_PLAYBACK,
+    VFS_USAGE_SCAN,
+};
+
+// returns the previous usage of the thread
+int vfs_set_thread_usage (int usage);
+int vfs_get_thread_usage (void);
+
 #endif // __VFS_H
@@ -33,6 +33,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include "vfs.h"
 
 #ifndef __linux__
 #define off64_t off_t
@@ -44,7 +45,12 @@
 #define USE_BUFFERING
 
 #ifndef USE_STDIO
-#define BUFSIZE 1024
+// the buffer size is configurable for playback and scanning,
+// the other uses (tag reading) get the minimum
+#define MIN_BUFSIZE (64*1024)
+#define MAX_BUFSIZE (1024*1024)
+// how far ahead of the read position the kernel is asked to prefetch during playback
+#define PLAYBACK_READAHEAD (4*1024*1024)
 #endif
 
 static DB_functions_t *deadbeef;
@@ -55,13 +61,17 @@ typedef struct {
 #else
     int stream;
     int64_t offs;
+    int usage;
 #ifdef USE_BUFFERING
-    uint8_t buffer[BUFSIZE];
+    uint8_t *buffer;
+    int bufsize;
     uint8_t *bufptr;
     int bufremaining;
+    int buflen; // number of valid bytes in the buffer, starting at buffer
+    int64_t advised_until;
 #endif
     int have_size;
-    size_t size;
+    int64_t size;
 #endif
 } STDIO_FILE;
 
@@ -77,14 +87,49 @@ stdio_open (const char *fname) {
     if (!file) {
         return NULL;
     }
+    STDIO_FILE *fp = malloc (sizeof (STDIO_FILE));
+    memset (fp, 0, sizeof (STDIO_FILE));
 #else
     int file = open (fname, O_LARGEFILE);
     if (file == -1) {
         return NULL;
     }
+
+    int usage = vfs_get_thread_usage ();
+    struct stat st;
+    int regular = !fstat (file, &st) && S_ISREG (st.st_mode);
+
+    int bufsize = 0;
+#ifdef USE_BUFFERING
+    bufsize = MIN_BUFSIZE;
+    if (usage != VFS_USAGE_DEFAULT) {
+        bufsize = deadbeef->conf_get_int ("vfs_stdio.buffer_size", MIN_BUFSIZE/1024) * 1024;
+        if (bufsize < MIN_BUFSIZE) {
+            bufsize = MIN_BUFSIZE;
+        }
+        else if (bufsize > MAX_BUFSIZE) {
+            bufsize = MAX_BUFSIZE;
+        }
+    }
 #endif
-    STDIO_FILE *fp = malloc (sizeof (STDIO_FILE));
+
+#ifdef POSIX_FADV_SEQUENTIAL
+    if (regular && usage != VFS_USAGE_DEFAULT) {
+        // doubles the kernel readahead
+        posix_fadvise (file, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+#endif
+
+    // the buffer is allocated together with the file
+    STDIO_FILE *fp = malloc (sizeof (STDIO_FILE) + bufsize);
     memset (fp, 0, sizeof (STDIO_FILE));
+    fp->usage = usage;
+#ifdef USE_BUFFERING
+    fp->buffer = (uint8_t *)(fp + 1);
+    fp->bufptr = fp->buffer;
+    fp->bufsize = bufsize;
+#endif
+#endif
     fp->vfs = &plugin;
     fp->stream = file;
     return (DB_FILE*)fp;
@@ -103,16 +148,44 @@ stdio_close (DB_FILE *stream) {
 
 #ifndef USE_STDIO
 #ifdef USE_BUFFERING
+// asks the kernel to prefetch the data ahead of the file position during playback,
+// which keeps slow network mounts from stalling the streamer
+static void
+advise_readahead (STDIO_FILE *f) {
+#ifdef POSIX_FADV_WILLNEED
+    if (f->usage != VFS_USAGE_PLAYBACK) {
+        return;
+    }
+    int64_t pos = f->offs + f->bufremaining;
+    if (f->advised_until - pos > PLAYBACK_READAHEAD/2) {
+        return;
+    }
+    int64_t from = f->advised_until > pos ? f->advised_until : pos;
+    posix_fadvise (f->stream, from, pos + PLAYBACK_READAHEAD - from, POSIX_FADV_WILLNEED);
+    f->advised_until = pos + PLAYBACK_READAHEAD;
+#endif
+}
+
+static void
+dropbuffer (STDIO_FILE *f) {
+    f->bufptr = f->buffer;
+    f->bufremaining = 0;
+    f->buflen = 0;
+}
+
 static int
 fillbuffer (STDIO_FILE *f) {
     assert (f->bufremaining >= 0);
     if (f->bufremaining == 0) {
-        f->bufremaining = (int)read (f->stream, f->buffer, BUFSIZE);
+        f->bufptr = f->buffer;
+        f->buflen = 0;
+        f->bufremaining = (int)read (f->stream, f->buffer, f->bufsize);
         if (f->bufremaining < 0) {
             f->bufremaining = 0;
             return -1;
         }
-        f->bufptr = f->buffer;
+        f->buflen = f->bufremaining;
+        advise_readahead (f);
     }
     return f->bufremaining;
 }
@@ -131,8 +204,23 @@ stdio_read (void *ptr, size_t size, size_t nmemb, DB_FILE *stream) {
     size_t nb = size * nmemb;
 #ifdef USE_BUFFERING
     while (nb > 0) {
-        if (fillbuffer (f) <= 0) {
-            break;
+        if (f->bufremaining == 0) {
+            if (nb >= f->bufsize) {
+                // no point in copying large reads through the buffer
+                ssize_t rb = read (f->stream, ptr, nb);
+                if (rb <= 0) {
+                    break;
+                }
+                dropbuffer (f);
+                ptr += rb;
+                f->offs += rb;
+                nb -= rb;
+                advise_readahead (f);
+                continue;
+            }
+            if (fillbuffer (f) <= 0) {
+                break;
+            }
         }
         int r = f->bufremaining;
         if (r > nb) {
@@ -164,19 +252,31 @@ stdio_seek (DB_FILE *stream, int64_t offset, int whence) {
 #ifdef USE_STDIO
     return fseek (((STDIO_FILE *)stream)->stream, offset, whence);
 #else
+    STDIO_FILE *f = (STDIO_FILE *)stream;
     // convert offset to absolute
     if (whence == SEEK_CUR) {
         whence = SEEK_SET;
-        offset = ((STDIO_FILE*)stream)->offs + offset;
+        offset = f->offs + offset;
+    }
+#ifdef USE_BUFFERING
+    // tag readers do a lot of short seeks, which can often be served from the buffer
+    int64_t bufstart = f->offs - (f->bufptr - f->buffer);
+    if (whence == SEEK_SET && offset >= bufstart && offset <= bufstart + f->buflen) {
+        f->bufptr = f->buffer + (offset - bufstart);
+        f->bufremaining = f->buflen - (int)(offset - bufstart);
+        f->offs = offset;
+        return 0;
     }
-    off64_t res = lseek64 (((STDIO_FILE *)stream)->stream, offset, whence);
+#endif
+    off64_t res = lseek64 (f->stream, offset, whence);
     if (res == -1) {
         return -1;
     }
-//    printf ("lseek res: %lld (%lld, %d, prev=%lld)\n", res, offset, whence,  ((STDIO_FILE*)stream)->offs);
-    ((STDIO_FILE*)stream)->offs = res;
+//    printf ("lseek res: %lld (%lld, %d, prev=%lld)\n", res, offset, whence,  f->offs);
+    f->offs = res;
 #ifdef USE_BUFFERING
-    ((STDIO_FILE*)stream)->bufremaining = 0;
+    dropbuffer (f);
+    f->advised_until = 0;
 #endif
 #endif
     return 0;
@@ -214,13 +314,18 @@ stdio_getlength (DB_FILE *stream) {
     return l;
 #else
     if (!f->have_size) {
-        int64_t size = lseek64 (f->stream, 0, SEEK_END);
-        lseek64 (f->stream, f->offs, SEEK_SET);
+        struct stat st;
+        if (!fstat (f->stream, &st) && S_ISREG (st.st_mode)) {
+            f->size = st.st_size;
+        }
+        else {
+            f->size = lseek64 (f->stream, 0, SEEK_END);
+            lseek64 (f->stream, f->offs, SEEK_SET);
 #ifdef USE_BUFFERING
-        f->bufremaining = 0;
+            dropbuffer (f);
 #endif
+        }
         f->have_size = 1;
-        f->size = size;
     }
     return f->size;
 #endif
@@ -240,7 +345,7 @@ stdio_is_streaming (void) {
 static DB_vfs_t plugin = {
     DB_PLUGIN_SET_API_VERSION
     .plugin.version_major = 1,
-    .plugin.version_minor = 0,
+    .plugin.version_minor = 1,
     .plugin.type = DB_PLUGIN_VFS,
     .plugin.name = "stdio vfs",
     .plugin.id = "vfs_stdio",
@@ -269,6 +374,8 @@ static DB_vfs_t plugin = {
         "Alexey Yakovenko waker@users.sourceforge.net\n"
     ,
     .plugin.website = "http://deadbeef.sf.net",
+    .plugin.configdialog =
+        "property \"Read buffer size for playback and scanning (KB)\" spinbtn[64,1024,64] vfs_stdio.buffer_size 64;\n",
     .open = stdio_open,
     .close = stdio_close,
     .read = stdio_read,